@@ -1217,7 +1217,10 @@ def _show_port(cli, port):
     cli.fout.write('       Out/TX  ')
     cli.fout.write('packets: {:<20,}'.format(stats.out.packets))
     cli.fout.write('bytes: {:<20,}\n'.format(stats.out.bytes))
-    cli.fout.write('{:<14} dropped: {:<20,}\n'.format('', stats.out.dropped))
+    cli.fout.write('{:<14} dropped: {:<20,}'.format('', stats.out.dropped))
+    if stats.out.kicks:
+        cli.fout.write('kicks: {:<20,}'.format(stats.out.kicks))
+    cli.fout.write('\n')
 
 
 @cmd('show port', 'Show the status of all ports')
@@ -1264,6 +1267,8 @@ def _show_module(cli, module_name):
                 cli.fout.write('(no downstream reader)\n')
             elif field.offset == -2:
                 cli.fout.write('(no upstream writer)\n')
+            elif field.offset == -3:
+                cli.fout.write('(out of space)\n')
             else:
                 cli.fout.write('\n')
 
@@ -1318,6 +1323,32 @@ def show_module_list(cli, module_names):
         _show_module(cli, module_name)
 
 
+@cmd('show metadata', 'Show the layout of per-packet metadata attributes')
+def show_metadata(cli):
+    layout = cli.bess.get_metadata_layout()
+
+    cli.fout.write('  %d/%d bytes used, in %d cache line(s), %d spill(s)\n' %
+                   (layout.footprint, layout.total_size, layout.cache_lines,
+                    layout.num_spills))
+
+    if layout.overflow_size:
+        cli.fout.write('  %d attribute(s) in the %d-byte overflow area '
+                       '(offset %d)\n' % (layout.num_overflows,
+                                          layout.overflow_size,
+                                          layout.overflow_offset))
+
+    for attr in sorted(layout.attrs, key=lambda a: (a.offset < 0, a.offset)):
+        if attr.offset >= 0:
+            offset_str = '%3d-%-3d' % (attr.offset,
+                                       attr.offset + attr.size - 1)
+        else:
+            offset_str = 'SPILLED'
+
+        cli.fout.write('  %s %16s %2d bytes  %s\n' %
+                       (offset_str, attr.name + ':', attr.size,
+                        ', '.join(attr.modules)))
+
+
 def _show_mclass(cli, cls_name, detail):
     info = cli.bess.get_mclass_info(cls_name)
     cli.fout.write('%-16s %s\n' % (info.name, info.help))
@@ -1331,6 +1362,41 @@ def _show_mclass(cli, cls_name, detail):
             cli.fout.write('\t\t (no commands)\n')
 
 
+def _show_gate_stats(cli, gate):
+    cli.fout.write('  %s:%d -> %s  (1 in %d batches sampled, %d samples)\n' %
+                   (gate.name, gate.ogate, gate.next, gate.sample_every,
+                    gate.samples))
+
+    if not gate.samples:
+        return
+
+    cli.fout.write('    avg %.1f cycles downstream per batch\n' %
+                   (float(gate.total_cycles) / gate.samples))
+
+    sizes = ['%d:%.1f%%' % (size, 100.0 * cnt / gate.samples)
+             for size, cnt in enumerate(gate.batch_sizes) if cnt]
+    cli.fout.write('    batch sizes  %s\n' % ' '.join(sizes))
+
+    cycles = ['%d+:%.1f%%' % (1 << i, 100.0 * cnt / gate.samples)
+              for i, cnt in enumerate(gate.cycles) if cnt]
+    cli.fout.write('    cycles       %s\n' % ' '.join(cycles))
+
+
+@cmd('show gatestats [MODULE]',
+     'Show batch sizes and downstream cycles of output gates')
+def show_gatestats(cli, module_name):
+    if module_name in [None, '*']:
+        module_name = ''
+
+    gates = cli.bess.get_gate_stats(module_name).gates
+    if not gates:
+        cli.fout.write('  No gate_stats hook. Try "gatestats enable"\n')
+        return
+
+    for gate in gates:
+        _show_gate_stats(cli, gate)
+
+
 @cmd('show mclass', 'Show all module classes')
 def show_mclass_all(cli):
     mclasses = cli.bess.list_mclasses().names
@@ -1702,6 +1768,22 @@ def track_module(cli, flag, module_name, direction, gate):
         cli.bess.resume_all()
 
 
+@cmd('gatestats ENABLE_DISABLE [MODULE] [OGATE]',
+     'Sample batch sizes and downstream cycles on output gates')
+def gatestats_module(cli, flag, module_name, gate):
+    if module_name in [None, '*']:
+        module_name = ''
+
+    cli.bess.pause_all()
+    try:
+        if flag == 'enable':
+            cli.bess.enable_gate_stats(module_name, gate)
+        else:
+            cli.bess.disable_gate_stats(module_name, gate)
+    finally:
+        cli.bess.resume_all()
+
+
 @cmd('interactive', 'Switch to interactive mode')
 def interactive(cli):
     if cli.interactive:
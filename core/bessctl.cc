@@ -1,7 +1,9 @@
 #include "bessctl.h"
 
+#include <algorithm>
 #include <future>
 #include <map>
+#include <memory>
 #include <string>
 #include <thread>
 
@@ -20,6 +22,8 @@
 
 #include "bessd.h"
 #include "gate.h"
+#include "hooks/gate_stats.h"
+#include "hooks/tcpdump.h"
 #include "hooks/track.h"
 #include "message.h"
 #include "metadata.h"
@@ -154,6 +158,85 @@ static pb_error_t disable_track_for_module(const Module* m, gate_idx_t gate_idx,
   return pb_errno(0);
 }
 
+static pb_error_t enable_gate_stats_for_module(const Module* m,
+                                               gate_idx_t gate_idx,
+                                               bool use_gate,
+                                               uint32_t sample_every) {
+  int ret;
+
+  if (use_gate) {
+    if (!is_active_gate(m->ogates(), gate_idx)) {
+      return pb_error(EINVAL, "Output gate '%hu' does not exist", gate_idx);
+    }
+    // The gate takes ownership only if the hook is added
+    std::unique_ptr<GateStats> hook(new GateStats(sample_every));
+    if ((ret = m->ogates()[gate_idx]->AddHook(hook.get()))) {
+      return pb_error(ret, "Failed to enable gate_stats on output gate '%hu'",
+                      gate_idx);
+    }
+    hook.release();
+    return pb_errno(0);
+  }
+
+  for (auto& gate : m->ogates()) {
+    if (!gate) {
+      continue;
+    }
+    std::unique_ptr<GateStats> hook(new GateStats(sample_every));
+    if ((ret = gate->AddHook(hook.get()))) {
+      return pb_error(ret, "Failed to enable gate_stats on output gate '%hu'",
+                      gate->gate_idx());
+    }
+    hook.release();
+  }
+  return pb_errno(0);
+}
+
+static pb_error_t disable_gate_stats_for_module(const Module* m,
+                                                gate_idx_t gate_idx,
+                                                bool use_gate) {
+  if (use_gate) {
+    if (!is_active_gate(m->ogates(), gate_idx)) {
+      return pb_error(EINVAL, "Output gate '%hu' does not exist", gate_idx);
+    }
+    m->ogates()[gate_idx]->RemoveHook(kGateHookGateStats);
+    return pb_errno(0);
+  }
+
+  for (auto& gate : m->ogates()) {
+    if (!gate) {
+      continue;
+    }
+    gate->RemoveHook(kGateHookGateStats);
+  }
+  return pb_errno(0);
+}
+
+static void collect_gate_stats(const Module* m,
+                               GetGateStatsResponse* response) {
+  for (const auto& g : m->ogates()) {
+    if (!g || !g->stats_hook()) {
+      continue;
+    }
+
+    const GateStats* s = g->stats_hook();
+    GetGateStatsResponse_Gate* gate = response->add_gates();
+
+    gate->set_name(m->name());
+    gate->set_ogate(g->gate_idx());
+    gate->set_next(g->igate()->module()->name());
+    gate->set_sample_every(s->sample_every());
+    gate->set_samples(s->samples());
+    gate->set_total_cycles(s->total_cycles());
+    for (size_t i = 0; i <= bess::PacketBatch::kMaxBurst; i++) {
+      gate->add_batch_sizes(s->batch_sizes()[i]);
+    }
+    for (int i = 0; i < GateStats::kCycleBuckets; i++) {
+      gate->add_cycles(s->cycles()[i]);
+    }
+  }
+}
+
 static int collect_igates(Module* m, GetModuleInfoResponse* response) {
   for (const auto& g : m->igates()) {
     if (!g) {
@@ -1015,10 +1098,12 @@ class BESSControlImpl final : public BESSControl::Service {
     response->mutable_inc()->set_packets(stats.inc.packets);
     response->mutable_inc()->set_dropped(stats.inc.dropped);
     response->mutable_inc()->set_bytes(stats.inc.bytes);
+    response->mutable_inc()->set_kicks(stats.inc.kicks);
 
     response->mutable_out()->set_packets(stats.out.packets);
     response->mutable_out()->set_dropped(stats.out.dropped);
     response->mutable_out()->set_bytes(stats.out.bytes);
+    response->mutable_out()->set_kicks(stats.out.kicks);
 
     response->set_timestamp(get_epoch_time());
 
@@ -1163,6 +1248,36 @@ class BESSControlImpl final : public BESSControl::Service {
     return Status::OK;
   }
 
+  Status GetMetadataLayout(ServerContext*, const EmptyRequest*,
+                           GetMetadataLayoutResponse* response) override {
+    const bess::metadata::Pipeline& pipeline =
+        bess::metadata::default_pipeline;
+
+    response->set_total_size(bess::metadata::kMetadataTotalSize);
+    response->set_footprint(pipeline.footprint());
+    response->set_cache_lines(pipeline.cache_lines());
+    response->set_num_spills(pipeline.num_spills());
+
+    if (pipeline.overflow()) {
+      response->set_overflow_offset(bess::metadata::kMetadataOverflowOffset);
+      response->set_overflow_size(bess::metadata::kMetadataOverflowSize);
+      response->set_num_overflows(pipeline.num_overflows());
+    }
+
+    for (const auto& it : pipeline.layout()) {
+      GetMetadataLayoutResponse_Attribute* attr = response->add_attrs();
+
+      attr->set_name(it.attr_id);
+      attr->set_size(it.size);
+      attr->set_offset(it.offset);
+      for (const auto& name : it.accessors) {
+        attr->add_modules(name);
+      }
+    }
+
+    return Status::OK;
+  }
+
   Status ConnectModules(ServerContext*, const ConnectModulesRequest* request,
                         EmptyResponse* response) override {
     VLOG(1) << "ConnectModulesRequest from client:" << std::endl
@@ -1218,15 +1333,32 @@ class BESSControlImpl final : public BESSControl::Service {
       return return_with_error(response, -ret, "Connection %s:%d->%d:%s failed",
                                m1_name, ogate, igate, m2_name);
 
+    // Otherwise offsets will be updated when workers resume
+    if (!is_any_worker_running()) {
+      return Status::OK;
+    }
+
+    ret = bess::metadata::default_pipeline.UpdateMetadataOffsets(true);
+    if (ret == -EBUSY) {
+      m1->DisconnectModules(ogate);
+      return return_with_error(response, EBUSY,
+                               "Connection %s:%d->%d:%s would change metadata "
+                               "offsets of modules in use. Pause workers first",
+                               m1_name, ogate, igate, m2_name);
+    } else if (ret < 0) {
+      m1->DisconnectModules(ogate);
+      return return_with_error(response, -ret,
+                               "Connection %s:%d->%d:%s failed to compute "
+                               "metadata offsets: %s",
+                               m1_name, ogate, igate, m2_name, strerror(-ret));
+    }
+
     return Status::OK;
   }
 
   Status DisconnectModules(ServerContext*,
                            const DisconnectModulesRequest* request,
                            EmptyResponse* response) override {
-    if (is_any_worker_running()) {
-      return return_with_error(response, EBUSY, "There is a running worker");
-    }
     const char* m_name;
     gate_idx_t ogate;
 
@@ -1245,11 +1377,48 @@ class BESSControlImpl final : public BESSControl::Service {
     }
     Module* m = it->second;
 
+    if (!is_any_worker_running()) {
+      ret = m->DisconnectModules(ogate);
+      if (ret < 0)
+        return return_with_error(response, -ret, "Disconnection %s:%d failed",
+                                 m_name, ogate);
+      return Status::OK;
+    }
+
+    propagate_active_worker();
+    if (m->num_active_workers()) {
+      return return_with_error(response, EBUSY, "Module '%s' is in use",
+                               m_name);
+    }
+
+    if (ogate >= m->ogates().size() || !m->ogates()[ogate]) {
+      return Status::OK;
+    }
+
+    Module* m_next = m->ogates()[ogate]->igate()->module();
+    gate_idx_t igate = m->ogates()[ogate]->igate_idx();
+
     ret = m->DisconnectModules(ogate);
     if (ret < 0)
       return return_with_error(response, -ret, "Disconnection %s:%d failed",
                                m_name, ogate);
 
+    // Downstream modules may still be running with the old offsets
+    ret = bess::metadata::default_pipeline.UpdateMetadataOffsets(true);
+    if (ret == -EBUSY) {
+      m->ConnectModules(ogate, m_next, igate);
+      return return_with_error(response, EBUSY,
+                               "Disconnection %s:%d would change metadata "
+                               "offsets of modules in use. Pause workers first",
+                               m_name, ogate);
+    } else if (ret < 0) {
+      m->ConnectModules(ogate, m_next, igate);
+      return return_with_error(response, -ret,
+                               "Disconnection %s:%d failed to compute "
+                               "metadata offsets: %s",
+                               m_name, ogate, strerror(-ret));
+    }
+
     return Status::OK;
   }
 
@@ -1288,8 +1457,24 @@ class BESSControlImpl final : public BESSControl::Service {
       return return_with_error(response, EINVAL,
                                "Input gate '%hu' does not exist", gate);
 
+    uint32_t snaplen = TcpDump::kDefaultSnaplen;
+    if (request->snaplen()) {
+      if (request->snaplen() > TcpDump::kMaxSnaplen) {
+        return return_with_error(response, EINVAL,
+                                 "'snaplen' must be no greater than %u",
+                                 TcpDump::kMaxSnaplen);
+      }
+      snaplen = request->snaplen();
+    }
+
+    uint64_t sample_every = std::max<uint64_t>(request->sample_every(), 1);
+    if (sample_every > UINT32_MAX) {
+      return return_with_error(response, EINVAL, "'sample_every' is too large");
+    }
+
     // TODO(melvin): actually change protobufs when new bessctl arrives
-    ret = m->EnableTcpDump(fifo, is_igate, gate);
+    ret = m->EnableTcpDump(fifo, is_igate, gate, snaplen, sample_every,
+                           request->max_pps());
 
     if (ret < 0) {
       return return_with_error(response, -ret, "Enabling tcpdump %s:%d failed",
@@ -1401,6 +1586,90 @@ class BESSControlImpl final : public BESSControl::Service {
     }
   }
 
+  Status EnableGateStats(ServerContext*, const EnableGateStatsRequest* request,
+                         EmptyResponse* response) override {
+    if (is_any_worker_running()) {
+      return return_with_error(response, EBUSY, "There is a running worker");
+    }
+
+    uint64_t sample_every = request->sample_every();
+    if (sample_every == 0) {
+      sample_every = GateStats::kDefaultSampleEvery;
+    } else if (sample_every > UINT32_MAX) {
+      return return_with_error(response, EINVAL, "'sample_every' is too large");
+    }
+
+    pb_error_t* error = response->mutable_error();
+    if (!request->name().length()) {
+      for (const auto& it : ModuleBuilder::all_modules()) {
+        *error = enable_gate_stats_for_module(it.second, request->ogate(),
+                                              request->use_gate(),
+                                              sample_every);
+        if (error->code() != 0) {
+          return Status::OK;
+        }
+      }
+      return Status::OK;
+    }
+
+    const auto& it = ModuleBuilder::all_modules().find(request->name());
+    if (it == ModuleBuilder::all_modules().end()) {
+      return return_with_error(response, ENOENT, "No module '%s' found",
+                               request->name().c_str());
+    }
+    *error = enable_gate_stats_for_module(it->second, request->ogate(),
+                                          request->use_gate(), sample_every);
+    return Status::OK;
+  }
+
+  Status DisableGateStats(ServerContext*,
+                          const DisableGateStatsRequest* request,
+                          EmptyResponse* response) override {
+    if (is_any_worker_running()) {
+      return return_with_error(response, EBUSY, "There is a running worker");
+    }
+
+    pb_error_t* error = response->mutable_error();
+    if (!request->name().length()) {
+      for (const auto& it : ModuleBuilder::all_modules()) {
+        *error = disable_gate_stats_for_module(it.second, request->ogate(),
+                                               request->use_gate());
+        if (error->code() != 0) {
+          return Status::OK;
+        }
+      }
+      return Status::OK;
+    }
+
+    const auto& it = ModuleBuilder::all_modules().find(request->name());
+    if (it == ModuleBuilder::all_modules().end()) {
+      return return_with_error(response, ENOENT, "No module '%s' found",
+                               request->name().c_str());
+    }
+    *error = disable_gate_stats_for_module(it->second, request->ogate(),
+                                           request->use_gate());
+    return Status::OK;
+  }
+
+  Status GetGateStats(ServerContext*, const GetGateStatsRequest* request,
+                      GetGateStatsResponse* response) override {
+    if (!request->name().length()) {
+      for (const auto& it : ModuleBuilder::all_modules()) {
+        collect_gate_stats(it.second, response);
+      }
+    } else {
+      const auto& it = ModuleBuilder::all_modules().find(request->name());
+      if (it == ModuleBuilder::all_modules().end()) {
+        return return_with_error(response, ENOENT, "No module '%s' found",
+                                 request->name().c_str());
+      }
+      collect_gate_stats(it->second, response);
+    }
+
+    response->set_timestamp(get_epoch_time());
+    return Status::OK;
+  }
+
   Status KillBess(ServerContext*, const EmptyRequest*,
                   EmptyResponse* response) override {
     if (is_any_worker_running()) {
@@ -0,0 +1,472 @@
+#include "af_packet.h"
+
+#include <algorithm>
+
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "../utils/copy.h"
+
+// Offset of packet data in a TPACKET_V2 TX frame
+#define TX_DATA_OFFSET (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll))
+
+// Copies a frame too big for a single buffer into a chain of them. Returns
+// false, leaving 'pkt' a single (empty) segment, if buffers run out.
+static bool copy_chained(bess::Packet *pkt, const uint8_t *src, uint32_t len) {
+  bess::Packet *last = pkt;
+  int nb_segs = 1;
+
+  bess::utils::Copy(pkt->head_data(), src, SNBUF_DATA);
+  pkt->set_data_len(SNBUF_DATA);
+
+  for (uint32_t off = SNBUF_DATA; off < len; off += SNBUF_DATA) {
+    uint32_t seg_len = std::min<uint32_t>(len - off, SNBUF_DATA);
+    bess::Packet *seg = bess::Packet::Alloc();
+
+    if (!seg) {
+      for (bess::Packet *p = pkt->next(); p;) {
+        bess::Packet *next = p->next();
+        bess::Packet::Free(p);
+        p = next;
+      }
+      pkt->set_next(nullptr);
+      return false;
+    }
+
+    bess::utils::Copy(seg->head_data(), src + off, seg_len);
+    seg->set_data_len(seg_len);
+    seg->set_next(nullptr);
+
+    last->set_next(seg);
+    last = seg;
+    nb_segs++;
+  }
+
+  pkt->set_nb_segs(nb_segs);
+  pkt->set_total_len(len);
+  return true;
+}
+
+int AFPacketPort::SetupRxRing(RxRing *ring,
+                              const bess::pb::AFPacketPortArg &arg,
+                              int fanout_id) {
+  const int version = TPACKET_V3;
+  struct tpacket_req3 req = tpacket_req3();
+  struct sockaddr_ll addr = sockaddr_ll();
+  void *map;
+
+  ring->block_size = arg.block_size() ? arg.block_size() : kDefaultBlockSize;
+  ring->num_blocks = arg.num_blocks() ? arg.num_blocks() : kDefaultNumBlocks;
+
+  if (ring->block_size % getpagesize() || ring->block_size < kRxFrameSize) {
+    return -EINVAL;
+  }
+
+  ring->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+  if (ring->fd < 0) {
+    return -errno;
+  }
+
+  if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version,
+                 sizeof(version)) < 0) {
+    return -errno;
+  }
+
+  req.tp_block_size = ring->block_size;
+  req.tp_block_nr = ring->num_blocks;
+  req.tp_frame_size = kRxFrameSize;
+  req.tp_frame_nr = ring->block_size / kRxFrameSize * ring->num_blocks;
+  req.tp_retire_blk_tov =
+      arg.block_timeout_ms() ? arg.block_timeout_ms() : kDefaultBlockTimeoutMs;
+
+  if (setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) <
+      0) {
+    return -errno;
+  }
+
+  ring->map_len = static_cast<size_t>(ring->block_size) * ring->num_blocks;
+  map = mmap(nullptr, ring->map_len, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, 0);
+  if (map == MAP_FAILED) {
+    return -errno;
+  }
+  ring->map = static_cast<uint8_t *>(map);
+
+  addr.sll_family = AF_PACKET;
+  addr.sll_protocol = htons(ETH_P_ALL);
+  addr.sll_ifindex = ifindex_;
+
+  if (bind(ring->fd, reinterpret_cast<struct sockaddr *>(&addr),
+           sizeof(addr)) < 0) {
+    return -errno;
+  }
+
+  if (arg.promiscuous()) {
+    struct packet_mreq mreq = packet_mreq();
+
+    mreq.mr_ifindex = ifindex_;
+    mreq.mr_type = PACKET_MR_PROMISC;
+
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq,
+                   sizeof(mreq)) < 0) {
+      return -errno;
+    }
+  }
+
+  if (fanout_id >= 0) {
+    int fanout = fanout_id | (PACKET_FANOUT_HASH << 16);
+
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_FANOUT, &fanout,
+                   sizeof(fanout)) < 0) {
+      return -errno;
+    }
+  }
+
+  ring->cur_block = 0;
+  ring->frames_left = 0;
+  ring->next_frame = nullptr;
+
+  return 0;
+}
+
+int AFPacketPort::SetupTxRing(TxRing *ring,
+                              const bess::pb::AFPacketPortArg &arg) {
+  const int version = TPACKET_V2;
+  const int one = 1;
+  struct tpacket_req req = tpacket_req();
+  struct sockaddr_ll addr = sockaddr_ll();
+  void *map;
+
+  ring->num_frames =
+      arg.tx_num_frames() ? arg.tx_num_frames() : kDefaultTxNumFrames;
+
+  // With protocol 0 the socket is never handed any incoming packets
+  ring->fd = socket(AF_PACKET, SOCK_RAW, 0);
+  if (ring->fd < 0) {
+    return -errno;
+  }
+
+  if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version,
+                 sizeof(version)) < 0) {
+    return -errno;
+  }
+
+  // Discard malformed frames instead of stalling the ring
+  if (setsockopt(ring->fd, SOL_PACKET, PACKET_LOSS, &one, sizeof(one)) < 0) {
+    return -errno;
+  }
+
+  if (arg.qdisc_bypass() &&
+      setsockopt(ring->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one,
+                 sizeof(one)) < 0) {
+    return -errno;
+  }
+
+  // One frame per block, so that any number of frames can be used
+  req.tp_block_size = kTxFrameSize;
+  req.tp_block_nr = ring->num_frames;
+  req.tp_frame_size = kTxFrameSize;
+  req.tp_frame_nr = ring->num_frames;
+
+  if (setsockopt(ring->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) <
+      0) {
+    return -errno;
+  }
+
+  ring->map_len = static_cast<size_t>(kTxFrameSize) * ring->num_frames;
+  map = mmap(nullptr, ring->map_len, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, 0);
+  if (map == MAP_FAILED) {
+    return -errno;
+  }
+  ring->map = static_cast<uint8_t *>(map);
+
+  addr.sll_family = AF_PACKET;
+  addr.sll_ifindex = ifindex_;
+
+  if (bind(ring->fd, reinterpret_cast<struct sockaddr *>(&addr),
+           sizeof(addr)) < 0) {
+    return -errno;
+  }
+
+  ring->cur_frame = 0;
+
+  return 0;
+}
+
+CommandResponse AFPacketPort::Init(const bess::pb::AFPacketPortArg &arg) {
+  const queue_t num_rxq = num_queues[PACKET_DIR_INC];
+  const queue_t num_txq = num_queues[PACKET_DIR_OUT];
+
+  int ret;
+
+  for (queue_t qid = 0; qid < MAX_QUEUES_PER_DIR; qid++) {
+    rx_rings_[qid].fd = -1;
+    tx_rings_[qid].fd = -1;
+  }
+
+  if (arg.ifname().empty()) {
+    return CommandFailure(EINVAL, "'ifname' must be given");
+  }
+
+  if (arg.ifname().length() >= IFNAMSIZ) {
+    return CommandFailure(EINVAL, "Interface name '%s' is too long",
+                          arg.ifname().c_str());
+  }
+
+  snprintf(ifname_, IFNAMSIZ, "%s", arg.ifname().c_str());
+
+  ifindex_ = if_nametoindex(ifname_);
+  if (ifindex_ == 0) {
+    return CommandFailure(errno, "Interface '%s' not found", ifname_);
+  }
+
+  // All RX sockets of this port share a fanout group
+  int fanout_id =
+      (getpid() ^ static_cast<int>(reinterpret_cast<uintptr_t>(this) >> 6)) &
+      0xffff;
+
+  for (queue_t qid = 0; qid < num_rxq; qid++) {
+    ret = SetupRxRing(&rx_rings_[qid], arg, (num_rxq > 1) ? fanout_id : -1);
+    if (ret < 0) {
+      DeInit();
+      return CommandFailure(-ret, "Failed to set up RX ring %d of '%s'", qid,
+                            ifname_);
+    }
+  }
+
+  for (queue_t qid = 0; qid < num_txq; qid++) {
+    ret = SetupTxRing(&tx_rings_[qid], arg);
+    if (ret < 0) {
+      DeInit();
+      return CommandFailure(-ret, "Failed to set up TX ring %d of '%s'", qid,
+                            ifname_);
+    }
+  }
+
+  return CommandSuccess();
+}
+
+void AFPacketPort::DeInit() {
+  for (queue_t qid = 0; qid < MAX_QUEUES_PER_DIR; qid++) {
+    RxRing *rx = &rx_rings_[qid];
+    TxRing *tx = &tx_rings_[qid];
+
+    if (rx->map) {
+      munmap(rx->map, rx->map_len);
+      rx->map = nullptr;
+    }
+
+    if (rx->fd >= 0) {
+      close(rx->fd);
+      rx->fd = -1;
+    }
+
+    if (tx->map) {
+      munmap(tx->map, tx->map_len);
+      tx->map = nullptr;
+    }
+
+    if (tx->fd >= 0) {
+      close(tx->fd);
+      tx->fd = -1;
+    }
+  }
+}
+
+void AFPacketPort::CollectStats(bool reset) {
+  for (queue_t qid = 0; qid < num_queues[PACKET_DIR_INC]; qid++) {
+    struct tpacket_stats_v3 stats;
+    socklen_t len = sizeof(stats);
+
+    // The kernel clears its counters on every read
+    if (getsockopt(rx_rings_[qid].fd, SOL_PACKET, PACKET_STATISTICS, &stats,
+                   &len) == 0) {
+      rx_drops_ += stats.tp_drops;
+    }
+  }
+
+  if (reset) {
+    rx_drops_ = 0;
+  }
+
+  port_stats_.inc.dropped = rx_drops_;
+}
+
+int AFPacketPort::RecvPackets(queue_t qid, bess::Packet **pkts, int cnt) {
+  RxRing *ring = &rx_rings_[qid];
+
+  const struct tpacket3_hdr *frames[bess::PacketBatch::kMaxBurst];
+  struct tpacket_block_desc *done_blocks[bess::PacketBatch::kMaxBurst];
+  int num_frames = 0;
+  int num_done = 0;
+
+  // Collect frames from as many blocks as needed, without copying yet
+  while (num_frames < cnt && num_done < cnt) {
+    auto *block = reinterpret_cast<struct tpacket_block_desc *>(
+        ring->map + static_cast<size_t>(ring->cur_block) * ring->block_size);
+
+    if (!(ACCESS_ONCE(block->hdr.bh1.block_status) & TP_STATUS_USER)) {
+      break;
+    }
+
+    LOAD_BARRIER();
+
+    if (!ring->next_frame) {
+      ring->frames_left = block->hdr.bh1.num_pkts;
+      ring->next_frame = reinterpret_cast<uint8_t *>(block) +
+                         block->hdr.bh1.offset_to_first_pkt;
+    }
+
+    while (ring->frames_left > 0 && num_frames < cnt) {
+      auto *hdr = reinterpret_cast<struct tpacket3_hdr *>(ring->next_frame);
+      auto *ll = reinterpret_cast<const struct sockaddr_ll *>(
+          ring->next_frame + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+      ring->next_frame += hdr->tp_next_offset;
+      ring->frames_left--;
+
+      // Skip packets sent by ourselves (or anyone else) on this interface
+      if (ll->sll_pkttype == PACKET_OUTGOING) {
+        continue;
+      }
+
+      frames[num_frames++] = hdr;
+    }
+
+    if (ring->frames_left > 0) {
+      // The batch is full. Continue from here next time.
+      break;
+    }
+
+    done_blocks[num_done++] = block;
+    ring->next_frame = nullptr;
+    ring->cur_block = (ring->cur_block + 1 == ring->num_blocks)
+                          ? 0
+                          : ring->cur_block + 1;
+  }
+
+  if (num_frames > 0 &&
+      bess::Packet::Alloc(pkts, num_frames, 0) !=
+          static_cast<size_t>(num_frames)) {
+    queue_stats[PACKET_DIR_INC][qid].dropped += num_frames;
+    num_frames = 0;
+  }
+
+  int received = 0;
+  for (int i = 0; i < num_frames; i++) {
+    const struct tpacket3_hdr *hdr = frames[i];
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(hdr) + hdr->tp_mac;
+    bess::Packet *pkt = pkts[received];
+    uint32_t len = hdr->tp_snaplen;
+
+    // Jumbo frames, or GRO/LRO aggregates
+    if (unlikely(len > SNBUF_DATA)) {
+      if (copy_chained(pkt, data, len)) {
+        received++;
+      } else {
+        queue_stats[PACKET_DIR_INC][qid].dropped++;
+      }
+      continue;
+    }
+
+    bess::utils::CopyInlined(pkt->head_data(), data, len);
+    pkt->set_data_len(len);
+    pkt->set_total_len(len);
+    received++;
+  }
+
+  if (received < num_frames) {
+    bess::Packet::Free(pkts + received, num_frames - received);
+  }
+
+  // The frames have been copied. Return the blocks to the kernel.
+  if (num_done > 0) {
+    STORE_BARRIER();
+    for (int i = 0; i < num_done; i++) {
+      done_blocks[i]->hdr.bh1.block_status = TP_STATUS_KERNEL;
+    }
+  }
+
+  return received;
+}
+
+int AFPacketPort::SendPackets(queue_t qid, bess::Packet **pkts, int cnt) {
+  TxRing *ring = &tx_rings_[qid];
+  bess::Packet *copied[bess::PacketBatch::kMaxBurst];
+  int num_copied = 0;
+  int sent = 0;
+
+  while (sent < cnt) {
+    bess::Packet *pkt = pkts[sent];
+    auto *hdr = reinterpret_cast<struct tpacket2_hdr *>(
+        ring->map + static_cast<size_t>(ring->cur_frame) * kTxFrameSize);
+    uint8_t *data = reinterpret_cast<uint8_t *>(hdr) + TX_DATA_OFFSET;
+
+    // Would never fit in a frame. Drop it, but not the rest of the batch.
+    if (unlikely(static_cast<size_t>(pkt->total_len()) >
+                 kTxFrameSize - TX_DATA_OFFSET)) {
+      bess::Packet::Free(pkt);
+      queue_stats[PACKET_DIR_OUT][qid].dropped++;
+      sent++;
+      continue;
+    }
+
+    // The ring is full?
+    if (ACCESS_ONCE(hdr->tp_status) != TP_STATUS_AVAILABLE) {
+      break;
+    }
+
+    copied[num_copied++] = pkt;
+    hdr->tp_len = pkt->total_len();
+
+    do {
+      bess::utils::CopyInlined(data, pkt->head_data(), pkt->head_len());
+      data += pkt->head_len();
+      pkt = pkt->next();
+    } while (pkt);
+
+    STORE_BARRIER();
+    hdr->tp_status = TP_STATUS_SEND_REQUEST;
+
+    ring->cur_frame =
+        (ring->cur_frame + 1 == ring->num_frames) ? 0 : ring->cur_frame + 1;
+    sent++;
+  }
+
+  if (num_copied) {
+    // A single system call for the whole batch. If it fails (e.g., the device
+    // queue is full), the frames are picked up by the next kick.
+    send(ring->fd, nullptr, 0, MSG_DONTWAIT);
+    bess::Packet::Free(copied, num_copied);
+  }
+
+  return sent;
+}
+
+Port::LinkStatus AFPacketPort::GetLinkStatus() {
+  struct ifreq ifr = ifreq();
+  bool link_up = false;
+  int fd;
+
+  snprintf(ifr.ifr_name, IFNAMSIZ, "%s", ifname_);
+
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd >= 0) {
+    if (ioctl(fd, SIOCGIFFLAGS, &ifr) == 0) {
+      link_up = ifr.ifr_flags & IFF_RUNNING;
+    }
+    close(fd);
+  }
+
+  return LinkStatus{
+      .speed = 0, .full_duplex = true, .autoneg = true, .link_up = link_up,
+  };
+}
+
+ADD_DRIVER(AFPacketPort, "af_packet_port",
+           "Linux network interface via AF_PACKET mmap'ed rings")
@@ -0,0 +1,119 @@
+#ifndef BESS_DRIVERS_AFPACKET_H_
+#define BESS_DRIVERS_AFPACKET_H_
+
+#include <linux/if_packet.h>
+#include <net/if.h>
+
+#include <glog/logging.h>
+
+#include "../port.h"
+
+/*!
+ * This driver attaches a port to a Linux network interface (e.g., one end of a
+ * veth pair) with AF_PACKET sockets and PACKET_MMAP rings shared with the
+ * kernel, so that no system call is made per packet.
+ *
+ * Each incoming queue is a TPACKET_V3 RX ring. The kernel fills a whole block
+ * of frames at a time, and RecvPackets() copies them into a batch in one pass.
+ * If there are multiple incoming queues, their sockets form a PACKET_FANOUT
+ * group and the kernel hashes flows across them.
+ *
+ * Each outgoing queue is a TPACKET_V2 TX ring on a separate socket. A batch is
+ * written into the ring and the kernel is kicked with a single send().
+ */
+class AFPacketPort final : public Port {
+ public:
+  AFPacketPort()
+      : Port(), ifname_(), ifindex_(), rx_rings_(), tx_rings_(), rx_drops_() {}
+
+  /*!
+   * Opens the sockets and maps the rings of all queues.
+   *
+   * PARAMETERS:
+   * * string ifname : the Linux network interface to attach to.
+   * * bool promiscuous : put the interface into promiscuous mode.
+   * * uint32 block_size, num_blocks : geometry of each RX ring.
+   * * uint32 block_timeout_ms : max delay until a partially filled block is
+   *   handed to BESS.
+   * * uint32 tx_num_frames : number of frames in each TX ring.
+   * * bool qdisc_bypass : send packets without going through the qdisc layer.
+   */
+  CommandResponse Init(const bess::pb::AFPacketPortArg &arg);
+
+  /*!
+   * Unmaps the rings and closes the sockets.
+   */
+  void DeInit() override;
+
+  /*!
+   * Updates the incoming drop counter from the kernel statistics.
+   */
+  void CollectStats(bool reset) override;
+
+  /*!
+   * Receives packets from the RX ring of queue 'qid'.
+   *
+   * RETURNS:
+   * * Total number of packets received (<=cnt)
+   */
+  int RecvPackets(queue_t qid, bess::Packet **pkts, int cnt) override;
+
+  /*!
+   * Sends packets via the TX ring of queue 'qid'. Stops at the first packet
+   * that does not fit, either because the ring is full or the packet is larger
+   * than a ring frame.
+   *
+   * RETURNS:
+   * * Total number of packets sent (<=cnt).
+   */
+  int SendPackets(queue_t qid, bess::Packet **pkts, int cnt) override;
+
+  LinkStatus GetLinkStatus() override;
+
+ private:
+  static const uint32_t kDefaultBlockSize = 1 << 17;  // 128KB
+  static const uint32_t kDefaultNumBlocks = 64;
+  static const uint32_t kDefaultBlockTimeoutMs = 1;
+  static const uint32_t kRxFrameSize = 2048;  // only a hint for TPACKET_V3
+  static const uint32_t kTxFrameSize = 4096;
+  static const uint32_t kDefaultTxNumFrames = 1024;
+
+  struct RxRing {
+    int fd;
+    uint8_t *map;
+    size_t map_len;
+
+    uint32_t block_size;
+    uint32_t num_blocks;
+
+    // Next block to be consumed, and progress within it if it was only
+    // partially consumed by the previous RecvPackets() call.
+    uint32_t cur_block;
+    uint32_t frames_left;
+    uint8_t *next_frame;
+  };
+
+  struct TxRing {
+    int fd;
+    uint8_t *map;
+    size_t map_len;
+
+    uint32_t num_frames;
+    uint32_t cur_frame;
+  };
+
+  int SetupRxRing(RxRing *ring, const bess::pb::AFPacketPortArg &arg,
+                  int fanout_id);
+  int SetupTxRing(TxRing *ring, const bess::pb::AFPacketPortArg &arg);
+
+  char ifname_[IFNAMSIZ];
+  int ifindex_;
+
+  RxRing rx_rings_[MAX_QUEUES_PER_DIR];
+  TxRing tx_rings_[MAX_QUEUES_PER_DIR];
+
+  // Packets dropped by the kernel because RX rings were full
+  uint64_t rx_drops_;
+};
+
+#endif  // BESS_DRIVERS_AFPACKET_H_
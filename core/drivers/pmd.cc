@@ -373,6 +373,19 @@ int PMDPort::SendPackets(queue_t qid, bess::Packet **pkts, int cnt) {
   return sent;
 }
 
+uint64_t PMDPort::GetTxOffloads() const {
+  uint64_t offloads = 0;
+
+#if SN_HW_TXCSUM
+  offloads |= PKT_TX_IP_CKSUM | PKT_TX_L4_MASK;
+#endif
+#if SN_TSO_SG
+  offloads |= PKT_TX_TCP_SEG;
+#endif
+
+  return offloads;
+}
+
 Port::LinkStatus PMDPort::GetLinkStatus() {
   struct rte_eth_link status;
   // rte_eth_link_get() may block up to 9 seconds, so use _nowait() variant.
@@ -95,6 +95,12 @@ class PMDPort final : public Port {
     return DRIVER_FLAG_SELF_INC_STATS | DRIVER_FLAG_SELF_OUT_STATS;
   }
 
+  /*!
+   * Checksum and TCP segmentation offloads are used only if enabled at
+   * compile time (SN_HW_TXCSUM and SN_TSO_SG in pmd.cc).
+   */
+  uint64_t GetTxOffloads() const override;
+
   LinkStatus GetLinkStatus() override;
 
   /*!
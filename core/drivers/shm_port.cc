@@ -0,0 +1,848 @@
+#include "shm_port.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "../utils/copy.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB 0x0004U
+#endif
+
+#define ROUND_TO_64(x) (((x) + 63) & ~static_cast<uint64_t>(63))
+
+static const size_t kHugepageSize = 2 * 1024 * 1024;
+
+// Descriptors of the copy mode carry a buffer index and the packet length.
+static inline llring_addr_t make_desc(uint32_t idx, uint32_t len) {
+  return reinterpret_cast<llring_addr_t>((static_cast<uintptr_t>(idx) << 32) |
+                                         len);
+}
+
+static inline uint32_t desc_idx(llring_addr_t desc) {
+  return reinterpret_cast<uintptr_t>(desc) >> 32;
+}
+
+static inline uint32_t desc_len(llring_addr_t desc) {
+  return reinterpret_cast<uintptr_t>(desc) & 0xffffffff;
+}
+
+// Dequeues up to 'n' entries from a ring we are the only consumer of. 'pos' is
+// our consumer index. The producer index comes from the peer, so the number of
+// entries is clamped to what the ring can hold, and every slot is masked.
+static int ring_dequeue(struct llring *r, uint32_t mask, uint32_t *pos,
+                        llring_addr_t *objs, int n) {
+  uint32_t entries = ACCESS_ONCE(r->prod.tail) - *pos;
+
+  n = std::min(n, static_cast<int>(std::min(entries, mask)));
+  if (n == 0) {
+    return 0;
+  }
+
+  LOAD_BARRIER();
+  for (int i = 0; i < n; i++) {
+    objs[i] = r->ring[(*pos + i) & mask];
+  }
+
+  // The slots must be read before the producer can reuse them
+  *pos += n;
+  STORE_BARRIER();
+  r->cons.head = *pos;
+  r->cons.tail = *pos;
+
+  return n;
+}
+
+// Enqueues up to 'n' entries to a ring we are the only producer of. 'pos' is
+// our producer index. Returns the number of entries enqueued.
+static int ring_enqueue(struct llring *r, uint32_t mask, uint32_t *pos,
+                        const llring_addr_t *objs, int n) {
+  uint32_t free_entries = mask + ACCESS_ONCE(r->cons.tail) - *pos;
+
+  n = std::min(n, static_cast<int>(std::min(free_entries, mask)));
+  if (n == 0) {
+    return 0;
+  }
+
+  for (int i = 0; i < n; i++) {
+    r->ring[(*pos + i) & mask] = objs[i];
+  }
+
+  // The slots must be written before the consumer can see them
+  *pos += n;
+  STORE_BARRIER();
+  r->prod.head = *pos;
+  r->prod.tail = *pos;
+
+  return n;
+}
+
+static int memfd_create_compat(const char *name, unsigned int flags) {
+  return syscall(__NR_memfd_create, name, flags);
+}
+
+// Sends 'hello', along with 'fd' if it is not negative.
+static int send_hello(int sock, const struct shm_port_hello &hello, int fd) {
+  struct iovec iov = {const_cast<shm_port_hello *>(&hello), sizeof(hello)};
+  struct msghdr msg = msghdr();
+  char cbuf[CMSG_SPACE(sizeof(int))] = {};
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  if (fd >= 0) {
+    struct cmsghdr *cmsg;
+
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+
+  ssize_t ret = sendmsg(sock, &msg, MSG_NOSIGNAL);
+  if (ret < 0) {
+    return -errno;
+  }
+
+  return (ret == sizeof(hello)) ? 0 : -EPROTO;
+}
+
+// Receives 'hello'. If 'fd' is not null, a file descriptor must be attached.
+static int recv_hello(int sock, struct shm_port_hello *hello, int *fd) {
+  struct iovec iov = {hello, sizeof(*hello)};
+  struct msghdr msg = msghdr();
+  char cbuf[CMSG_SPACE(sizeof(int))] = {};
+  ssize_t ret;
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+
+  do {
+    ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (ret < 0 && errno == EINTR);
+
+  if (ret < 0) {
+    return -errno;
+  }
+
+  if (fd) {
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS) {
+      return -EPROTO;
+    }
+    memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+  }
+
+  if (ret != sizeof(*hello) || hello->magic != SHM_PORT_MAGIC ||
+      hello->version != SHM_PORT_VERSION) {
+    if (fd) {
+      close(*fd);
+    }
+    return -EPROTO;
+  }
+
+  return 0;
+}
+
+void ShmPort::FillHello(struct shm_port_hello *hello, bool allow_zero_copy) {
+  *hello = shm_port_hello();
+  hello->magic = SHM_PORT_MAGIC;
+  hello->version = SHM_PORT_VERSION;
+  hello->flags = allow_zero_copy ? SHM_PORT_F_ZERO_COPY : 0;
+  hello->region_size = region_size_;
+  hello->pool_pid = getpid();
+  hello->pool_addr =
+      reinterpret_cast<uintptr_t>(bess::get_pframe_pool_socket(0));
+}
+
+bool ShmPort::SharesPool(const struct shm_port_hello &peer) {
+  struct shm_port_hello self;
+
+  FillHello(&self, true);
+  return peer.pool_pid == self.pool_pid && peer.pool_addr == self.pool_addr;
+}
+
+bool ShmPort::WaitReadable(int fd) {
+  struct pollfd fds[2] = {{fd, POLLIN, 0}, {exit_fd_, POLLIN, 0}};
+
+  for (;;) {
+    int ret = poll(fds, 2, -1);
+
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      PLOG(ERROR) << "[ShmPort]:poll()";
+      return false;
+    }
+
+    if (fds[1].revents) {
+      return false;
+    }
+
+    if (fds[0].revents) {
+      return true;
+    }
+  }
+}
+
+int ShmPort::CreateRegion(uint32_t ring_slots, uint32_t buf_size) {
+  uint32_t nq[2];
+  uint64_t ring_bytes = ROUND_TO_64(llring_bytes_with_slots(ring_slots));
+  uint64_t bufs_bytes = static_cast<uint64_t>(ring_slots - 1) * buf_size;
+  uint64_t size = ROUND_TO_64(sizeof(struct shm_port_region));
+  uint64_t map_size;
+  void *map;
+
+  nq[SHM_PORT_S2C] = num_queues[PACKET_DIR_OUT];
+  nq[SHM_PORT_C2S] = num_queues[PACKET_DIR_INC];
+
+  size += (ring_bytes * 2 + bufs_bytes) * (nq[0] + nq[1]);
+
+  // Try hugepages first, since the buffers are touched by both sides for
+  // every packet. Without reserved hugepages, mmap() fails and we fall back to
+  // regular pages.
+  region_fd_ = memfd_create_compat(name().c_str(), MFD_CLOEXEC | MFD_HUGETLB);
+  if (region_fd_ >= 0) {
+    map_size = (size + kHugepageSize - 1) & ~(kHugepageSize - 1);
+    map = MAP_FAILED;
+    if (ftruncate(region_fd_, map_size) == 0) {
+      map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 region_fd_, 0);
+    }
+
+    if (map == MAP_FAILED) {
+      close(region_fd_);
+      region_fd_ = -1;
+    }
+  }
+
+  if (region_fd_ < 0) {
+    LOG(WARNING) << "[ShmPort]: hugepages not available for " << name()
+                 << ", using regular pages";
+
+    region_fd_ = memfd_create_compat(name().c_str(), MFD_CLOEXEC);
+    if (region_fd_ < 0) {
+      return -errno;
+    }
+
+    map_size = (size + getpagesize() - 1) & ~(getpagesize() - 1);
+    if (ftruncate(region_fd_, map_size) < 0) {
+      return -errno;
+    }
+
+    map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+               region_fd_, 0);
+    if (map == MAP_FAILED) {
+      return -errno;
+    }
+  }
+
+  region_ = static_cast<struct shm_port_region *>(map);
+  region_size_ = map_size;
+  region_->magic = SHM_PORT_MAGIC;
+  region_->version = SHM_PORT_VERSION;
+  region_->region_size = map_size;
+  region_->ring_slots = ring_slots;
+  region_->buf_size = buf_size;
+  ring_slots_ = ring_slots;
+  buf_size_ = buf_size;
+
+  uint64_t off = ROUND_TO_64(sizeof(struct shm_port_region));
+  uint8_t *base = reinterpret_cast<uint8_t *>(region_);
+
+  for (int i = 0; i < 2; i++) {
+    region_->num_queues[i] = nq[i];
+
+    for (uint32_t q = 0; q < nq[i]; q++) {
+      struct shm_port_queue *sq = &region_->queues[i][q];
+      struct llring *ring;
+      struct llring *free_ring;
+
+      sq->ring_off = off;
+      off += ring_bytes;
+      sq->free_off = off;
+      off += ring_bytes;
+      sq->bufs_off = off;
+      off += bufs_bytes;
+
+      ring = reinterpret_cast<struct llring *>(base + sq->ring_off);
+      free_ring = reinterpret_cast<struct llring *>(base + sq->free_off);
+
+      llring_init(ring, ring_slots, 1, 1);
+      llring_init(free_ring, ring_slots, 1, 1);
+
+      // Initially all buffers belong to the producer
+      for (uint32_t idx = 0; idx < ring_slots - 1; idx++) {
+        llring_sp_enqueue(free_ring, make_desc(idx, 0));
+      }
+    }
+  }
+
+  return 0;
+}
+
+int ShmPort::ValidateRegion(size_t region_size) {
+  // 'region_size' has been checked against the region file. The rest is read
+  // once, since the peer may change the region under us.
+  uint32_t slots = ACCESS_ONCE(region_->ring_slots);
+  uint32_t buf_size = ACCESS_ONCE(region_->buf_size);
+
+  if (region_->magic != SHM_PORT_MAGIC ||
+      region_->version != SHM_PORT_VERSION ||
+      region_->region_size != region_size) {
+    return -EPROTO;
+  }
+
+  if (slots < 2 || (slots & (slots - 1)) || buf_size == 0 ||
+      buf_size % 64 || buf_size > SNBUF_DATA) {
+    return -EPROTO;
+  }
+
+  // The client sees the rings from the other side
+  if (region_->num_queues[SHM_PORT_S2C] != num_queues[PACKET_DIR_INC] ||
+      region_->num_queues[SHM_PORT_C2S] != num_queues[PACKET_DIR_OUT]) {
+    return -EINVAL;
+  }
+
+  ring_slots_ = slots;
+  buf_size_ = buf_size;
+
+  return 0;
+}
+
+int ShmPort::AttachQueue(int dir, queue_t qid, Queue *q) {
+  uint8_t *base = reinterpret_cast<uint8_t *>(region_);
+  uint64_t ring_bytes = llring_bytes_with_slots(ring_slots_);
+  uint64_t bufs_bytes = static_cast<uint64_t>(ring_slots_ - 1) * buf_size_;
+
+  // A copy, so that the offsets we check are the ones we use
+  struct shm_port_queue sq = region_->queues[dir][qid];
+
+  if (sq.ring_off + ring_bytes > region_size_ ||
+      sq.free_off + ring_bytes > region_size_ ||
+      sq.bufs_off + bufs_bytes > region_size_) {
+    return -EPROTO;
+  }
+
+  q->ring = reinterpret_cast<struct llring *>(base + sq.ring_off);
+  q->free = reinterpret_cast<struct llring *>(base + sq.free_off);
+  q->bufs = base + sq.bufs_off;
+  q->stash_cnt = 0;
+
+  // Pick up where the rings were left at setup. No traffic flows yet, and
+  // any index is safe to start from, as it is always masked.
+  if ((dir == SHM_PORT_S2C) == is_server_) {
+    q->ring_pos = ACCESS_ONCE(q->ring->prod.tail);
+    q->free_pos = ACCESS_ONCE(q->free->cons.tail);
+  } else {
+    q->ring_pos = ACCESS_ONCE(q->ring->cons.tail);
+    q->free_pos = ACCESS_ONCE(q->free->prod.tail);
+  }
+
+  return 0;
+}
+
+int ShmPort::AttachQueues() {
+  int rx_dir = is_server_ ? SHM_PORT_C2S : SHM_PORT_S2C;
+  int tx_dir = is_server_ ? SHM_PORT_S2C : SHM_PORT_C2S;
+  int ret;
+
+  for (queue_t qid = 0; qid < num_queues[PACKET_DIR_INC]; qid++) {
+    ret = AttachQueue(rx_dir, qid, &rx_queues_[qid]);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  for (queue_t qid = 0; qid < num_queues[PACKET_DIR_OUT]; qid++) {
+    ret = AttachQueue(tx_dir, qid, &tx_queues_[qid]);
+    if (ret < 0) {
+      return ret;
+    }
+  }
+
+  return 0;
+}
+
+void ShmPort::ServeClient(bool allow_zero_copy) {
+  struct shm_port_hello hello;
+  int ret;
+
+  for (;;) {
+    if (!WaitReadable(listen_fd_)) {
+      return;
+    }
+
+    ctrl_fd_ = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (ctrl_fd_ >= 0) {
+      break;
+    }
+
+    if (errno != EINTR && errno != EAGAIN) {
+      PLOG(ERROR) << "[ShmPort]:accept4()";
+      return;
+    }
+  }
+
+  FillHello(&hello, allow_zero_copy);
+  ret = send_hello(ctrl_fd_, hello, region_fd_);
+  if (ret < 0) {
+    LOG(ERROR) << "[ShmPort]: " << name()
+               << ": handshake failed: " << strerror(-ret);
+    return;
+  }
+
+  if (!WaitReadable(ctrl_fd_)) {
+    return;
+  }
+
+  ret = recv_hello(ctrl_fd_, &hello, nullptr);
+  if (ret < 0) {
+    LOG(ERROR) << "[ShmPort]: " << name()
+               << ": handshake failed: " << strerror(-ret);
+    return;
+  }
+
+  zero_copy_ = allow_zero_copy && (hello.flags & SHM_PORT_F_ZERO_COPY) &&
+               SharesPool(hello);
+
+  // Workers must see zero_copy_ before peer_up_
+  __sync_synchronize();
+  peer_up_ = 1;
+
+  LOG(INFO) << "[ShmPort]: " << name() << ": client connected ("
+            << (zero_copy_ ? "zero-copy" : "copy") << " mode)";
+
+  // Nothing more is sent over the control channel. Wait for EOF.
+  for (;;) {
+    char buf[64];
+
+    if (!WaitReadable(ctrl_fd_)) {
+      return;
+    }
+
+    ret = recv(ctrl_fd_, buf, sizeof(buf), MSG_DONTWAIT);
+    if (ret == 0 || (ret < 0 && errno != EINTR && errno != EAGAIN)) {
+      break;
+    }
+  }
+
+  peer_up_ = 0;
+  LOG(INFO) << "[ShmPort]: " << name() << ": client disconnected";
+}
+
+void ShmPort::WatchServer() {
+  for (;;) {
+    char buf[64];
+    int ret;
+
+    if (!WaitReadable(ctrl_fd_)) {
+      return;
+    }
+
+    ret = recv(ctrl_fd_, buf, sizeof(buf), MSG_DONTWAIT);
+    if (ret == 0 || (ret < 0 && errno != EINTR && errno != EAGAIN)) {
+      break;
+    }
+  }
+
+  peer_up_ = 0;
+  LOG(INFO) << "[ShmPort]: " << name() << ": server disconnected";
+}
+
+CommandResponse ShmPort::InitServer(const bess::pb::ShmPortArg &arg) {
+  uint32_t ring_slots =
+      arg.ring_slots() ? arg.ring_slots() : kDefaultRingSlots;
+  uint32_t buf_size = arg.buf_size() ? arg.buf_size() : kDefaultBufSize;
+  size_t addrlen;
+  int ret;
+
+  if (ring_slots < 2 || (ring_slots & (ring_slots - 1))) {
+    return CommandFailure(EINVAL, "'ring_slots' must be a power of 2");
+  }
+
+  if (buf_size % 64 || buf_size > SNBUF_DATA) {
+    return CommandFailure(EINVAL,
+                          "'buf_size' must be a multiple of 64, up to %d",
+                          SNBUF_DATA);
+  }
+
+  ret = CreateRegion(ring_slots, buf_size);
+  if (ret < 0) {
+    return CommandFailure(-ret, "Failed to create the shared region");
+  }
+
+  ret = AttachQueues();
+  if (ret < 0) {
+    return CommandFailure(-ret, "Invalid shared region");
+  }
+
+  listen_fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    return CommandFailure(errno, "socket(AF_UNIX) failed");
+  }
+
+  // This doesn't include the trailing null character.
+  addrlen = sizeof(addr_.sun_family) + strlen(addr_.sun_path);
+
+  // Non-abstract socket address?
+  if (addr_.sun_path[0] != '@') {
+    // Remove existing socket file, if any.
+    unlink(addr_.sun_path);
+  } else {
+    addr_.sun_path[0] = '\0';
+  }
+
+  ret = bind(listen_fd_, reinterpret_cast<struct sockaddr *>(&addr_), addrlen);
+  if (ret < 0) {
+    return CommandFailure(errno, "bind(%s) failed", addr_.sun_path);
+  }
+
+  ret = listen(listen_fd_, 1);
+  if (ret < 0) {
+    return CommandFailure(errno, "listen() failed");
+  }
+
+  bool allow_zero_copy = !arg.no_zero_copy();
+  ctrl_thread_ = std::thread([=]() { ServeClient(allow_zero_copy); });
+
+  return CommandSuccess();
+}
+
+CommandResponse ShmPort::InitClient(const bess::pb::ShmPortArg &arg) {
+  struct shm_port_hello hello;
+  struct stat st;
+  size_t addrlen;
+  void *map;
+  int ret;
+
+  if (arg.ring_slots() || arg.buf_size()) {
+    return CommandFailure(EINVAL, "The geometry is determined by the server");
+  }
+
+  ctrl_fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (ctrl_fd_ < 0) {
+    return CommandFailure(errno, "socket(AF_UNIX) failed");
+  }
+
+  addrlen = sizeof(addr_.sun_family) + strlen(addr_.sun_path);
+  if (addr_.sun_path[0] == '@') {
+    addr_.sun_path[0] = '\0';
+  }
+
+  ret = connect(ctrl_fd_, reinterpret_cast<struct sockaddr *>(&addr_),
+                addrlen);
+  if (ret < 0) {
+    return CommandFailure(errno, "connect() failed");
+  }
+
+  if (!WaitReadable(ctrl_fd_)) {
+    return CommandFailure(EIO, "No handshake from the server");
+  }
+
+  ret = recv_hello(ctrl_fd_, &hello, &region_fd_);
+  if (ret < 0) {
+    region_fd_ = -1;
+    return CommandFailure(-ret, "Handshake with the server failed");
+  }
+
+  // Trust the size of the file, not what the server says about it
+  if (fstat(region_fd_, &st) < 0) {
+    return CommandFailure(errno, "fstat() of the shared region failed");
+  }
+
+  if (hello.region_size < sizeof(struct shm_port_region) ||
+      hello.region_size > static_cast<uint64_t>(st.st_size)) {
+    return CommandFailure(EPROTO, "Invalid shared region size");
+  }
+
+  map = mmap(nullptr, hello.region_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+             region_fd_, 0);
+  if (map == MAP_FAILED) {
+    return CommandFailure(errno, "mmap() of the shared region failed");
+  }
+  region_ = static_cast<struct shm_port_region *>(map);
+
+  region_size_ = hello.region_size;
+
+  ret = ValidateRegion(region_size_);
+  if (ret == -EINVAL) {
+    return CommandFailure(EINVAL,
+                          "Queue counts must mirror the server "
+                          "(inc %u, out %u)",
+                          region_->num_queues[SHM_PORT_S2C],
+                          region_->num_queues[SHM_PORT_C2S]);
+  } else if (ret < 0) {
+    return CommandFailure(-ret, "Invalid shared region");
+  }
+
+  ret = AttachQueues();
+  if (ret < 0) {
+    return CommandFailure(-ret, "Invalid shared region");
+  }
+
+  bool allow_zero_copy = !arg.no_zero_copy() &&
+                         (hello.flags & SHM_PORT_F_ZERO_COPY) &&
+                         SharesPool(hello);
+
+  FillHello(&hello, allow_zero_copy);
+  ret = send_hello(ctrl_fd_, hello, -1);
+  if (ret < 0) {
+    return CommandFailure(-ret, "Handshake with the server failed");
+  }
+
+  zero_copy_ = allow_zero_copy;
+  peer_up_ = 1;
+
+  ctrl_thread_ = std::thread([this]() { WatchServer(); });
+
+  return CommandSuccess();
+}
+
+CommandResponse ShmPort::Init(const bess::pb::ShmPortArg &arg) {
+  const std::string path = arg.path();
+  CommandResponse ret;
+
+  is_server_ = !arg.client();
+
+  addr_.sun_family = AF_UNIX;
+
+  if (path.length() != 0) {
+    snprintf(addr_.sun_path, sizeof(addr_.sun_path), "%s", path.c_str());
+  } else if (is_server_) {
+    snprintf(addr_.sun_path, sizeof(addr_.sun_path), "%s/bess_shm_%s",
+             P_tmpdir, name().c_str());
+  } else {
+    return CommandFailure(EINVAL, "'path' must be given for a client");
+  }
+
+  exit_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (exit_fd_ < 0) {
+    return CommandFailure(errno, "eventfd() failed");
+  }
+
+  ret = is_server_ ? InitServer(arg) : InitClient(arg);
+  if (ret.error().code() != 0) {
+    DeInit();
+  }
+
+  return ret;
+}
+
+void ShmPort::DeInit() {
+  peer_up_ = 0;
+
+  if (ctrl_thread_.joinable()) {
+    uint64_t one = 1;
+
+    if (write(exit_fd_, &one, sizeof(one)) == sizeof(one)) {
+      ctrl_thread_.join();
+    } else {
+      ctrl_thread_.detach();
+    }
+  }
+
+  // Packets in flight belong to the consumer side, i.e., us for RX rings.
+  if (region_ && zero_copy_) {
+    for (queue_t qid = 0; qid < num_queues[PACKET_DIR_INC]; qid++) {
+      Queue *q = &rx_queues_[qid];
+      bess::Packet *pkts[bess::PacketBatch::kMaxBurst];
+      int cnt;
+
+      while ((cnt = ring_dequeue(q->ring, ring_slots_ - 1, &q->ring_pos,
+                                 reinterpret_cast<llring_addr_t *>(pkts),
+                                 bess::PacketBatch::kMaxBurst)) > 0) {
+        bess::Packet::Free(pkts, cnt);
+      }
+    }
+  }
+
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    listen_fd_ = -1;
+
+    if (addr_.sun_path[0] != '\0') {
+      unlink(addr_.sun_path);
+    }
+  }
+
+  if (ctrl_fd_ >= 0) {
+    close(ctrl_fd_);
+    ctrl_fd_ = -1;
+  }
+
+  if (exit_fd_ >= 0) {
+    close(exit_fd_);
+    exit_fd_ = -1;
+  }
+
+  if (region_) {
+    munmap(region_, region_size_);
+    region_ = nullptr;
+  }
+
+  if (region_fd_ >= 0) {
+    close(region_fd_);
+    region_fd_ = -1;
+  }
+}
+
+int ShmPort::RecvPackets(queue_t qid, bess::Packet **pkts, int cnt) {
+  Queue *q = &rx_queues_[qid];
+  llring_addr_t descs[bess::PacketBatch::kMaxBurst];
+  llring_addr_t idxs[bess::PacketBatch::kMaxBurst];
+  uint32_t max_len = buf_size_;
+  int received = 0;
+  int n;
+
+  if (!peer_up_) {
+    return 0;
+  }
+
+  cnt = std::min(cnt, static_cast<int>(bess::PacketBatch::kMaxBurst));
+
+  if (zero_copy_) {
+    return ring_dequeue(q->ring, ring_slots_ - 1, &q->ring_pos,
+                        reinterpret_cast<llring_addr_t *>(pkts), cnt);
+  }
+
+  n = ring_dequeue(q->ring, ring_slots_ - 1, &q->ring_pos, descs, cnt);
+  if (n == 0) {
+    return 0;
+  }
+
+  // Do not trust the peer with the buffer boundaries. Bad descriptors are
+  // dropped rather than put back on the free ring.
+  int valid = 0;
+  for (int i = 0; i < n; i++) {
+    if (desc_idx(descs[i]) < ring_slots_ - 1 && desc_len(descs[i]) <= max_len) {
+      descs[valid++] = descs[i];
+    }
+  }
+  queue_stats[PACKET_DIR_INC][qid].dropped += n - valid;
+  n = valid;
+
+  if (bess::Packet::Alloc(pkts, n, 0) == static_cast<size_t>(n)) {
+    for (int i = 0; i < n; i++) {
+      uint32_t idx = desc_idx(descs[i]);
+      uint32_t len = desc_len(descs[i]);
+      bess::Packet *pkt = pkts[received++];
+
+      pkt->set_data_len(len);
+      pkt->set_total_len(len);
+      bess::utils::CopyInlined(pkt->head_data<void *>(),
+                               q->bufs + static_cast<size_t>(idx) * max_len,
+                               len, true);
+    }
+  } else {
+    queue_stats[PACKET_DIR_INC][qid].dropped += n;
+  }
+
+  for (int i = 0; i < n; i++) {
+    idxs[i] = make_desc(desc_idx(descs[i]), 0);
+  }
+
+  // There are fewer buffers than the free ring slots, so this cannot fall
+  // short unless the peer misbehaves.
+  ring_enqueue(q->free, ring_slots_ - 1, &q->free_pos, idxs, n);
+
+  return received;
+}
+
+int ShmPort::SendPackets(queue_t qid, bess::Packet **pkts, int cnt) {
+  Queue *q = &tx_queues_[qid];
+  llring_addr_t descs[bess::PacketBatch::kMaxBurst];
+  uint32_t max_len = buf_size_;
+  int sent = 0;
+
+  if (!peer_up_) {
+    return 0;
+  }
+
+  cnt = std::min(cnt, static_cast<int>(bess::PacketBatch::kMaxBurst));
+
+  if (zero_copy_) {
+    return ring_enqueue(q->ring, ring_slots_ - 1, &q->ring_pos,
+                        reinterpret_cast<llring_addr_t *>(pkts), cnt);
+  }
+
+  if (q->stash_cnt < cnt) {
+    q->stash_cnt += ring_dequeue(q->free, ring_slots_ - 1, &q->free_pos,
+                                 q->stash + q->stash_cnt, cnt - q->stash_cnt);
+  }
+
+  while (sent < cnt && q->stash_cnt > 0) {
+    bess::Packet *pkt = pkts[sent];
+    uint32_t len = pkt->total_len();
+    uint32_t idx;
+    uint8_t *buf;
+
+    if (len > max_len) {
+      break;
+    }
+
+    // The free ring comes from the peer. Drop any index out of bounds.
+    idx = desc_idx(q->stash[--q->stash_cnt]);
+    if (idx >= ring_slots_ - 1) {
+      continue;
+    }
+
+    buf = q->bufs + static_cast<size_t>(idx) * max_len;
+    descs[sent++] = make_desc(idx, len);
+
+    // buf_size is a multiple of 64, so a sloppy copy of a single segment
+    // stays in the buffer.
+    if (!pkt->next()) {
+      bess::utils::CopyInlined(buf, pkt->head_data(), len, true);
+      continue;
+    }
+
+    do {
+      bess::utils::Copy(buf, pkt->head_data(), pkt->data_len());
+      buf += pkt->data_len();
+      pkt = pkt->next();
+    } while (pkt);
+  }
+
+  if (sent == 0) {
+    return 0;
+  }
+
+  // The ring has room for all buffers, so this cannot fall short unless the
+  // peer misbehaves.
+  ring_enqueue(q->ring, ring_slots_ - 1, &q->ring_pos, descs, sent);
+
+  bess::Packet::Free(pkts, sent);
+
+  return sent;
+}
+
+Port::LinkStatus ShmPort::GetLinkStatus() {
+  return LinkStatus{
+      .speed = 0,
+      .full_duplex = true,
+      .autoneg = true,
+      .link_up = peer_up_ != 0,
+  };
+}
+
+ADD_DRIVER(ShmPort, "shm_port",
+           "shared memory descriptor rings between local processes")
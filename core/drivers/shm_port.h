@@ -0,0 +1,206 @@
+#ifndef BESS_DRIVERS_SHMPORT_H_
+#define BESS_DRIVERS_SHMPORT_H_
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+
+#include <glog/logging.h>
+
+#include "../kmod/llring.h"
+#include "../packet.h"
+#include "../port.h"
+
+#define SHM_PORT_MAGIC 0x53484d50 /* "SHMP" */
+#define SHM_PORT_VERSION 1
+
+/* Both peers use the zero-copy mode (agreed in the handshake) */
+#define SHM_PORT_F_ZERO_COPY (1 << 0)
+
+/* Ring sets in the shared region. "Server" is the side that created it. */
+#define SHM_PORT_S2C 0
+#define SHM_PORT_C2S 1
+
+/* Offsets (in bytes from the beginning of the region) of a queue */
+struct shm_port_queue {
+  uint64_t ring_off; /* filled descriptors, producer -> consumer */
+  uint64_t free_off; /* empty buffer indices, consumer -> producer */
+  uint64_t bufs_off; /* (ring_slots - 1) buffers of buf_size bytes */
+};
+
+/* Placed at the beginning of the shared region */
+struct shm_port_region {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t region_size;
+  uint32_t ring_slots;
+  uint32_t buf_size;
+  uint32_t num_queues[2]; /* indexed by SHM_PORT_S2C/C2S */
+  struct shm_port_queue queues[2][MAX_QUEUES_PER_DIR];
+};
+
+/* Exchanged once over the control socket, in both directions. The message
+ * from the server carries the region file descriptor (SCM_RIGHTS). */
+struct shm_port_hello {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t flags;
+  uint32_t pad;
+  uint64_t region_size;
+  /* Identify the packet pool of the sender. Packets can be passed by pointer
+   * only if both peers see the same pool at the same address. */
+  int64_t pool_pid;
+  uint64_t pool_addr;
+};
+
+/*!
+ * This driver connects two BESS instances (or BESS and another local process)
+ * with descriptor rings in a shared memory region, similar to memif.
+ *
+ * The server side creates the region, preferably on hugepages, and listens on
+ * a UNIX socket. The client connects to the socket and receives the region file
+ * descriptor along with the layout. Each queue has two llrings: one carries
+ * descriptors of filled buffers from the producer to the consumer, and the
+ * other returns the emptied buffers. Packets are copied into and out of the
+ * buffers, with no system call on the data path.
+ *
+ * If both sides turn out to share the same packet pool (e.g., two ports of the
+ * same BESS process), the rings carry packet pointers instead, without copying.
+ *
+ * The port carries no traffic until a client has connected. Once the client
+ * goes away, the port stays down; destroy and recreate the port to reconnect.
+ */
+class ShmPort final : public Port {
+ public:
+  ShmPort()
+      : Port(),
+        is_server_(),
+        addr_(),
+        listen_fd_(-1),
+        ctrl_fd_(-1),
+        exit_fd_(-1),
+        region_fd_(-1),
+        region_(),
+        region_size_(),
+        ring_slots_(),
+        buf_size_(),
+        ctrl_thread_(),
+        peer_up_(),
+        zero_copy_(),
+        rx_queues_(),
+        tx_queues_() {}
+
+  /*!
+   * Creates the shared region and starts listening (server), or connects to
+   * the server and maps its region (client).
+   *
+   * PARAMETERS:
+   * * string path : UNIX socket path for the control channel.
+   * * bool client : connect to an existing server port.
+   * * uint32 ring_slots, buf_size : geometry of each queue (server only).
+   * * bool no_zero_copy : always copy packets, even if the pool is shared.
+   */
+  CommandResponse Init(const bess::pb::ShmPortArg &arg);
+
+  /*!
+   * Closes the control channel and unmaps the region.
+   */
+  void DeInit() override;
+
+  /*!
+   * Receives packets from the ring of incoming queue 'qid'.
+   *
+   * RETURNS:
+   * * Total number of packets received (<=cnt)
+   */
+  int RecvPackets(queue_t qid, bess::Packet **pkts, int cnt) override;
+
+  /*!
+   * Sends packets to the ring of outgoing queue 'qid'. Stops at the first
+   * packet that does not fit, either because the ring is full or the packet is
+   * larger than a buffer.
+   *
+   * RETURNS:
+   * * Total number of packets sent (<=cnt).
+   */
+  int SendPackets(queue_t qid, bess::Packet **pkts, int cnt) override;
+
+  /*!
+   * The link is up while a peer is connected.
+   */
+  LinkStatus GetLinkStatus() override;
+
+ private:
+  static const uint32_t kDefaultRingSlots = 1024;
+  static const uint32_t kDefaultBufSize = 2048;
+
+  // The llrings are in the region, where the peer can write anything to them.
+  // So they are not touched with the llring functions: the geometry is
+  // ring_slots_, and our own index of each ring is kept here. Only the index
+  // of the peer is read from the region.
+  struct Queue {
+    struct llring *ring;
+    struct llring *free;
+    uint32_t ring_pos;  // (RX) consumer index of 'ring', (TX) producer index
+    uint32_t free_pos;  // (RX) producer index of 'free', (TX) consumer index
+    uint8_t *bufs;
+
+    // (TX only) Buffers taken from the free ring but not used yet
+    llring_addr_t stash[bess::PacketBatch::kMaxBurst];
+    int stash_cnt;
+  };
+
+  CommandResponse InitServer(const bess::pb::ShmPortArg &arg);
+  CommandResponse InitClient(const bess::pb::ShmPortArg &arg);
+
+  // Creates the region file and lays out the rings in it.
+  int CreateRegion(uint32_t ring_slots, uint32_t buf_size);
+
+  // Checks the header of a region created by the peer, and keeps its
+  // geometry in ring_slots_ and buf_size_.
+  int ValidateRegion(size_t region_size);
+
+  // Sets up rx_queues_ and tx_queues_ after the region is mapped. Fails if
+  // the rings of a queue do not fit in the region.
+  int AttachQueues();
+  int AttachQueue(int dir, queue_t qid, Queue *q);
+
+  // (server) Waits for a client, does the handshake, and then waits until the
+  // client goes away. Runs on ctrl_thread_.
+  void ServeClient(bool allow_zero_copy);
+
+  // (client) Waits until the server goes away. Runs on ctrl_thread_.
+  void WatchServer();
+
+  // Waits until 'fd' becomes readable. Returns false if the port is being
+  // destroyed.
+  bool WaitReadable(int fd);
+
+  void FillHello(struct shm_port_hello *hello, bool allow_zero_copy);
+  bool SharesPool(const struct shm_port_hello &peer);
+
+  bool is_server_;
+
+  struct sockaddr_un addr_;
+  int listen_fd_;
+  int ctrl_fd_;
+  int exit_fd_;  // signals ctrl_thread_ to quit
+
+  int region_fd_;
+  struct shm_port_region *region_;
+  // Not from the region, which the peer can write to
+  size_t region_size_;
+  uint32_t ring_slots_;
+  uint32_t buf_size_;
+
+  std::thread ctrl_thread_;
+
+  // Set once the handshake is done. Cleared when the peer goes away.
+  volatile int peer_up_;
+  bool zero_copy_;
+
+  Queue rx_queues_[MAX_QUEUES_PER_DIR];
+  Queue tx_queues_[MAX_QUEUES_PER_DIR];
+};
+
+#endif  // BESS_DRIVERS_SHMPORT_H_
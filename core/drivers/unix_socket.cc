@@ -1,5 +1,7 @@
 #include "unix_socket.h"
 
+#include <algorithm>
+
 // TODO(barath): Clarify these comments.
 // Only one client can be connected at the same time.  Polling sockets is quite
 // exprensive, so we throttle the polling rate.  (by checking sockets once every
@@ -26,6 +28,19 @@ void UnixSocketPort::AcceptNewClient() {
 
   recv_skip_cnt_ = 0;
 
+  if (use_epoll_) {
+    struct epoll_event ev = epoll_event();
+
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = ret;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, ret, &ev) < 0) {
+      PLOG(ERROR) << "[UnixSocket]:epoll_ctl()";
+    }
+
+    // There may be packets that arrived before the registration
+    readable_ = 1;
+  }
+
   if (old_client_fd_ != kNotConnectedFd) {
     // Reuse the old file descriptor number by atomically exchanging the new fd
     // with the
@@ -37,6 +52,33 @@ void UnixSocketPort::AcceptNewClient() {
   }
 }
 
+void UnixSocketPort::WaitForPackets() {
+  for (;;) {
+    struct epoll_event ev;
+    int ret = epoll_wait(epoll_fd_, &ev, 1, -1);
+
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      PLOG(ERROR) << "[UnixSocket]:epoll_wait()";
+      return;
+    }
+
+    if (ret == 0) {
+      continue;
+    }
+
+    if (ev.data.fd == exit_fd_) {
+      return;
+    }
+
+    // Edge-triggered: this fires once for every batch of new packets, which
+    // RecvPackets() then drains.
+    readable_ = 1;
+  }
+}
+
 // This accept thread terminates once a new client is connected.
 void *AcceptThreadMain(void *arg) {
   UnixSocketPort *p = reinterpret_cast<UnixSocketPort *>(arg);
@@ -68,6 +110,7 @@ CommandResponse UnixSocketPort::Init(const bess::pb::UnixSocketPortArg &arg) {
 
   client_fd_ = kNotConnectedFd;
   old_client_fd_ = kNotConnectedFd;
+  use_epoll_ = arg.epoll();
 
   if (num_txq > 1 || num_rxq > 1) {
     return CommandFailure(EINVAL, "Cannot have more than 1 queue per RX/TX");
@@ -108,6 +151,28 @@ CommandResponse UnixSocketPort::Init(const bess::pb::UnixSocketPortArg &arg) {
     return CommandFailure(errno, "listen() failed");
   }
 
+  if (use_epoll_) {
+    struct epoll_event ev = epoll_event();
+
+    epoll_fd_ = epoll_create1(0);
+    if (epoll_fd_ < 0) {
+      return CommandFailure(errno, "epoll_create1() failed");
+    }
+
+    exit_fd_ = eventfd(0, 0);
+    if (exit_fd_ < 0) {
+      return CommandFailure(errno, "eventfd() failed");
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.fd = exit_fd_;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, exit_fd_, &ev) < 0) {
+      return CommandFailure(errno, "epoll_ctl() failed");
+    }
+
+    epoll_thread_ = std::thread([this]() { WaitForPackets(); });
+  }
+
   std::thread accept_thread(AcceptThreadMain, reinterpret_cast<void *>(this));
   accept_thread.detach();
 
@@ -120,6 +185,27 @@ void UnixSocketPort::DeInit() {
   if (client_fd_ >= 0) {
     close(client_fd_);
   }
+
+  if (epoll_thread_.joinable()) {
+    uint64_t one = 1;
+
+    if (write(exit_fd_, &one, sizeof(one)) == sizeof(one)) {
+      epoll_thread_.join();
+    } else {
+      epoll_thread_.detach();
+    }
+  }
+
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+  }
+
+  if (exit_fd_ >= 0) {
+    close(exit_fd_);
+  }
+
+  bess::Packet::Free(rx_pkts_, rx_pkts_cnt_);
+  rx_pkts_cnt_ = 0;
 }
 
 int UnixSocketPort::RecvPackets(queue_t qid, bess::Packet **pkts, int cnt) {
@@ -129,47 +215,85 @@ int UnixSocketPort::RecvPackets(queue_t qid, bess::Packet **pkts, int cnt) {
     return 0;
   }
 
-  if (recv_skip_cnt_) {
+  if (use_epoll_) {
+    if (!readable_) {
+      return 0;
+    }
+
+    // Clear the flag before receiving, so that packets arriving from now on
+    // set it again.
+    readable_ = 0;
+  } else if (recv_skip_cnt_) {
     recv_skip_cnt_--;
     return 0;
   }
 
-  int received = 0;
-  while (received < cnt) {
-    bess::Packet *pkt = static_cast<bess::Packet *>(bess::Packet::Alloc());
-    int ret;
+  // rx_pkts_ is refilled in bulk, as allocation is all-or-nothing.
+  if (rx_pkts_cnt_ < cnt) {
+    size_t n = bess::PacketBatch::kMaxBurst - rx_pkts_cnt_;
 
-    if (!pkt) {
-      break;
+    if (bess::Packet::Alloc(rx_pkts_ + rx_pkts_cnt_, n, 0) == n) {
+      rx_pkts_cnt_ += n;
     }
+  }
 
-    // Datagrams larger than 2KB will be truncated.
-    ret = recv(client_fd_, pkt->data(), SNBUF_DATA, 0);
-
-    if (ret > 0) {
-      pkt->append(ret);
-      pkts[received++] = pkt;
-      continue;
+  cnt = std::min(cnt, rx_pkts_cnt_);
+  if (cnt == 0) {
+    if (use_epoll_) {
+      readable_ = 1;
     }
+    return 0;
+  }
 
-    bess::Packet::Free(pkt);
+  struct mmsghdr msgs[cnt];
+  struct iovec iovs[cnt];
 
-    if (ret < 0) {
-      if (errno == EAGAIN || errno == EWOULDBLOCK) {
-        break;
-      }
+  // Packets are taken from the end of rx_pkts_
+  bess::Packet **bulk_top = rx_pkts_ + rx_pkts_cnt_ - 1;
 
-      if (errno == EINTR) {
-        continue;
-      }
+  for (int i = 0; i < cnt; i++) {
+    iovs[i].iov_base = bulk_top[-i]->data();
+    iovs[i].iov_len = SNBUF_DATA;  // Datagrams larger than 2KB are truncated.
+
+    msgs[i].msg_hdr = msghdr();
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  int ret;
+  do {
+    ret = recvmmsg(client_fd_, msgs, cnt, MSG_DONTWAIT, nullptr);
+  } while (ret < 0 && errno == EINTR);
+
+  int received = 0;
+  bool closed = (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+
+  for (int i = 0; i < ret; i++) {
+    bess::Packet *pkt = bulk_top[-i];
+    uint32_t len = msgs[i].msg_len;
+
+    // A zero-length message means the connection has been closed.
+    if (len == 0) {
+      closed = true;
+      break;
     }
 
-    // Connection closed.
-    CloseConnection();
-    break;
+    pkt->set_data_len(len);
+    pkt->set_total_len(len);
+    pkts[received++] = pkt;
   }
 
-  if (received == 0) {
+  // The unused packets are kept for later
+  rx_pkts_cnt_ -= received;
+
+  if (closed) {
+    CloseConnection();
+  } else if (use_epoll_) {
+    // There may be more packets to receive
+    if (received == cnt) {
+      readable_ = 1;
+    }
+  } else if (received == 0) {
     recv_skip_cnt_ = RECV_SKIP_TICKS;
   }
 
@@ -177,21 +301,25 @@ int UnixSocketPort::RecvPackets(queue_t qid, bess::Packet **pkts, int cnt) {
 }
 
 int UnixSocketPort::SendPackets(queue_t qid, bess::Packet **pkts, int cnt) {
-  int sent = 0;
-
   DCHECK_EQ(qid, 0);
 
-  for (int i = 0; i < cnt; i++) {
-    bess::Packet *pkt = pkts[i];
+  if (client_fd_ == kNotConnectedFd) {
+    return 0;
+  }
 
-    int nb_segs = pkt->nb_segs();
-    struct iovec iov[nb_segs];
+  struct mmsghdr msgs[cnt];
+  struct iovec iovs[cnt][MAX_TX_FRAGS];
+  int num_msgs;
 
-    struct msghdr msg = msghdr();
-    msg.msg_iov = iov;
-    msg.msg_iovlen = nb_segs;
+  for (num_msgs = 0; num_msgs < cnt; num_msgs++) {
+    bess::Packet *pkt = pkts[num_msgs];
 
-    ssize_t ret;
+    int nb_segs = pkt->nb_segs();
+    struct iovec *iov = iovs[num_msgs];
+
+    if (nb_segs > MAX_TX_FRAGS) {
+      break;
+    }
 
     for (int j = 0; j < nb_segs; j++) {
       iov[j].iov_base = pkt->head_data();
@@ -199,18 +327,26 @@ int UnixSocketPort::SendPackets(queue_t qid, bess::Packet **pkts, int cnt) {
       pkt = pkt->next();
     }
 
-    ret = sendmsg(client_fd_, &msg, 0);
-    if (ret < 0) {
-      break;
-    }
+    msgs[num_msgs].msg_hdr = msghdr();
+    msgs[num_msgs].msg_hdr.msg_iov = iov;
+    msgs[num_msgs].msg_hdr.msg_iovlen = nb_segs;
+  }
 
-    sent++;
+  if (num_msgs == 0) {
+    return 0;
   }
 
-  if (sent) {
-    bess::Packet::Free(pkts, sent);
+  int sent;
+  do {
+    sent = sendmmsg(client_fd_, msgs, num_msgs, MSG_DONTWAIT);
+  } while (sent < 0 && errno == EINTR);
+
+  if (sent <= 0) {
+    return 0;
   }
 
+  bess::Packet::Free(pkts, sent);
+
   return sent;
 }
 
@@ -6,6 +6,8 @@
 #include <poll.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <thread>
@@ -28,13 +30,22 @@ class UnixSocketPort final : public Port {
         listen_fd_(),
         addr_(),
         client_fd_(),
-        old_client_fd_() {}
+        old_client_fd_(),
+        use_epoll_(),
+        epoll_fd_(-1),
+        exit_fd_(-1),
+        readable_(),
+        epoll_thread_(),
+        rx_pkts_(),
+        rx_pkts_cnt_() {}
 
   /*!
    * Initialize the port, ie, open the socket.
    *
    * PARAMETERS:
    * * string path : file name to bind the socket ti.
+   * * bool epoll : wait for incoming packets with a helper thread, instead of
+   *   polling the socket.
    */
   CommandResponse Init(const bess::pb::UnixSocketPortArg &arg);
 
@@ -44,7 +55,7 @@ class UnixSocketPort final : public Port {
   void DeInit() override;
 
   /*!
-   * Receives packets from the device.
+   * Receives packets from the device, with a single recvmmsg() call.
    *
    * PARAMETERS:
    * * queue_t quid : socket has no notion of queues so this is ignored.
@@ -61,7 +72,7 @@ class UnixSocketPort final : public Port {
   int RecvPackets(queue_t qid, bess::Packet **pkts, int cnt) override;
 
   /*!
-   * Sends packets out on the device.
+   * Sends packets out on the device, with a single sendmmsg() call.
    *
    * PARAMETERS:
    * * queue_t quid : PCAP has no notion of queues so this is ignored.
@@ -82,6 +93,12 @@ class UnixSocketPort final : public Port {
    */
   void AcceptNewClient();
 
+  /*!
+   * Main loop of the helper thread in epoll mode. Flags the port as readable
+   * whenever the client socket has new packets.
+   */
+  void WaitForPackets();
+
  private:
   // Value for a disconnected socket.
   static const int kNotConnectedFd = -1;
@@ -94,7 +111,7 @@ class UnixSocketPort final : public Port {
   /*!
   * Calling recv() system call is expensive so we only do it every
   * RECV_SKIP_TICKS times -- this counter keeps track of how many ticks its been
-  * since we last called recv().
+  * since we last called recv(). Not used in epoll mode.
   * */
   uint32_t recv_skip_cnt_;
 
@@ -115,6 +132,24 @@ class UnixSocketPort final : public Port {
   /* If client FD is not connected, what was the fd the last time we were
    * connected to a client? */
   int old_client_fd_;
+
+  /*!
+   * In epoll mode, a helper thread blocks in epoll_wait() on the client socket
+   * and sets 'readable_', so that RecvPackets() calls recvmmsg() only when
+   * there is something to receive. 'exit_fd_' (an eventfd) stops the thread.
+   */
+  bool use_epoll_;
+  int epoll_fd_;
+  int exit_fd_;
+  volatile int readable_;
+  std::thread epoll_thread_;
+
+  /*!
+   * Pre-allocated packets to receive into. Allocated in bulk and kept across
+   * calls, so that empty polls don't allocate and free packets.
+   */
+  bess::Packet *rx_pkts_[bess::PacketBatch::kMaxBurst];
+  int rx_pkts_cnt_;
 };
 
 #endif  // BESS_DRIVERS_UNIXSOCKET_H_
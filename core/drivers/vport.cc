@@ -13,7 +13,12 @@
 #include <rte_malloc.h>
 
 #include "../message.h"
+#include "../utils/checksum.h"
+#include "../utils/ether.h"
 #include "../utils/format.h"
+#include "../utils/ip.h"
+#include "../utils/tcp.h"
+#include "../utils/udp.h"
 
 /* TODO: Unify vport and vport_native */
 
@@ -22,6 +27,10 @@
 #define REFILL_LOW 16
 #define REFILL_HIGH 32
 
+/* With TX offloads, a single packet may take up to SN_TX_MAX_SEGS buffers */
+#define REFILL_LOW_OFFLOAD (SN_TX_MAX_SEGS * 2)
+#define REFILL_HIGH_OFFLOAD (SN_TX_MAX_SEGS * 4)
+
 /* This watermark is to detect congestion and cache bouncing due to
  * head-eating-tail (needs at least 8 slots less then the total ring slots).
  * Not sure how to tune this... */
@@ -40,29 +49,120 @@ static inline int find_next_nonworker_cpu(int cpu) {
   return cpu;
 }
 
-static void refill_tx_bufs(struct llring *r) {
+static void refill_tx_bufs(struct llring *r, bool offload) {
   bess::Packet *pkts[REFILL_HIGH];
   phys_addr_t objs[REFILL_HIGH];
 
+  int low = offload ? REFILL_LOW_OFFLOAD : REFILL_LOW;
+  int high = offload ? REFILL_HIGH_OFFLOAD : REFILL_HIGH;
   int deficit;
   int ret;
 
   int curr_cnt = llring_count(r);
 
-  if (curr_cnt >= REFILL_LOW)
+  if (curr_cnt >= low)
     return;
 
-  deficit = REFILL_HIGH - curr_cnt;
+  for (deficit = high - curr_cnt; deficit > 0; deficit -= ret) {
+    ret = bess::Packet::Alloc((bess::Packet **)pkts,
+                              std::min(deficit, REFILL_HIGH), 0);
+    if (ret == 0)
+      return;
+
+    for (int i = 0; i < ret; i++)
+      objs[i] = pkts[i]->paddr();
 
-  ret = bess::Packet::Alloc((bess::Packet **)pkts, deficit, 0);
-  if (ret == 0)
-    return;
+    int err = llring_mp_enqueue_bulk(r, objs, ret);
+    DCHECK_EQ(err, 0);
+  }
+}
+
+/* Links the rest of a packet spanning multiple buffers (TSO) */
+static void chain_tx_segs(bess::Packet *pkt, phys_addr_t next) {
+  bess::Packet *last = pkt;
+  int nb_segs = 1;
+
+  while (next) {
+    bess::Packet *seg = bess::Packet::from_paddr(next);
+    struct sn_tx_desc *tx_desc = seg->scratchpad<struct sn_tx_desc *>();
+
+    seg->set_data_off(SNBUF_HEADROOM);
+    seg->set_data_len(tx_desc->seg_len);
+
+    last->set_next(seg);
+    last = seg;
+    next = tx_desc->next;
+    nb_segs++;
+  }
+
+  pkt->set_nb_segs(nb_segs);
+}
+
+/* Translates the checksum/TSO requests of the host stack into PKT_TX_* flags.
+ * Ports do them in hardware, or PortOut/QueueOut in software. */
+static void set_tx_offloads(bess::Packet *pkt,
+                            const struct sn_tx_metadata *meta) {
+  using bess::utils::be16_t;
+  using bess::utils::Ethernet;
+  using bess::utils::Ipv4;
+  using bess::utils::Tcp;
+  using bess::utils::Udp;
+
+  uint16_t l2_len = sizeof(Ethernet);
+  be16_t ether_type = pkt->head_data<Ethernet *>()->ether_type;
+  uint64_t flags = 0;
+
+  /* The kernel driver may have inserted VLAN tags (tx_tci/tx_outer_tci) */
+  while ((ether_type == be16_t(Ethernet::Type::kVlan) ||
+          ether_type == be16_t(Ethernet::Type::kQinQ)) &&
+         l2_len + 4 <= meta->csum_start) {
+    ether_type = *pkt->head_data<be16_t *>(l2_len + 2);
+    l2_len += 4;
+  }
+
+  if (ether_type == be16_t(Ethernet::Type::kIpv4)) {
+    flags |= PKT_TX_IPV4;
+  } else if (ether_type == be16_t(Ethernet::Type::kIpv6)) {
+    flags |= PKT_TX_IPV6;
+  }
+
+  switch (meta->csum_dest - meta->csum_start) {
+    case offsetof(Tcp, checksum):
+      flags |= PKT_TX_TCP_CKSUM;
+      break;
+    case offsetof(Udp, checksum):
+      flags |= PKT_TX_UDP_CKSUM;
+      break;
+    default:
+      /* Not with the features we advertise (NETIF_F_IP(V6)_CSUM) */
+      return;
+  }
 
-  for (int i = 0; i < ret; i++)
-    objs[i] = pkts[i]->paddr();
+  pkt->set_l2_len(l2_len);
+  pkt->set_l3_len(meta->csum_start - l2_len);
 
-  ret = llring_mp_enqueue_bulk(r, objs, ret);
-  DCHECK_EQ(ret, 0);
+  if (meta->gso_type != SN_GSO_NONE &&
+      (flags & PKT_TX_L4_MASK) == PKT_TX_TCP_CKSUM) {
+    Tcp *tcp = pkt->head_data<Tcp *>(meta->csum_start);
+    uint16_t *cksum = pkt->head_data<uint16_t *>(meta->csum_dest);
+    uint16_t l4_len = pkt->total_len() - meta->csum_start;
+
+    flags |= PKT_TX_TCP_SEG;
+    pkt->set_l4_len(tcp->offset * 4);
+    pkt->set_tso_segsz(meta->gso_mss);
+
+    /* The pseudo header checksum should not include the length for TSO */
+    *cksum = ~bess::utils::FoldChecksum(
+        *cksum + static_cast<uint16_t>(~be16_t::swap(l4_len)));
+
+    if (flags & PKT_TX_IPV4) {
+      Ipv4 *ip = pkt->head_data<Ipv4 *>(l2_len);
+      ip->checksum = 0;
+      flags |= PKT_TX_IP_CKSUM;
+    }
+  }
+
+  pkt->set_offload_flags(flags);
 }
 
 static void drain_sn_to_drv_q(struct llring *q) {
@@ -109,9 +209,7 @@ static void reclaim_packets(struct llring *ring) {
     ret = llring_mc_dequeue_burst(ring, objs, bess::PacketBatch::kMaxBurst);
     if (ret == 0)
       break;
-    for (int i = 0; i < ret; i++) {
-      pkts[i] = bess::Packet::from_paddr(objs[i]);
-    }
+    bess::Packet::from_paddr_bulk(pkts, objs, ret);
     bess::Packet::Free(pkts, ret);
   }
 }
@@ -222,6 +320,7 @@ void *VPort::AllocBar(struct tx_queue_opts *txq_opts,
   conf->num_rxq = num_queues[PACKET_DIR_OUT];
   conf->link_on = 1;
   conf->promisc_on = 1;
+  conf->tx_offload_on = tx_offload_;
 
   conf->txq_opts = *txq_opts;
   conf->rxq_opts = *rxq_opts;
@@ -241,7 +340,7 @@ void *VPort::AllocBar(struct tx_queue_opts *txq_opts,
     /* BESS -> Driver */
     llring_init(reinterpret_cast<struct llring *>(ptr), SLOTS_PER_LLRING,
                 SINGLE_P, SINGLE_C);
-    refill_tx_bufs(reinterpret_cast<struct llring *>(ptr));
+    refill_tx_bufs(reinterpret_cast<struct llring *>(ptr), tx_offload_);
     inc_qs_[i].sn_to_drv = reinterpret_cast<struct llring *>(ptr);
     ptr += ROUND_TO_64(bytes_per_llring);
   }
@@ -428,6 +527,8 @@ CommandResponse VPort::Init(const bess::pb::VPortArg &arg) {
 
   struct tx_queue_opts txq_opts = tx_queue_opts();
   struct rx_queue_opts rxq_opts = rx_queue_opts();
+  uint32_t coalesce_usecs = 0;
+  uint32_t coalesce_pkts = 0;
 
   fd_ = -1;
   netns_fd_ = -1;
@@ -477,10 +578,21 @@ CommandResponse VPort::Init(const bess::pb::VPortArg &arg) {
   txq_opts.tci = arg.tx_tci();
   txq_opts.outer_tci = arg.tx_outer_tci();
   rxq_opts.loopback = arg.loopback();
+  tx_offload_ = arg.tx_offload();
 
   bar_ = AllocBar(&txq_opts, &rxq_opts);
   phy_addr = rte_malloc_virt2phy(bar_);
 
+  if (!arg.no_coalesce()) {
+    coalesce_usecs = arg.coalesce_usecs() ?: kDefaultCoalesceUsecs;
+    coalesce_pkts = arg.coalesce_pkts() ?: kDefaultCoalescePkts;
+  }
+
+  for (queue_t qid = 0; qid < num_queues[PACKET_DIR_OUT]; qid++) {
+    out_qs_[qid].rx_regs->coalesce_usecs = coalesce_usecs;
+    out_qs_[qid].rx_regs->coalesce_pkts = coalesce_pkts;
+  }
+
   VLOG(1) << "virt: " << bar_ << ", phys: " << phy_addr;
 
   ret = ioctl(fd_, SN_IOC_CREATE_HOSTNIC, &phy_addr);
@@ -546,28 +658,55 @@ int VPort::RecvPackets(queue_t qid, bess::Packet **pkts, int max_cnt) {
   }
   cnt = llring_sc_dequeue_burst(tx_queue->drv_to_sn, paddr, max_cnt);
 
-  refill_tx_bufs(tx_queue->sn_to_drv);
+  refill_tx_bufs(tx_queue->sn_to_drv, tx_offload_);
+
+  bess::Packet::from_paddr_bulk(pkts, paddr, cnt);
 
   for (i = 0; i < cnt; i++) {
-    bess::Packet *pkt;
+    bess::Packet *pkt = pkts[i];
     struct sn_tx_desc *tx_desc;
-    uint16_t len;
-
-    pkt = pkts[i] = bess::Packet::from_paddr(paddr[i]);
 
     tx_desc = pkt->scratchpad<struct sn_tx_desc *>();
-    len = tx_desc->total_len;
 
     pkt->set_data_off(SNBUF_HEADROOM);
-    pkt->set_total_len(len);
-    pkt->set_data_len(len);
+    pkt->set_total_len(tx_desc->total_len);
+    pkt->set_data_len(tx_desc->seg_len);
+
+    if (unlikely(tx_desc->next)) {
+      chain_tx_segs(pkt, tx_desc->next);
+    }
 
-    /* TODO: process sn_tx_metadata */
+    if (tx_desc->meta.csum_start != SN_TX_CSUM_DONT) {
+      set_tx_offloads(pkt, &tx_desc->meta);
+    }
   }
 
   return cnt;
 }
 
+bool VPort::NeedsKick(struct queue *rx_queue) {
+  volatile uint32_t *irq_disabled = &rx_queue->rx_regs->irq_disabled;
+
+  switch (*irq_disabled) {
+    case SN_IRQ_ENABLED:
+      return __sync_bool_compare_and_swap(irq_disabled, SN_IRQ_ENABLED,
+                                          SN_IRQ_DISABLED);
+
+    case SN_IRQ_DEFERRED:
+      // The driver will poll the queue soon anyway. Kick only if enough
+      // packets have piled up in the meantime.
+      if (llring_count(rx_queue->sn_to_drv) <
+          rx_queue->rx_regs->coalesce_pkts) {
+        return false;
+      }
+      return __sync_bool_compare_and_swap(irq_disabled, SN_IRQ_DEFERRED,
+                                          SN_IRQ_DISABLED);
+
+    default:
+      return false;
+  }
+}
+
 int VPort::SendPackets(queue_t qid, bess::Packet **pkts, int cnt) {
   struct queue *rx_queue = &out_qs_[qid];
 
@@ -620,7 +759,7 @@ int VPort::SendPackets(queue_t qid, bess::Packet **pkts, int cnt) {
 
       rx_desc->next = seg_snb->paddr();
       rx_desc = next_desc;
-      seg = reinterpret_cast<bess::Packet *>(snb->next());
+      seg = reinterpret_cast<bess::Packet *>(seg->next());
     }
   }
 
@@ -630,10 +769,12 @@ int VPort::SendPackets(queue_t qid, bess::Packet **pkts, int cnt) {
     return 0;
 
   /* TODO: generic notification architecture */
-  if (__sync_bool_compare_and_swap(&rx_queue->rx_regs->irq_disabled, 0, 1)) {
+  if (NeedsKick(rx_queue)) {
     ret = ioctl(fd_, SN_IOC_KICK_RX, 1 << map_.rxq_to_cpu[qid]);
     if (ret) {
       PLOG(ERROR) << "ioctl(KICK_RX)";
+    } else {
+      queue_stats[PACKET_DIR_OUT][qid].kicks++;
     }
   }
 
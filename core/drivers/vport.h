@@ -6,7 +6,13 @@
 
 class VPort final : public Port {
  public:
-  VPort() : fd_(), bar_(), map_(), netns_fd_(), container_pid_() {}
+  VPort()
+      : fd_(),
+        bar_(),
+        map_(),
+        netns_fd_(),
+        container_pid_(),
+        tx_offload_() {}
   void InitDriver() override;
 
   CommandResponse Init(const bess::pb::VPortArg &arg);
@@ -16,6 +22,9 @@ class VPort final : public Port {
   int SendPackets(queue_t qid, bess::Packet **pkts, int cnt) override;
 
  private:
+  static const uint32_t kDefaultCoalesceUsecs = 20;
+  static const uint32_t kDefaultCoalescePkts = 64;
+
   struct queue {
     union {
       struct sn_rxq_registers *rx_regs;
@@ -25,6 +34,10 @@ class VPort final : public Port {
     struct llring *sn_to_drv;
   };
 
+  // Returns true if the kernel driver should be woken up for the new packets
+  // on an RX queue.
+  bool NeedsKick(struct queue *rx_queue);
+
   void FreeBar();
   void *AllocBar(struct tx_queue_opts *txq_opts,
                  struct rx_queue_opts *rxq_opts);
@@ -43,6 +56,9 @@ class VPort final : public Port {
 
   int netns_fd_;
   int container_pid_;
+
+  // The host stack may send packets with pending checksums and TSO packets
+  bool tx_offload_;
 };
 
 #endif  // BESS_DRIVERS_VPORT_H_
@@ -1,42 +1,204 @@
 #include "vport_zc.h"
 
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <rte_config.h>
 #include <rte_malloc.h>
 
 #define ROUND_TO_64(x) ((x + 32) & (~0x3f))
 
+#define MIN_SLOTS 64
+#define MAX_SLOTS 65536
+
+// The peer is sleeping (or about to), so wake it up. It never fails unless the
+// counter would overflow, which means the peer has a lot to catch up with.
+static inline void ring_doorbell(int fd) {
+  uint64_t one = 1;
+  ssize_t ret;
+
+  ret = write(fd, &one, sizeof(one));
+  (void)ret;
+}
+
+static bool valid_slots(size_t slots) {
+  return slots >= MIN_SLOTS && slots <= MAX_SLOTS && !(slots & (slots - 1));
+}
+
+static void sock_path(const std::string &name, struct sockaddr_un *addr) {
+  *addr = sockaddr_un();
+  addr->sun_family = AF_UNIX;
+  snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/%s/%s.sock", P_tmpdir,
+           VPORT_DIR_PREFIX, name.c_str());
+}
+
+int ZeroCopyVPort::SendDoorbells(int sock) {
+  struct vport_doorbells msg_data = {num_queues[PACKET_DIR_INC],
+                                     num_queues[PACKET_DIR_OUT]};
+  struct iovec iov = {&msg_data, sizeof(msg_data)};
+  struct msghdr msg = msghdr();
+  char cbuf[CMSG_SPACE(sizeof(int) * MAX_QUEUES_PER_DIR * 2)] = {};
+  struct cmsghdr *cmsg;
+  int fds[MAX_QUEUES_PER_DIR * 2];
+  int num_fds = 0;
+  ssize_t ret;
+
+  for (int i = 0; i < msg_data.num_inc_q; i++) {
+    fds[num_fds++] = inc_fd_[i];
+  }
+
+  for (int i = 0; i < msg_data.num_out_q; i++) {
+    fds[num_fds++] = out_fd_[i];
+  }
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * num_fds);
+
+  ret = sendmsg(sock, &msg, MSG_NOSIGNAL);
+  if (ret < 0) {
+    return -errno;
+  }
+
+  return (ret == sizeof(msg_data)) ? 0 : -EPROTO;
+}
+
+void ZeroCopyVPort::ServePeers() {
+  for (;;) {
+    struct pollfd fds[2] = {{listen_fd_, POLLIN, 0}, {exit_fd_, POLLIN, 0}};
+    int sock;
+    int ret;
+
+    ret = poll(fds, 2, -1);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      PLOG(ERROR) << "[ZeroCopyVPort]:poll()";
+      return;
+    }
+
+    if (fds[1].revents) {
+      return;
+    }
+
+    sock = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (sock < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == ECONNABORTED) {
+        continue;
+      }
+      PLOG(ERROR) << "[ZeroCopyVPort]:accept4()";
+      return;
+    }
+
+    ret = SendDoorbells(sock);
+    if (ret < 0) {
+      LOG(WARNING) << "[ZeroCopyVPort]: " << name()
+                   << ": failed to send doorbells: " << strerror(-ret);
+    }
+
+    close(sock);
+  }
+}
+
+int ZeroCopyVPort::StartControl() {
+  struct sockaddr_un addr;
+
+  sock_path(name(), &addr);
+  if (strlen(addr.sun_path) + 1 >= sizeof(addr.sun_path)) {
+    return -ENAMETOOLONG;
+  }
+
+  exit_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (exit_fd_ < 0) {
+    return -errno;
+  }
+
+  listen_fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    return -errno;
+  }
+
+  // Remove the socket of a previous instance, if any.
+  unlink(addr.sun_path);
+
+  if (bind(listen_fd_, reinterpret_cast<struct sockaddr *>(&addr),
+           sizeof(addr)) < 0) {
+    return -errno;
+  }
+
+  if (listen(listen_fd_, 16) < 0) {
+    return -errno;
+  }
+
+  ctrl_thread_ = std::thread([this]() { ServePeers(); });
+
+  return 0;
+}
+
 CommandResponse ZeroCopyVPort::Init(const bess::pb::EmptyArg &) {
   struct vport_bar *bar = nullptr;
 
   int num_inc_q = num_queues[PACKET_DIR_INC];
   int num_out_q = num_queues[PACKET_DIR_OUT];
+  size_t inc_slots = queue_size[PACKET_DIR_INC];
+  size_t out_slots = queue_size[PACKET_DIR_OUT];
 
-  int bytes_per_llring;
+  int bytes_per_inc_llring;
+  int bytes_per_out_llring;
   int total_bytes;
   uint8_t *ptr;
   int i;
+  int ret;
   char port_dir[PORT_NAME_LEN + 256];
   char file_name[PORT_NAME_LEN + 256];
   struct stat sb;
   FILE *fp;
   size_t bar_address;
 
-  bytes_per_llring = llring_bytes_with_slots(SLOTS_PER_LLRING);
+  std::fill(inc_fd_, inc_fd_ + MAX_QUEUES_PER_DIR, -1);
+  std::fill(out_fd_, out_fd_ + MAX_QUEUES_PER_DIR, -1);
+
+  if (num_inc_q > MAX_QUEUES_PER_DIR || num_out_q > MAX_QUEUES_PER_DIR) {
+    return CommandFailure(EINVAL, "Up to %d queues are supported",
+                          MAX_QUEUES_PER_DIR);
+  }
+
+  if (!valid_slots(inc_slots) || !valid_slots(out_slots)) {
+    return CommandFailure(EINVAL,
+                          "Queue sizes must be a power of 2 in [%d, %d]",
+                          MIN_SLOTS, MAX_SLOTS);
+  }
+
+  bytes_per_inc_llring = llring_bytes_with_slots(inc_slots);
+  bytes_per_out_llring = llring_bytes_with_slots(out_slots);
   total_bytes = ROUND_TO_64(sizeof(struct vport_bar)) +
-                ROUND_TO_64(bytes_per_llring) * (num_inc_q + num_out_q) +
+                ROUND_TO_64(bytes_per_inc_llring) * num_inc_q +
+                ROUND_TO_64(bytes_per_out_llring) * num_out_q +
                 ROUND_TO_64(sizeof(struct vport_inc_regs)) * num_inc_q +
                 ROUND_TO_64(sizeof(struct vport_out_regs)) * num_out_q;
 
   bar = static_cast<struct vport_bar *>(rte_zmalloc(nullptr, total_bytes, 64));
+  if (!bar) {
+    return CommandFailure(ENOMEM, "rte_zmalloc(%d) failed", total_bytes);
+  }
   bar_address = (size_t)bar;
-  DCHECK(bar);
   bar_ = bar;
 
   strncpy(bar->name, name().c_str(), PORT_NAME_LEN);
@@ -52,13 +214,13 @@ CommandResponse ZeroCopyVPort::Init(const bess::pb::EmptyArg &) {
         reinterpret_cast<struct vport_inc_regs *>(ptr);
     ptr += ROUND_TO_64(sizeof(struct vport_inc_regs));
 
-    llring_init(reinterpret_cast<struct llring *>(ptr), SLOTS_PER_LLRING,
-                SINGLE_P, SINGLE_C);
+    llring_init(reinterpret_cast<struct llring *>(ptr), inc_slots, SINGLE_P,
+                SINGLE_C);
     llring_set_water_mark(reinterpret_cast<struct llring *>(ptr),
-                          SLOTS_WATERMARK);
+                          SLOTS_WATERMARK(inc_slots));
     bar->inc_qs[i] = reinterpret_cast<struct llring *>(ptr);
     inc_qs_[i] = bar->inc_qs[i];
-    ptr += ROUND_TO_64(bytes_per_llring);
+    ptr += ROUND_TO_64(bytes_per_inc_llring);
   }
 
   /* Set up out llrings */
@@ -67,13 +229,32 @@ CommandResponse ZeroCopyVPort::Init(const bess::pb::EmptyArg &) {
         reinterpret_cast<struct vport_out_regs *>(ptr);
     ptr += ROUND_TO_64(sizeof(struct vport_out_regs));
 
-    llring_init(reinterpret_cast<struct llring *>(ptr), SLOTS_PER_LLRING,
-                SINGLE_P, SINGLE_C);
+    llring_init(reinterpret_cast<struct llring *>(ptr), out_slots, SINGLE_P,
+                SINGLE_C);
     llring_set_water_mark(reinterpret_cast<struct llring *>(ptr),
-                          SLOTS_WATERMARK);
+                          SLOTS_WATERMARK(out_slots));
     bar->out_qs[i] = reinterpret_cast<struct llring *>(ptr);
     out_qs_[i] = bar->out_qs[i];
-    ptr += ROUND_TO_64(bytes_per_llring);
+    ptr += ROUND_TO_64(bytes_per_out_llring);
+  }
+
+  /* Doorbells. Non-blocking, as BESS must never sleep on them. */
+  for (i = 0; i < num_inc_q; i++) {
+    inc_fd_[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inc_fd_[i] < 0) {
+      ret = errno;
+      DeInit();
+      return CommandFailure(ret, "eventfd() failed");
+    }
+  }
+
+  for (i = 0; i < num_out_q; i++) {
+    out_fd_[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (out_fd_[i] < 0) {
+      ret = errno;
+      DeInit();
+      return CommandFailure(ret, "eventfd() failed");
+    }
   }
 
   snprintf(port_dir, PORT_NAME_LEN + 256, "%s/%s", P_tmpdir, VPORT_DIR_PREFIX);
@@ -85,13 +266,10 @@ CommandResponse ZeroCopyVPort::Init(const bess::pb::EmptyArg &) {
     mkdir(port_dir, S_IRWXU | S_IRWXG | S_IRWXO);
   }
 
-  for (i = 0; i < num_out_q; i++) {
-    snprintf(file_name, PORT_NAME_LEN + 256, "%s/%s/%s.rx%d", P_tmpdir,
-             VPORT_DIR_PREFIX, name().c_str(), i);
-
-    mkfifo(file_name, 0666);
-
-    out_irq_fd_[i] = open(file_name, O_RDWR);
+  ret = StartControl();
+  if (ret < 0) {
+    DeInit();
+    return CommandFailure(-ret, "Failed to create the control socket");
   }
 
   snprintf(file_name, PORT_NAME_LEN + 256, "%s/%s/%s", P_tmpdir,
@@ -106,15 +284,41 @@ CommandResponse ZeroCopyVPort::Init(const bess::pb::EmptyArg &) {
 
 void ZeroCopyVPort::DeInit() {
   char file_name[PORT_NAME_LEN + 256];
+  struct sockaddr_un addr;
 
-  int num_out_q = num_queues[PACKET_DIR_OUT];
+  if (ctrl_thread_.joinable()) {
+    uint64_t one = 1;
+
+    if (write(exit_fd_, &one, sizeof(one)) == sizeof(one)) {
+      ctrl_thread_.join();
+    } else {
+      ctrl_thread_.detach();
+    }
+  }
+
+  if (listen_fd_ >= 0) {
+    close(listen_fd_);
+    listen_fd_ = -1;
+
+    sock_path(name(), &addr);
+    unlink(addr.sun_path);
+  }
 
-  for (int i = 0; i < num_out_q; i++) {
-    snprintf(file_name, PORT_NAME_LEN + 256, "%s/%s/%s.rx%d", P_tmpdir,
-             VPORT_DIR_PREFIX, name().c_str(), i);
+  if (exit_fd_ >= 0) {
+    close(exit_fd_);
+    exit_fd_ = -1;
+  }
+
+  for (int i = 0; i < MAX_QUEUES_PER_DIR; i++) {
+    if (inc_fd_[i] >= 0) {
+      close(inc_fd_[i]);
+      inc_fd_[i] = -1;
+    }
 
-    unlink(file_name);
-    close(out_irq_fd_[i]);
+    if (out_fd_[i] >= 0) {
+      close(out_fd_[i]);
+      out_fd_[i] = -1;
+    }
   }
 
   snprintf(file_name, PORT_NAME_LEN + 256, "%s/%s/%s", P_tmpdir,
@@ -122,19 +326,25 @@ void ZeroCopyVPort::DeInit() {
   unlink(file_name);
 
   rte_free(bar_);
+  bar_ = nullptr;
 }
 
 int ZeroCopyVPort::SendPackets(queue_t qid, bess::Packet **pkts, int cnt) {
   struct llring *q = out_qs_[qid];
+  struct vport_out_regs *regs = out_regs_[qid];
   int ret;
 
   ret = llring_enqueue_bulk(q, (void **)pkts, cnt);
   if (ret == -LLRING_ERR_NOBUF)
     return 0;
 
-  if (__sync_bool_compare_and_swap(&out_regs_[qid]->irq_enabled, 1, 0)) {
-    char t[1] = {'F'};
-    ret = write(out_irq_fd_[qid], reinterpret_cast<void *>(t), 1);
+  /* The peer sets irq_enabled and then checks the ring once more before it
+   * sleeps. Make sure that either it sees the packets or we see the flag. */
+  __sync_synchronize();
+
+  if (regs->irq_enabled &&
+      __sync_bool_compare_and_swap(&regs->irq_enabled, 1, 0)) {
+    ring_doorbell(out_fd_[qid]);
   }
 
   return cnt;
@@ -142,9 +352,21 @@ int ZeroCopyVPort::SendPackets(queue_t qid, bess::Packet **pkts, int cnt) {
 
 int ZeroCopyVPort::RecvPackets(queue_t qid, bess::Packet **pkts, int cnt) {
   struct llring *q = inc_qs_[qid];
+  struct vport_inc_regs *regs = inc_regs_[qid];
   int ret;
 
   ret = llring_dequeue_burst(q, (void **)pkts, cnt);
+  if (ret == 0)
+    return 0;
+
+  /* Same as SendPackets(), for a peer waiting for space in the ring */
+  __sync_synchronize();
+
+  if (regs->space_wanted &&
+      __sync_bool_compare_and_swap(&regs->space_wanted, 1, 0)) {
+    ring_doorbell(inc_fd_[qid]);
+  }
+
   return ret;
 }
 
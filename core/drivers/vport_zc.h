@@ -1,17 +1,21 @@
 #ifndef BESS_DRIVERS_ZERO_COPY_VPORT_
 #define BESS_DRIVERS_ZERO_COPY_VPORT_
+#include <thread>
+
 #include <gtest/gtest.h>
 
 #include "../kmod/llring.h"
 #include "../message.h"
 #include "../port.h"
 
+/* Default number of slots of each llring. Can be changed per port with
+ * size_inc_q/size_out_q (power of 2). */
 #define SLOTS_PER_LLRING 1024
 
 /* This watermark is to detect congestion and cache bouncing due to
  * head-eating-tail (needs at least 8 slots less then the total ring slots).
  * Not sure how to tune this... */
-#define SLOTS_WATERMARK ((SLOTS_PER_LLRING >> 3) * 7) /* 87.5% */
+#define SLOTS_WATERMARK(slots) (((slots) >> 3) * 7) /* 87.5% */
 
 /* Disable (0) single producer/consumer mode for now.
  * This is slower, but just to be on the safe side. :) */
@@ -22,14 +26,31 @@
 
 #define VPORT_DIR_PREFIX "sn_vports"
 
+/* Each queue has a doorbell (eventfd), which BESS rings only if the peer has
+ * asked for it with a flag in the queue registers. A peer sets the flag, checks
+ * the ring once more, and then sleeps on the doorbell. BESS clears the flag
+ * when it rings the doorbell, so a busy queue costs no system call. */
 struct vport_inc_regs {
   uint64_t dropped;
+  /* Set by the peer when the ring is full. BESS rings the doorbell of the
+   * queue once it has dequeued some packets. */
+  uint32_t space_wanted;
 } __cacheline_aligned;
 
 struct vport_out_regs {
+  /* Set by the peer when the ring is empty. BESS rings the doorbell of the
+   * queue once it has enqueued some packets. */
   uint32_t irq_enabled;
 } __cacheline_aligned;
 
+/* Sent to each peer that connects to <VPORT_DIR_PREFIX>/<name>.sock, with the
+ * doorbells of the incoming queues and then of the outgoing queues attached
+ * (SCM_RIGHTS). BESS closes the connection right after. */
+struct vport_doorbells {
+  int num_inc_q;
+  int num_out_q;
+};
+
 /* This is equivalent to the old bar */
 struct vport_bar {
   char name[PORT_NAME_LEN];
@@ -57,9 +78,23 @@ class ZeroCopyVPort final : public Port {
   int RecvPackets(queue_t qid, bess::Packet **pkts, int cnt) override;
   int SendPackets(queue_t qid, bess::Packet **pkts, int cnt) override;
 
+  size_t DefaultIncQueueSize() const override { return SLOTS_PER_LLRING; }
+  size_t DefaultOutQueueSize() const override { return SLOTS_PER_LLRING; }
+
  private:
   friend class ZeroCopyVPortTest;
   FRIEND_TEST(ZeroCopyVPortTest, Recv);
+  FRIEND_TEST(ZeroCopyVPortTest, Doorbells);
+
+  // Creates the control socket and starts ctrl_thread_.
+  int StartControl();
+
+  // Hands out the doorbells to peers until the port is destroyed. Runs on
+  // ctrl_thread_, which sleeps in poll() in the meantime.
+  void ServePeers();
+
+  // Sends all doorbells over a connected socket.
+  int SendDoorbells(int sock);
 
   struct vport_bar *bar_ = {};
 
@@ -69,7 +104,13 @@ class ZeroCopyVPort final : public Port {
   struct vport_out_regs *out_regs_[MAX_QUEUES_PER_DIR] = {};
   struct llring *out_qs_[MAX_QUEUES_PER_DIR] = {};
 
-  int out_irq_fd_[MAX_QUEUES_PER_DIR] = {};
+  // Doorbells (eventfd) of each queue. Set to -1 by Init().
+  int inc_fd_[MAX_QUEUES_PER_DIR] = {};
+  int out_fd_[MAX_QUEUES_PER_DIR] = {};
+
+  int listen_fd_ = -1;
+  int exit_fd_ = -1;  // signals ctrl_thread_ to quit
+  std::thread ctrl_thread_;
 };
 
 #endif  // BESS_DRIVERS_ZERO_COPY_VPORT_
@@ -1,6 +1,9 @@
 #include "vport_zc.h"
 
+#include <poll.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include <gtest/gtest.h>
@@ -37,6 +40,9 @@ class ZeroCopyVPortTest : public ::testing::Test {
     ASSERT_NE(nullptr, port_);
     port_->num_queues[PACKET_DIR_INC] = 1;
     port_->num_queues[PACKET_DIR_OUT] = 1;
+    // As bessctl does when the queue sizes are not given
+    port_->queue_size[PACKET_DIR_INC] = port_->DefaultIncQueueSize();
+    port_->queue_size[PACKET_DIR_OUT] = port_->DefaultOutQueueSize();
     ASSERT_EQ(0, port_->Init(arg).error().code());
   }
 
@@ -115,3 +121,66 @@ TEST_F(ZeroCopyVPortTest, Recv) {
   tx_batch.clear();
   bess::Packet::Free(&rx_batch);
 }
+
+TEST_F(ZeroCopyVPortTest, Doorbells) {
+  if (!dpdk_inited_) {
+    return;
+  }
+
+  struct sockaddr_un addr = sockaddr_un();
+  struct vport_doorbells doorbells;
+  struct iovec iov = {&doorbells, sizeof(doorbells)};
+  struct msghdr msg = msghdr();
+  char cbuf[CMSG_SPACE(sizeof(int) * 2)] = {};
+  int fds[2];
+  int sock;
+
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s/p0.sock", P_tmpdir,
+           VPORT_DIR_PREFIX);
+  sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  ASSERT_LE(0, sock);
+  ASSERT_EQ(0, connect(sock, reinterpret_cast<struct sockaddr *>(&addr),
+                       sizeof(addr)));
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  ASSERT_EQ(static_cast<ssize_t>(sizeof(doorbells)), recvmsg(sock, &msg, 0));
+  close(sock);
+
+  EXPECT_EQ(1, doorbells.num_inc_q);
+  EXPECT_EQ(1, doorbells.num_out_q);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  ASSERT_NE(nullptr, cmsg);
+  ASSERT_EQ(CMSG_LEN(sizeof(fds)), cmsg->cmsg_len);
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  struct pollfd pfd = {fds[1], POLLIN, 0};
+  bess::Packet pkt;
+  bess::Packet *pkt_ptr = &pkt;
+  pkt.set_refcnt(2);
+  pkt.set_next(nullptr);
+
+  // Not asked for, so no doorbell
+  ASSERT_EQ(1, port_->SendPackets(0, &pkt_ptr, 1));
+  EXPECT_EQ(0, poll(&pfd, 1, 0));
+
+  port_->out_regs_[0]->irq_enabled = 1;
+  ASSERT_EQ(1, port_->SendPackets(0, &pkt_ptr, 1));
+  EXPECT_EQ(1, poll(&pfd, 1, 0));
+  EXPECT_EQ(0U, port_->out_regs_[0]->irq_enabled);
+
+  // Space in the incoming queue
+  pfd.fd = fds[0];
+  port_->inc_regs_[0]->space_wanted = 1;
+  llring_enqueue_bulk(port_->inc_qs_[0], reinterpret_cast<void **>(&pkt_ptr),
+                      1);
+  ASSERT_EQ(1, port_->RecvPackets(0, &pkt_ptr, 1));
+  EXPECT_EQ(1, poll(&pfd, 1, 0));
+  EXPECT_EQ(0U, port_->inc_regs_[0]->space_wanted);
+
+  close(fds[0]);
+  close(fds[1]);
+}
@@ -3,6 +3,9 @@
 #include <algorithm>
 #include <string>
 
+#include "hooks/gate_stats.h"
+#include "hooks/track.h"
+
 namespace bess {
 
 int Gate::AddHook(GateHook *hook) {
@@ -14,6 +17,7 @@ int Gate::AddHook(GateHook *hook) {
 
   hooks_.push_back(hook);
   std::sort(hooks_.begin(), hooks_.end(), GateHookComp);
+  UpdateHookCache();
   return 0;
 }
 
@@ -32,6 +36,7 @@ void Gate::RemoveHook(const std::string &name) {
     if (hook->name() == name) {
       delete hook;
       hooks_.erase(it);
+      UpdateHookCache();
       return;
     }
   }
@@ -42,6 +47,25 @@ void Gate::ClearHooks() {
     delete hook;
   }
   hooks_.clear();
+  UpdateHookCache();
+}
+
+void Gate::UpdateHookCache() {
+  track_hook_ = nullptr;
+  stats_hook_ = nullptr;
+  has_slow_hooks_ = false;
+
+  for (const auto &hook : hooks_) {
+    if (hook->name() == kGateHookTrackGate) {
+      track_hook_ = static_cast<TrackGate *>(hook);
+      continue;
+    }
+
+    if (hook->name() == kGateHookGateStats) {
+      stats_hook_ = static_cast<GateStats *>(hook);
+    }
+    has_slow_hooks_ = true;
+  }
 }
 
 void IGate::RemoveOgate(const OGate *og) {
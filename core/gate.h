@@ -7,7 +7,9 @@
 #include "pktbatch.h"
 #include "utils/common.h"
 
+class GateStats;
 class Module;
+class TrackGate;
 
 namespace bess {
 
@@ -64,7 +66,13 @@ inline bool GateHookComp(const GateHook *lhs, const GateHook *rhs) {
 class Gate {
  public:
   Gate(Module *m, gate_idx_t idx, void *arg)
-      : module_(m), gate_idx_(idx), arg_(arg), hooks_() {}
+      : module_(m),
+        gate_idx_(idx),
+        arg_(arg),
+        track_hook_(),
+        stats_hook_(),
+        has_slow_hooks_(),
+        hooks_() {}
 
   ~Gate() { ClearHooks(); }
 
@@ -76,6 +84,16 @@ class Gate {
 
   const std::vector<GateHook *> &hooks() const { return hooks_; }
 
+  // The TrackGate hook, if any. As most gates have no other hooks, the data
+  // path calls it directly (see RunChooseModule()), skipping hooks_.
+  TrackGate *track_hook() const { return track_hook_; }
+
+  // The GateStats hook, if any. It also counts as a slow hook.
+  GateStats *stats_hook() const { return stats_hook_; }
+
+  // True if the gate has any hook other than TrackGate
+  bool has_slow_hooks() const { return has_slow_hooks_; }
+
   // Inserts hook in priority order and returns 0 on success.
   int AddHook(GateHook *hook);
 
@@ -90,9 +108,16 @@ class Gate {
   Module *module_;      /* the module this gate belongs to */
   gate_idx_t gate_idx_; /* input/output gate index of itself */
 
+  // Updates the cached hook pointers and has_slow_hooks_ after hooks_ changes
+  void UpdateHookCache();
+
   /* mutable values below */
   void *arg_;
 
+  TrackGate *track_hook_;
+  GateStats *stats_hook_;
+  bool has_slow_hooks_;
+
   // TODO(melvin): Consider using a map here instead. It gets rid of the need to
   // scan to find modules for queries. Not sure how priority would work in a
   // map, though.
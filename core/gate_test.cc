@@ -2,6 +2,7 @@
 
 #include <gtest/gtest.h>
 
+#include "hooks/gate_stats.h"
 #include "hooks/tcpdump.h"
 #include "hooks/track.h"
 #include "module.h"
@@ -66,6 +67,25 @@ TEST_F(GateTest, RemoveHook) {
   ASSERT_EQ(nullptr, g->FindHook(kGateHookTrackGate));
 }
 
+TEST_F(GateTest, HookCache) {
+  ASSERT_EQ(nullptr, g->track_hook());
+  ASSERT_FALSE(g->has_slow_hooks());
+
+  ASSERT_EQ(0, g->AddHook(new TrackGate()));
+  ASSERT_EQ(g->FindHook(kGateHookTrackGate), g->track_hook());
+  ASSERT_FALSE(g->has_slow_hooks());
+
+  ASSERT_EQ(0, g->AddHook(new TcpDump()));
+  ASSERT_TRUE(g->has_slow_hooks());
+
+  g->RemoveHook(kGateHookTrackGate);
+  ASSERT_EQ(nullptr, g->track_hook());
+  ASSERT_TRUE(g->has_slow_hooks());
+
+  g->ClearHooks();
+  ASSERT_FALSE(g->has_slow_hooks());
+}
+
 TEST(HookTest, TrackGate) {
   TrackGate t;
   bess::PacketBatch b;
@@ -75,6 +95,36 @@ TEST(HookTest, TrackGate) {
   ASSERT_EQ(b.cnt(), t.pkts());
 }
 
+TEST(HookTest, GateStats) {
+  GateStats s(4);
+  bess::PacketBatch b;
+
+  for (int i = 0; i < 8; i++) {
+    b.set_cnt(i + 1);
+    s.ProcessBatch(&b);
+    if (s.sampled()) {
+      s.AddCycles(1000);
+    }
+  }
+
+  // The first batch and every 4th one after
+  ASSERT_EQ(2, s.samples());
+  ASSERT_EQ(1, s.batch_sizes()[1]);
+  ASSERT_EQ(1, s.batch_sizes()[5]);
+  ASSERT_EQ(2000, s.total_cycles());
+  ASSERT_EQ(2, s.cycles()[9]);  // 512 <= 1000 < 1024
+}
+
+TEST_F(GateTest, GateStatsHook) {
+  ASSERT_EQ(0, g->AddHook(new GateStats()));
+  ASSERT_EQ(g->FindHook(kGateHookGateStats), g->stats_hook());
+  ASSERT_TRUE(g->has_slow_hooks());
+
+  g->RemoveHook(kGateHookGateStats);
+  ASSERT_EQ(nullptr, g->stats_hook());
+  ASSERT_FALSE(g->has_slow_hooks());
+}
+
 TEST_F(IOGateTest, OGate) {
   og->set_igate(ig);
   og->set_igate_idx(0);
@@ -0,0 +1,72 @@
+#ifndef BESS_HOOKS_GATE_STATS_
+#define BESS_HOOKS_GATE_STATS_
+
+#include <algorithm>
+
+#include "../gate.h"
+
+const std::string kGateHookGateStats = "gate_stats";
+const uint16_t kGateHookPriorityGateStats = 2;
+
+// GateStats samples the batches going out of an output gate, and records their
+// sizes and the cycles spent downstream of the gate (see RunChooseModule()).
+// Together they show where in a pipeline batches get fragmented and where the
+// cycles go. Like TrackGate, it does not synchronize between workers.
+class GateStats final : public bess::GateHook {
+ public:
+  static const uint32_t kDefaultSampleEvery = 16;
+
+  // Bucket i counts batches that took [2^i, 2^(i+1)) cycles
+  static const int kCycleBuckets = 40;
+
+  explicit GateStats(uint32_t sample_every = kDefaultSampleEvery)
+      : bess::GateHook(kGateHookGateStats, kGateHookPriorityGateStats),
+        sample_every_(std::max<uint32_t>(sample_every, 1)),
+        countdown_(1),
+        samples_(),
+        total_cycles_(),
+        batch_sizes_(),
+        cycles_() {}
+
+  uint32_t sample_every() const { return sample_every_; }
+
+  uint64_t samples() const { return samples_; }
+  uint64_t total_cycles() const { return total_cycles_; }
+
+  // Indexed by batch size
+  const uint64_t *batch_sizes() const { return batch_sizes_; }
+
+  const uint64_t *cycles() const { return cycles_; }
+
+  void ProcessBatch(const bess::PacketBatch *batch) override {
+    if (--countdown_ > 0) {
+      return;
+    }
+
+    countdown_ = sample_every_;
+    samples_++;
+    batch_sizes_[batch->cnt()]++;
+  }
+
+  // True if the last batch seen by ProcessBatch() has been sampled
+  bool sampled() const { return countdown_ == sample_every_; }
+
+  // Called with the cycles spent downstream, for sampled batches
+  void AddCycles(uint64_t cycles) {
+    int bucket = 63 - __builtin_clzll(cycles | 1);
+
+    total_cycles_ += cycles;
+    cycles_[std::min(bucket, kCycleBuckets - 1)]++;
+  }
+
+ private:
+  const uint32_t sample_every_;
+  uint32_t countdown_;
+
+  uint64_t samples_;
+  uint64_t total_cycles_;
+  uint64_t batch_sizes_[bess::PacketBatch::kMaxBurst + 1];
+  uint64_t cycles_[kCycleBuckets];
+};
+
+#endif  // BESS_HOOKS_GATE_STATS_
@@ -1,40 +1,288 @@
 #include "tcpdump.h"
 
-#include <sys/uio.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
 
 #include <glog/logging.h>
 
+#include "../mem_alloc.h"
 #include "../utils/common.h"
+#include "../utils/copy.h"
 #include "../utils/pcap.h"
 #include "../utils/time.h"
 
-void TcpDump::ProcessBatch(const bess::PacketBatch *batch) {
+// How long the drain thread sleeps when there is nothing to write
+static const useconds_t kDrainIdleUs = 1000;
+
+TcpDump::~TcpDump() {
+  stop_ = true;
+  if (drain_thread_.joinable()) {
+    drain_thread_.join();
+  }
+
+  if (fifo_fd_ >= 0) {
+    LOG(INFO) << "tcpdump: " << captured() << " packets captured, "
+              << dropped() << " dropped";
+    close(fifo_fd_);
+  }
+
+  for (int wid = 0; wid < Worker::kMaxWorkers; wid++) {
+    if (rings_[wid]) {
+      mem_free(rings_[wid]);
+    }
+  }
+}
+
+int TcpDump::Init(const char *fifo, uint32_t snaplen, uint32_t sample_every,
+                  uint64_t max_pps) {
+  struct pcap_hdr file_hdr = {
+      .magic_number = PCAP_MAGIC_NUMBER,
+      .version_major = PCAP_VERSION_MAJOR,
+      .version_minor = PCAP_VERSION_MINOR,
+      .thiszone = PCAP_THISZONE,
+      .sigfigs = PCAP_SIGFIGS,
+      .snaplen = snaplen,
+      .network = PCAP_NETWORK,
+  };
   struct timeval tv;
 
-  int ret = 0;
+  int fd;
+  int ret;
+
+  if (snaplen == 0 || snaplen > kMaxSnaplen || sample_every == 0) {
+    return -EINVAL;
+  }
+
+  fd = open(fifo, O_WRONLY | O_NONBLOCK);
+  if (fd < 0)
+    return -errno;
+
+  /* Looooong time ago Linux ignored O_NONBLOCK in open().
+   * Try again just in case. */
+  ret = fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  if (ret < 0) {
+    close(fd);
+    return -errno;
+  }
+
+  ret = write(fd, &file_hdr, sizeof(file_hdr));
+  if (ret < 0) {
+    close(fd);
+    return -errno;
+  }
+
+  fifo_fd_ = fd;
+  snaplen_ = snaplen;
+  slot_size_ = align_ceil(sizeof(Slot) + snaplen, 64);
+  sample_every_ = sample_every;
+  tsc_per_pkt_ = max_pps ? std::max<uint64_t>(tsc_hz / max_pps, 1) : 0;
 
   gettimeofday(&tv, nullptr);
+  base_tsc_ = rdtsc();
+  base_ns_ = tv.tv_sec * 1000000000ull + tv.tv_usec * 1000ull;
+
+  active_ = true;
+  drain_thread_ = std::thread(&TcpDump::Drain, this);
+
+  return 0;
+}
+
+uint64_t TcpDump::dropped() const {
+  uint64_t ret = 0;
+
+  for (int wid = 0; wid < Worker::kMaxWorkers; wid++) {
+    if (rings_[wid]) {
+      ret += rings_[wid]->dropped;
+    }
+  }
+
+  return ret;
+}
+
+uint64_t TcpDump::captured() const {
+  uint64_t ret = 0;
+
+  for (int wid = 0; wid < Worker::kMaxWorkers; wid++) {
+    if (rings_[wid]) {
+      ret += rings_[wid]->captured;
+    }
+  }
+
+  return ret;
+}
+
+TcpDump::Ring *TcpDump::NewRing() {
+  Ring *ring = reinterpret_cast<Ring *>(mem_alloc_ex(
+      sizeof(Ring) + kRingSlots * slot_size_, alignof(Ring), ctx.socket()));
+
+  if (ring) {
+    ring->countdown = 1;
+  }
+
+  return ring;
+}
+
+bool TcpDump::Sample(Ring *ring, uint64_t now) {
+  if (--ring->countdown > 0) {
+    return false;
+  }
+  ring->countdown = sample_every_;
+
+  if (tsc_per_pkt_) {
+    if (ring->next_tsc >= now + tsc_per_pkt_ * kRateBurst) {
+      return false;
+    }
+    ring->next_tsc = std::max(ring->next_tsc, now) + tsc_per_pkt_;
+  }
+
+  return true;
+}
+
+void TcpDump::ProcessBatch(const bess::PacketBatch *batch) {
+  if (unlikely(!active_)) {
+    return;
+  }
+
+  int wid = ctx.wid();
+  Ring *ring = rings_[wid];
+
+  if (unlikely(!ring)) {
+    ring = NewRing();
+    if (!ring) {
+      return;
+    }
+
+    // Make the ring visible to the drain thread only after it is set up
+    __sync_synchronize();
+    rings_[wid] = ring;
+  }
+
+  uint64_t now = rdtsc();
+  uint32_t head = ring->head;
+  uint32_t tail = ring->tail;
 
   for (int i = 0; i < batch->cnt(); i++) {
-    bess::Packet *pkt = batch->pkts()[i];
-    struct pcap_rec_hdr rec = {
-        .ts_sec = (uint32_t)tv.tv_sec,
-        .ts_usec = (uint32_t)tv.tv_usec,
-        .incl_len = (uint32_t)pkt->head_len(),
-        .orig_len = (uint32_t)pkt->total_len(),
-    };
-
-    struct iovec vec[2] = {{&rec, sizeof(rec)},
-                           {pkt->head_data(), (size_t)pkt->total_len()}};
-
-    ret = writev(fifo_fd_, vec, 2);
-    if (ret < 0) {
+    const bess::Packet *pkt = batch->pkts()[i];
+
+    if (!Sample(ring, now)) {
+      continue;
+    }
+
+    if (head - tail >= kRingSlots) {
+      ring->dropped++;
+      continue;
+    }
+
+    Slot *s = slot(ring, head);
+    uint32_t len = std::min<uint32_t>(pkt->head_len(), snaplen_);
+
+    s->tsc = now;
+    s->rec.incl_len = len;
+    s->rec.orig_len = pkt->total_len();
+    bess::utils::Copy(s->data, pkt->head_data(), len);
+    head++;
+  }
+
+  if (head != ring->head) {
+    // The drain thread must see the slots before the new head
+    __sync_synchronize();
+    ring->head = head;
+  }
+}
+
+void TcpDump::Drain() {
+  while (!stop_) {
+    int n = 0;
+
+    for (int wid = 0; wid < Worker::kMaxWorkers; wid++) {
+      Ring *ring = rings_[wid];
+      if (!ring) {
+        continue;
+      }
+
+      int ret = DrainRing(ring);
+      if (ret < 0) {
+        // Workers stop capturing. The hook stays until disabled.
+        active_ = false;
+        return;
+      }
+      n += ret;
+    }
+
+    if (n == 0) {
+      usleep(kDrainIdleUs);
+    }
+  }
+}
+
+int TcpDump::DrainRing(Ring *ring) {
+  uint32_t head = ring->head;
+  uint32_t tail = ring->tail;
+  int n = 0;
+
+  // Read the slots only after the head
+  __sync_synchronize();
+
+  for (; tail != head; tail++) {
+    Slot *s = slot(ring, tail);
+    uint64_t ns = base_ns_;
+
+    if (s->tsc > base_tsc_) {
+      ns += tsc_to_ns(s->tsc - base_tsc_);
+    }
+
+    s->rec.ts_sec = ns / 1000000000;
+    s->rec.ts_usec = ns % 1000000000 / 1000;
+
+    if (!WriteFully(&s->rec, sizeof(s->rec) + s->rec.incl_len)) {
+      return -1;
+    }
+    n++;
+  }
+
+  ring->captured += n;
+
+  // The worker may reuse the slots only after we are done with them
+  __sync_synchronize();
+  ring->tail = tail;
+
+  return n;
+}
+
+bool TcpDump::WriteFully(const void *buf, size_t len) {
+  const char *p = static_cast<const char *>(buf);
+
+  while (len > 0) {
+    ssize_t ret = write(fifo_fd_, p, len);
+
+    if (ret > 0) {
+      p += ret;
+      len -= ret;
+      continue;
+    }
+
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (ret < 0 && errno != EAGAIN) {
       if (errno == EPIPE) {
         DLOG(WARNING) << "Broken pipe: stopping tcpdump";
-        close(fifo_fd_);
-        fifo_fd_ = 0;
+      } else {
+        PLOG(WARNING) << "write() to tcpdump FIFO";
       }
-      return;
+      return false;
+    }
+
+    if (stop_) {
+      return false;
     }
+
+    // The reader is behind. Wait, but not so long as to delay stopping.
+    struct pollfd pfd = {.fd = fifo_fd_, .events = POLLOUT, .revents = 0};
+    poll(&pfd, 1, 100);
   }
+
+  return true;
 }
@@ -1,26 +1,124 @@
 #ifndef BESS_HOOKS_TCPDUMP_
 #define BESS_HOOKS_TCPDUMP_
 
+#include <thread>
+
 #include "../module.h"
+#include "../utils/pcap.h"
+#include "../worker.h"
 
 const std::string kGateHookTcpDumpGate = "tcpdump";
 
 const uint16_t kGateHookPriorityTcpDump = 1;
 
 // TcpDump dumps copies of the packets seen by a gate. Useful for debugging.
+//
+// Workers only copy (sampled, truncated) packets into a ring of their own,
+// and a separate thread writes them out to the FIFO. A slow reader thus costs
+// dropped captures, never blocking or slowing down the workers.
 class TcpDump final : public bess::GateHook {
  public:
+  static const uint32_t kDefaultSnaplen = SNBUF_DATA;
+  static const uint32_t kMaxSnaplen = SNBUF_HEADROOM + SNBUF_DATA;
+
+  // Per worker. Must be a power of 2.
+  static const uint32_t kRingSlots = 1024;
+
+  // Packets that may be captured back-to-back when rate limited
+  static const uint32_t kRateBurst = 32;
+
   TcpDump()
       : bess::GateHook(kGateHookTcpDumpGate, kGateHookPriorityTcpDump),
-        fifo_fd_(){};
+        fifo_fd_(-1),
+        active_(),
+        stop_(),
+        snaplen_(),
+        slot_size_(),
+        sample_every_(),
+        tsc_per_pkt_(),
+        base_tsc_(),
+        base_ns_(),
+        rings_(),
+        drain_thread_() {}
+
+  ~TcpDump();
+
+  // Opens the FIFO, writes the pcap header, and starts the drain thread.
+  // Captures up to 'snaplen' bytes of every 'sample_every'-th packet, and no
+  // more than 'max_pps' packets per second per worker (0 for no limit).
+  // Returns 0 on success, -errno on failure.
+  int Init(const char *fifo, uint32_t snaplen, uint32_t sample_every,
+           uint64_t max_pps);
 
   int fifo_fd() const { return fifo_fd_; }
-  void set_fifo_fd(int fifo_fd) { fifo_fd_ = fifo_fd; }
+
+  // Captures lost because the drain thread could not keep up
+  uint64_t dropped() const;
+
+  // Captures written out to the FIFO
+  uint64_t captured() const;
 
   void ProcessBatch(const bess::PacketBatch *batch);
 
  private:
+  // 'rec' is filled in by the drain thread, and written out with 'data'
+  struct Slot {
+    uint64_t tsc;
+    struct pcap_rec_hdr rec;
+    char data[];
+  };
+
+  // Single producer (the worker), single consumer (the drain thread)
+  struct Ring {
+    // Written by the worker
+    volatile uint32_t head __attribute__((aligned(64)));
+    uint32_t countdown;  // packets to skip before the next sample
+    uint64_t next_tsc;   // for rate limiting
+    uint64_t dropped;
+
+    // Written by the drain thread
+    volatile uint32_t tail __attribute__((aligned(64)));
+    uint64_t captured;
+
+    char slots[] __attribute__((aligned(64)));
+  };
+
+  Ring *NewRing();
+
+  Slot *slot(Ring *ring, uint32_t idx) const {
+    return reinterpret_cast<Slot *>(ring->slots +
+                                    (idx & (kRingSlots - 1)) * slot_size_);
+  }
+
+  // Returns false if the packet should not be captured by this worker
+  bool Sample(Ring *ring, uint64_t now);
+
+  void Drain();
+
+  // Returns the number of records written, or -1 if the FIFO is broken
+  int DrainRing(Ring *ring);
+
+  // Returns false if the FIFO is broken or the thread has been stopped
+  bool WriteFully(const void *buf, size_t len);
+
   int fifo_fd_;
+
+  volatile bool active_;
+  volatile bool stop_;
+
+  uint32_t snaplen_;
+  size_t slot_size_;
+  uint32_t sample_every_;
+  uint64_t tsc_per_pkt_;  // 0 if not rate limited
+
+  // For conversion of TSC timestamps to wall-clock time
+  uint64_t base_tsc_;
+  uint64_t base_ns_;
+
+  // Allocated by each worker when it first sees a packet, on its socket
+  Ring *volatile rings_[Worker::kMaxWorkers];
+
+  std::thread drain_thread_;
 };
 
 #endif  // BESS_HOOKS_TCPDUMP_
@@ -0,0 +1,130 @@
+#include "tcpdump.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "../packet.h"
+#include "../pktbatch.h"
+#include "../utils/pcap.h"
+
+namespace {
+
+class TcpDumpTest : public ::testing::Test {
+ protected:
+  static const int kPktLen = 100;
+
+  virtual void SetUp() {
+    char dir_template[] = "/tmp/tcpdump_test.XXXXXX";
+
+    ASSERT_NE(nullptr, mkdtemp(dir_template));
+    dir_ = dir_template;
+    fifo_ = dir_ + "/fifo";
+    ASSERT_EQ(0, mkfifo(fifo_.c_str(), 0600));
+
+    // The writer cannot open a FIFO with O_NONBLOCK without a reader
+    read_fd_ = open(fifo_.c_str(), O_RDONLY | O_NONBLOCK);
+    ASSERT_LE(0, read_fd_);
+
+    pkt_.set_buffer(pkt_.data());
+    pkt_.set_data_len(kPktLen);
+    pkt_.set_total_len(kPktLen);
+
+    batch_.clear();
+    for (size_t i = 0; i < bess::PacketBatch::kMaxBurst; i++) {
+      batch_.add(&pkt_);
+    }
+  }
+
+  virtual void TearDown() {
+    close(read_fd_);
+    unlink(fifo_.c_str());
+    rmdir(dir_.c_str());
+  }
+
+  // Reads exactly 'len' bytes, waiting up to a second
+  bool ReadFully(void *buf, size_t len) {
+    char *p = static_cast<char *>(buf);
+
+    while (len > 0) {
+      struct pollfd pfd = {.fd = read_fd_, .events = POLLIN, .revents = 0};
+      if (poll(&pfd, 1, 1000) <= 0) {
+        return false;
+      }
+
+      ssize_t ret = read(read_fd_, p, len);
+      if (ret <= 0) {
+        return false;
+      }
+      p += ret;
+      len -= ret;
+    }
+
+    return true;
+  }
+
+  std::string dir_;
+  std::string fifo_;
+  int read_fd_;
+
+  bess::Packet pkt_;
+  bess::PacketBatch batch_;
+};
+
+TEST_F(TcpDumpTest, InvalidArgs) {
+  TcpDump tcpdump;
+
+  EXPECT_EQ(-EINVAL, tcpdump.Init(fifo_.c_str(), 0, 1, 0));
+  EXPECT_EQ(-EINVAL,
+            tcpdump.Init(fifo_.c_str(), TcpDump::kMaxSnaplen + 1, 1, 0));
+  EXPECT_EQ(-EINVAL, tcpdump.Init(fifo_.c_str(), 64, 0, 0));
+  EXPECT_EQ(-ENOENT, tcpdump.Init((dir_ + "/nonexistent").c_str(), 64, 1, 0));
+}
+
+TEST_F(TcpDumpTest, Sampling) {
+  const uint32_t snaplen = 60;
+  struct pcap_hdr hdr;
+  char buf[kPktLen];
+
+  TcpDump tcpdump;
+  ASSERT_EQ(0, tcpdump.Init(fifo_.c_str(), snaplen, 4, 0));
+
+  ASSERT_TRUE(ReadFully(&hdr, sizeof(hdr)));
+  EXPECT_EQ(PCAP_MAGIC_NUMBER, hdr.magic_number);
+  EXPECT_EQ(snaplen, hdr.snaplen);
+
+  tcpdump.ProcessBatch(&batch_);
+
+  // 1 in 4 packets, truncated
+  for (size_t i = 0; i < bess::PacketBatch::kMaxBurst / 4; i++) {
+    struct pcap_rec_hdr rec;
+
+    ASSERT_TRUE(ReadFully(&rec, sizeof(rec)));
+    EXPECT_EQ(snaplen, rec.incl_len);
+    EXPECT_EQ(static_cast<uint32_t>(kPktLen), rec.orig_len);
+    ASSERT_TRUE(ReadFully(buf, rec.incl_len));
+    EXPECT_EQ(0, memcmp(buf, pkt_.head_data(), snaplen));
+  }
+
+  // Nothing more
+  EXPECT_FALSE(ReadFully(buf, 1));
+  EXPECT_EQ(0U, tcpdump.dropped());
+}
+
+// Without a reader keeping up, captures should be dropped, not block
+TEST_F(TcpDumpTest, DropWhenFull) {
+  TcpDump tcpdump;
+  ASSERT_EQ(0, tcpdump.Init(fifo_.c_str(), 64, 1, 0));
+
+  // Way more than the ring and the pipe can hold together
+  for (int i = 0; i < 1000; i++) {
+    tcpdump.ProcessBatch(&batch_);
+  }
+
+  EXPECT_LT(0U, tcpdump.dropped());
+}
+
+}  // namespace (unnamed)
@@ -95,14 +95,31 @@ struct sn_conf_space {
 	uint8_t link_on;
 	uint8_t promisc_on;
 
+	/* Let the host stack hand over TX packets with pending checksums
+	 * (CHECKSUM_PARTIAL) and TSO super-packets, to be resolved by BESS */
+	uint8_t tx_offload_on;
+
 	struct tx_queue_opts txq_opts;
 	struct rx_queue_opts rxq_opts;
 } __attribute__((__aligned__(64)));
 
+/* Values of sn_rxq_registers.irq_disabled */
+#define SN_IRQ_ENABLED 0	/* BESS should kick the driver */
+#define SN_IRQ_DISABLED 1	/* The driver is polling the queue */
+#define SN_IRQ_DEFERRED 2	/* The driver will poll in coalesce_usecs */
+
 struct sn_rxq_registers {
 	/* Set by the kernel driver, to suppress bogus interrupts */
 	volatile uint32_t irq_disabled;
 
+	/* Interrupt coalescing, set by BESS. While the queue is busy, the
+	 * driver polls it again coalesce_usecs after each NAPI round
+	 * (SN_IRQ_DEFERRED), instead of waiting for a kick. BESS still kicks
+	 * in the meantime, if coalesce_pkts packets are pending.
+	 * 0 for coalesce_usecs disables this. */
+	volatile uint32_t coalesce_usecs;
+	volatile uint32_t coalesce_pkts;
+
 	/* Separate this from the shared cache line */
 	uint64_t dropped __attribute__((__aligned__(64)));
 } __attribute__((__aligned__(64)));
@@ -112,17 +129,39 @@ struct sn_rxq_registers {
 
 #define SN_TX_FRAG_MAX_NUM 18 /*(MAX_SKB_FRAGS + 1)*/
 
+/* Maximum number of buffers a TX packet can span */
+#define SN_TX_MAX_SEGS 32
+
+/* Values of sn_tx_metadata.gso_type */
+#define SN_GSO_NONE 0
+#define SN_GSO_TCPV4 1
+#define SN_GSO_TCPV6 2
+
 /* Driver -> BESS metadata for TX packets */
 struct sn_tx_metadata {
 	/* Both are relative offsets from the beginning of the packet.
 	 * The sender should set csum_start to CSUM_DONT
-	 * if no checksumming is wanted (csum_dest is undefined).*/
+	 * if no checksumming is wanted (csum_dest is undefined).
+	 * As with CHECKSUM_PARTIAL, the L4 checksum field holds the checksum
+	 * of the pseudo header, including the L4 length. */
 	uint16_t csum_start;
 	uint16_t csum_dest;
+
+	/* For TSO packets (gso_type != SN_GSO_NONE), the TCP payload size of
+	 * each segment. csum_start/csum_dest are always set for them. */
+	uint16_t gso_mss;
+	uint8_t gso_type;
 };
 
 struct sn_tx_desc {
-	uint16_t total_len;
+	uint32_t total_len;
+
+	/* Only the following two fields are valid for non-head segments */
+	uint16_t seg_len;
+
+	/* The physical address of next snbuf
+	 * (forms a NULL-terminating linked list) */
+	phys_addr_t next;
 
 	struct sn_tx_metadata meta;
 };
@@ -181,6 +220,8 @@ struct sn_rx_desc {
  * Then the driver will copy (metedata + packet data) _into_ those buffers
  * as packets are transmitted, and writeback the cookie via the drv_to_sn.
  *   1. Cookie
+ * Packets larger than SNBUF_DATA (up to SN_TX_MAX_SEGS buffers) are chained
+ * with sn_tx_desc.next, and only the first buffer is written back.
  *
  *
  * RX:
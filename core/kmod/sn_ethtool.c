@@ -56,7 +56,7 @@ static void sn_ethtool_get_strings(struct net_device *netdev,
 	int i;
 
 	BUILD_BUG_ON(NUM_STATS_PER_TX_QUEUE != 5);
-	BUILD_BUG_ON(NUM_STATS_PER_RX_QUEUE != 6);
+	BUILD_BUG_ON(NUM_STATS_PER_RX_QUEUE != 7);
 
 	if (sset != ETH_SS_STATS)
 		return;
@@ -90,6 +90,8 @@ static void sn_ethtool_get_strings(struct net_device *netdev,
 		p += ETH_GSTRING_LEN;
 		sprintf(p, "rx_queue_%u_llpolls", i);
 		p += ETH_GSTRING_LEN;
+		sprintf(p, "rx_queue_%u_timerpolls", i);
+		p += ETH_GSTRING_LEN;
 	}
 }
 
@@ -101,7 +103,7 @@ static void sn_ethtool_get_ethtool_stats(struct net_device *netdev,
 	int i;
 
 	BUILD_BUG_ON(NUM_STATS_PER_TX_QUEUE != 5);
-	BUILD_BUG_ON(NUM_STATS_PER_RX_QUEUE != 6);
+	BUILD_BUG_ON(NUM_STATS_PER_RX_QUEUE != 7);
 
 	for (i = 0; i < dev->num_txq; i++) {
 		data[0] = dev->tx_queues[i]->tx.stats.packets;
@@ -122,6 +124,7 @@ static void sn_ethtool_get_ethtool_stats(struct net_device *netdev,
 		data[3] = dev->rx_queues[i]->rx.stats.polls;
 		data[4] = dev->rx_queues[i]->rx.stats.interrupts;
 		data[5] = dev->rx_queues[i]->rx.stats.ll_polls;
+		data[6] = dev->rx_queues[i]->rx.stats.timer_polls;
 		data += NUM_STATS_PER_RX_QUEUE;
 	}
 }
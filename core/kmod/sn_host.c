@@ -145,6 +145,35 @@ static void free_snb_bulk(struct sn_queue *queue, phys_addr_t paddr[], int cnt)
 	}
 }
 
+/* Copies the packet into a chain of snbufs. 'paddr' must have enough buffers
+ * for skb->len bytes. */
+static void sn_host_copy_skb(struct sk_buff *skb,
+		struct sn_tx_metadata *meta,
+		phys_addr_t paddr[], int nr_bufs)
+{
+	struct sn_tx_desc *tx_desc;
+	int offset = 0;
+	int i;
+
+	tx_desc = phys_to_virt(paddr[0] + SNBUF_SCRATCHPAD_OFF);
+	tx_desc->total_len = skb->len;
+	tx_desc->meta = *meta;
+
+	for (i = 0; i < nr_bufs; i++) {
+		int seg_len = min_t(int, skb->len - offset, SNBUF_DATA);
+
+		tx_desc = phys_to_virt(paddr[i] + SNBUF_SCRATCHPAD_OFF);
+		tx_desc->seg_len = seg_len;
+		tx_desc->next = (i + 1 < nr_bufs) ? paddr[i + 1] : 0;
+
+		/* also takes care of paged frags */
+		skb_copy_bits(skb, offset,
+				phys_to_virt(paddr[i] + SNBUF_DATA_OFF),
+				seg_len);
+		offset += seg_len;
+	}
+}
+
 static int sn_host_do_tx_batch(struct sn_queue *queue,
 		struct sk_buff *skb_arr[],
 		struct sn_tx_metadata meta_arr[],
@@ -161,37 +190,58 @@ static int sn_host_do_tx_batch(struct sn_queue *queue,
 			(int)llring_free_count(queue->drv_to_sn));
 	cnt_to_send = min(cnt_to_send, MAX_BATCH);
 
-	cnt = alloc_snb_burst(queue, paddr_arr, cnt_to_send);
-	queue->tx.stats.descriptor += cnt_requested - cnt;
-
-	if (cnt == 0)
-		return 0;
-
-	for (i = 0; i < cnt; i++) {
-		struct sk_buff *skb = skb_arr[i];
-		phys_addr_t paddr = paddr_arr[i];
-		struct sn_tx_desc *tx_desc;
-		char *dst_addr;
+	cnt = 0;
+	while (cnt < cnt_to_send) {
+		struct sk_buff *skb = skb_arr[cnt];
+		phys_addr_t bufs[SN_TX_MAX_SEGS];
+		int nr_bufs;
+		int got;
+
+		/* The common case. Allocate for the whole run of packets that
+		 * fit in a single buffer at once. */
+		if (skb->len <= SNBUF_DATA) {
+			int run = 1;
+
+			while (cnt + run < cnt_to_send &&
+					skb_arr[cnt + run]->len <= SNBUF_DATA)
+				run++;
+
+			got = alloc_snb_burst(queue, &paddr_arr[cnt], run);
+			for (i = 0; i < got; i++) {
+				sn_host_copy_skb(skb_arr[cnt + i],
+						&meta_arr[cnt + i],
+						&paddr_arr[cnt + i], 1);
+			}
 
-		int j;
+			cnt += got;
+			if (got < run)
+				break;
+			continue;
+		}
 
-		dst_addr = phys_to_virt(paddr + SNBUF_DATA_OFF);
-		tx_desc = phys_to_virt(paddr + SNBUF_SCRATCHPAD_OFF);
+		/* Only with TSO */
+		nr_bufs = DIV_ROUND_UP(skb->len, SNBUF_DATA);
+		if (unlikely(nr_bufs > SN_TX_MAX_SEGS)) {
+			/* Should not happen, as we cap gso_max_size */
+			break;
+		}
 
-		tx_desc->total_len = skb->len;
-		tx_desc->meta = meta_arr[i];
+		got = alloc_snb_burst(queue, bufs, nr_bufs);
+		if (unlikely(got < nr_bufs)) {
+			/* alloc_snb_burst() drained the cache before taking
+			 * from the ring, so the cache has room for them */
+			store_to_cache(bufs, got);
+			break;
+		}
 
-		memcpy(dst_addr, skb->data, skb_headlen(skb));
-		dst_addr += skb_headlen(skb);
+		sn_host_copy_skb(skb, &meta_arr[cnt], bufs, nr_bufs);
+		paddr_arr[cnt++] = bufs[0];
+	}
 
-		for (j = 0; j < skb_shinfo(skb)->nr_frags; j++) {
-			skb_frag_t *frag = &skb_shinfo(skb)->frags[j];
+	queue->tx.stats.descriptor += cnt_requested - cnt;
 
-			memcpy(dst_addr, skb_frag_address(frag),
-					skb_frag_size(frag));
-			dst_addr += skb_frag_size(frag);
-		}
-	}
+	if (cnt == 0)
+		return 0;
 
 	ret = llring_sp_enqueue_burst(queue->drv_to_sn, paddr_arr, cnt);
 	if (ret < cnt && net_ratelimit()) {
@@ -35,6 +35,7 @@
 
 #include <linux/netdevice.h>
 #include <linux/miscdevice.h>
+#include <linux/hrtimer.h>
 
 #define MODULE_NAME "bess"
 
@@ -86,11 +87,15 @@ struct sn_queue {
 				u64 polls;
 				u64 interrupts;
 				u64 ll_polls;
+				u64 timer_polls;
 			} stats;
 
 			struct sn_rxq_registers *rx_regs;
 			struct napi_struct napi;
 
+			/* Polls the queue again while it is busy */
+			struct hrtimer coalesce_timer;
+
 			spinlock_t lock; /* kernel has its own locks for TX */
 
 			struct rx_queue_opts opts;
@@ -57,6 +57,7 @@
 #include "../snbuf_layout.h"
 
 static int sn_poll(struct napi_struct *napi, int budget);
+static enum hrtimer_restart sn_coalesce_timer(struct hrtimer *timer);
 static void sn_enable_interrupt(struct sn_queue *rx_queue);
 
 static void sn_test_cache_alignment(struct sn_device *dev)
@@ -177,6 +178,11 @@ static int sn_alloc_queues(struct sn_device *dev,
 		napi_hash_add(&dev->rx_queues[i]->rx.napi);
 #endif
 		spin_lock_init(&dev->rx_queues[i]->rx.lock);
+
+		hrtimer_init(&dev->rx_queues[i]->rx.coalesce_timer,
+				CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		dev->rx_queues[i]->rx.coalesce_timer.function =
+				sn_coalesce_timer;
 	}
 
 	sn_test_cache_alignment(dev);
@@ -189,6 +195,7 @@ static void sn_free_queues(struct sn_device *dev)
 	int i;
 
 	for (i = 0; i < dev->num_rxq; i++) {
+		hrtimer_cancel(&dev->rx_queues[i]->rx.coalesce_timer);
 #ifdef CONFIG_NET_RX_BUSY_POLL
 		napi_hash_del(&dev->rx_queues[i]->rx.napi);
 #endif
@@ -220,8 +227,11 @@ static int sn_close(struct net_device *netdev)
 	struct sn_device *dev = netdev_priv(netdev);
 	int i;
 
-	for (i = 0; i < dev->num_rxq; i++)
+	/* Polling may arm the coalescing timer, so stop NAPI first */
+	for (i = 0; i < dev->num_rxq; i++) {
 		napi_disable(&dev->rx_queues[i]->rx.napi);
+		hrtimer_cancel(&dev->rx_queues[i]->rx.coalesce_timer);
+	}
 
 	return 0;
 }
@@ -229,7 +239,7 @@ static int sn_close(struct net_device *netdev)
 static void sn_enable_interrupt(struct sn_queue *rx_queue)
 {
 	__sync_synchronize();
-	rx_queue->rx.rx_regs->irq_disabled = 0;
+	rx_queue->rx.rx_regs->irq_disabled = SN_IRQ_ENABLED;
 	__sync_synchronize();
 
 	/* NOTE: make sure check again if the queue is really empty,
@@ -256,7 +266,38 @@ static void sn_disable_interrupt(struct sn_queue *rx_queue)
 	 * but in some cases the driver itself may also want to disable IRQ
 	 * (e.g., for low latency socket polling) */
 
-	rx_queue->rx.rx_regs->irq_disabled = 1;
+	rx_queue->rx.rx_regs->irq_disabled = SN_IRQ_DISABLED;
+}
+
+/* While the queue keeps receiving packets, poll it again after a short
+ * while rather than enabling the interrupt. BESS does not need to kick us
+ * in the meantime, so the kick rate stays low under moderate load.
+ * Returns false if coalescing is disabled. */
+static bool sn_defer_interrupt(struct sn_queue *rx_queue)
+{
+	uint32_t usecs = rx_queue->rx.rx_regs->coalesce_usecs;
+
+	if (!usecs)
+		return false;
+
+	rx_queue->rx.rx_regs->irq_disabled = SN_IRQ_DEFERRED;
+	hrtimer_start(&rx_queue->rx.coalesce_timer,
+		      ns_to_ktime((u64)usecs * NSEC_PER_USEC),
+		      HRTIMER_MODE_REL);
+
+	return true;
+}
+
+static enum hrtimer_restart sn_coalesce_timer(struct hrtimer *timer)
+{
+	struct sn_queue *rx_queue;
+
+	rx_queue = container_of(timer, struct sn_queue, rx.coalesce_timer);
+
+	rx_queue->rx.stats.timer_polls++;
+	napi_schedule(&rx_queue->rx.napi);
+
+	return HRTIMER_NORESTART;
 }
 
 /* if non-zero, the caller should drop the packet */
@@ -507,6 +548,12 @@ static int sn_poll(struct napi_struct *napi, int budget)
 
 	if (ret < budget) {
 		napi_complete(napi);
+
+		/* Fall back to the interrupt mode once the queue has been
+		 * idle for a whole coalescing period. */
+		if (ret > 0 && sn_defer_interrupt(rx_queue))
+			goto out;
+
 		sn_enable_interrupt(rx_queue);
 
 		/* last check for race condition.
@@ -517,6 +564,7 @@ static int sn_poll(struct napi_struct *napi, int budget)
 		}
 	}
 
+out:
 	spin_unlock(&rx_queue->rx.lock);
 
 	return ret;
@@ -532,6 +580,18 @@ static void sn_set_tx_metadata(struct sk_buff *skb,
 		tx_meta->csum_start = SN_TX_CSUM_DONT;
 		tx_meta->csum_dest = SN_TX_CSUM_DONT;
 	}
+
+	tx_meta->gso_mss = 0;
+	tx_meta->gso_type = SN_GSO_NONE;
+
+	if (skb_is_gso(skb)) {
+		tx_meta->gso_mss = skb_shinfo(skb)->gso_size;
+
+		if (skb_shinfo(skb)->gso_type & SKB_GSO_TCPV4)
+			tx_meta->gso_type = SN_GSO_TCPV4;
+		else if (skb_shinfo(skb)->gso_type & SKB_GSO_TCPV6)
+			tx_meta->gso_type = SN_GSO_TCPV6;
+	}
 }
 
 static inline int sn_send_tx_queue(struct sn_queue *queue,
@@ -695,22 +755,24 @@ static const struct net_device_ops sn_netdev_ops = {
 
 extern const struct ethtool_ops sn_ethtool_ops;
 
-static void sn_set_offloads(struct net_device *netdev)
+static void sn_set_offloads(struct net_device *netdev,
+			    struct sn_conf_space *conf)
 {
-	netif_set_gso_max_size(netdev, SNBUF_DATA);
-
-#if 0
-	netdev->hw_features = NETIF_F_SG |
-			      NETIF_F_IP_CSUM |
-			      NETIF_F_RXCSUM |
-			      NETIF_F_TSO |
-			      NETIF_F_TSO_ECN |
-			      NETIF_F_LRO |
-			      NETIF_F_GSO_UDP_TUNNEL;
-#else
-	/* Disable all offloading features for now */
-	netdev->hw_features = 0;
-#endif
+	if (conf->tx_offload_on) {
+		/* BESS resolves them in software if the packet leaves through
+		 * a port that cannot do the same, so they are always safe */
+		netif_set_gso_max_size(netdev,
+				min(GSO_MAX_SIZE, SN_TX_MAX_SEGS * SNBUF_DATA));
+		netdev->hw_features = NETIF_F_SG |
+				      NETIF_F_IP_CSUM |
+				      NETIF_F_IPV6_CSUM |
+				      NETIF_F_TSO |
+				      NETIF_F_TSO_ECN |
+				      NETIF_F_TSO6;
+	} else {
+		netif_set_gso_max_size(netdev, SNBUF_DATA);
+		netdev->hw_features = 0;
+	}
 
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(3,8,0))
 	netdev->hw_enc_features = netdev->hw_features;
@@ -821,7 +883,7 @@ int sn_create_netdev(void *bar, struct sn_device **dev_ret)
 
 	netdev->destructor = sn_netdev_destructor;
 
-	sn_set_offloads(netdev);
+	sn_set_offloads(netdev, conf);
 
 	netdev->netdev_ops = &sn_netdev_ops;
 	netdev->ethtool_ops = &sn_ethtool_ops;
@@ -6,6 +6,7 @@
 #include "bessd.h"
 #include "debug.h"
 #include "dpdk.h"
+#include "metadata.h"
 #include "opts.h"
 #include "packet.h"
 #include "port.h"
@@ -51,6 +52,8 @@ int main(int argc, char *argv[]) {
   init_dpdk(argv[0], FLAGS_m, FLAGS_a, FLAGS_no_huge);
   bess::init_mempool();
 
+  bess::metadata::default_pipeline.set_overflow(FLAGS_metadata_overflow);
+
   PortBuilder::InitDrivers();
 
   SetupControl();
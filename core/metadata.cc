@@ -4,7 +4,6 @@
 
 #include <algorithm>
 #include <functional>
-#include <queue>
 
 #include "mem_alloc.h"
 #include "module.h"
@@ -18,29 +17,20 @@ Pipeline default_pipeline;
 
 // Helpers -----------------------------------------------------------------
 
-static mt_offset_t ComputeNextOffset(mt_offset_t curr_offset, int8_t size) {
-  uint32_t overflow;
-  int8_t rounded_size;
-
-  rounded_size = align_ceil_pow2(size);
-
-  if (curr_offset % rounded_size) {
-    curr_offset = align_ceil(curr_offset, rounded_size);
-  }
-
-  overflow = (uint32_t)curr_offset + (uint32_t)size;
+// Multi-byte attributes are aligned to their (power of 2 rounded) size, so
+// that they never straddle a cache line.
+static int NaturalAlignment(int size) {
+  return std::min<int>(align_ceil_pow2(size), kMetadataMaxAlign);
+}
 
-  return overflow > kMetadataTotalSize ? kMetadataOffsetNoSpace : curr_offset;
+static bool StraddlesCacheLine(int offset, int size) {
+  return offset / kMetadataCacheLineSize !=
+         (offset + size - 1) / kMetadataCacheLineSize;
 }
 
 // Generate warnings for modules that read metadata that never gets set.
-static void CheckOrphanReaders() {
-  for (const auto &it : ModuleBuilder::all_modules()) {
-    const Module *m = it.second;
-    if (!m) {
-      break;
-    }
-
+static void CheckOrphanReaders(const std::vector<Module *> &modules) {
+  for (const Module *m : modules) {
     size_t i = 0;
     for (const auto &attr : m->all_attrs()) {
       if (m->attr_offset(i) == kMetadataOffsetNoRead) {
@@ -57,23 +47,24 @@ static inline attr_id_t get_attr_id(const struct Attribute *attr) {
   return attr->name;
 }
 
-// ScopeComponent ----------------------------------------------------------
-
-class ScopeComponentComp {
- public:
-  explicit ScopeComponentComp(const bool &revparam = false)
-      : reverse_(revparam) {}
+// Returns the modules of the component that read or write the attribute.
+// Others only carry it between them.
+static std::vector<Module *> FindAccessors(const ScopeComponent &comp) {
+  std::vector<Module *> ret;
 
-  bool operator()(const ScopeComponent *lhs, const ScopeComponent *rhs) const {
-    if (reverse_) {
-      return (lhs->offset() < rhs->offset());
+  for (Module *m : comp.modules()) {
+    for (const auto &attr : m->all_attrs()) {
+      if (get_attr_id(&attr) == comp.attr_id()) {
+        ret.push_back(m);
+        break;
+      }
     }
-    return (lhs->offset() > rhs->offset());
   }
 
- private:
-  bool reverse_;
-};
+  return ret;
+}
+
+// ScopeComponent ----------------------------------------------------------
 
 static bool DegreeComp(const ScopeComponent &a, const ScopeComponent &b) {
   return a.degree() > b.degree();
@@ -92,17 +83,12 @@ bool ScopeComponent::DisjointFrom(const ScopeComponent &rhs) {
 
 // Pipeline ----------------------------------------------------------------
 
-int Pipeline::PrepareMetadataComputation() {
-  for (const auto &it : ModuleBuilder::all_modules()) {
-    Module *m = it.second;
-    if (!m) {
-      break;
-    }
-
+int Pipeline::PrepareMetadataComputation(const std::vector<Module *> &modules) {
+  for (Module *m : modules) {
     if (!module_components_.count(m)) {
       module_components_.emplace(
           m, reinterpret_cast<scope_id_t *>(
-                 mem_alloc(sizeof(scope_id_t) * kMetadataTotalSize)));
+                 mem_alloc(sizeof(scope_id_t) * kMetadataOffsetLimit)));
     }
 
     if (module_components_[m] == nullptr) {
@@ -110,7 +96,10 @@ int Pipeline::PrepareMetadataComputation() {
     }
 
     module_scopes_[m] = -1;
-    memset(module_components_[m], -1, sizeof(scope_id_t) * kMetadataTotalSize);
+    memset(module_components_[m], -1,
+           sizeof(scope_id_t) * kMetadataOffsetLimit);
+
+    new_offsets_[m].assign(m->all_attrs().size(), kMetadataOffsetNoWrite);
 
     for (const auto &attr : m->all_attrs()) {
       attr.scope_id = -1;
@@ -130,6 +119,7 @@ void Pipeline::CleanupMetadataComputation() {
     c.clear_modules();
   }
   scope_components_.clear();
+  new_offsets_.clear();
 }
 
 void Pipeline::AddModuleToComponent(Module *m, const struct Attribute *attr) {
@@ -286,12 +276,12 @@ void Pipeline::FillOffsetArrays() {
         if (get_attr_id(&attr) == id) {
           if (invalid) {
             if (attr.mode == Attribute::AccessMode::kRead) {
-              m->set_attr_offset(k, kMetadataOffsetNoRead);
+              new_offsets_[m][k] = kMetadataOffsetNoRead;
             } else {
-              m->set_attr_offset(k, kMetadataOffsetNoWrite);
+              new_offsets_[m][k] = kMetadataOffsetNoWrite;
             }
           } else {
-            m->set_attr_offset(k, offset);
+            new_offsets_[m][k] = offset;
           }
           break;
         }
@@ -307,66 +297,181 @@ void Pipeline::FillOffsetArrays() {
   }
 }
 
+bool Pipeline::ConflictsWithAssigned(ScopeComponent &comp, int offset) {
+  for (const auto &other : scope_components_) {
+    if (&other == &comp || !other.assigned() || other.offset() < 0) {
+      continue;
+    }
+
+    if (offset + comp.size() <= other.offset() ||
+        other.offset() + other.size() <= offset) {
+      continue;
+    }
+
+    if (!comp.DisjointFrom(other)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+mt_offset_t Pipeline::PickOffset(
+    ScopeComponent &comp, const std::vector<Module *> &accessors,
+    const std::map<const Module *, uint32_t> &lines, int begin, int end) {
+  const int size = comp.size();
+  const int align = NaturalAlignment(size);
+  mt_offset_t best = kMetadataOffsetNoSpace;
+  size_t best_cost = SIZE_MAX;
+
+  for (int offset = begin; offset + size <= end; offset += align) {
+    if (StraddlesCacheLine(offset, size) ||
+        ConflictsWithAssigned(comp, offset)) {
+      continue;
+    }
+
+    uint32_t line_mask = 1 << (offset / kMetadataCacheLineSize);
+    size_t cost = 0;
+
+    for (Module *m : accessors) {
+      const auto &it = lines.find(m);
+      if (it == lines.end() || !(it->second & line_mask)) {
+        cost++;
+      }
+    }
+
+    // The lowest offset wins a tie, so hot attributes fill the first line.
+    if (cost < best_cost) {
+      best = offset;
+      best_cost = cost;
+    }
+  }
+
+  return best;
+}
+
 void Pipeline::AssignOffsets() {
-  mt_offset_t offset = 0;
-  ScopeComponent *comp1;
-  const ScopeComponent *comp2;
+  std::vector<std::vector<Module *>> accessors(scope_components_.size());
+  std::vector<size_t> order;
+
+  // Cache lines of the metadata area that each module touches so far
+  std::map<const Module *, uint32_t> lines;
 
   for (size_t i = 0; i < scope_components_.size(); i++) {
-    std::priority_queue<const ScopeComponent *,
-                        std::vector<const ScopeComponent *>, ScopeComponentComp>
-        h;
-    comp1 = &scope_components_[i];
-
-    if (comp1->invalid()) {
-      comp1->set_offset(kMetadataOffsetNoRead);
-      comp1->set_assigned(true);
+    ScopeComponent &comp = scope_components_[i];
+
+    if (comp.invalid()) {
+      comp.set_offset(kMetadataOffsetNoRead);
+      comp.set_assigned(true);
       continue;
     }
 
-    if (comp1->assigned() || comp1->modules().size() == 1) {
+    // Nobody reads it. FillOffsetArrays() will take care of it.
+    if (comp.modules().size() == 1) {
       continue;
     }
 
-    offset = 0;
+    accessors[i] = FindAccessors(comp);
+    order.push_back(i);
+  }
 
-    for (size_t j = 0; j < scope_components_.size(); j++) {
-      if (i == j) {
-        continue;
-      }
+  // Attributes accessed by more modules go first. Otherwise keep the order of
+  // degrees, so that the most constrained components are placed early.
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return accessors[a].size() > accessors[b].size();
+  });
+
+  for (size_t i : order) {
+    ScopeComponent &comp = scope_components_[i];
+    mt_offset_t offset = PickOffset(comp, accessors[i], lines, 0,
+                                    kMetadataTotalSize);
+
+    // Placed last among its peers, so this is one of the least used ones
+    if (offset == kMetadataOffsetNoSpace && overflow_) {
+      offset = PickOffset(comp, accessors[i], lines, kMetadataOverflowOffset,
+                          kMetadataOffsetLimit);
+    }
+
+    comp.set_offset(offset);
+    comp.set_assigned(true);
 
-      if (!scope_components_[i].DisjointFrom(scope_components_[j]) &&
-          scope_components_[j].assigned()) {
-        h.push(&scope_components_[j]);
+    if (offset >= 0) {
+      for (Module *m : accessors[i]) {
+        lines[m] |= 1 << (offset / kMetadataCacheLineSize);
       }
     }
+  }
 
-    while (!h.empty()) {
-      comp2 = h.top();
-      h.pop();
+  FillOffsetArrays();
+}
 
-      if (comp2->offset() == kMetadataOffsetNoRead ||
-          comp2->offset() == kMetadataOffsetNoWrite ||
-          comp2->offset() == kMetadataOffsetNoSpace) {
-        continue;
-      }
+void Pipeline::RecordLayout(const std::vector<Module *> &modules) {
+  std::set<std::string> names;
+  uint32_t used_lines = 0;
+
+  for (const Module *m : modules) {
+    names.insert(m->name());
+  }
+
+  // Scopes do not cross islands, so an entry with any of the modules is stale
+  layout_.erase(
+      std::remove_if(layout_.begin(), layout_.end(),
+                     [&names](const AttrLayout &attr_layout) {
+                       for (const auto &name : attr_layout.accessors) {
+                         if (names.count(name)) {
+                           return true;
+                         }
+                       }
+                       return false;
+                     }),
+      layout_.end());
+
+  for (const auto &comp : scope_components_) {
+    // Invalid, or not read by anyone
+    if (comp.invalid() || comp.modules().size() == 1) {
+      continue;
+    }
 
-      if (offset + comp1->size() > comp2->offset()) {
-        offset =
-            ComputeNextOffset(comp2->offset() + comp2->size(), comp1->size());
+    AttrLayout attr_layout;
+    attr_layout.attr_id = comp.attr_id();
+    attr_layout.size = comp.size();
+    attr_layout.offset = comp.offset();
+    for (const Module *m : FindAccessors(comp)) {
+      attr_layout.accessors.push_back(m->name());
+    }
+    layout_.push_back(attr_layout);
+
+    if (comp.offset() == kMetadataOffsetNoSpace) {
+      LOG(WARNING) << "Metadata attr " << comp.attr_id() << "/" << comp.size()
+                   << " does not fit in the " << kMetadataTotalSize
+                   << "-byte metadata area"
+                   << (overflow_ ? " nor the overflow area" : "");
+    }
+  }
+
+  footprint_ = 0;
+  num_spills_ = 0;
+  num_overflows_ = 0;
+
+  for (const auto &attr_layout : layout_) {
+    if (attr_layout.offset == kMetadataOffsetNoSpace) {
+      num_spills_++;
+    } else if (attr_layout.offset >= 0) {
+      size_t end = attr_layout.offset + attr_layout.size;
+
+      if (end > kMetadataTotalSize) {
+        num_overflows_++;
       } else {
-        break;
+        footprint_ = std::max(footprint_, end);
       }
+      used_lines |= 1 << (attr_layout.offset / kMetadataCacheLineSize);
     }
-
-    comp1->set_offset(offset);
-    comp1->set_assigned(true);
   }
 
-  FillOffsetArrays();
+  cache_lines_ = __builtin_popcount(used_lines);
 }
 
-void Pipeline::LogAllScopes() const {
+void Pipeline::LogAllScopes(const std::vector<Module *> &modules) const {
   for (size_t i = 0; i < scope_components_.size(); i++) {
     VLOG(1) << "scope component for " << scope_components_[i].size()
             << "-byte attr " << scope_components_[i].attr_id() << " at offset "
@@ -379,17 +484,12 @@ void Pipeline::LogAllScopes() const {
     VLOG(1) << "}";
   }
 
-  for (const auto &it : ModuleBuilder::all_modules()) {
-    const Module *m = it.second;
-    if (!m) {
-      break;
-    }
-
+  for (const Module *m : modules) {
     const scope_id_t *scope_arr = module_components_.find(m)->second;
 
     LOG(INFO) << "Module " << m->name()
               << " part of the following scope components: ";
-    for (size_t i = 0; i < kMetadataTotalSize; i++) {
+    for (size_t i = 0; i < kMetadataOffsetLimit; i++) {
       if (scope_arr[i] != -1) {
         LOG(INFO) << "scope " << scope_arr[i] << " at offset " << i;
       }
@@ -408,30 +508,101 @@ void Pipeline::ComputeScopeDegrees() {
   }
 }
 
-/* Main entry point for calculating metadata offsets. */
-int Pipeline::ComputeMetadataOffsets() {
-  int ret;
+std::vector<Module *> Pipeline::CollectIslands(
+    const std::set<Module *> &seeds) const {
+  std::set<const Module *> visited;
+  std::vector<const Module *> stack(seeds.begin(), seeds.end());
+  std::vector<Module *> ret;
 
-  ret = PrepareMetadataComputation();
+  while (!stack.empty()) {
+    const Module *m = stack.back();
+    stack.pop_back();
 
-  if (ret) {
-    CleanupMetadataComputation();
-    return ret;
+    if (!visited.insert(m).second) {
+      continue;
+    }
+
+    for (const auto &igate : m->igates()) {
+      if (!igate) {
+        continue;
+      }
+
+      for (const auto &ogate : igate->ogates_upstream()) {
+        stack.push_back(ogate->module());
+      }
+    }
+
+    for (const auto &ogate : m->ogates()) {
+      if (!ogate) {
+        continue;
+      }
+
+      stack.push_back(ogate->igate()->module());
+    }
   }
 
+  // Same order as a full computation, so that both give the same offsets
   for (const auto &it : ModuleBuilder::all_modules()) {
     Module *m = it.second;
     if (!m) {
       break;
     }
 
+    if (visited.count(m)) {
+      ret.push_back(m);
+    }
+  }
+
+  return ret;
+}
+
+bool Pipeline::CommitOffsets(bool keep_active) {
+  if (keep_active) {
+    for (const auto &it : new_offsets_) {
+      const Module *m = it.first;
+
+      if (m->num_active_workers() == 0) {
+        continue;
+      }
+
+      for (size_t i = 0; i < it.second.size(); i++) {
+        if (m->attr_offset(i) != it.second[i]) {
+          return false;
+        }
+      }
+    }
+  }
+
+  for (const auto &it : new_offsets_) {
+    Module *m = const_cast<Module *>(it.first);
+
+    for (size_t i = 0; i < it.second.size(); i++) {
+      m->set_attr_offset(i, it.second[i]);
+    }
+  }
+
+  return true;
+}
+
+int Pipeline::ComputeOffsetsOf(const std::vector<Module *> &modules,
+                               bool keep_active) {
+  int ret;
+
+  ret = PrepareMetadataComputation(modules);
+
+  if (ret) {
+    CleanupMetadataComputation();
+    return ret;
+  }
+
+  for (Module *m : modules) {
     size_t i = 0;
     for (const auto &attr : m->all_attrs()) {
       if (attr.mode == Attribute::AccessMode::kRead ||
           attr.mode == Attribute::AccessMode::kUpdate) {
-        m->set_attr_offset(i, kMetadataOffsetNoRead);
+        new_offsets_[m][i] = kMetadataOffsetNoRead;
       } else if (attr.mode == Attribute::AccessMode::kWrite) {
-        m->set_attr_offset(i, kMetadataOffsetNoWrite);
+        new_offsets_[m][i] = kMetadataOffsetNoWrite;
         if (attr.scope_id == -1) {
           IdentifySingleScopeComponent(m, &attr);
         }
@@ -444,16 +615,53 @@ int Pipeline::ComputeMetadataOffsets() {
   std::sort(scope_components_.begin(), scope_components_.end(), DegreeComp);
   AssignOffsets();
 
+  if (!CommitOffsets(keep_active)) {
+    CleanupMetadataComputation();
+    return -EBUSY;
+  }
+
+  RecordLayout(modules);
+
   if (VLOG_IS_ON(1)) {
-    LogAllScopes();
+    LogAllScopes(modules);
   }
 
-  CheckOrphanReaders();
+  CheckOrphanReaders(modules);
 
   CleanupMetadataComputation();
+
+  for (Module *m : modules) {
+    dirty_modules_.erase(m);
+  }
+
   return 0;
 }
 
+/* Main entry point for calculating metadata offsets. */
+int Pipeline::ComputeMetadataOffsets() {
+  std::vector<Module *> modules;
+
+  for (const auto &it : ModuleBuilder::all_modules()) {
+    Module *m = it.second;
+    if (!m) {
+      break;
+    }
+
+    modules.push_back(m);
+  }
+
+  layout_.clear();
+  return ComputeOffsetsOf(modules, false);
+}
+
+int Pipeline::UpdateMetadataOffsets(bool keep_active) {
+  if (dirty_modules_.empty()) {
+    return 0;
+  }
+
+  return ComputeOffsetsOf(CollectIslands(dirty_modules_), keep_active);
+}
+
 int Pipeline::RegisterAttribute(const std::string &attr_name, size_t size) {
   const auto &it = registered_attrs_.find(attr_name);
   if (it == registered_attrs_.end()) {
@@ -30,8 +30,35 @@ static const size_t kMetadataTotalSize = SNBUF_METADATA;
 static_assert(kMetadataTotalSize <= SIZE_MAX,
               "Total metadata size check failed");
 
+// Attributes that do not fit in the metadata area may go to the overflow area
+// at the front of the headroom, if the pipeline enables it. Offsets in either
+// area are relative to the start of the metadata area, so that the fast path
+// of attribute access is the same for both.
+static const size_t kMetadataOverflowOffset = SNBUF_HEADROOM_OFF -
+                                              SNBUF_METADATA_OFF;
+static const size_t kMetadataOverflowSize = 64;
+static_assert(kMetadataOverflowSize <= SNBUF_HEADROOM,
+              "Metadata overflow area must fit in the headroom");
+
+// Every valid offset is smaller than this.
+static const size_t kMetadataOffsetLimit =
+    kMetadataOverflowOffset + kMetadataOverflowSize;
+
+// Attributes never straddle a cache line, and the ones accessed by more
+// modules are packed into the first one.
+static const size_t kMetadataCacheLineSize = 64;
+static_assert(SNBUF_METADATA_OFF % kMetadataCacheLineSize == 0,
+              "Metadata area must be cache line aligned");
+static_assert(kMetadataOverflowOffset % kMetadataCacheLineSize == 0,
+              "Metadata overflow area must be cache line aligned");
+static_assert(kMetadataOffsetLimit / kMetadataCacheLineSize <= 32,
+              "Too many cache lines in the metadata areas");
+
+// Multi-byte attributes are aligned to their size, up to this many bytes.
+static const size_t kMetadataMaxAlign = 8;
+
 // Normal offset values are 0 or a positive value.
-typedef int8_t mt_offset_t;
+typedef int16_t mt_offset_t;
 typedef int16_t scope_id_t;
 
 // No downstream module reads the attribute, so the module can skip writing.
@@ -40,7 +67,8 @@ static const mt_offset_t kMetadataOffsetNoWrite = -1;
 // No upstream module writes the attribute, thus garbage value will be read.
 static const mt_offset_t kMetadataOffsetNoRead = -2;
 
-// Out of space in packet buffers for the attribute.
+// Out of space in packet buffers (including the overflow area, if enabled)
+// for the attribute.
 static const mt_offset_t kMetadataOffsetNoSpace = -3;
 
 static inline int IsValidOffset(mt_offset_t offset) {
@@ -58,6 +86,16 @@ struct Attribute {
 
 typedef std::string attr_id_t;
 
+// Where a scope component ended up, as of the last ComputeMetadataOffsets().
+struct AttrLayout {
+  attr_id_t attr_id;
+  int size;
+  mt_offset_t offset;
+  // Modules that read or write the attribute, as opposed to just passing it
+  // along. The more there are, the hotter the attribute.
+  std::vector<std::string> accessors;
+};
+
 class ScopeComponent {
  public:
   ScopeComponent()
@@ -119,28 +157,84 @@ class Pipeline {
       : scope_components_(),
         module_scopes_(),
         module_components_(),
-        registered_attrs_() {}
+        registered_attrs_(),
+        dirty_modules_(),
+        new_offsets_(),
+        overflow_(),
+        layout_(),
+        footprint_(),
+        cache_lines_(),
+        num_spills_(),
+        num_overflows_() {}
 
   // Main entry point for calculating metadata offsets.
   int ComputeMetadataOffsets();
 
+  // Recomputes offsets only for the modules connected (in either direction)
+  // to those marked dirty since the last computation. Scope components never
+  // span two such islands, so the result is the same as a full computation.
+  // If @keep_active is true and the offsets of any module with active workers
+  // would change, nothing is updated and -EBUSY is returned.
+  int UpdateMetadataOffsets(bool keep_active = false);
+
+  // Called whenever the attributes or connections of a module change.
+  void MarkDirty(Module *m) { dirty_modules_.insert(m); }
+
+  // Called when a module is destroyed.
+  void ForgetModule(Module *m) { dirty_modules_.erase(m); }
+
+  bool dirty() const { return !dirty_modules_.empty(); }
+
+  // Whether attributes that do not fit in the metadata area may be placed in
+  // the overflow area. Modules then must not use more than
+  // SNBUF_HEADROOM - kMetadataOverflowSize bytes of headroom, or they would
+  // clobber those attributes; Packet::prepend() refuses to. Applies to
+  // offsets computed afterwards.
+  bool overflow() const { return overflow_; }
+  void set_overflow(bool overflow) { overflow_ = overflow; }
+
   // Registers attr and returns 0 if no attribute named @attr_name with size
   // other than @size has already been registered for this pipeline.
   // Returns -EINVAL on error.
   int RegisterAttribute(const std::string &attr_name, size_t size);
   void DeregisterAttribute(const std::string &attr_name);
 
+  // Results of the last offset computation, for diagnostics.
+  const std::vector<AttrLayout> &layout() const { return layout_; }
+
+  // Bytes up to the end of the last attribute in the metadata area.
+  size_t footprint() const { return footprint_; }
+
+  // Number of cache lines holding any attribute.
+  int cache_lines() const { return cache_lines_; }
+
+  // Number of scope components that did not fit (kMetadataOffsetNoSpace).
+  int num_spills() const { return num_spills_; }
+
+  // Number of scope components placed in the overflow area.
+  int num_overflows() const { return num_overflows_; }
+
  private:
   friend class MetadataTest;
 
   // Allocate and initiliaze scope component storage.
   // Returns 0 on sucess, -errno on failure.
-  int PrepareMetadataComputation();
+  int PrepareMetadataComputation(const std::vector<Module *> &modules);
 
   void CleanupMetadataComputation();
 
+  // Computes offsets for @modules, which must be closed under connections.
+  int ComputeOffsetsOf(const std::vector<Module *> &modules, bool keep_active);
+
+  // Returns all modules connected to any of @seeds, in registration order.
+  std::vector<Module *> CollectIslands(const std::set<Module *> &seeds) const;
+
+  // Copies new_offsets_ to the modules. Returns false (without copying) if
+  // @keep_active is set and a module with active workers would be affected.
+  bool CommitOffsets(bool keep_active);
+
   // Debugging tool.
-  void LogAllScopes() const;
+  void LogAllScopes(const std::vector<Module *> &modules) const;
 
   // Add a module to the current scope component.
   void AddModuleToComponent(Module *m, const struct Attribute *attr);
@@ -167,6 +261,21 @@ class Pipeline {
   void AssignOffsets();
   void ComputeScopeDegrees();
 
+  // Returns true if [offset, offset + size) overlaps an attribute of an
+  // assigned component that shares a module with 'comp'.
+  bool ConflictsWithAssigned(ScopeComponent &comp, int offset);
+
+  // Returns the offset in [begin, end) for 'comp' that adds the fewest cache
+  // lines to the modules in 'accessors', given the lines they already use
+  // ('lines').
+  mt_offset_t PickOffset(ScopeComponent &comp,
+                         const std::vector<Module *> &accessors,
+                         const std::map<const Module *, uint32_t> &lines,
+                         int begin, int end);
+
+  // Replaces the layout entries of @modules with the current computation.
+  void RecordLayout(const std::vector<Module *> &modules);
+
   std::vector<ScopeComponent> scope_components_;
 
   // Maps modules to the
@@ -180,6 +289,20 @@ class Pipeline {
   // attribute is deregistered once it reaches back to 0.
   // Those modules should agree on the same size(=size_t).
   std::map<std::string, std::tuple<size_t, int> > registered_attrs_;
+
+  // Modules whose offsets may be stale.
+  std::set<Module *> dirty_modules_;
+
+  // Offsets being computed, not yet visible to the modules.
+  std::map<const Module *, std::vector<mt_offset_t> > new_offsets_;
+
+  bool overflow_;
+
+  std::vector<AttrLayout> layout_;
+  size_t footprint_;
+  int cache_lines_;
+  int num_spills_;
+  int num_overflows_;
 };
 
 extern bess::metadata::Pipeline default_pipeline;
@@ -3,6 +3,7 @@
 #include <gtest/gtest.h>
 
 #include <cstdlib>
+#include <cstring>
 #include <vector>
 
 #include "module.h"
@@ -52,6 +53,7 @@ class MetadataTest : public ::testing::Test {
   virtual void SetUp() {
     default_pipeline.CleanupMetadataComputation();
     default_pipeline.registered_attrs_.clear();
+    default_pipeline.set_overflow(false);
     m0 = ::create_foo();
     m1 = ::create_foo();
     ASSERT_TRUE(m0);
@@ -147,6 +149,148 @@ TEST_F(MetadataTest, MultipleAttrSimplePipeNoSpaceFails) {
 
   ASSERT_EQ(kMetadataOffsetNoSpace, m0->attr_offset(n));
   ASSERT_EQ(kMetadataOffsetNoSpace, m1->attr_offset(n));
+  EXPECT_EQ(1, default_pipeline.num_spills());
+  EXPECT_EQ(kMetadataTotalSize, default_pipeline.footprint());
+}
+
+// With the overflow area, the attribute with the fewest accessors goes there
+TEST_F(MetadataTest, MultipleAttrSimplePipeOverflow) {
+  Module *m2 = create_foo();
+  ASSERT_NE(nullptr, m2);
+
+  size_t sz = kMetadataAttrMaxSize;
+  size_t n = kMetadataTotalSize / sz;
+  for (size_t i = 0; i <= n; i++) {
+    std::string s = "attr" + std::to_string(i);
+    ASSERT_EQ(i, m0->AddMetadataAttr(s, sz, Attribute::AccessMode::kWrite));
+    ASSERT_EQ(i, m1->AddMetadataAttr(s, sz, Attribute::AccessMode::kRead));
+  }
+  ASSERT_EQ(0, m2->AddMetadataAttr("attr0", sz, Attribute::AccessMode::kRead));
+  m0->ConnectModules(0, m1, 0);
+  m1->ConnectModules(0, m2, 0);
+
+  default_pipeline.set_overflow(true);
+  ASSERT_EQ(0, default_pipeline.ComputeMetadataOffsets());
+
+  EXPECT_EQ(0, default_pipeline.num_spills());
+  EXPECT_EQ(1, default_pipeline.num_overflows());
+  EXPECT_EQ(kMetadataTotalSize, default_pipeline.footprint());
+
+  EXPECT_EQ(0, m0->attr_offset(0));
+  EXPECT_EQ(0, m2->attr_offset(0));
+  EXPECT_EQ(static_cast<int>(kMetadataOverflowOffset), m0->attr_offset(n));
+  EXPECT_EQ(static_cast<int>(kMetadataOverflowOffset), m1->attr_offset(n));
+}
+
+// Prepending must not grow the packet into an attribute in the overflow area
+TEST_F(MetadataTest, PrependSparesOverflow) {
+  size_t sz = kMetadataAttrMaxSize;
+  size_t n = kMetadataTotalSize / sz;
+  for (size_t i = 0; i <= n; i++) {
+    std::string s = "attr" + std::to_string(i);
+    ASSERT_EQ(i, m0->AddMetadataAttr(s, sz, Attribute::AccessMode::kWrite));
+    ASSERT_EQ(i, m1->AddMetadataAttr(s, sz, Attribute::AccessMode::kRead));
+  }
+  m0->ConnectModules(0, m1, 0);
+
+  default_pipeline.set_overflow(true);
+  ASSERT_EQ(0, default_pipeline.ComputeMetadataOffsets());
+
+  mt_offset_t offset = m0->attr_offset(n);
+  ASSERT_EQ(static_cast<int>(kMetadataOverflowOffset), offset);
+
+  bess::Packet pkt;
+  pkt.set_buffer(pkt.data<char *>() - SNBUF_HEADROOM);
+  pkt.set_data_off(SNBUF_HEADROOM);
+  pkt.set_data_len(60);
+  pkt.set_total_len(60);
+
+  memset(ptr_attr_with_offset<char>(offset, &pkt), 0x5a, sz);
+
+  // All of the headroom but the overflow area
+  const uint16_t room = SNBUF_HEADROOM - kMetadataOverflowSize;
+  EXPECT_EQ(nullptr, pkt.prepend(room + 1));
+  ASSERT_NE(nullptr, pkt.prepend(room));
+  EXPECT_EQ(nullptr, pkt.prepend(1));
+  memset(pkt.head_data(), 0xff, room);
+
+  const char *val = ptr_attr_with_offset<char>(offset, &pkt);
+  for (size_t i = 0; i < sz; i++) {
+    EXPECT_EQ(0x5a, val[i]);
+  }
+
+  // Without the overflow area, all of the headroom is usable
+  default_pipeline.set_overflow(false);
+  EXPECT_NE(nullptr, pkt.prepend(kMetadataOverflowSize));
+}
+
+// Check that attributes are naturally aligned and never straddle a cache line
+TEST_F(MetadataTest, MultipleAttrAligned) {
+  const size_t sizes[] = {1, 3, 2, 5, 8, 12, 32, 6, 4, 16, 7};
+  size_t i = 0;
+
+  for (size_t sz : sizes) {
+    std::string s = "attr" + std::to_string(i);
+    ASSERT_EQ(i, m0->AddMetadataAttr(s, sz, Attribute::AccessMode::kWrite));
+    ASSERT_EQ(i, m1->AddMetadataAttr(s, sz, Attribute::AccessMode::kRead));
+    i++;
+  }
+  m0->ConnectModules(0, m1, 0);
+
+  ASSERT_EQ(0, default_pipeline.ComputeMetadataOffsets());
+  EXPECT_EQ(0, default_pipeline.num_spills());
+
+  i = 0;
+  for (size_t sz : sizes) {
+    mt_offset_t offset = m0->attr_offset(i++);
+    size_t align = std::min<size_t>(align_ceil_pow2(sz), kMetadataMaxAlign);
+
+    ASSERT_LE(0, offset);
+    EXPECT_EQ(0U, offset % align) << "size " << sz;
+    EXPECT_EQ(offset / kMetadataCacheLineSize,
+              (offset + sz - 1) / kMetadataCacheLineSize)
+        << "size " << sz;
+  }
+}
+
+// Check that the attribute accessed by the most modules gets the first cache
+// line, and that the others are grouped by the modules accessing them.
+TEST_F(MetadataTest, HotAttrFirstCacheLine) {
+  Module *m2 = create_foo();
+  ASSERT_NE(nullptr, m2);
+
+  ASSERT_EQ(0, m0->AddMetadataAttr("a", 32, Attribute::AccessMode::kWrite));
+  ASSERT_EQ(1, m0->AddMetadataAttr("b", 32, Attribute::AccessMode::kWrite));
+  ASSERT_EQ(2, m0->AddMetadataAttr("c", 32, Attribute::AccessMode::kWrite));
+  ASSERT_EQ(3, m0->AddMetadataAttr("hot", 4, Attribute::AccessMode::kWrite));
+  ASSERT_EQ(0, m1->AddMetadataAttr("hot", 4, Attribute::AccessMode::kRead));
+  ASSERT_EQ(0, m2->AddMetadataAttr("a", 32, Attribute::AccessMode::kRead));
+  ASSERT_EQ(1, m2->AddMetadataAttr("b", 32, Attribute::AccessMode::kRead));
+  ASSERT_EQ(2, m2->AddMetadataAttr("c", 32, Attribute::AccessMode::kRead));
+  ASSERT_EQ(3, m2->AddMetadataAttr("hot", 4, Attribute::AccessMode::kRead));
+  m0->ConnectModules(0, m1, 0);
+  m1->ConnectModules(0, m2, 0);
+
+  ASSERT_EQ(0, default_pipeline.ComputeMetadataOffsets());
+
+  EXPECT_EQ(0, m0->attr_offset(3));
+  EXPECT_EQ(0, m1->attr_offset(0));
+  EXPECT_EQ(8, m0->attr_offset(0));
+  EXPECT_EQ(64, m0->attr_offset(1));
+  EXPECT_EQ(96, m0->attr_offset(2));
+
+  EXPECT_EQ(0, default_pipeline.num_spills());
+  EXPECT_EQ(2, default_pipeline.cache_lines());
+  EXPECT_EQ(kMetadataTotalSize, default_pipeline.footprint());
+
+  ASSERT_EQ(4U, default_pipeline.layout().size());
+  for (const auto &attr_layout : default_pipeline.layout()) {
+    if (attr_layout.attr_id == "hot") {
+      EXPECT_EQ(3U, attr_layout.accessors.size());
+    } else {
+      EXPECT_EQ(2U, attr_layout.accessors.size());
+    }
+  }
 }
 
 TEST_F(MetadataTest, MultipeAttrSimplePipe) {
@@ -317,5 +461,52 @@ TEST_F(MetadataTest, ScopeComponentDegreeOrder) {
               (m4->attr_offset(1) + 6 <= m3->attr_offset(4)));
 }
 
+// Only the island with changes should be recomputed, and the outcome should be
+// the same as with a full computation.
+TEST_F(MetadataTest, IncrementalUpdate) {
+  Module *m2 = create_foo();
+  Module *m3 = create_foo();
+  ASSERT_NE(nullptr, m2);
+  ASSERT_NE(nullptr, m3);
+
+  m0->AddMetadataAttr("a", 4, Attribute::AccessMode::kWrite);
+  m1->AddMetadataAttr("a", 4, Attribute::AccessMode::kRead);
+  m0->ConnectModules(0, m1, 0);
+
+  m2->AddMetadataAttr("b", 2, Attribute::AccessMode::kWrite);
+  m3->AddMetadataAttr("b", 2, Attribute::AccessMode::kRead);
+
+  ASSERT_TRUE(default_pipeline.dirty());
+  ASSERT_EQ(0, default_pipeline.ComputeMetadataOffsets());
+  ASSERT_FALSE(default_pipeline.dirty());
+  EXPECT_EQ(1U, default_pipeline.layout().size());
+  EXPECT_EQ(kMetadataOffsetNoRead, m3->attr_offset(0));
+
+  // Must stay as is, since nothing changed around m0 and m1
+  m0->set_attr_offset(0, 60);
+  m1->set_attr_offset(0, 60);
+
+  m2->ConnectModules(0, m3, 0);
+  ASSERT_TRUE(default_pipeline.dirty());
+  ASSERT_EQ(0, default_pipeline.UpdateMetadataOffsets());
+  ASSERT_FALSE(default_pipeline.dirty());
+
+  EXPECT_EQ(60, m0->attr_offset(0));
+  EXPECT_EQ(60, m1->attr_offset(0));
+  EXPECT_EQ(0, m2->attr_offset(0));
+  EXPECT_EQ(0, m3->attr_offset(0));
+  EXPECT_EQ(2U, default_pipeline.layout().size());
+
+  // Nothing to do
+  ASSERT_EQ(0, default_pipeline.UpdateMetadataOffsets());
+  EXPECT_EQ(60, m0->attr_offset(0));
+
+  m2->DisconnectModules(0);
+  ASSERT_EQ(0, default_pipeline.UpdateMetadataOffsets());
+  EXPECT_EQ(kMetadataOffsetNoRead, m3->attr_offset(0));
+  EXPECT_EQ(1U, default_pipeline.layout().size());
+  EXPECT_EQ(60, m0->attr_offset(0));
+}
+
 }  // namespace metadata
 }  // namespace bess
@@ -1,9 +1,5 @@
 #include "module.h"
 
-#include <fcntl.h>
-#include <sys/uio.h>
-#include <unistd.h>
-
 #include <glog/logging.h>
 
 #include <algorithm>
@@ -14,7 +10,6 @@
 #include "hooks/track.h"
 #include "mem_alloc.h"
 #include "scheduler.h"
-#include "utils/pcap.h"
 #include "worker.h"
 
 const Commands Module::cmds;
@@ -57,6 +52,10 @@ int ModuleBuilder::DestroyModule(Module *m, bool erase) {
   m->DestroyAllTasks();
   m->DeregisterAllAttributes();
 
+  if (m->pipeline()) {
+    m->pipeline()->ForgetModule(m);
+  }
+
   if (erase) {
     all_modules_.erase(m->name());
   }
@@ -353,6 +352,7 @@ int Module::AddMetadataAttr(const std::string &name, size_t size,
   attr.scope_id = -1;
 
   attrs_.push_back(attr);
+  pipeline_->MarkDirty(this);
 
   return attrs_.size() - 1;
 }
@@ -405,6 +405,11 @@ int Module::ConnectModules(gate_idx_t ogate_idx, Module *m_next,
   ogate->AddHook(new TrackGate());
   igate->PushOgate(ogate);
 
+  if (pipeline_) {
+    pipeline_->MarkDirty(this);
+    pipeline_->MarkDirty(m_next);
+  }
+
   return 0;
 }
 
@@ -428,6 +433,11 @@ int Module::DisconnectModules(gate_idx_t ogate_idx) {
 
   igate = ogate->igate();
 
+  if (pipeline_) {
+    pipeline_->MarkDirty(this);
+    pipeline_->MarkDirty(igate->module());
+  }
+
   /* Does the igate become inactive as well? */
   igate->RemoveOgate(ogate);
   if (igate->ogates_upstream().empty()) {
@@ -461,8 +471,15 @@ int Module::DisconnectModulesUpstream(gate_idx_t igate_idx) {
     return 0;
   }
 
+  if (pipeline_) {
+    pipeline_->MarkDirty(this);
+  }
+
   for (const auto &ogate : igate->ogates_upstream()) {
     Module *m_prev = ogate->module();
+    if (pipeline_) {
+      pipeline_->MarkDirty(m_prev);
+    }
     m_prev->ogates_[ogate->gate_idx()] = nullptr;
     ogate->ClearHooks();
     delete ogate;
@@ -595,20 +612,11 @@ void _trace_after_call(void) {
 }
 #endif
 
-// TODO(melvin): Much of this belongs in the TcpDump constructor.
-int Module::EnableTcpDump(const char *fifo, int is_igate, gate_idx_t gate_idx) {
-  static const struct pcap_hdr PCAP_FILE_HDR = {
-      .magic_number = PCAP_MAGIC_NUMBER,
-      .version_major = PCAP_VERSION_MAJOR,
-      .version_minor = PCAP_VERSION_MINOR,
-      .thiszone = PCAP_THISZONE,
-      .sigfigs = PCAP_SIGFIGS,
-      .snaplen = PCAP_SNAPLEN,
-      .network = PCAP_NETWORK,
-  };
+int Module::EnableTcpDump(const char *fifo, int is_igate, gate_idx_t gate_idx,
+                          uint32_t snaplen, uint32_t sample_every,
+                          uint64_t max_pps) {
   bess::Gate *gate;
 
-  int fd;
   int ret;
 
   /* Don't allow tcpdump to be attached to gates that are not active */
@@ -618,37 +626,25 @@ int Module::EnableTcpDump(const char *fifo, int is_igate, gate_idx_t gate_idx) {
   if (is_igate && !is_active_gate<bess::IGate>(igates_, gate_idx))
     return -EINVAL;
 
-  fd = open(fifo, O_WRONLY | O_NONBLOCK);
-  if (fd < 0)
-    return -errno;
-
-  /* Looooong time ago Linux ignored O_NONBLOCK in open().
-   * Try again just in case. */
-  ret = fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
-  if (ret < 0) {
-    close(fd);
-    return -errno;
-  }
-
-  ret = write(fd, &PCAP_FILE_HDR, sizeof(PCAP_FILE_HDR));
-  if (ret < 0) {
-    close(fd);
-    return -errno;
-  }
-
   if (is_igate) {
     gate = igates_[gate_idx];
   } else {
     gate = ogates_[gate_idx];
   }
 
+  if (gate->FindHook(kGateHookTcpDumpGate)) {
+    return -EEXIST;
+  }
+
   TcpDump *tcpdump = new TcpDump();
-  if (!gate->AddHook(tcpdump)) {
-    tcpdump->set_fifo_fd(fd);
-  } else {
+  ret = tcpdump->Init(fifo, snaplen, sample_every, max_pps);
+  if (ret < 0) {
     delete tcpdump;
+    return ret;
   }
 
+  gate->AddHook(tcpdump);
+
   return 0;
 }
 
@@ -8,10 +8,13 @@
 #include <vector>
 
 #include "gate.h"
+#include "hooks/gate_stats.h"
+#include "hooks/track.h"
 #include "message.h"
 #include "metadata.h"
 #include "packet.h"
 #include "scheduler.h"
+#include "utils/time.h"
 
 using bess::gate_idx_t;
 
@@ -246,7 +249,11 @@ class Module {
   int AddMetadataAttr(const std::string &name, size_t size,
                       bess::metadata::Attribute::AccessMode mode);
 
-  int EnableTcpDump(const char *fifo, int is_igate, gate_idx_t gate_idx);
+  // Captures up to 'snaplen' bytes of every 'sample_every'-th packet, up to
+  // 'max_pps' packets per second per worker (0 for no limit).
+  int EnableTcpDump(const char *fifo, int is_igate, gate_idx_t gate_idx,
+                    uint32_t snaplen = SNBUF_DATA, uint32_t sample_every = 1,
+                    uint64_t max_pps = 0);
 
   int DisableTcpDump(int is_igate, gate_idx_t gate_idx);
 
@@ -362,6 +369,23 @@ static inline void deadend(bess::PacketBatch *batch) {
   bess::Packet::Free(batch);
 }
 
+// Gates usually have no hook but TrackGate (on by default), so that case
+// costs a branch and an inlined call. Other hooks go through hooks().
+static inline void run_gate_hooks(bess::Gate *gate,
+                                  const bess::PacketBatch *batch) {
+  if (likely(!gate->has_slow_hooks())) {
+    TrackGate *track = gate->track_hook();
+    if (track) {
+      track->ProcessBatch(batch);
+    }
+    return;
+  }
+
+  for (auto &hook : gate->hooks()) {
+    hook->ProcessBatch(batch);
+  }
+}
+
 inline void Module::RunChooseModule(gate_idx_t ogate_idx,
                                     bess::PacketBatch *batch) {
   bess::OGate *ogate;
@@ -381,16 +405,25 @@ inline void Module::RunChooseModule(gate_idx_t ogate_idx,
     deadend(batch);
     return;
   }
-  for (auto &hook : ogate->hooks()) {
-    hook->ProcessBatch(batch);
-  }
+  run_gate_hooks(ogate, batch);
+  run_gate_hooks(ogate->igate(), batch);
 
-  for (auto &hook : ogate->igate()->hooks()) {
-    hook->ProcessBatch(batch);
+  ctx.set_current_igate(ogate->igate_idx());
+
+  Module *next = static_cast<Module *>(ogate->arg());
+
+  if (unlikely(ogate->has_slow_hooks())) {
+    GateStats *stats = ogate->stats_hook();
+
+    if (stats && stats->sampled()) {
+      uint64_t start = rdtsc();
+      next->ProcessBatch(batch);
+      stats->AddCycles(rdtsc() - start);
+      return;
+    }
   }
 
-  ctx.set_current_igate(ogate->igate_idx());
-  (static_cast<Module *>(ogate->arg()))->ProcessBatch(batch);
+  next->ProcessBatch(batch);
 }
 
 inline void Module::RunNextModule(bess::PacketBatch *batch) {
@@ -46,6 +46,21 @@ class DummyRelayModule : public Module {
   RunNextModule(batch);
 }
 
+// Stands for hooks other than TrackGate, which take the slow path
+class DummyHook final : public bess::GateHook {
+ public:
+  DummyHook() : bess::GateHook(kDummyHookName), cnt_() {}
+
+  void ProcessBatch(const bess::PacketBatch *) { cnt_++; }
+
+ private:
+  static const std::string kDummyHookName;
+
+  uint64_t cnt_;
+};
+
+const std::string DummyHook::kDummyHookName = "dummy";
+
 DEF_MODULE(DummySourceModule, "src", "the most sophisticated modue ever");
 DEF_MODULE(DummyRelayModule, "relay", "the most sophisticated modue ever");
 
@@ -83,6 +98,30 @@ class ModuleFixture : public benchmark::Fixture {
     ModuleBuilder::DestroyAllModules();
   }
 
+  // Calls f() on the output gates of the chain
+  template <typename F>
+  void ForEachOGate(F f) {
+    f(src_->ogates()[0]);
+    for (Module *relay : relays) {
+      if (!relay->ogates().empty() && relay->ogates()[0]) {
+        f(relay->ogates()[0]);
+      }
+    }
+  }
+
+  void RunChain(benchmark::State &state) {
+    const size_t batch_size = bess::PacketBatch::kMaxBurst;
+
+    Task t(src_, reinterpret_cast<void *>(batch_size), nullptr);
+
+    while (state.KeepRunning()) {
+      struct task_result ret = t();
+      DCHECK_EQ(ret.packets, batch_size);
+    }
+
+    state.SetItemsProcessed(state.iterations() * batch_size);
+  }
+
   Module *src_;
   std::vector<Module *> relays;
   DummySourceModule_class DummySourceModule_singleton;
@@ -91,29 +130,24 @@ class ModuleFixture : public benchmark::Fixture {
 
 }  // namespace (unnamed)
 
+// With the default TrackGate hooks
 BENCHMARK_DEFINE_F(ModuleFixture, Chain)(benchmark::State &state) {
-  const size_t batch_size = bess::PacketBatch::kMaxBurst;
-
-  Task t(src_, reinterpret_cast<void *>(batch_size), nullptr);
+  RunChain(state);
+}
 
-  while (state.KeepRunning()) {
-    struct task_result ret = t();
-    DCHECK_EQ(ret.packets, batch_size);
-  }
+BENCHMARK_DEFINE_F(ModuleFixture, ChainNoHooks)(benchmark::State &state) {
+  ForEachOGate([](bess::OGate *ogate) { ogate->ClearHooks(); });
+  RunChain(state);
+}
 
-  state.SetItemsProcessed(state.iterations() * batch_size);
+// With an extra hook on every gate, as with tcpdump
+BENCHMARK_DEFINE_F(ModuleFixture, ChainSlowHooks)(benchmark::State &state) {
+  ForEachOGate([](bess::OGate *ogate) { ogate->AddHook(new DummyHook()); });
+  RunChain(state);
 }
 
-BENCHMARK_REGISTER_F(ModuleFixture, Chain)
-    ->Arg(1)
-    ->Arg(2)
-    ->Arg(3)
-    ->Arg(4)
-    ->Arg(5)
-    ->Arg(6)
-    ->Arg(7)
-    ->Arg(8)
-    ->Arg(9)
-    ->Arg(10);
+BENCHMARK_REGISTER_F(ModuleFixture, Chain)->DenseRange(1, 10);
+BENCHMARK_REGISTER_F(ModuleFixture, ChainNoHooks)->DenseRange(1, 10);
+BENCHMARK_REGISTER_F(ModuleFixture, ChainSlowHooks)->DenseRange(1, 10);
 
 BENCHMARK_MAIN()
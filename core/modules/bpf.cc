@@ -36,9 +36,12 @@
 #include <pcap.h>
 #include <sys/mman.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <utility>
+#include <vector>
 
 /*
  * Registers
@@ -521,6 +524,17 @@ typedef void (*emit_func)(bpf_bin_stream *stream, u_int value, u_int n);
       JMP(stream.refs[stream.bpf_pc + (off)] - stream.refs[stream.bpf_pc]); \
   } while (0)
 
+/*
+ * Bails out of the program on a bad packet, in a merged program (see
+ * bpf_merge_compile()). Instead of returning 0, jumps to the next filter.
+ * Always 5 bytes long.
+ */
+#define FAIL()                                                   \
+  do {                                                           \
+    u_int fail_off = stream.refs[fail[i]] - (stream.cur_ip + 5); \
+    JMP(fail_off);                                               \
+  } while (0)
+
 /*
  * Emit routine to update the jump table.
  */
@@ -608,9 +622,12 @@ static int bpf_jit_optimize(struct bpf_insn *prog, u_int nins) {
 
 /*
  * Function that does the real stuff.
+ *
+ * If 'fail' is given, a bad packet load (or division by zero) at the i-th
+ * instruction jumps to the fail[i]-th instruction, rather than returning 0.
  */
 static bpf_filter_func_t bpf_jit_compile(struct bpf_insn *prog, u_int nins,
-                                         size_t *size) {
+                                         const u_int *fail, size_t *size) {
   bpf_bin_stream stream;
   struct bpf_insn *ins;
   int flags, fret, fpkt, fmem, fjmp, flen;
@@ -635,6 +652,8 @@ static bpf_filter_func_t bpf_jit_compile(struct bpf_insn *prog, u_int nins,
   memset(&stream, 0, sizeof(stream));
 
   /* Allocate the reference table for the jumps. */
+  if (fail)
+    fjmp = 1;
   if (fjmp) {
     stream.refs = static_cast<uint *>(calloc(nins + 1, sizeof(u_int)));
     if (stream.refs == nullptr)
@@ -690,15 +709,19 @@ static bpf_filter_func_t bpf_jit_compile(struct bpf_insn *prog, u_int nins,
           MOVrd(EDI, ECX);
           SUBrd(ESI, ECX);
           CMPid(sizeof(int32_t), ECX);
-          if (fmem) {
+          if (fail) {
+            JAEb(5);
+            FAIL();
+          } else if (fmem) {
             JAEb(4);
             ZEROrd(EAX);
             LEAVE();
+            RET();
           } else {
             JAEb(3);
             ZEROrd(EAX);
+            RET();
           }
-          RET();
           MOVrq3(R8, RCX);
           MOVobd(RCX, RSI, EAX);
           BSWAP(EAX);
@@ -712,12 +735,17 @@ static bpf_filter_func_t bpf_jit_compile(struct bpf_insn *prog, u_int nins,
           MOVrd(EDI, ECX);
           SUBrd(ESI, ECX);
           CMPid(sizeof(int16_t), ECX);
-          if (fmem) {
-            JAEb(2);
-            LEAVE();
-          } else
-            JAEb(1);
-          RET();
+          if (fail) {
+            JAEb(5);
+            FAIL();
+          } else {
+            if (fmem) {
+              JAEb(2);
+              LEAVE();
+            } else
+              JAEb(1);
+            RET();
+          }
           MOVrq3(R8, RCX);
           MOVobw(RCX, RSI, AX);
           SWAP_AX();
@@ -727,12 +755,17 @@ static bpf_filter_func_t bpf_jit_compile(struct bpf_insn *prog, u_int nins,
           ZEROrd(EAX);
           MOVid(ins->k, ESI);
           CMPrd(EDI, ESI);
-          if (fmem) {
-            JBb(2);
-            LEAVE();
-          } else
-            JBb(1);
-          RET();
+          if (fail) {
+            JBb(5);
+            FAIL();
+          } else {
+            if (fmem) {
+              JBb(2);
+              LEAVE();
+            } else
+              JBb(1);
+            RET();
+          }
           MOVrq3(R8, RCX);
           MOVobb(RCX, RSI, AL);
           break;
@@ -757,15 +790,19 @@ static bpf_filter_func_t bpf_jit_compile(struct bpf_insn *prog, u_int nins,
           MOVrd(EDI, ECX);
           SUBrd(ESI, ECX);
           CMPid(sizeof(int32_t), ECX);
-          if (fmem) {
+          if (fail) {
+            JAEb(5);
+            FAIL();
+          } else if (fmem) {
             JAEb(4);
             ZEROrd(EAX);
             LEAVE();
+            RET();
           } else {
             JAEb(3);
             ZEROrd(EAX);
+            RET();
           }
-          RET();
           MOVrq3(R8, RCX);
           MOVobd(RCX, RSI, EAX);
           BSWAP(EAX);
@@ -784,12 +821,17 @@ static bpf_filter_func_t bpf_jit_compile(struct bpf_insn *prog, u_int nins,
           MOVrd(EDI, ECX);
           SUBrd(ESI, ECX);
           CMPid(sizeof(int16_t), ECX);
-          if (fmem) {
-            JAEb(2);
-            LEAVE();
-          } else
-            JAEb(1);
-          RET();
+          if (fail) {
+            JAEb(5);
+            FAIL();
+          } else {
+            if (fmem) {
+              JAEb(2);
+              LEAVE();
+            } else
+              JAEb(1);
+            RET();
+          }
           MOVrq3(R8, RCX);
           MOVobw(RCX, RSI, AX);
           SWAP_AX();
@@ -803,12 +845,17 @@ static bpf_filter_func_t bpf_jit_compile(struct bpf_insn *prog, u_int nins,
           MOVrd(EDI, ECX);
           SUBrd(EDX, ECX);
           CMPrd(ESI, ECX);
-          if (fmem) {
-            JAb(2);
-            LEAVE();
-          } else
-            JAb(1);
-          RET();
+          if (fail) {
+            JAb(5);
+            FAIL();
+          } else {
+            if (fmem) {
+              JAb(2);
+              LEAVE();
+            } else
+              JAb(1);
+            RET();
+          }
           MOVrq3(R8, RCX);
           ADDrd(EDX, ESI);
           MOVobb(RCX, RSI, AL);
@@ -817,15 +864,19 @@ static bpf_filter_func_t bpf_jit_compile(struct bpf_insn *prog, u_int nins,
         case BPF_LDX | BPF_MSH | BPF_B:
           MOVid(ins->k, ESI);
           CMPrd(EDI, ESI);
-          if (fmem) {
+          if (fail) {
+            JBb(5);
+            FAIL();
+          } else if (fmem) {
             JBb(4);
             ZEROrd(EAX);
             LEAVE();
+            RET();
           } else {
             JBb(3);
             ZEROrd(EAX);
+            RET();
           }
-          RET();
           ZEROrd(EDX);
           MOVrq3(R8, RCX);
           MOVobb(RCX, RSI, DL);
@@ -958,15 +1009,19 @@ static bpf_filter_func_t bpf_jit_compile(struct bpf_insn *prog, u_int nins,
 
         case BPF_ALU | BPF_DIV | BPF_X:
           TESTrd(EDX, EDX);
-          if (fmem) {
+          if (fail) {
+            JNEb(5);
+            FAIL();
+          } else if (fmem) {
             JNEb(4);
             ZEROrd(EAX);
             LEAVE();
+            RET();
           } else {
             JNEb(3);
             ZEROrd(EAX);
+            RET();
           }
-          RET();
           MOVrd(EDX, ECX);
           ZEROrd(EDX);
           DIVrd(ECX);
@@ -1089,6 +1144,427 @@ static bpf_filter_func_t bpf_jit_compile(struct bpf_insn *prog, u_int nins,
   return (reinterpret_cast<bpf_filter_func_t>(stream.ibuf));
 }
 
+/* -------------------------------------------------------------------------
+ * Merging of multiple filters into a single program
+ * ------------------------------------------------------------------------- */
+
+/*
+ * Filters are concatenated in priority order. An accepting "ret" of a filter
+ * returns its gate, while a rejecting one jumps to the next filter. So does a
+ * bad packet load (see 'fail' of bpf_jit_compile()). Falling off the last
+ * filter returns 0, the default gate.
+ *
+ * Filters generated by libpcap mostly start with the same tests (e.g.,
+ * "ldh [12]; jeq #0x800"), which need not be run again on the same packet.
+ * Jumps are threaded through loads and tests whose results are already known
+ * on the way, and then unreachable instructions are dropped.
+ */
+
+/*
+ * A value loaded from the packet, as (size << 32 | k) for "ld{,h,b} [k]".
+ * "ldxb 4*([k]&0xf)" is (kMshLoad | k), and "ld{,h,b} [x + k]" with such X is
+ * (kIndLoad | msh_k << 41 | size << 32 | k).
+ */
+typedef uint64_t bpf_load_t;
+
+static const bpf_load_t kNoLoad = UINT64_MAX;
+static const bpf_load_t kMshLoad = 1ull << 63;
+static const bpf_load_t kIndLoad = 1ull << 40;
+
+/* Known facts are bounded, to keep merging of many filters cheap */
+static const size_t kMaxFacts = 32;
+
+/* "jxx #k" on a loaded value is known to be 'result' */
+struct bpf_fact {
+  bpf_load_t load;
+  uint16_t op;
+  uint32_t k;
+  bool result;
+};
+
+/* What is known at a point of the program */
+struct bpf_state {
+  bpf_load_t a; /* the load that A holds, or kNoLoad */
+  bpf_load_t x; /* the load that X holds, or kNoLoad */
+  std::vector<bpf_fact> facts;
+};
+
+/* The load into A by the instruction, with 'x' in X (kNoLoad if unknown) */
+static bpf_load_t load_of(const struct bpf_insn &ins, bpf_load_t x) {
+  bpf_load_t load = (static_cast<bpf_load_t>(BPF_SIZE(ins.code)) << 32) | ins.k;
+
+  if (BPF_CLASS(ins.code) != BPF_LD)
+    return kNoLoad;
+
+  if (BPF_MODE(ins.code) == BPF_ABS)
+    return load;
+
+  if (BPF_MODE(ins.code) == BPF_IND && x != kNoLoad && (x & kMshLoad) &&
+      (x & ~kMshLoad) < (1u << 22))
+    return kIndLoad | (x & ~kMshLoad) << 41 | load;
+
+  return kNoLoad;
+}
+
+/* The load into X by the instruction */
+static bpf_load_t ldx_of(const struct bpf_insn &ins) {
+  if (ins.code == (BPF_LDX | BPF_MSH | BPF_B))
+    return kMshLoad | ins.k;
+
+  return kNoLoad;
+}
+
+static bool is_cond_jump(const struct bpf_insn &ins) {
+  return BPF_CLASS(ins.code) == BPF_JMP && BPF_OP(ins.code) != BPF_JA;
+}
+
+/* Can the instruction bail out on a bad packet? (see bpf_jit_compile()) */
+static bool can_fail(const struct bpf_insn &ins) {
+  switch (ins.code) {
+    case BPF_LD | BPF_W | BPF_ABS:
+    case BPF_LD | BPF_H | BPF_ABS:
+    case BPF_LD | BPF_B | BPF_ABS:
+    case BPF_LD | BPF_W | BPF_IND:
+    case BPF_LD | BPF_H | BPF_IND:
+    case BPF_LD | BPF_B | BPF_IND:
+    case BPF_LDX | BPF_MSH | BPF_B:
+    case BPF_ALU | BPF_DIV | BPF_X:
+      return true;
+  }
+  return false;
+}
+
+/* Does the instruction set A (or return) without reading A? */
+static bool overwrites_a(const struct bpf_insn &ins) {
+  return BPF_CLASS(ins.code) == BPF_LD || ins.code == (BPF_RET | BPF_K);
+}
+
+static bool eval_jump(uint16_t op, uint32_t v, uint32_t k) {
+  switch (op) {
+    case BPF_JEQ:
+      return v == k;
+    case BPF_JGT:
+      return v > k;
+    case BPF_JGE:
+      return v >= k;
+    case BPF_JSET:
+      return (v & k) != 0;
+  }
+  return false;
+}
+
+/* Returns 1 or 0 if "jxx #k" on the load is known to be true or false */
+static int known_result(const bpf_state &s, bpf_load_t load, uint16_t op,
+                        uint32_t k) {
+  for (const auto &f : s.facts) {
+    if (f.load != load)
+      continue;
+    if (f.op == op && f.k == k)
+      return f.result;
+    if (f.op == BPF_JEQ && f.result)
+      return eval_jump(op, f.k, k);
+  }
+  return -1;
+}
+
+/* Has the packet load already succeeded on the way here? */
+static bool is_loaded(const bpf_state &s, bpf_load_t load) {
+  if (s.a == load)
+    return true;
+
+  for (const auto &f : s.facts) {
+    if (f.load == load)
+      return true;
+  }
+  return false;
+}
+
+static void add_fact(bpf_state *s, bpf_load_t load, uint16_t op, uint32_t k,
+                     bool result) {
+  if (known_result(*s, load, op, k) >= 0)
+    return;
+
+  if (s->facts.size() >= kMaxFacts)
+    s->facts.erase(s->facts.begin());
+  s->facts.push_back({load, op, k, result});
+}
+
+/* Updates 's' to what is known after the (non-jump) instruction */
+static void step(const struct bpf_insn &ins, bpf_state *s) {
+  switch (BPF_CLASS(ins.code)) {
+    case BPF_LD:
+      s->a = load_of(ins, s->x);
+      break;
+    case BPF_LDX:
+      s->x = ldx_of(ins);
+      break;
+    case BPF_ALU:
+      s->a = kNoLoad;
+      break;
+    case BPF_MISC:
+      if (BPF_MISCOP(ins.code) == BPF_TAX)
+        s->x = s->a;
+      else
+        s->a = s->x;
+      break;
+  }
+}
+
+/* Updates 's' to what is known after the conditional jump is (not) taken */
+static void branch(const struct bpf_insn &ins, bool taken, bpf_state *s) {
+  if (BPF_SRC(ins.code) == BPF_K && s->a != kNoLoad)
+    add_fact(s, s->a, BPF_OP(ins.code), ins.k, taken);
+}
+
+/* Keeps only what is known on both paths */
+static void meet(bpf_state *to, const bpf_state &from) {
+  if (to->a != from.a)
+    to->a = kNoLoad;
+  if (to->x != from.x)
+    to->x = kNoLoad;
+
+  auto not_in_from = [&from](const bpf_fact &f) {
+    for (const auto &g : from.facts) {
+      if (f.load == g.load && f.op == g.op && f.k == g.k &&
+          f.result == g.result)
+        return false;
+    }
+    return true;
+  };
+  to->facts.erase(
+      std::remove_if(to->facts.begin(), to->facts.end(), not_in_from),
+      to->facts.end());
+}
+
+/* Computes the states at the beginning of reachable instructions */
+static void bpf_analyze(const std::vector<struct bpf_insn> &prog,
+                        const std::vector<u_int> &fail,
+                        std::vector<bpf_state> *in,
+                        std::vector<bool> *reached) {
+  auto propagate = [in, reached](u_int to, const bpf_state &s) {
+    if ((*reached)[to]) {
+      meet(&(*in)[to], s);
+    } else {
+      (*in)[to] = s;
+      (*reached)[to] = true;
+    }
+  };
+
+  in->assign(prog.size(), {kNoLoad, kNoLoad, {}});
+  reached->assign(prog.size(), false);
+  (*reached)[0] = true;
+
+  for (u_int i = 0; i < prog.size(); i++) {
+    const struct bpf_insn &ins = prog[i];
+
+    if (!(*reached)[i])
+      continue;
+
+    if (can_fail(ins)) {
+      /* A and X may have been clobbered */
+      bpf_state s = (*in)[i];
+
+      s.a = kNoLoad;
+      s.x = kNoLoad;
+      propagate(fail[i], s);
+    }
+
+    if (BPF_CLASS(ins.code) == BPF_RET)
+      continue;
+
+    if (ins.code == (BPF_JMP | BPF_JA)) {
+      propagate(i + 1 + ins.k, (*in)[i]);
+    } else if (is_cond_jump(ins)) {
+      bpf_state s_true = (*in)[i];
+      bpf_state s_false = (*in)[i];
+
+      branch(ins, true, &s_true);
+      branch(ins, false, &s_false);
+      propagate(i + 1 + ins.jt, s_true);
+      propagate(i + 1 + ins.jf, s_false);
+    } else {
+      bpf_state s = (*in)[i];
+
+      step(ins, &s);
+      propagate(i + 1, s);
+    }
+  }
+}
+
+/*
+ * Follows a jump to 'to' with the state 's' on the jump, through loads and
+ * tests with known results. X is left as is, so loads into X are skipped only
+ * if redundant. Returns the furthest instruction (up to 'limit')
+ * that the jump can go straight to.
+ */
+static u_int bpf_thread(const std::vector<struct bpf_insn> &prog, u_int to,
+                        bpf_state s, u_int limit) {
+  const bpf_load_t real_a = s.a;
+  u_int best = to;
+
+  for (;;) {
+    const struct bpf_insn &ins = prog[to];
+    bpf_load_t load = load_of(ins, s.x);
+
+    if (load != kNoLoad) {
+      /* Skipped loads must be known not to fail */
+      if (!is_loaded(s, load))
+        break;
+      s.a = load;
+      to++;
+    } else if (ldx_of(ins) != kNoLoad && ldx_of(ins) == s.x) {
+      to++;
+    } else if (ins.code == (BPF_JMP | BPF_JA)) {
+      to += 1 + ins.k;
+    } else if (is_cond_jump(ins) && BPF_SRC(ins.code) == BPF_K &&
+               s.a != kNoLoad) {
+      int result = known_result(s, s.a, BPF_OP(ins.code), ins.k);
+      if (result < 0)
+        break;
+      to += 1 + (result ? ins.jt : ins.jf);
+    } else {
+      break;
+    }
+
+    if (to > limit)
+      break;
+
+    /* A must be what the code there expects, unless it is overwritten */
+    if (s.a == real_a || overwrites_a(prog[to]))
+      best = to;
+  }
+
+  return best;
+}
+
+/* Retargets jumps with bpf_thread() */
+static void bpf_thread_jumps(std::vector<struct bpf_insn> *prog,
+                             const std::vector<u_int> &fail) {
+  std::vector<bpf_state> in;
+  std::vector<bool> reached;
+
+  bpf_analyze(*prog, fail, &in, &reached);
+
+  for (u_int i = 0; i < prog->size(); i++) {
+    struct bpf_insn &ins = (*prog)[i];
+
+    if (!reached[i])
+      continue;
+
+    if (ins.code == (BPF_JMP | BPF_JA)) {
+      u_int to = bpf_thread(*prog, i + 1 + ins.k, in[i], prog->size() - 1);
+      ins.k = to - (i + 1);
+    } else if (is_cond_jump(ins)) {
+      /* jt and jf are 8-bit */
+      u_int limit = std::min<u_int>(i + 1 + UINT8_MAX, prog->size() - 1);
+      bpf_state s_true = in[i];
+      bpf_state s_false = in[i];
+
+      branch(ins, true, &s_true);
+      branch(ins, false, &s_false);
+      ins.jt = bpf_thread(*prog, i + 1 + ins.jt, s_true, limit) - (i + 1);
+      ins.jf = bpf_thread(*prog, i + 1 + ins.jf, s_false, limit) - (i + 1);
+    }
+  }
+}
+
+/* Drops unreachable instructions */
+static void bpf_compact(std::vector<struct bpf_insn> *prog,
+                        std::vector<u_int> *fail) {
+  u_int n = prog->size();
+  std::vector<bool> live(n, false);
+  std::vector<u_int> new_idx(n);
+  u_int j = 0;
+
+  live[0] = true;
+  for (u_int i = 0; i < n; i++) {
+    const struct bpf_insn &ins = (*prog)[i];
+
+    if (!live[i])
+      continue;
+
+    if (can_fail(ins))
+      live[(*fail)[i]] = true;
+
+    if (BPF_CLASS(ins.code) == BPF_RET) {
+      continue;
+    } else if (ins.code == (BPF_JMP | BPF_JA)) {
+      live[i + 1 + ins.k] = true;
+    } else if (is_cond_jump(ins)) {
+      live[i + 1 + ins.jt] = true;
+      live[i + 1 + ins.jf] = true;
+    } else {
+      live[i + 1] = true;
+    }
+  }
+
+  for (u_int i = 0; i < n; i++) {
+    new_idx[i] = j;
+    j += live[i];
+  }
+
+  /* Jumps only get shorter, so jt and jf do not overflow */
+  j = 0;
+  for (u_int i = 0; i < n; i++) {
+    struct bpf_insn ins = (*prog)[i];
+
+    if (!live[i])
+      continue;
+
+    if (ins.code == (BPF_JMP | BPF_JA)) {
+      ins.k = new_idx[i + 1 + ins.k] - (j + 1);
+    } else if (is_cond_jump(ins)) {
+      ins.jt = new_idx[i + 1 + ins.jt] - (j + 1);
+      ins.jf = new_idx[i + 1 + ins.jf] - (j + 1);
+    }
+
+    (*fail)[j] = can_fail(ins) ? new_idx[(*fail)[i]] : 0;
+    (*prog)[j++] = ins;
+  }
+
+  prog->resize(j);
+  fail->resize(j);
+}
+
+/*
+ * Returns a single program that returns the gate of the first matching filter
+ * (0 if none), or nullptr if the filters cannot be merged.
+ */
+static bpf_filter_func_t bpf_merge_compile(const struct filter *filters,
+                                           int n_filters, size_t *size) {
+  std::vector<struct bpf_insn> prog;
+  std::vector<u_int> fail;
+
+  for (int f = 0; f < n_filters; f++) {
+    u_int base = prog.size();
+    u_int next = base + filters[f].n_insns;
+
+    for (u_int i = 0; i < filters[f].n_insns; i++) {
+      struct bpf_insn ins = filters[f].insns[i];
+
+      if (ins.code == (BPF_RET | BPF_A)) {
+        return nullptr; /* not generated by libpcap */
+      } else if (ins.code == (BPF_RET | BPF_K) && ins.k) {
+        ins.k = filters[f].gate;
+      } else if (ins.code == (BPF_RET | BPF_K)) {
+        ins.code = BPF_JMP | BPF_JA;
+        ins.k = next - (base + i + 1);
+      }
+
+      prog.push_back(ins);
+      fail.push_back(next);
+    }
+  }
+
+  prog.push_back({BPF_RET | BPF_K, 0, 0, 0});
+  fail.push_back(0);
+
+  bpf_thread_jumps(&prog, fail);
+  bpf_compact(&prog, &fail);
+
+  return bpf_jit_compile(prog.data(), prog.size(), fail.data(), size);
+}
+
 /* -------------------------------------------------------------------------
  * Module code begins from here
  * ------------------------------------------------------------------------- */
@@ -1111,7 +1587,8 @@ static int compare_filter(const void *filter1, const void *filter2) {
 
 const Commands BPF::cmds = {
     {"add", "BPFArg", MODULE_CMD_FUNC(&BPF::CommandAdd), 0},
-    {"clear", "EmptyArg", MODULE_CMD_FUNC(&BPF::CommandClear), 0}};
+    {"clear", "EmptyArg", MODULE_CMD_FUNC(&BPF::CommandClear), 0},
+    {"load_ebpf", "EBPFArg", MODULE_CMD_FUNC(&BPF::CommandLoadEbpf), 0}};
 
 CommandResponse BPF::Init(const bess::pb::BPFArg &arg) {
   return CommandAdd(arg);
@@ -1121,51 +1598,298 @@ void BPF::DeInit() {
   for (int i = 0; i < n_filters_; i++) {
     munmap(reinterpret_cast<void *>(filters_[i].func), filters_[i].mmap_size);
     free(filters_[i].exp);
+    free(filters_[i].insns);
   }
 
   n_filters_ = 0;
+  MergeFilters();
+
+  ebpf_.reset();
+  ebpf_attrs_.clear();
+  ebpf_maps_.clear();
+}
+
+void BPF::MergeFilters() {
+  bpf_filter_func_t func = nullptr;
+  size_t size = 0;
+
+  if (n_filters_ >= 2) {
+    func = bpf_merge_compile(filters_, n_filters_, &size);
+    if (!func) {
+      LOG(WARNING) << name() << ": failed to merge filters. "
+                   << "Running them one by one.";
+    }
+  }
+
+  if (merged_func_) {
+    munmap(reinterpret_cast<void *>(merged_func_), merged_size_);
+  }
+
+  merged_func_ = func;
+  merged_size_ = size;
+}
+
+CommandResponse BPF::AddFilter(const bess::pb::BPFArg_Filter &f) {
+  struct filter *filter = &filters_[n_filters_];
+  struct bpf_program il_code;
+
+  const char *exp = f.filter().c_str();
+  int64_t gate = f.gate();
+  if (gate < 0 || gate >= MAX_GATES) {
+    return CommandFailure(EINVAL, "Invalid gate");
+  }
+  if (pcap_compile_nopcap(SNAPLEN, DLT_EN10MB,  // Ethernet
+                          &il_code, exp, 1,     // optimize (IL only)
+                          PCAP_NETMASK_UNKNOWN) == -1) {
+    return CommandFailure(EINVAL, "BPF compilation error");
+  }
+  filter->priority = f.priority();
+  filter->gate = f.gate();
+  filter->exp = strdup(exp);
+  filter->func = bpf_jit_compile(il_code.bf_insns, il_code.bf_len, nullptr,
+                                 &filter->mmap_size);
+  if (!filter->func) {
+    pcap_freecode(&il_code);
+    free(filter->exp);
+    return CommandFailure(ENOMEM, "BPF JIT compilation error");
+  }
+  filter->n_insns = il_code.bf_len;
+  filter->insns = static_cast<struct bpf_insn *>(
+      malloc(il_code.bf_len * sizeof(struct bpf_insn)));
+  if (!filter->insns) {
+    pcap_freecode(&il_code);
+    munmap(reinterpret_cast<void *>(filter->func), filter->mmap_size);
+    free(filter->exp);
+    return CommandFailure(ENOMEM, "malloc() failed");
+  }
+  memcpy(filter->insns, il_code.bf_insns,
+         il_code.bf_len * sizeof(struct bpf_insn));
+  pcap_freecode(&il_code);
+
+  n_filters_++;
+  qsort(filters_, n_filters_, sizeof(struct filter), &compare_filter);
+
+  return CommandSuccess();
 }
 
 CommandResponse BPF::CommandAdd(const bess::pb::BPFArg &arg) {
+  if (ebpf_ && arg.filters_size() > 0) {
+    return CommandFailure(EINVAL, "An eBPF program is loaded");
+  }
+
   if (n_filters_ + arg.filters_size() > MAX_FILTERS) {
     return CommandFailure(EINVAL, "Too many filters");
   }
 
-  struct filter *filter = &filters_[n_filters_];
-  struct bpf_program il_code;
+  CommandResponse err = CommandSuccess();
 
   for (const auto &f : arg.filters()) {
-    const char *exp = f.filter().c_str();
-    int64_t gate = f.gate();
-    if (gate < 0 || gate >= MAX_GATES) {
-      return CommandFailure(EINVAL, "Invalid gate");
+    err = AddFilter(f);
+    if (err.error().code() != 0) {
+      break;
+    }
+  }
+
+  // Filters added before any failure stay
+  MergeFilters();
+  return err;
+}
+
+CommandResponse BPF::CommandClear(const bess::pb::EmptyArg &) {
+  DeInit();
+  return CommandSuccess();
+}
+
+uint64_t BPF::EbpfGetAttr(uint64_t attr, uint64_t, uint64_t, uint64_t,
+                          uint64_t, void *arg) {
+  const EbpfContext *c = static_cast<EbpfContext *>(arg);
+  const BPF *m = c->module;
+  uint64_t val = 0;
+
+  if (attr < m->ebpf_attrs_.size()) {
+    const EbpfAttr &a = m->ebpf_attrs_[attr];
+    uint8_t *p = ptr_attr_with_offset<uint8_t>(m->attr_offset(a.id), c->pkt);
+    if (p) {
+      memcpy(&val, p, a.size);
     }
-    if (pcap_compile_nopcap(SNAPLEN, DLT_EN10MB,  // Ethernet
-                            &il_code, exp, 1,     // optimize (IL only)
-                            PCAP_NETMASK_UNKNOWN) == -1) {
-      return CommandFailure(EINVAL, "BPF compilation error");
+  }
+
+  return val;
+}
+
+uint64_t BPF::EbpfSetAttr(uint64_t attr, uint64_t val, uint64_t, uint64_t,
+                          uint64_t, void *arg) {
+  const EbpfContext *c = static_cast<EbpfContext *>(arg);
+  const BPF *m = c->module;
+
+  if (attr < m->ebpf_attrs_.size()) {
+    const EbpfAttr &a = m->ebpf_attrs_[attr];
+    uint8_t *p = ptr_attr_with_offset<uint8_t>(m->attr_offset(a.id), c->pkt);
+    if (p) {
+      memcpy(p, &val, a.size);
     }
-    filter->priority = f.priority();
-    filter->gate = f.gate();
-    filter->exp = strdup(exp);
-    filter->func =
-        bpf_jit_compile(il_code.bf_insns, il_code.bf_len, &filter->mmap_size);
-    pcap_freecode(&il_code);
-    if (!filter->func) {
-      free(filter->exp);
-      return CommandFailure(ENOMEM, "BPF JIT compilation error");
+  }
+
+  return 0;
+}
+
+uint64_t BPF::EbpfMapLookup(uint64_t map, uint64_t key, uint64_t def,
+                            uint64_t, uint64_t, void *arg) {
+  const BPF *m = static_cast<EbpfContext *>(arg)->module;
+
+  if (map < m->ebpf_maps_.size()) {
+    const auto *entry = m->ebpf_maps_[map].map.Find(key);
+    if (entry) {
+      return entry->second;
     }
-    n_filters_++;
-    qsort(filters_, n_filters_, sizeof(struct filter), &compare_filter);
+  }
 
-    filter++;
+  return def;
+}
+
+uint64_t BPF::EbpfMapUpdate(uint64_t map, uint64_t key, uint64_t val,
+                            uint64_t, uint64_t, void *arg) {
+  BPF *m = static_cast<EbpfContext *>(arg)->module;
+
+  if (map >= m->ebpf_maps_.size()) {
+    return -EINVAL;
   }
 
+  EbpfMap &em = m->ebpf_maps_[map];
+  auto *entry = em.map.Find(key);
+
+  if (entry) {
+    entry->second = val;
+    return 0;
+  }
+
+  if (em.map.Count() >= em.max_entries || !em.map.Insert(key, val)) {
+    return -ENOSPC;
+  }
+
+  return 0;
+}
+
+uint64_t BPF::EbpfMapDelete(uint64_t map, uint64_t key, uint64_t, uint64_t,
+                            uint64_t, void *arg) {
+  BPF *m = static_cast<EbpfContext *>(arg)->module;
+
+  if (map >= m->ebpf_maps_.size()) {
+    return -EINVAL;
+  }
+
+  return m->ebpf_maps_[map].map.Remove(key) ? 0 : -ENOENT;
+}
+
+CommandResponse BPF::AddEbpfAttr(const bess::pb::EBPFArg_Attr &attr,
+                                 EbpfAttr *out) {
+  using AccessMode = bess::metadata::Attribute::AccessMode;
+  AccessMode mode;
+
+  if (attr.mode() == "read") {
+    mode = AccessMode::kRead;
+  } else if (attr.mode() == "write") {
+    mode = AccessMode::kWrite;
+  } else if (attr.mode() == "update") {
+    mode = AccessMode::kUpdate;
+  } else {
+    return CommandFailure(EINVAL, "Invalid mode '%s' for attribute '%s'",
+                          attr.mode().c_str(), attr.name().c_str());
+  }
+
+  if (attr.size() < 1 || attr.size() > 8) {
+    return CommandFailure(EINVAL, "Attribute '%s' must be 1-8 bytes",
+                          attr.name().c_str());
+  }
+
+  int id = AddMetadataAttr(attr.name(), attr.size(), mode);
+
+  if (id == -EEXIST) {
+    // Registered for a previous program. Attributes cannot be removed.
+    const auto &attrs = all_attrs();
+    id = 0;
+    while (attrs[id].name != attr.name()) {
+      id++;
+    }
+
+    if (attrs[id].size != static_cast<size_t>(attr.size()) ||
+        attrs[id].mode != mode) {
+      return CommandFailure(EEXIST,
+                            "Attribute '%s' is already registered with a "
+                            "different size or mode",
+                            attr.name().c_str());
+    }
+  } else if (id < 0) {
+    return CommandFailure(-id, "Failed to register attribute '%s'",
+                          attr.name().c_str());
+  }
+
+  out->id = id;
+  out->size = attr.size();
   return CommandSuccess();
 }
 
-CommandResponse BPF::CommandClear(const bess::pb::EmptyArg &) {
-  DeInit();
+CheckConstraintResult BPF::CheckModuleConstraints() const {
+  if (!ebpf_maps_.empty() && num_active_workers() > 1) {
+    LOG(ERROR) << name() << " runs an eBPF program with maps, but packets "
+               << "come in on " << num_active_workers() << " workers";
+    return CHECK_FATAL_ERROR;
+  }
+
+  return Module::CheckModuleConstraints();
+}
+
+CommandResponse BPF::CommandLoadEbpf(const bess::pb::EBPFArg &arg) {
+  using bess::utils::ebpf::Insn;
+  using bess::utils::ebpf::Program;
+
+  const std::string &code = arg.program();
+  std::unique_ptr<Program> prog(new Program());
+  std::vector<EbpfAttr> attrs(arg.attrs_size());
+  std::vector<EbpfMap> maps(arg.maps_size());
+  std::string err;
+
+  if (n_filters_ > 0) {
+    return CommandFailure(EINVAL, "Filters are installed");
+  }
+
+  if (code.size() % sizeof(Insn) != 0) {
+    return CommandFailure(EINVAL, "Program size must be a multiple of %zu",
+                          sizeof(Insn));
+  }
+
+  std::vector<Insn> insns(code.size() / sizeof(Insn));
+  memcpy(insns.data(), code.data(), code.size());
+
+  if (!prog->Load(insns.data(), insns.size(),
+                  {EbpfGetAttr, EbpfSetAttr, EbpfMapLookup, EbpfMapUpdate,
+                   EbpfMapDelete},
+                  &err)) {
+    return CommandFailure(EINVAL, "Invalid eBPF program: %s", err.c_str());
+  }
+
+  if (!arg.no_jit() && !prog->Jit()) {
+    return CommandFailure(ENOMEM, "eBPF JIT compilation error");
+  }
+
+  for (int i = 0; i < arg.maps_size(); i++) {
+    if (arg.maps(i).max_entries() == 0) {
+      return CommandFailure(EINVAL, "Map %d has no room for entries", i);
+    }
+    maps[i].max_entries = arg.maps(i).max_entries();
+  }
+
+  for (int i = 0; i < arg.attrs_size(); i++) {
+    CommandResponse ret = AddEbpfAttr(arg.attrs(i), &attrs[i]);
+    if (ret.error().code() != 0) {
+      return ret;
+    }
+  }
+
+  ebpf_ = std::move(prog);
+  ebpf_attrs_ = std::move(attrs);
+  ebpf_maps_ = std::move(maps);
+
   return CommandSuccess();
 }
 
@@ -1203,11 +1927,35 @@ inline void BPF::process_batch_1filter(bess::PacketBatch *batch) {
     RunChooseModule(filter->gate, &out_batches[1]);
 }
 
+void BPF::ProcessBatchEbpf(bess::PacketBatch *batch) {
+  gate_idx_t out_gates[bess::PacketBatch::kMaxBurst];
+  EbpfContext ectx = {.module = this, .pkt = nullptr};
+  int cnt = batch->cnt();
+
+  for (int i = 0; i < cnt; i++) {
+    bess::Packet *pkt = batch->pkts()[i];
+    uint64_t ret;
+
+    ectx.pkt = pkt;
+    ret = ebpf_->Run(pkt->head_data<uint8_t *>(), pkt->head_len(), &ectx);
+
+    // Including Program::kAbort
+    out_gates[i] = ret < MAX_GATES ? ret : DROP_GATE;
+  }
+
+  RunSplit(out_gates, batch);
+}
+
 void BPF::ProcessBatch(bess::PacketBatch *batch) {
   gate_idx_t out_gates[bess::PacketBatch::kMaxBurst];
   int n_filters = n_filters_;
   int cnt;
 
+  if (ebpf_) {
+    ProcessBatchEbpf(batch);
+    return;
+  }
+
   if (n_filters == 0) {
     RunNextModule(batch);
     return;
@@ -1220,24 +1968,12 @@ void BPF::ProcessBatch(bess::PacketBatch *batch) {
 
   cnt = batch->cnt();
 
-  /* slow version for general cases */
   for (int i = 0; i < cnt; i++) {
-    bess::Packet *pkt = batch->pkts()[i];
-    struct filter *filter = &filters_[0];
-    gate_idx_t gate = 0; /* default gate for unmatched pkts */
-
-    for (int j = 0; j < n_filters; j++, filter++) {
-      if (filter->func(pkt->head_data<uint8_t *>(), pkt->total_len(),
-                       pkt->head_len()) != 0) {
-        gate = filter->gate;
-        break;
-      }
-    }
-
-    out_gates[i] = gate;
+    out_gates[i] = Match(batch->pkts()[i]);
   }
 
   RunSplit(out_gates, batch);
 }
 
-ADD_MODULE(BPF, "bpf", "classifies packets with pcap-filter(7) syntax")
+ADD_MODULE(BPF, "bpf",
+           "classifies packets with pcap-filter(7) syntax or eBPF programs")
@@ -1,13 +1,23 @@
 #ifndef BESS_MODULES_BPF_H_
 #define BESS_MODULES_BPF_H_
 
+#include <rte_config.h>
+#include <rte_hash_crc.h>
+
+#include <memory>
+#include <vector>
+
 #include "../module.h"
 #include "../module_msg.pb.h"
+#include "../utils/cuckoo_map.h"
+#include "../utils/ebpf.h"
 
 #define MAX_FILTERS 128
 
 typedef u_int (*bpf_filter_func_t)(u_char *, u_int, u_int);
 
+struct bpf_insn;
+
 struct filter {
   bpf_filter_func_t func;
   int gate;
@@ -15,6 +25,9 @@ struct filter {
   size_t mmap_size; /* needed for munmap() */
   int priority;     /* higher number == higher priority */
   char *exp;        /* original filter expression string */
+
+  struct bpf_insn *insns; /* IL code, kept for merging with other filters */
+  u_int n_insns;
 };
 
 class BPF final : public Module {
@@ -23,18 +36,102 @@ class BPF final : public Module {
 
   static const Commands cmds;
 
+  BPF() : Module() { max_allowed_workers_ = Worker::kMaxWorkers; }
+
   CommandResponse Init(const bess::pb::BPFArg &arg);
   void DeInit() override;
 
   void ProcessBatch(bess::PacketBatch *batch) override;
 
+  // Filters can run on any number of workers, but the maps of an eBPF program
+  // are not locked. Fails if a program with maps gets packets from more than
+  // one worker.
+  CheckConstraintResult CheckModuleConstraints() const override;
+
   CommandResponse CommandAdd(const bess::pb::BPFArg &arg);
   CommandResponse CommandClear(const bess::pb::EmptyArg &arg);
+  CommandResponse CommandLoadEbpf(const bess::pb::EBPFArg &arg);
+
+  // Returns the gate of the first (highest-priority) filter that matches the
+  // packet, or 0 if none does.
+  gate_idx_t Match(bess::Packet *pkt) const {
+    if (merged_func_) {
+      return merged_func_(pkt->head_data<uint8_t *>(), pkt->total_len(),
+                          pkt->head_len());
+    }
+    return MatchEach(pkt);
+  }
+
+  // Same as Match(), but without the merged program, running the filters one
+  // by one until one matches.
+  gate_idx_t MatchEach(bess::Packet *pkt) const {
+    for (int i = 0; i < n_filters_; i++) {
+      if (filters_[i].func(pkt->head_data<uint8_t *>(), pkt->total_len(),
+                           pkt->head_len()) != 0) {
+        return filters_[i].gate;
+      }
+    }
+    return 0; /* default gate for unmatched pkts */
+  }
 
  private:
+  struct EbpfMapHash {
+    bess::utils::HashResult operator()(uint64_t key) const {
+      return rte_hash_crc_8byte(key, 0);
+    }
+  };
+
+  struct EbpfAttr {
+    int id;
+    size_t size;
+  };
+
+  struct EbpfMap {
+    bess::utils::CuckooMap<uint64_t, uint64_t, EbpfMapHash> map;
+    size_t max_entries;
+  };
+
+  // Passed to the helpers
+  struct EbpfContext {
+    BPF *module;
+    bess::Packet *pkt;
+  };
+
+  // Helpers callable from eBPF programs, in the order of their numbers
+  static uint64_t EbpfGetAttr(uint64_t attr, uint64_t, uint64_t, uint64_t,
+                              uint64_t, void *arg);
+  static uint64_t EbpfSetAttr(uint64_t attr, uint64_t val, uint64_t, uint64_t,
+                              uint64_t, void *arg);
+  static uint64_t EbpfMapLookup(uint64_t map, uint64_t key, uint64_t def,
+                                uint64_t, uint64_t, void *arg);
+  static uint64_t EbpfMapUpdate(uint64_t map, uint64_t key, uint64_t val,
+                                uint64_t, uint64_t, void *arg);
+  static uint64_t EbpfMapDelete(uint64_t map, uint64_t key, uint64_t, uint64_t,
+                                uint64_t, void *arg);
+
+  CommandResponse AddEbpfAttr(const bess::pb::EBPFArg_Attr &attr,
+                              EbpfAttr *out);
+
+  void ProcessBatchEbpf(bess::PacketBatch *batch);
+
+  CommandResponse AddFilter(const bess::pb::BPFArg_Filter &f);
+
+  // (Re)builds merged_func_ out of all filters
+  void MergeFilters();
+
   struct filter filters_[MAX_FILTERS + 1] = {};
   int n_filters_ = {};
 
+  // All filters merged into a single program that returns the gate. Null if
+  // there are less than two filters, or they could not be merged.
+  bpf_filter_func_t merged_func_ = {};
+  size_t merged_size_ = {};
+
+  // If set, runs instead of the filters (there can be none then)
+  std::unique_ptr<bess::utils::ebpf::Program> ebpf_;
+  std::vector<EbpfAttr> ebpf_attrs_;
+  std::vector<EbpfMap> ebpf_maps_;
+
   inline void process_batch_1filter(bess::PacketBatch *batch);
 };
 
@@ -0,0 +1,78 @@
+// Benchmark for BPF module.
+
+#include <benchmark/benchmark.h>
+#include <glog/logging.h>
+
+#include <cstring>
+#include <string>
+
+#include "bpf.h"
+
+namespace {
+
+// Installs 'n' filters, alternating "tcp dst port" and "udp dst port", none of
+// which matches the packet. Every filter thus has to be tried.
+class BPFFixture : public benchmark::Fixture {
+ public:
+  void SetUp(benchmark::State &state) override {
+    bess::pb::BPFArg arg;
+
+    for (int i = 0; i < state.range(0); i++) {
+      bess::pb::BPFArg_Filter *f = arg.add_filters();
+
+      f->set_filter((i % 2 ? "tcp" : "udp") + std::string(" dst port ") +
+                    std::to_string(1000 + i));
+      f->set_gate(i + 1);
+    }
+
+    CommandResponse ret = bpf_.Init(arg);
+    CHECK_EQ(ret.error().code(), 0);
+
+    // Ethernet/IPv4/TCP to port 80
+    pkt_.set_buffer(pkt_.data());
+
+    uint8_t *p = pkt_.head_data<uint8_t *>();
+    memset(p, 0, kPktLen);
+    p[12] = 0x08;  // IPv4
+    p[14] = 0x45;
+    p[23] = 0x06;  // TCP
+    p[37] = 80;
+    pkt_.set_data_len(kPktLen);
+    pkt_.set_total_len(kPktLen);
+  }
+
+  void TearDown(benchmark::State &) override { bpf_.DeInit(); }
+
+ protected:
+  static const int kPktLen = 64;
+
+  BPF bpf_;
+  bess::Packet pkt_;
+};
+
+}  // namespace (unnamed)
+
+// All filters merged into a single program
+BENCHMARK_DEFINE_F(BPFFixture, Match)(benchmark::State &state) {
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(bpf_.Match(&pkt_));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// One program per filter
+BENCHMARK_DEFINE_F(BPFFixture, MatchEach)(benchmark::State &state) {
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(bpf_.MatchEach(&pkt_));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_REGISTER_F(BPFFixture, Match)
+    ->RangeMultiplier(2)
+    ->Range(2, MAX_FILTERS);
+BENCHMARK_REGISTER_F(BPFFixture, MatchEach)
+    ->RangeMultiplier(2)
+    ->Range(2, MAX_FILTERS);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,165 @@
+#include "bpf.h"
+
+#include <algorithm>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "../packet.h"
+#include "../utils/random.h"
+
+namespace {
+
+// Filters are merged into a single program when there are two or more. The
+// merged program must pick the same gate as running the filters one by one,
+// whatever the priorities, overlaps and packets are.
+class BPFTest : public ::testing::Test {
+ protected:
+  BPFTest() : rd_(1234) {}
+
+  std::string RandomExpression() {
+    switch (rd_.GetRange(14)) {
+      case 0:
+        return "ip";
+      case 1:
+        return "ip6";
+      case 2:
+        return "arp";
+      case 3:
+        return "vlan";
+      case 4:
+        return "tcp";
+      case 5:
+        return "udp";
+      case 6:
+        return "tcp dst port " + std::to_string(rd_.GetRange(8));
+      case 7:
+        return "udp src port " + std::to_string(rd_.GetRange(8));
+      case 8:
+        return "src host 10.0.0." + std::to_string(rd_.GetRange(8));
+      case 9:
+        return "ip6 and tcp";
+      case 10:
+        return "vlan and ip";
+      case 11:
+        return "ip[6:2] & 0x3fff != 0";  // fragments
+      case 12:
+        return "len >= " + std::to_string(rd_.GetRange(128));
+      default:
+        return "ether[0] & 1 != 0";
+    }
+  }
+
+  // Fills the packet with a random frame, more or less well formed, possibly
+  // truncated.
+  void RandomPacket(bess::Packet *pkt) {
+    uint8_t *p = pkt->head_data<uint8_t *>();
+    size_t off = 12;
+    size_t len;
+
+    for (size_t i = 0; i < 128; i++) {
+      p[i] = rd_.Get();
+    }
+
+    // VLAN, or QinQ
+    if (rd_.GetRange(4) == 0) {
+      if (rd_.GetRange(2) == 0) {
+        p[off++] = 0x88;
+        p[off++] = 0xa8;
+        off += 2;
+      }
+      p[off++] = 0x81;
+      p[off++] = 0x00;
+      off += 2;
+    }
+
+    switch (rd_.GetRange(8)) {
+      case 0:
+      case 1:
+      case 2:
+      case 3:
+        p[off++] = 0x08;
+        p[off++] = 0x00;
+        p[off] = 0x40 | (rd_.GetRange(4) ? 5 : 5 + rd_.GetRange(11));
+        // No fragment, a first fragment, or a later one
+        p[off + 6] = rd_.GetRange(3) ? 0 : 0x20 | rd_.GetRange(2);
+        p[off + 7] = rd_.GetRange(2) ? 0 : rd_.Get();
+        p[off + 9] = rd_.GetRange(2) ? 6 : 17;
+        p[off + 12] = 10;
+        p[off + 13] = 0;
+        p[off + 14] = 0;
+        p[off + 15] = rd_.GetRange(8);
+        off += (p[off] & 0xf) * 4;
+        break;
+      case 4:
+      case 5:
+        p[off++] = 0x86;
+        p[off++] = 0xdd;
+        // TCP, UDP, a fragment header, or hop-by-hop options
+        p[off + 6] = kIpv6NextHeaders[rd_.GetRange(4)];
+        off += 40;
+        break;
+      case 6:
+        p[off++] = 0x08;
+        p[off++] = 0x06;
+        break;
+      default:
+        off += 2;
+        break;
+    }
+
+    // Ports
+    if (off + 4 <= 128) {
+      p[off] = 0;
+      p[off + 1] = rd_.GetRange(8);
+      p[off + 2] = 0;
+      p[off + 3] = rd_.GetRange(8);
+    }
+
+    len = rd_.GetRange(4) ? std::max<size_t>(off + 20, 60) : rd_.GetRange(off);
+    len = std::min<size_t>(len, 128);
+    pkt->set_data_len(len);
+    pkt->set_total_len(len);
+  }
+
+  static constexpr uint8_t kIpv6NextHeaders[] = {6, 17, 44, 0};
+
+  Random rd_;
+};
+
+constexpr uint8_t BPFTest::kIpv6NextHeaders[];
+
+TEST_F(BPFTest, MergedMatchesEach) {
+  bess::Packet pkt;
+
+  pkt.set_buffer(pkt.data());
+  pkt.set_data_off(0);
+
+  for (int trial = 0; trial < 200; trial++) {
+    BPF bpf;
+    bess::pb::BPFArg arg;
+    int n = 1 + rd_.GetRange(trial % 2 ? 8 : MAX_FILTERS);
+
+    for (int i = 0; i < n; i++) {
+      bess::pb::BPFArg_Filter *f = arg.add_filters();
+
+      // Gate 0 is also the default one. Few priorities, so that they overlap.
+      f->set_filter(RandomExpression());
+      f->set_gate(rd_.GetRange(8));
+      f->set_priority(rd_.GetRange(4));
+    }
+
+    ASSERT_EQ(0, bpf.Init(arg).error().code());
+
+    for (int i = 0; i < 1000; i++) {
+      RandomPacket(&pkt);
+      ASSERT_EQ(bpf.MatchEach(&pkt), bpf.Match(&pkt))
+          << "trial " << trial << ", packet " << i << " of "
+          << pkt.total_len() << " bytes";
+    }
+
+    bpf.DeInit();
+  }
+}
+
+}  // namespace (unnamed)
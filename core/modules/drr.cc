@@ -1,5 +1,6 @@
 #include "drr.h"
 
+#include <algorithm>
 #include <cmath>
 #include <fstream>
 #include <iostream>
@@ -24,12 +25,23 @@ const Commands DRR::cmds = {
     {"set_quantum_size", "DRRQuantumArg",
      MODULE_CMD_FUNC(&DRR::CommandQuantumSize), 0},
     {"set_max_flow_queue_size", "DRRMaxFlowQueueSizeArg",
-     MODULE_CMD_FUNC(&DRR::CommandMaxFlowQueueSize), 0}};
+     MODULE_CMD_FUNC(&DRR::CommandMaxFlowQueueSize), 0},
+    {"get_stats", "EmptyArg", MODULE_CMD_FUNC(&DRR::CommandGetStats), 0}};
 
 DRR::DRR()
     : quantum_(kDefaultQuantum),
       max_queue_size_(kFlowQueueMax),
       max_number_flows_(kDefaultNumFlows),
+      max_buffered_(kDefaultMaxBuffered),
+      num_buffered_(0),
+      chunks_(),
+      free_desc_(kNoDesc),
+      by_length_(),
+      longest_(0),
+      aqm_(),
+      aqm_drops_(0),
+      sojourn_long_(0),
+      sojourn_hist_(),
       flow_ring_(nullptr),
       current_flow_(nullptr) {}
 
@@ -63,6 +75,26 @@ CommandResponse DRR::Init(const bess::pb::DRRArg& arg) {
     }
   }
 
+  if (arg.max_buffered_packets() != 0) {
+    err = SetMaxBuffered(arg.max_buffered_packets());
+    if (err.error().code() != 0) {
+      return err;
+    }
+  }
+
+  ResizeLengthLists();
+
+  if (arg.has_aqm()) {
+    bess::utils::Aqm::Policy policy;
+
+    if (!bess::utils::Aqm::ParsePolicy(arg.aqm().policy(), &policy)) {
+      return CommandFailure(EINVAL, "AQM policy must be 'codel', 'pie' or ''");
+    }
+    aqm_ = bess::utils::Aqm(policy, arg.aqm().target_ns(),
+                            arg.aqm().interval_ns());
+    sojourn_hist_.reset(new LogHistogram());
+  }
+
   /* register task */
   tid = RegisterTask(nullptr);
   if (tid == INVALID_TASK_ID) {
@@ -168,18 +200,15 @@ uint32_t DRR::GetNextBatch(bess::PacketBatch* batch, int* err) {
       continue;
     }
 
-    uint32_t bytes = GetNextPackets(batch, f, err);
-    total_bytes += bytes;
-    if (*err != 0) {
-      return total_bytes;
-    }
+    total_bytes += GetNextPackets(batch, f);
 
-    if (llring_empty(f->queue) && !f->next_packet) {
+    if (f->qlen == 0) {
       f->deficit = 0;
+      f->aqm.Empty();
     }
 
     // if the flow doesn't have any more packets to give, reenqueue it
-    if (!f->next_packet || f->next_packet->total_len() > f->deficit) {
+    if (f->qlen == 0 || desc(f->head).pkt->total_len() > f->deficit) {
       *err = llring_enqueue(flow_ring_, f);
       if (*err != 0) {
         return total_bytes;
@@ -203,7 +232,7 @@ DRR::Flow* DRR::GetNextFlow(int* err) {
       return nullptr;
     }
 
-    if (llring_empty(f->queue) && !f->next_packet) {
+    if (f->qlen == 0) {
       // if the flow expired, remove it
       if (now - f->timer > kTtl) {
         RemoveFlow(f);
@@ -224,27 +253,32 @@ DRR::Flow* DRR::GetNextFlow(int* err) {
   return f;
 }
 
-uint32_t DRR::GetNextPackets(bess::PacketBatch* batch, Flow* f, int* err) {
+uint32_t DRR::GetNextPackets(bess::PacketBatch* batch, Flow* f) {
   uint32_t total_bytes = 0;
-  bess::Packet* pkt;
+  uint64_t now = ctx.current_ns();
 
-  while (!batch->full() && (!llring_empty(f->queue) || f->next_packet)) {
-    // makes sure there isn't already a packet at the front
-    if (!f->next_packet) {
-      *err = llring_dequeue(f->queue, reinterpret_cast<void**>(&pkt));
-      if (*err < 0) {
-        return total_bytes;
-      }
-    } else {
-      pkt = f->next_packet;
-      f->next_packet = nullptr;
-    }
+  while (!batch->full() && f->qlen > 0) {
+    bess::Packet* pkt = desc(f->head).pkt;
+    uint64_t ts = desc(f->head).ts;
 
     if (pkt->total_len() > f->deficit) {
-      f->next_packet = pkt;
       break;
     }
 
+    PopPacket(f);
+
+    if (sojourn_hist_) {
+      uint64_t sojourn = now > ts ? now - ts : 0;
+
+      sojourn_hist_->insert(sojourn);
+      sojourn_long_ += sojourn >= kSojournLongNs;
+      if (f->aqm.ShouldDrop(now, sojourn, f->qlen == 0)) {
+        bess::Packet::Free(pkt);
+        aqm_drops_++;
+        continue;
+      }
+    }
+
     f->deficit -= pkt->total_len();
     total_bytes += pkt->total_len();
     batch->add(pkt);
@@ -273,11 +307,9 @@ void DRR::AddNewFlow(bess::Packet* pkt, FlowId id, int* err) {
   // creates flow
   Flow* f = new Flow(id);
 
-  // TODO(joshua) do proper error checking
-  f->queue = AddQueue(static_cast<int>(kFlowQueueSize), err);
-
-  if (*err != 0) {
-    return;
+  if (sojourn_hist_) {
+    f->aqm = bess::utils::Aqm(aqm_.policy(), aqm_.target_ns(),
+                              aqm_.interval_ns());
   }
 
   flows_.Insert(id, f);
@@ -295,6 +327,9 @@ void DRR::RemoveFlow(Flow* f) {
   if (f == current_flow_) {
     current_flow_ = nullptr;
   }
+  while (f->qlen > 0) {
+    bess::Packet::Free(PopPacket(f));
+  }
   flows_.Remove(f->id);
   delete f;
 }
@@ -320,55 +355,136 @@ llring* DRR::AddQueue(uint32_t slots, int* err) {
 
 void DRR::Enqueue(Flow* f, bess::Packet* newpkt, int* err) {
   // if the queue is full. drop the packet.
-  if (llring_count(f->queue) >= max_queue_size_) {
+  if (f->qlen >= max_queue_size_) {
     bess::Packet::Free(newpkt);
     return;
   }
 
-  // creates a new queue if there is not enough space for the new packet
-  // in the old queue
-  if (llring_full(f->queue)) {
-    uint32_t slots =
-        RoundToPowerTwo(llring_count(f->queue) * kQueueGrowthFactor);
-    f->queue = ResizeQueue(f->queue, slots, err);
-    if (*err != 0) {
+  uint32_t idx = AllocDesc();
+  if (idx == kNoDesc) {
+    // the buffer is full. drop from the longest queue, or this packet if this
+    // flow's queue is the longest.
+    if (f->qlen >= longest_) {
       bess::Packet::Free(newpkt);
       return;
     }
+    bess::Packet::Free(PopPacket(by_length_[longest_]));
+    idx = AllocDesc();
+  }
+
+  PushPacket(f, newpkt, idx);
+  f->timer = get_epoch_time();
+  *err = 0;
+}
+
+uint32_t DRR::AllocDesc() {
+  if (num_buffered_ >= max_buffered_) {
+    return kNoDesc;
   }
 
-  *err = llring_enqueue(f->queue, reinterpret_cast<void*>(newpkt));
-  if (*err == 0) {
-    f->timer = get_epoch_time();
+  if (free_desc_ == kNoDesc) {
+    uint32_t first = chunks_.size() * kPoolChunk;
+    Desc* chunk = new Desc[kPoolChunk];
+
+    for (uint32_t i = 0; i < kPoolChunk; i++) {
+      chunk[i].pkt = nullptr;
+      chunk[i].next = (i + 1 < kPoolChunk) ? first + i + 1 : kNoDesc;
+    }
+    chunks_.emplace_back(chunk);
+    free_desc_ = first;
+  }
+
+  uint32_t idx = free_desc_;
+  free_desc_ = desc(idx).next;
+  return idx;
+}
+
+void DRR::PushPacket(Flow* f, bess::Packet* pkt, uint32_t idx) {
+  Desc& d = desc(idx);
+
+  d.pkt = pkt;
+  d.ts = ctx.current_ns();
+  d.next = kNoDesc;
+  if (f->tail == kNoDesc) {
+    f->head = idx;
   } else {
-    bess::Packet::Free(newpkt);
+    desc(f->tail).next = idx;
   }
+  f->tail = idx;
+
+  num_buffered_++;
+  SetQueueLength(f, f->qlen + 1);
 }
 
-llring* DRR::ResizeQueue(llring* old_queue, uint32_t new_size, int* err) {
-  llring* new_queue = AddQueue(new_size, err);
-  if (*err != 0) {
-    return nullptr;
+bess::Packet* DRR::PopPacket(Flow* f) {
+  uint32_t idx = f->head;
+  Desc& d = desc(idx);
+  bess::Packet* pkt = d.pkt;
+
+  f->head = d.next;
+  if (f->head == kNoDesc) {
+    f->tail = kNoDesc;
   }
 
-  // migrates packets from the old queue
-  if (old_queue) {
-    bess::Packet* pkt;
+  d.next = free_desc_;
+  free_desc_ = idx;
 
-    while (llring_dequeue(old_queue, reinterpret_cast<void**>(&pkt)) == 0) {
-      *err = llring_enqueue(new_queue, pkt);
-      if (*err == -LLRING_ERR_NOBUF) {
-        bess::Packet::Free(pkt);
-        *err = 0;
-      } else if (*err != 0) {
-        std::free(new_queue);
-        return nullptr;
-      }
+  num_buffered_--;
+  SetQueueLength(f, f->qlen - 1);
+  return pkt;
+}
+
+void DRR::SetQueueLength(Flow* f, uint32_t qlen) {
+  if (f->qlen > 0) {
+    if (f->len_prev) {
+      f->len_prev->len_next = f->len_next;
+    } else {
+      by_length_[f->qlen] = f->len_next;
+    }
+    if (f->len_next) {
+      f->len_next->len_prev = f->len_prev;
+    }
+  }
+
+  f->qlen = qlen;
+
+  if (qlen > 0) {
+    f->len_prev = nullptr;
+    f->len_next = by_length_[qlen];
+    if (f->len_next) {
+      f->len_next->len_prev = f;
     }
+    by_length_[qlen] = f;
+  }
 
-    std::free(old_queue);
+  // lengths change by one at a time, so this loops at most once
+  longest_ = std::max(longest_, qlen);
+  while (longest_ > 0 && !by_length_[longest_]) {
+    longest_--;
   }
-  return new_queue;
+}
+
+void DRR::ResizeLengthLists() {
+  // no queue can be longer than either limit. by_length_ never shrinks, as
+  // lowering max_queue_size_ does not shorten existing queues.
+  size_t size = std::min(max_queue_size_, max_buffered_) + 1;
+
+  if (size > by_length_.size()) {
+    by_length_.resize(size, nullptr);
+  }
+}
+
+CommandResponse DRR::CommandGetStats(const bess::pb::EmptyArg&) {
+  bess::pb::AqmCommandGetStatsResponse r;
+
+  if (!sojourn_hist_) {
+    return CommandFailure(EINVAL, "sojourn times require the 'aqm' argument");
+  }
+
+  bess::utils::TakeAqmStats(&r, sojourn_hist_.get(), &aqm_drops_,
+                            &sojourn_long_);
+
+  return CommandSuccess(r);
 }
 
 CommandResponse DRR::SetQuantumSize(uint32_t size) {
@@ -385,6 +501,15 @@ CommandResponse DRR::SetMaxFlowQueueSize(uint32_t queue_size) {
     return CommandFailure(EINVAL, "max queue size must be at least 1");
   }
   max_queue_size_ = queue_size;
+  ResizeLengthLists();
+  return CommandSuccess();
+}
+
+CommandResponse DRR::SetMaxBuffered(uint32_t num_packets) {
+  if (num_packets == 0) {
+    return CommandFailure(EINVAL, "max buffered packets must be at least 1");
+  }
+  max_buffered_ = num_packets;
   return CommandSuccess();
 }
 
@@ -2,6 +2,8 @@
 #define BESS_MODULES_DRR_H_
 
 #include <cstdlib>
+#include <memory>
+#include <vector>
 
 #include <rte_hash_crc.h>
 
@@ -9,7 +11,9 @@
 #include "../module.h"
 #include "../module_msg.pb.h"
 #include "../pktbatch.h"
+#include "../utils/aqm.h"
 #include "../utils/cuckoo_map.h"
+#include "../utils/histogram.h"
 #include "../utils/ip.h"
 
 using bess::utils::Ipv4Prefix;
@@ -39,6 +43,10 @@ using bess::utils::CuckooMap;
   *    * Max Number of flows: max number of flows the module will handle
   *    * Max Flow Queue Size: the maximum size that any Flows queue can get
   *          before the module will start dropping the flows packets
+  *    * Max Buffered Packets: the maximum number of packets queued over all
+  *          flows. Beyond it, the longest queue drops its oldest packet.
+  *    * AQM: the active queue management policy (CoDel or PIE), run for each
+  *          flow separately
   * COMMANDS
   *    update quantum: cannot not be done live
   *    update Max Flow Queue Size: can be done live
@@ -47,11 +55,15 @@ class DRR final : public Module {
  public:
   // the default max number of flows allowed + 1
   static const int kDefaultNumFlows = 4096;
-  static const int kFlowQueueSize = 2048;  // initial queue size for a flow
-  static const int kQueueGrowthFactor =
-      2;  // the scale at which a flow's queue grows
   static const int kFlowQueueMax =
-      8192;                     // the max flow queue size if non-specified
+      8192;  // the max flow queue size if non-specified
+  static const int kDefaultMaxBuffered =
+      65536;  // the max packets queued over all flows if non-specified
+  static const uint32_t kPoolChunk =
+      4096;  // packet descriptors are allocated this many at a time
+  static const uint32_t kNoDesc = UINT32_MAX;  // null descriptor index
+  static const uint64_t kSojournLongNs =
+      100000000;  // sojourn times of 100ms or more are also counted apart
   static const int kTtl = 300;  // time to live for flow entries
   static const int kDefaultQuantum =
       1500;  // default value to initialize qauntum_ to
@@ -67,33 +79,41 @@ class DRR final : public Module {
     uint8_t protocol;
   };
 
+  /*
+   a queued packet. Descriptors come from a pool shared by all flows, and
+   each flow links its own into a FIFO.
+  */
+  struct Desc {
+    bess::Packet* pkt;
+    uint64_t ts;    // when the packet was enqueued, in ns
+    uint32_t next;  // the next descriptor in the flow or the free list
+  };
+
   /*
    stores the metrics of the flow, a timer and the queue to store the packets
    in.
   */
   struct Flow {
-    int deficit;                // the allocated bytes to the flow
-    double timer;               // to determine if TTL should be used
-    FlowId id;                  // allows the flow to remove itself from the map
-    struct llring* queue;       // queue to store current packets for flow
-    bess::Packet* next_packet;  // buffer to store next packet from the queue.
-    Flow() : deficit(0), timer(0), id(), next_packet(nullptr){};
+    int deficit;       // the allocated bytes to the flow
+    double timer;      // to determine if TTL should be used
+    FlowId id;         // allows the flow to remove itself from the map
+    uint32_t head;     // the oldest packet of the flow, kNoDesc if none
+    uint32_t tail;     // the newest packet of the flow, kNoDesc if none
+    uint32_t qlen;     // number of packets in the queue
+    Flow* len_prev;    // neighbors among the flows with the same qlen
+    Flow* len_next;
+    bess::utils::Aqm aqm;  // the flow's own AQM state
+    Flow() : Flow(FlowId()){};
     Flow(FlowId new_id)
-        : deficit(0), timer(0), id(new_id), next_packet(nullptr){};
-    ~Flow() {
-      if (queue) {
-        bess::Packet* pkt;
-        while (llring_sc_dequeue(queue, reinterpret_cast<void**>(&pkt)) == 0) {
-          bess::Packet::Free(pkt);
-        }
-
-        std::free(queue);
-      }
-
-      if (next_packet) {
-        bess::Packet::Free(next_packet);
-      }
-    }
+        : deficit(0),
+          timer(0),
+          id(new_id),
+          head(kNoDesc),
+          tail(kNoDesc),
+          qlen(0),
+          len_prev(nullptr),
+          len_next(nullptr),
+          aqm(){};
   };
 
   // hashes a FlowId
@@ -138,8 +158,11 @@ class DRR final : public Module {
   CommandResponse CommandQuantumSize(const bess::pb::DRRQuantumArg& arg);
   CommandResponse CommandMaxFlowQueueSize(
       const bess::pb::DRRMaxFlowQueueSizeArg& arg);
+  CommandResponse CommandGetStats(const bess::pb::EmptyArg& arg);
 
  private:
+  friend class DRRTest;
+
   /*
     Sets the quantum: the number of bytes allocated to each flow on every round
     Takes the size to set the quantum to. Returns 0 on success and error value
@@ -156,24 +179,52 @@ class DRR final : public Module {
   CommandResponse SetMaxFlowQueueSize(uint32_t queue_size);
 
   /*
-    Creates a new larger llring queue of the specifed size and moves over all
-    of the entries from the old queue and frees the old_queue. Takes a pointer
-    to the
-    location of the  current queue, the new size of the queue and integer
-    pointer
-    to set on error. If the integer pointer is set than the return value will be
-    a
-    nullptr. Returns a pointer to the new llring otherwise.
+    Sets the maximum number of packets queued over all flows. Takes the
+    number of packets. Returns 0 on success and error value otherwise.
   */
-  llring* ResizeQueue(llring* old_queue, uint32_t new_size, int* err);
+  CommandResponse SetMaxBuffered(uint32_t num_packets);
 
   /*
-    Puts the packet into the llring queue within the flow. Takes the flow to
-    enqueue the packet into, the packet to enqueue into the flow's queue
-    and integer pointer to be set on error.
+    Puts the packet into the queue within the flow. If all flows together hold
+    max_buffered_ packets, the longest queue drops its oldest packet to make
+    room, or the packet is dropped if the flow's queue is the longest. Takes
+    the flow to enqueue the packet into, the packet to enqueue into the flow's
+    queue and integer pointer to be set on error.
   */
   void Enqueue(Flow* f, bess::Packet* pkt, int* err);
 
+  Desc& desc(uint32_t idx) {
+    return chunks_[idx / kPoolChunk][idx % kPoolChunk];
+  }
+
+  /*
+    Takes a descriptor from the pool, allocating another chunk of them if
+    needed. Returns kNoDesc if max_buffered_ packets are queued already.
+  */
+  uint32_t AllocDesc();
+
+  /*
+    Appends the packet to the flow's queue, in the descriptor from AllocDesc()
+  */
+  void PushPacket(Flow* f, bess::Packet* pkt, uint32_t idx);
+
+  /*
+    Removes the oldest packet from the flow's queue, which must not be empty,
+    and returns its descriptor to the pool. Returns the packet.
+  */
+  bess::Packet* PopPacket(Flow* f);
+
+  /*
+    Updates the flow's queue length and moves it to the matching list in
+    by_length_
+  */
+  void SetQueueLength(Flow* f, uint32_t qlen);
+
+  /*
+    Makes sure that by_length_ can hold every possible queue length
+  */
+  void ResizeLengthLists();
+
   /*
     Takes a Packet to get a flow id for. Returns the 5 element identifier for
     the flow that the packet belongs to
@@ -204,11 +255,9 @@ class DRR final : public Module {
   /*
     gets the next set of packets from flow given allocated bytes
     Takes the PacketBatch to put the packets into and the flow to get the
-    packets
-    from and integer pointer to set on error. Returns the total bytes put in
-    batch
+    packets from. Returns the total bytes put in batch
   */
-  uint32_t GetNextPackets(bess::PacketBatch* batch, Flow* f, int* err);
+  uint32_t GetNextPackets(bess::PacketBatch* batch, Flow* f);
 
   /*
     gets the next flow from the queue of flows. Returns nullptr if the next
@@ -218,10 +267,9 @@ class DRR final : public Module {
   Flow* GetNextFlow(int* err);
 
   /*
-    allocates llring queue space and adds the queue to the specified flow with
-    size indicated by slots. Takes the Flow to add the queue, the number
-    of slots for the queue to have and the integer pointer to set on error.
-    Returns a llring queue.
+    allocates llring queue space with size indicated by slots. Takes the
+    number of slots for the queue to have and the integer pointer to set on
+    error. Returns a llring queue.
   */
   llring* AddQueue(uint32_t slots, int* err);
 
@@ -235,6 +283,29 @@ class DRR final : public Module {
   // max number of flow's that the module will handle.
   uint32_t max_number_flows_;
 
+  // max number of packets queued over all flows
+  uint32_t max_buffered_;
+
+  // number of packets queued over all flows
+  uint32_t num_buffered_;
+
+  // the shared pool of packet descriptors. It grows by a chunk at a time, so
+  // that memory follows the number of queued packets rather than of flows.
+  std::vector<std::unique_ptr<Desc[]>> chunks_;
+  uint32_t free_desc_;  // the first free descriptor, kNoDesc if none
+
+  // by_length_[n] lists the flows with n queued packets, so that the longest
+  // queue is found in O(1) on overflow. longest_ is the largest n with flows.
+  std::vector<Flow*> by_length_;
+  uint32_t longest_;
+
+  // Only with the 'aqm' argument, in which case sojourn_hist_ is allocated.
+  // New flows get a fresh copy of aqm_.
+  bess::utils::Aqm aqm_;
+  uint64_t aqm_drops_;
+  uint64_t sojourn_long_;
+  std::unique_ptr<LogHistogram> sojourn_hist_;
+
   // state map used to reunite packets with their flow
   CuckooMap<FlowId, Flow*, Hash, EqualTo> flows_;
   llring* flow_ring_;   // llring used for round robin.
@@ -0,0 +1,218 @@
+#include "drr.h"
+
+#include <unistd.h>
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../dpdk.h"
+#include "../utils/ether.h"
+#include "../utils/ip.h"
+#include "../utils/udp.h"
+
+class DRRTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    if (!dpdk_inited_) {
+      if (geteuid() == 0) {
+        init_dpdk("drr_test", 1024, 0, true);
+        bess::init_mempool();
+        dpdk_inited_ = true;
+      } else {
+        LOG(INFO) << "This test requires root privileges. Skipping...";
+        return;
+      }
+    }
+
+    int err = 0;
+
+    // As Init() does, but without registering a task
+    drr_.reset(new DRR());
+    drr_->flow_ring_ = drr_->AddQueue(DRR::kDefaultNumFlows, &err);
+    ASSERT_EQ(0, err);
+    drr_->ResizeLengthLists();
+  }
+
+  void SetMaxBuffered(uint32_t num_packets) {
+    ASSERT_EQ(0, drr_->SetMaxBuffered(num_packets).error().code());
+    drr_->ResizeLengthLists();
+  }
+
+  // A UDP packet of flow 'src'
+  static bess::Packet *NewPacket(uint32_t src) {
+    using bess::utils::be16_t;
+    using bess::utils::be32_t;
+    using bess::utils::Ethernet;
+    using bess::utils::Ipv4;
+    using bess::utils::Udp;
+
+    bess::Packet *pkt = reinterpret_cast<bess::Packet *>(
+        rte_pktmbuf_alloc(bess::get_pframe_pool_socket(0)));
+    if (!pkt) {
+      return nullptr;
+    }
+
+    const size_t len = sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp);
+    memset(pkt->head_data(), 0, len);
+    pkt->set_data_len(len);
+    pkt->set_total_len(len);
+
+    Ethernet *eth = pkt->head_data<Ethernet *>();
+    Ipv4 *ip = reinterpret_cast<Ipv4 *>(eth + 1);
+    Udp *udp = reinterpret_cast<Udp *>(ip + 1);
+
+    eth->ether_type = be16_t(Ethernet::Type::kIpv4);
+    ip->header_length = 5;
+    ip->protocol = Ipv4::Proto::kUdp;
+    ip->src = be32_t(src);
+    ip->dst = be32_t(1);
+    udp->src_port = be16_t(1000);
+    udp->dst_port = be16_t(2000);
+    return pkt;
+  }
+
+  // Queues 'cnt' packets of flow 'src', and returns them
+  std::vector<bess::Packet *> Send(uint32_t src, int cnt) {
+    std::vector<bess::Packet *> sent;
+
+    while (cnt > 0) {
+      bess::PacketBatch batch;
+
+      batch.clear();
+      for (; cnt > 0 && !batch.full(); cnt--) {
+        bess::Packet *pkt = NewPacket(src);
+        EXPECT_NE(nullptr, pkt);
+        batch.add(pkt);
+        sent.push_back(pkt);
+      }
+      drr_->ProcessBatch(&batch);
+    }
+    return sent;
+  }
+
+  DRR::Flow *GetFlow(uint32_t src) {
+    auto *it = drr_->flows_.Find(DRR::FlowId{src, 1, 1000, 2000, 17});
+    return it ? it->second : nullptr;
+  }
+
+  // Dequeues every packet, and returns how many there were
+  int Drain() {
+    int total = 0;
+    int err = 0;
+
+    drr_->quantum_ = 1 << 20;
+    while (drr_->num_buffered_ > 0) {
+      bess::PacketBatch batch;
+
+      batch.clear();
+      drr_->GetNextBatch(&batch, &err);
+      EXPECT_EQ(0, err);
+      if (batch.cnt() == 0) {
+        break;
+      }
+      total += batch.cnt();
+      bess::Packet::Free(batch.pkts(), batch.cnt());
+    }
+    return total;
+  }
+
+  uint32_t NumBuffered() const { return drr_->num_buffered_; }
+  uint32_t Longest() const { return drr_->longest_; }
+  size_t NumChunks() const { return drr_->chunks_.size(); }
+
+  bess::Packet *Head(DRR::Flow *f) { return drr_->desc(f->head).pkt; }
+  bess::Packet *Tail(DRR::Flow *f) { return drr_->desc(f->tail).pkt; }
+
+  // Whether no flow is listed by its queue length
+  bool NoLengthLists() const {
+    for (DRR::Flow *f : drr_->by_length_) {
+      if (f) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Walks the free list, and returns its length. Fails on a descriptor out of
+  // the pool or seen twice.
+  uint32_t CountFree() {
+    const uint32_t num_descs = NumChunks() * DRR::kPoolChunk;
+    std::vector<bool> seen(num_descs);
+    uint32_t num_free = 0;
+
+    for (uint32_t idx = drr_->free_desc_; idx != DRR::kNoDesc;
+         idx = drr_->desc(idx).next) {
+      EXPECT_LT(idx, num_descs);
+      if (idx >= num_descs || seen[idx]) {
+        ADD_FAILURE() << "bad descriptor " << idx << " on the free list";
+        break;
+      }
+      seen[idx] = true;
+      num_free++;
+    }
+    return num_free;
+  }
+
+  std::unique_ptr<DRR> drr_;
+  static bool dpdk_inited_;
+};
+
+bool DRRTest::dpdk_inited_ = false;
+
+// Past the descriptor limit, the oldest packets of the longest flow go first
+TEST_F(DRRTest, PoolFullDropsLongest) {
+  if (!dpdk_inited_) {
+    return;
+  }
+
+  const uint32_t kLimit = DRR::kPoolChunk + 100;
+  SetMaxBuffered(kLimit);
+
+  std::vector<bess::Packet *> a = Send(1, DRR::kPoolChunk);
+  Send(2, 100);
+  ASSERT_EQ(kLimit, NumBuffered());
+  EXPECT_EQ(2, NumChunks());
+
+  Send(3, 50);
+  DRR::Flow *fa = GetFlow(1);
+  ASSERT_NE(nullptr, fa);
+  EXPECT_EQ(DRR::kPoolChunk - 50, fa->qlen);
+  EXPECT_EQ(100, GetFlow(2)->qlen);
+  EXPECT_EQ(50, GetFlow(3)->qlen);
+  EXPECT_EQ(kLimit, NumBuffered());
+  EXPECT_EQ(fa->qlen, Longest());
+  EXPECT_EQ(a[50], Head(fa));
+
+  // The longest flow itself gets nothing more
+  Send(1, 10);
+  EXPECT_EQ(DRR::kPoolChunk - 50, fa->qlen);
+  EXPECT_EQ(a.back(), Tail(fa));
+  EXPECT_EQ(kLimit, NumBuffered());
+  EXPECT_EQ(2, NumChunks());
+}
+
+// Once the flows drain, every descriptor is back on the free list, once
+TEST_F(DRRTest, DescriptorsReturn) {
+  if (!dpdk_inited_) {
+    return;
+  }
+
+  const uint32_t kLimit = 2 * DRR::kPoolChunk + 10;
+  SetMaxBuffered(kLimit);
+
+  for (uint32_t src = 1; src <= 20; src++) {
+    Send(src, src * 50);
+  }
+  Send(21, 1000);  // evicts from the longest flows
+  ASSERT_EQ(kLimit, NumBuffered());
+
+  EXPECT_EQ(static_cast<int>(kLimit), Drain());
+  EXPECT_EQ(0, NumBuffered());
+  EXPECT_EQ(0, Longest());
+  EXPECT_TRUE(NoLengthLists());
+
+  EXPECT_EQ(3, NumChunks());
+  EXPECT_EQ(NumChunks() * DRR::kPoolChunk, CountFree());
+}
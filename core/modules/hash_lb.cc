@@ -2,8 +2,27 @@
 
 #include <rte_hash_crc.h>
 
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+#include "../utils/ether.h"
+#include "../utils/ip.h"
+#include "../utils/udp.h"
+#include "../utils/vxlan.h"
+
+using bess::utils::be16_t;
+using bess::utils::Ethernet;
+using bess::utils::Ipv4;
+using bess::utils::Udp;
+using bess::utils::Vxlan;
+
 const enum LbMode DEFAULT_MODE = LB_L4;
 
+// Weights are relative. This is plenty, and keeps PopulateMaglev() from
+// overflowing.
+static const int kMaxWeight = 1 << 16;
+
 static inline uint32_t hash_64(uint64_t val, uint32_t init_val) {
 #if __SSE4_2__ && __x86_64
   return crc32c_sse42_u64(val, init_val);
@@ -31,6 +50,190 @@ static inline uint16_t hash_range(uint32_t hashval, uint16_t range) {
 #endif
 }
 
+// IPv6 extension headers that may come before the L4 header
+enum Ipv6Ext : uint8_t {
+  kHopByHop = 0,
+  kRouting = 43,
+  kFragment = 44,
+  kAh = 51,
+  kDestOpts = 60,
+};
+
+// Bounds the work per packet. Real packets have no more than a few.
+static const int kMaxIpv6Ext = 8;
+
+static const uint16_t kVxlanPort = 4789;
+
+// GRE header flags and the EtherType of Ethernet-in-GRE (NVGRE)
+static const uint16_t kGreChecksum = 0x8000;
+static const uint16_t kGreKey = 0x2000;
+static const uint16_t kGreSeq = 0x1000;
+static const uint16_t kGreVersion = 0x0007;
+static const uint16_t kGreTeb = 0x6558;
+
+static inline uint16_t load_be16(const uint8_t *p) {
+  return (p[0] << 8) | p[1];
+}
+
+uint32_t HashLB::HashL2(const uint8_t *head, uint32_t len) {
+  const uint32_t kAddrsSize = 2 * Ethernet::Address::kSize;
+  uint8_t addrs[kAddrsSize] = {};
+
+  // Runts hash on whatever they have
+  if (unlikely(len < kAddrsSize)) {
+    memcpy(addrs, head, len);
+    head = addrs;
+  }
+
+  uint64_t v0 = *(reinterpret_cast<const uint64_t *>(head));
+  uint32_t v1 = *(reinterpret_cast<const uint32_t *>(head + 8));
+
+  return hash_64(v0, v1);
+}
+
+// VLAN/QinQ tags, IPv4 options and IPv6 extension headers are skipped. With
+// 'inner', VXLAN and GRE packets hash on their inner headers instead.
+//
+// Every field is bounds checked against 'len'. Packets that cannot be parsed
+// (non-IP, truncated, ...) hash on whatever was parsed last, down to the MAC
+// addresses, so that they still spread over the gates. IP fragments do not
+// hash on ports, as only the first fragment carries them.
+template <bool L4>
+uint32_t HashLB::HashFlow(const uint8_t *head, uint32_t len, bool inner) {
+  uint32_t fallback = HashL2(head, len);
+  uint32_t off = 2 * Ethernet::Address::kSize;
+  uint16_t type = 0;
+  bool has_l2 = true;
+
+  for (int depth = 0;; depth++) {
+    if (has_l2) {
+      for (;;) {
+        if (off + sizeof(be16_t) > len) {
+          return fallback;
+        }
+        type = load_be16(head + off);
+        off += sizeof(be16_t);
+        if (type != Ethernet::Type::kVlan && type != Ethernet::Type::kQinQ) {
+          break;
+        }
+        off += sizeof(be16_t);  // TCI
+      }
+    }
+
+    uint8_t proto;
+    uint32_t hash;
+    uint32_t l4_off;
+    bool frag;
+
+    if (type == Ethernet::Type::kIpv4) {
+      const Ipv4 *ip = reinterpret_cast<const Ipv4 *>(head + off);
+
+      if (off + sizeof(Ipv4) > len || ip->header_length < 5) {
+        return fallback;
+      }
+
+      proto = ip->protocol;
+      hash = hash_64(*(reinterpret_cast<const uint64_t *>(&ip->src)), 0);
+      l4_off = off + (ip->header_length << 2);
+      frag = (ip->fragment_offset.value() & (Ipv4::Flag::kMF | 0x1fff)) != 0;
+    } else if (type == Ethernet::Type::kIpv6) {
+      const uint64_t *addrs =
+          reinterpret_cast<const uint64_t *>(head + off + 8);
+
+      if (off + 40 > len) {
+        return fallback;
+      }
+
+      proto = head[off + 6];
+      hash = hash_64(addrs[0], 0);
+      hash = hash_64(addrs[1], hash);
+      hash = hash_64(addrs[2], hash);
+      hash = hash_64(addrs[3], hash);
+      l4_off = off + 40;
+      frag = false;
+
+      // Extension headers are all at least 8 bytes long
+      for (int i = 0; i < kMaxIpv6Ext && l4_off + 8 <= len; i++) {
+        const uint8_t *ext = head + l4_off;
+
+        if (proto == kHopByHop || proto == kRouting || proto == kDestOpts) {
+          l4_off += (ext[1] + 1) * 8;
+        } else if (proto == kFragment) {
+          frag = frag || (load_be16(ext + 2) & 0xfff9) != 0;  // offset, M
+          l4_off += 8;
+        } else if (proto == kAh) {
+          l4_off += (ext[1] + 2) * 4;
+        } else {
+          break;
+        }
+        proto = ext[0];
+      }
+    } else {
+      return fallback;
+    }
+
+    if (L4) {
+      fallback = hash_64(proto, hash);
+    } else {
+      fallback = hash;
+    }
+
+    if (inner && depth == 0 && !frag) {
+      if (proto == Ipv4::Proto::kUdp && l4_off + sizeof(Udp) <= len) {
+        const Udp *udp = reinterpret_cast<const Udp *>(head + l4_off);
+
+        if (udp->dst_port == be16_t(kVxlanPort)) {
+          off = l4_off + sizeof(Udp) + sizeof(Vxlan) +
+                2 * Ethernet::Address::kSize;
+          has_l2 = true;
+          continue;
+        }
+      } else if (proto == Ipv4::Proto::kGre && l4_off + 4 <= len) {
+        uint16_t flags = load_be16(head + l4_off);
+        uint16_t gre_proto = load_be16(head + l4_off + 2);
+
+        if ((flags & kGreVersion) == 0) {
+          off = l4_off + 4;
+          off += (flags & kGreChecksum) ? 4 : 0;
+          off += (flags & kGreKey) ? 4 : 0;
+          off += (flags & kGreSeq) ? 4 : 0;
+
+          if (gre_proto == kGreTeb) {
+            off += 2 * Ethernet::Address::kSize;
+            has_l2 = true;
+            continue;
+          } else if (gre_proto == Ethernet::Type::kIpv4 ||
+                     gre_proto == Ethernet::Type::kIpv6) {
+            type = gre_proto;
+            has_l2 = false;
+            continue;
+          }
+        }
+      }
+    }
+
+    if (!L4) {
+      return hash;
+    }
+
+    bool has_ports = proto == Ipv4::Proto::kTcp ||
+                     proto == Ipv4::Proto::kUdp ||
+                     proto == Ipv4::Proto::kSctp ||
+                     proto == Ipv4::Proto::kUdpLite;
+
+    if (frag || !has_ports || l4_off + 4 > len) {
+      return fallback;
+    }
+
+    uint64_t ports = *(reinterpret_cast<const uint32_t *>(head + l4_off));
+    return hash_64(ports | static_cast<uint64_t>(proto) << 32, hash);
+  }
+}
+
+// Also used by the tests
+template uint32_t HashLB::HashFlow<false>(const uint8_t *, uint32_t, bool);
+template uint32_t HashLB::HashFlow<true>(const uint8_t *, uint32_t, bool);
+
 static inline int is_valid_gate(gate_idx_t gate) {
   return (gate < MAX_GATES || gate == DROP_GATE);
 }
@@ -38,135 +241,216 @@ static inline int is_valid_gate(gate_idx_t gate) {
 const Commands HashLB::cmds = {{"set_mode", "HashLBCommandSetModeArg",
                                 MODULE_CMD_FUNC(&HashLB::CommandSetMode), 0},
                                {"set_gates", "HashLBCommandSetGatesArg",
-                                MODULE_CMD_FUNC(&HashLB::CommandSetGates), 0}};
+                                MODULE_CMD_FUNC(&HashLB::CommandSetGates), 1}};
+
+// Each gate fills the table following its own permutation of the entries, as
+// in Maglev (Eisenbud et al., NSDI '16). The permutations depend only on the
+// gate number, so a gate keeps most of its entries when others come or go.
+void HashLB::PopulateMaglev(Table *t, const std::vector<uint64_t> &weights) {
+  const uint32_t size = kMaglevTableSize;
+  const int n = t->num_gates;
+
+  std::vector<uint32_t> offset(n);
+  std::vector<uint32_t> skip(n);
+  std::vector<uint32_t> next(n);
+  std::vector<bool> taken(size);
+  std::map<gate_idx_t, int> seen;
+  uint64_t max_weight = 0;
+
+  for (int i = 0; i < n; i++) {
+    // A gate listed more than once gets a permutation per occurrence
+    uint64_t key = t->gates[i] | static_cast<uint64_t>(seen[t->gates[i]]++)
+                                     << 16;
+
+    offset[i] = hash_64(key, 0) % size;
+    skip[i] = hash_64(key, 1) % (size - 1) + 1;
+    max_weight = std::max(max_weight, weights[i]);
+  }
 
-CommandResponse HashLB::CommandSetMode(
-    const bess::pb::HashLBCommandSetModeArg &arg) {
-  if (arg.mode() == "l2") {
-    mode_ = LB_L2;
-  } else if (arg.mode() == "l3") {
-    mode_ = LB_L3;
-  } else if (arg.mode() == "l4") {
-    mode_ = LB_L4;
-  } else {
-    return CommandFailure(EINVAL, "available LB modes: l2, l3, l4");
+  if (max_weight == 0) {
+    std::fill(t->maglev.begin(), t->maglev.end(), DROP_GATE);
+    return;
   }
 
-  return CommandSuccess();
-}
+  uint32_t filled = 0;
 
-CommandResponse HashLB::CommandSetGates(
-    const bess::pb::HashLBCommandSetGatesArg &arg) {
-  if (arg.gates_size() > MAX_HLB_GATES) {
-    return CommandFailure(EINVAL, "no more than %d gates", MAX_HLB_GATES);
-  }
+  for (uint64_t round = 0; filled < size; round++) {
+    for (int i = 0; i < n && filled < size; i++) {
+      // Gate i takes weights[i] / max_weight entries per round
+      if ((round + 1) * weights[i] / max_weight ==
+          round * weights[i] / max_weight) {
+        continue;
+      }
 
-  for (int i = 0; i < arg.gates_size(); i++) {
-    gates_[i] = arg.gates(i);
-    if (!is_valid_gate(gates_[i])) {
-      return CommandFailure(EINVAL, "invalid gate %d", gates_[i]);
+      uint32_t c;
+      do {
+        c = (offset[i] + static_cast<uint64_t>(next[i]++) * skip[i]) % size;
+      } while (taken[c]);
+
+      taken[c] = true;
+      t->maglev[c] = t->gates[i];
+      filled++;
     }
   }
-
-  num_gates_ = arg.gates_size();
-  return CommandSuccess();
 }
 
-CommandResponse HashLB::Init(const bess::pb::HashLBArg &arg) {
-  mode_ = DEFAULT_MODE;
+template <typename T>
+CommandResponse HashLB::SetGates(const T &arg) {
+  Table *t = &tables_[!active_];
+  std::vector<uint64_t> weights;
 
   if (arg.gates_size() > MAX_HLB_GATES) {
     return CommandFailure(EINVAL, "no more than %d gates", MAX_HLB_GATES);
   }
 
+  if (arg.weights_size() > 0) {
+    if (!maglev_) {
+      return CommandFailure(EINVAL, "weights require 'maglev'");
+    }
+    if (arg.weights_size() != arg.gates_size()) {
+      return CommandFailure(EINVAL, "%d gates but %d weights",
+                            arg.gates_size(), arg.weights_size());
+    }
+  }
+
+  // Validate everything first. A worker may still be reading this table.
   for (int i = 0; i < arg.gates_size(); i++) {
-    gates_[i] = arg.gates(i);
-    if (!is_valid_gate(gates_[i])) {
-      return CommandFailure(EINVAL, "invalid gate %d", gates_[i]);
+    gate_idx_t gate = arg.gates(i);
+    int64_t weight = arg.weights_size() ? arg.weights(i) : 1;
+
+    if (!is_valid_gate(gate)) {
+      return CommandFailure(EINVAL, "invalid gate %d", gate);
+    }
+    if (weight < 0 || weight > kMaxWeight) {
+      return CommandFailure(EINVAL, "weights must be [0, %d]", kMaxWeight);
     }
+    weights.push_back(weight);
   }
 
-  num_gates_ = arg.gates_size();
+  for (int i = 0; i < arg.gates_size(); i++) {
+    t->gates[i] = arg.gates(i);
+  }
+  t->num_gates = arg.gates_size();
+
+  if (maglev_) {
+    PopulateMaglev(t, weights);
+  }
+
+  // Workers must see the complete table before it becomes active
+  __sync_synchronize();
+  active_ = !active_;
+
+  return CommandSuccess();
+}
+
+template <typename T>
+CommandResponse HashLB::SetMode(const T &arg) {
+  enum LbMode mode;
 
   if (arg.mode() == "l2") {
-    mode_ = LB_L2;
+    mode = LB_L2;
   } else if (arg.mode() == "l3") {
-    mode_ = LB_L3;
+    mode = LB_L3;
   } else if (arg.mode() == "l4") {
-    mode_ = LB_L4;
+    mode = LB_L4;
   } else {
     return CommandFailure(EINVAL, "available LB modes: l2, l3, l4");
   }
 
+  if (mode == LB_L2 && (arg.inner() || arg.use_rss())) {
+    return CommandFailure(EINVAL, "'inner' and 'use_rss' require l3 or l4");
+  }
+
+  // NICs hash the outer headers
+  if (arg.inner() && arg.use_rss()) {
+    return CommandFailure(EINVAL, "'inner' and 'use_rss' are exclusive");
+  }
+
+  mode_ = mode;
+  inner_ = arg.inner();
+  use_rss_ = arg.use_rss();
+
   return CommandSuccess();
 }
 
-void HashLB::LbL2(bess::PacketBatch *batch, gate_idx_t *out_gates) {
-  for (int i = 0; i < batch->cnt(); i++) {
-    bess::Packet *snb = batch->pkts()[i];
-    char *head = snb->head_data<char *>();
+CommandResponse HashLB::CommandSetMode(
+    const bess::pb::HashLBCommandSetModeArg &arg) {
+  return SetMode(arg);
+}
 
-    uint64_t v0 = *(reinterpret_cast<uint64_t *>(head));
-    uint32_t v1 = *(reinterpret_cast<uint32_t *>(head + 8));
+CommandResponse HashLB::CommandSetGates(
+    const bess::pb::HashLBCommandSetGatesArg &arg) {
+  return SetGates(arg);
+}
 
-    uint32_t hash_val = hash_64(v0, v1);
+CommandResponse HashLB::Init(const bess::pb::HashLBArg &arg) {
+  mode_ = DEFAULT_MODE;
+  maglev_ = arg.maglev();
 
-    out_gates[i] = gates_[hash_range(hash_val, num_gates_)];
+  if (maglev_) {
+    for (Table &t : tables_) {
+      t.maglev.resize(kMaglevTableSize, DROP_GATE);
+    }
   }
+
+  CommandResponse err = SetGates(arg);
+  if (err.error().code() != 0) {
+    return err;
+  }
+
+  return SetMode(arg);
 }
 
-void HashLB::LbL3(bess::PacketBatch *batch, gate_idx_t *out_gates) {
-  /* assumes untagged packets */
-  const int ip_offset = 14;
+inline gate_idx_t HashLB::Lookup(const Table &t, uint32_t hash_val) const {
+  if (maglev_) {
+    return t.maglev[hash_val % kMaglevTableSize];
+  }
+  return t.gates[hash_range(hash_val, t.num_gates)];
+}
 
+void HashLB::LbL2(const Table &t, bess::PacketBatch *batch,
+                  gate_idx_t *out_gates) {
   for (int i = 0; i < batch->cnt(); i++) {
     bess::Packet *snb = batch->pkts()[i];
-    char *head = snb->head_data<char *>();
-
-    uint32_t hash_val;
-    uint64_t v = *(reinterpret_cast<uint64_t *>(head + ip_offset + 12));
 
-    hash_val = hash_64(v, 0);
-
-    out_gates[i] = gates_[hash_range(hash_val, num_gates_)];
+    out_gates[i] =
+        Lookup(t, HashL2(snb->head_data<uint8_t *>(), snb->head_len()));
   }
 }
 
-void HashLB::LbL4(bess::PacketBatch *batch, gate_idx_t *out_gates) {
-  /* assumes untagged packets without IP options */
-  const int ip_offset = 14;
-  const int l4_offset = ip_offset + 20;
-
+template <bool L4>
+void HashLB::LbIp(const Table &t, bess::PacketBatch *batch,
+                  gate_idx_t *out_gates) {
   for (int i = 0; i < batch->cnt(); i++) {
     bess::Packet *snb = batch->pkts()[i];
-    char *head = snb->head_data<char *>();
-
     uint32_t hash_val;
-    uint64_t v0 = *(reinterpret_cast<uint64_t *>(head + ip_offset + 12));
-    uint32_t v1 = *(reinterpret_cast<uint64_t *>(head + l4_offset)); /* ports */
 
-    v1 ^= *(reinterpret_cast<uint32_t *>(head + ip_offset + 9)); /* ip_proto */
-
-    hash_val = hash_64(v0, v1);
+    if (use_rss_ && (snb->offload_flags() & PKT_RX_RSS_HASH)) {
+      hash_val = snb->rss_hash();
+    } else {
+      hash_val =
+          HashFlow<L4>(snb->head_data<uint8_t *>(), snb->head_len(), inner_);
+    }
 
-    out_gates[i] = gates_[hash_range(hash_val, num_gates_)];
+    out_gates[i] = Lookup(t, hash_val);
   }
 }
 
 void HashLB::ProcessBatch(bess::PacketBatch *batch) {
   gate_idx_t out_gates[bess::PacketBatch::kMaxBurst];
+  const Table &t = tables_[active_];
 
   switch (mode_) {
     case LB_L2:
-      LbL2(batch, out_gates);
+      LbL2(t, batch, out_gates);
       break;
 
     case LB_L3:
-      LbL3(batch, out_gates);
+      LbIp<false>(t, batch, out_gates);
       break;
 
     case LB_L4:
-      LbL4(batch, out_gates);
+      LbIp<true>(t, batch, out_gates);
       break;
 
     default:
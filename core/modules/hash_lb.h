@@ -1,15 +1,17 @@
 #ifndef BESS_MODULES_HASHLB_H_
 #define BESS_MODULES_HASHLB_H_
 
+#include <vector>
+
 #include "../module.h"
 #include "../module_msg.pb.h"
 
 #define MAX_HLB_GATES 16384
 
-/* TODO: add symmetric mode (e.g., LB_L4_SYM), v6 mode, etc. */
+/* TODO: add symmetric mode (e.g., LB_L4_SYM) */
 enum LbMode {
   LB_L2, /* dst MAC + src MAC */
-  LB_L3, /* src IP + dst IP */
+  LB_L3, /* src IP + dst IP (IPv4 or IPv6) */
   LB_L4  /* L4 proto + src IP + dst IP + src port + dst port */
 };
 
@@ -19,7 +21,18 @@ class HashLB final : public Module {
 
   static const Commands cmds;
 
-  HashLB() : Module(), gates_(), num_gates_(), mode_() {}
+  // Entries in a Maglev table. Must be a prime, and much larger than the
+  // number of gates for their shares to follow their weights closely.
+  static const uint32_t kMaglevTableSize = 65537;
+
+  HashLB()
+      : Module(),
+        tables_(),
+        active_(),
+        maglev_(),
+        mode_(),
+        inner_(),
+        use_rss_() {}
 
   CommandResponse Init(const bess::pb::HashLBArg &arg);
 
@@ -30,13 +43,62 @@ class HashLB final : public Module {
       const bess::pb::HashLBCommandSetGatesArg &arg);
 
  private:
-  void LbL2(bess::PacketBatch *batch, gate_idx_t *ogates);
-  void LbL3(bess::PacketBatch *batch, gate_idx_t *ogates);
-  void LbL4(bess::PacketBatch *batch, gate_idx_t *ogates);
+  friend class HashLBTest;
+
+  // Maps hash values to gates
+  struct Table {
+    gate_idx_t gates[MAX_HLB_GATES];
+    int num_gates;
+
+    // kMaglevTableSize entries, if maglev_
+    std::vector<gate_idx_t> maglev;
+  };
+
+  // Builds the inactive table out of arg.gates() and arg.weights(), and
+  // makes it active. For both HashLBArg and HashLBCommandSetGatesArg.
+  template <typename T>
+  CommandResponse SetGates(const T &arg);
+
+  // Fills t->maglev with t->gates, t->gates[i] taking a share of the entries
+  // proportional to weights[i]
+  void PopulateMaglev(Table *t, const std::vector<uint64_t> &weights);
+
+  // Sets mode_, inner_ and use_rss_. For both HashLBArg and
+  // HashLBCommandSetModeArg.
+  template <typename T>
+  CommandResponse SetMode(const T &arg);
+
+  gate_idx_t Lookup(const Table &t, uint32_t hash_val) const;
 
-  gate_idx_t gates_[MAX_HLB_GATES];
-  int num_gates_;
+  // Hashes the MAC addresses of the packet, 'len' bytes at 'head'
+  static uint32_t HashL2(const uint8_t *head, uint32_t len);
+
+  // Hashes the IP addresses of the packet, and with L4, its L4 protocol and
+  // ports
+  template <bool L4>
+  static uint32_t HashFlow(const uint8_t *head, uint32_t len, bool inner);
+
+  void LbL2(const Table &t, bess::PacketBatch *batch, gate_idx_t *ogates);
+
+  // LB_L3 if !L4, LB_L4 otherwise
+  template <bool L4>
+  void LbIp(const Table &t, bess::PacketBatch *batch, gate_idx_t *ogates);
+
+  // Workers keep running while the gates change: set_gates fills the
+  // inactive table and then flips active_. Both tables are allocated up front
+  // and always hold valid gates, so a worker still reading the old one at the
+  // time of the next change at worst misdirects a few packets.
+  Table tables_[2];
+  volatile int active_;
+
+  bool maglev_;
   enum LbMode mode_;
+
+  // Hash the inner headers of VXLAN and GRE packets
+  bool inner_;
+
+  // Use the NIC's RSS hash, if any, instead of hashing the headers
+  bool use_rss_;
 };
 
 #endif  // BESS_MODULES_HASHLB_H_
@@ -0,0 +1,315 @@
+#include "hash_lb.h"
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+typedef std::vector<uint8_t> Bytes;
+
+Bytes operator+(Bytes a, const Bytes &b) {
+  a.insert(a.end(), b.begin(), b.end());
+  return a;
+}
+
+// Ethernet header with the given VLAN tags (TPIDs) before 'type'
+Bytes Eth(uint16_t type, const std::vector<uint16_t> &tags = {}) {
+  Bytes b = {0x02, 0, 0, 0, 0, 0x01, 0x02, 0, 0, 0, 0, 0x02};
+
+  for (uint16_t tpid : tags) {
+    b = b + Bytes{uint8_t(tpid >> 8), uint8_t(tpid), 0x00, 0x64};
+  }
+  return b + Bytes{uint8_t(type >> 8), uint8_t(type)};
+}
+
+// IPv4 header from 10.0.0.src to 10.0.0.dst, with 'opts' bytes of options
+Bytes Ipv4(uint8_t proto, uint8_t src, uint8_t dst, int opts = 0,
+           uint16_t frag = 0) {
+  Bytes b = {uint8_t(0x40 | (5 + opts / 4)), 0, 0, 0, 0, 0,
+             uint8_t(frag >> 8), uint8_t(frag), 64, proto, 0, 0,
+             10, 0, 0, src, 10, 0, 0, dst};
+
+  for (int i = 0; i < opts; i++) {
+    b.push_back(0x01);  // NOP
+  }
+  return b;
+}
+
+// IPv6 header from fd00::src to fd00::dst
+Bytes Ipv6(uint8_t next, uint8_t src, uint8_t dst) {
+  Bytes b = {0x60, 0, 0, 0, 0, 0, next, 64};
+  Bytes addr(16);
+
+  addr[0] = 0xfd;
+  addr[15] = src;
+  b = b + addr;
+  addr[15] = dst;
+  return b + addr;
+}
+
+// IPv6 extension header of 8 * (1 + len) bytes
+Bytes Ipv6Ext(uint8_t next, uint8_t len = 0) {
+  Bytes b(8 * (1 + len));
+
+  b[0] = next;
+  b[1] = len;
+  return b;
+}
+
+// IPv6 fragment header
+Bytes Ipv6Frag(uint8_t next, uint16_t offset, bool more) {
+  uint16_t v = (offset << 3) | more;
+
+  return {next, 0, uint8_t(v >> 8), uint8_t(v), 0, 0, 0, 1};
+}
+
+// UDP/TCP ports, padded to 8 bytes
+Bytes Ports(uint16_t src, uint16_t dst) {
+  return {uint8_t(src >> 8), uint8_t(src), uint8_t(dst >> 8), uint8_t(dst),
+          0, 0, 0, 0};
+}
+
+const uint8_t kTcp = 6;
+const uint8_t kUdp = 17;
+const uint8_t kGre = 47;
+
+}  // namespace (unnamed)
+
+class HashLBTest : public ::testing::Test {
+ protected:
+  // The buffers are exactly 'len' bytes long, so that the address sanitizer
+  // catches reads past the packet.
+  static uint32_t L2(const Bytes &pkt, size_t len) {
+    Bytes buf(pkt.begin(), pkt.begin() + len);
+    return HashLB::HashL2(buf.data(), len);
+  }
+
+  static uint32_t L3(const Bytes &pkt, bool inner = false) {
+    return HashLB::HashFlow<false>(Bytes(pkt).data(), pkt.size(), inner);
+  }
+
+  static uint32_t L4(const Bytes &pkt, bool inner = false) {
+    return HashLB::HashFlow<true>(Bytes(pkt).data(), pkt.size(), inner);
+  }
+
+  static uint32_t L4(const Bytes &pkt, size_t len, bool inner) {
+    Bytes buf(pkt.begin(), pkt.begin() + len);
+    return HashLB::HashFlow<true>(buf.data(), len, inner);
+  }
+
+  // The Maglev table in use
+  static std::vector<gate_idx_t> Maglev(const HashLB &lb) {
+    return lb.tables_[lb.active_].maglev;
+  }
+
+  // Number of Maglev entries of each gate
+  static std::map<gate_idx_t, int> Shares(const HashLB &lb) {
+    std::map<gate_idx_t, int> shares;
+
+    for (gate_idx_t gate : Maglev(lb)) {
+      shares[gate]++;
+    }
+    return shares;
+  }
+};
+
+TEST_F(HashLBTest, L2Runts) {
+  Bytes pkt = Eth(0x0800);
+
+  for (size_t len = 0; len < 12; len++) {
+    L2(pkt, len);
+  }
+  EXPECT_NE(L2(pkt, 6), L2(pkt, 12));
+  EXPECT_EQ(L2(pkt, 12), L2(pkt, pkt.size()));
+}
+
+TEST_F(HashLBTest, VlanTags) {
+  Bytes l3 = Ipv4(kTcp, 1, 2) + Ports(1000, 80);
+  uint32_t hash = L4(Eth(0x0800) + l3);
+
+  EXPECT_EQ(hash, L4(Eth(0x0800, {0x8100}) + l3));
+  EXPECT_EQ(hash, L4(Eth(0x0800, {0x88a8, 0x8100}) + l3));
+  EXPECT_NE(hash, L4(Eth(0x0800, {0x8100}) + Ipv4(kTcp, 1, 2) +
+                     Ports(1001, 80)));
+}
+
+TEST_F(HashLBTest, Ipv4Options) {
+  uint32_t hash = L4(Eth(0x0800) + Ipv4(kUdp, 1, 2) + Ports(1000, 53));
+
+  EXPECT_EQ(hash, L4(Eth(0x0800) + Ipv4(kUdp, 1, 2, 12) + Ports(1000, 53)));
+  EXPECT_NE(hash, L4(Eth(0x0800) + Ipv4(kUdp, 1, 2, 12) + Ports(1000, 54)));
+  EXPECT_NE(hash, L4(Eth(0x0800) + Ipv4(kTcp, 1, 2, 12) + Ports(1000, 53)));
+
+  // L3 ignores the protocol and ports
+  EXPECT_EQ(L3(Eth(0x0800) + Ipv4(kUdp, 1, 2) + Ports(1000, 53)),
+            L3(Eth(0x0800) + Ipv4(kTcp, 1, 2, 4) + Ports(5, 6)));
+}
+
+TEST_F(HashLBTest, Ipv6ExtensionHeaders) {
+  uint32_t hash = L4(Eth(0x86dd) + Ipv6(kTcp, 1, 2) + Ports(1000, 80));
+
+  EXPECT_EQ(hash, L4(Eth(0x86dd) + Ipv6(0, 1, 2) + Ipv6Ext(60, 1) +
+                     Ipv6Ext(kTcp) + Ports(1000, 80)));
+  EXPECT_NE(hash, L4(Eth(0x86dd) + Ipv6(0, 1, 2) + Ipv6Ext(60, 1) +
+                     Ipv6Ext(kTcp) + Ports(1000, 81)));
+  EXPECT_NE(hash, L4(Eth(0x86dd) + Ipv6(kTcp, 1, 3) + Ports(1000, 80)));
+}
+
+// Only the first fragment has the ports, so no fragment hashes on them
+TEST_F(HashLBTest, Fragments) {
+  const uint16_t kMoreFragments = 0x2000;
+  Bytes eth = Eth(0x0800);
+
+  uint32_t first = L4(eth + Ipv4(kUdp, 1, 2, 0, kMoreFragments) +
+                      Ports(1000, 53));
+  uint32_t later = L4(eth + Ipv4(kUdp, 1, 2, 0, 185) + Ports(7, 7));
+  uint32_t last = L4(eth + Ipv4(kUdp, 1, 2, 0, 370));
+
+  EXPECT_EQ(first, later);
+  EXPECT_EQ(first, last);
+  EXPECT_NE(first, L4(eth + Ipv4(kUdp, 1, 2) + Ports(1000, 53)));
+
+  eth = Eth(0x86dd);
+  first = L4(eth + Ipv6(44, 1, 2) + Ipv6Frag(kUdp, 0, true) +
+             Ports(1000, 53));
+  later = L4(eth + Ipv6(44, 1, 2) + Ipv6Frag(kUdp, 185, false) +
+             Ports(7, 7));
+
+  EXPECT_EQ(first, later);
+  EXPECT_NE(first, L4(eth + Ipv6(kUdp, 1, 2) + Ports(1000, 53)));
+}
+
+TEST_F(HashLBTest, Vxlan) {
+  Bytes inner = Eth(0x0800) + Ipv4(kTcp, 3, 4) + Ports(1000, 80);
+  Bytes vxlan = {0x08, 0, 0, 0, 0, 0, 0x2a, 0};
+  Bytes outer = Eth(0x0800) + Ipv4(kUdp, 1, 2) + Ports(50000, 4789) + vxlan;
+  Bytes outer2 = Eth(0x0800) + Ipv4(kUdp, 1, 2) + Ports(50001, 4789) + vxlan;
+
+  EXPECT_EQ(L4(inner), L4(outer + inner, true));
+  EXPECT_EQ(L4(inner), L4(outer2 + inner, true));
+  EXPECT_EQ(L3(inner), L3(outer + inner, true));
+  EXPECT_NE(L4(outer + inner), L4(outer2 + inner));
+}
+
+TEST_F(HashLBTest, Gre) {
+  Bytes inner_ip = Ipv4(kUdp, 3, 4) + Ports(1000, 53);
+  Bytes inner = Eth(0x0800) + inner_ip;
+
+  // NVGRE, with a key
+  Bytes nvgre = Eth(0x0800) + Ipv4(kGre, 1, 2) +
+                Bytes{0x20, 0, 0x65, 0x58, 0, 0, 0x01, 0};
+  EXPECT_EQ(L4(inner), L4(nvgre + inner, true));
+
+  // IPv4 in GRE, with a checksum and a sequence number
+  Bytes gre = Eth(0x0800) + Ipv4(kGre, 1, 2) +
+              Bytes{0x90, 0, 0x08, 0x00, 0, 0, 0, 0, 0, 0, 0, 1};
+  EXPECT_EQ(L4(inner), L4(gre + inner_ip, true));
+
+  // Without 'inner', the outer header
+  EXPECT_EQ(L4(Eth(0x0800) + Ipv4(kGre, 1, 2)), L4(gre + inner_ip));
+}
+
+// Every prefix of every packet hashes without reading past it
+TEST_F(HashLBTest, Truncated) {
+  Bytes vxlan = {0x08, 0, 0, 0, 0, 0, 0x2a, 0};
+  const std::vector<Bytes> pkts = {
+      Eth(0x0800, {0x88a8, 0x8100}) + Ipv4(kTcp, 1, 2, 40) + Ports(1, 2),
+      Eth(0x86dd) + Ipv6(0, 1, 2) + Ipv6Ext(43, 2) + Ipv6Ext(51, 1) +
+          Ipv6Frag(kTcp, 0, true) + Ports(1, 2),
+      Eth(0x0800) + Ipv4(kUdp, 1, 2) + Ports(1, 4789) + vxlan +
+          Eth(0x86dd, {0x8100}) + Ipv6(kUdp, 3, 4) + Ports(5, 6),
+      Eth(0x86dd) + Ipv6(kGre, 1, 2) + Bytes{0xb0, 0, 0x65, 0x58} +
+          Bytes(12) + Eth(0x0800) + Ipv4(kTcp, 3, 4) + Ports(5, 6),
+  };
+
+  for (const Bytes &pkt : pkts) {
+    for (size_t len = 0; len <= pkt.size(); len++) {
+      L4(pkt, len, false);
+      L4(pkt, len, true);
+    }
+  }
+
+  // Without the ports, as for fragments
+  const Bytes &pkt = pkts[0];
+  EXPECT_EQ(L4(pkt, pkt.size() - 8, false),
+            L4(Eth(0x0800) + Ipv4(kTcp, 1, 2, 0, 185)));
+}
+
+TEST_F(HashLBTest, MaglevWeights) {
+  const std::vector<int> weights = {1, 2, 3, 4, 0, 10};
+  const int total = 20;
+  const int kSize = HashLB::kMaglevTableSize;
+  HashLB lb;
+  bess::pb::HashLBArg arg;
+
+  arg.set_mode("l4");
+  arg.set_maglev(true);
+  for (size_t i = 0; i < weights.size(); i++) {
+    arg.add_gates(i);
+    arg.add_weights(weights[i]);
+  }
+  ASSERT_EQ(0, lb.Init(arg).error().code());
+
+  std::map<gate_idx_t, int> shares = Shares(lb);
+  EXPECT_EQ(0, shares.count(DROP_GATE));
+  EXPECT_EQ(0, shares.count(4));
+
+  for (size_t i = 0; i < weights.size(); i++) {
+    double expected = 1.0 * kSize * weights[i] / total;
+    EXPECT_NEAR(expected, shares[i], kSize * 0.001)
+        << "gate " << i;
+  }
+
+  // All zero
+  bess::pb::HashLBCommandSetGatesArg set_arg;
+  set_arg.add_gates(0);
+  set_arg.add_weights(0);
+  ASSERT_EQ(0, lb.CommandSetGates(set_arg).error().code());
+  shares = Shares(lb);
+  EXPECT_EQ(1, shares.size());
+  EXPECT_EQ(kSize, shares[DROP_GATE]);
+}
+
+// Taking one gate out of N moves its entries, and few others
+TEST_F(HashLBTest, MaglevRemoveGate) {
+  const int kNumGates = 8;
+  const size_t kSize = HashLB::kMaglevTableSize;
+  HashLB lb;
+  bess::pb::HashLBArg arg;
+  bess::pb::HashLBCommandSetGatesArg set_arg;
+
+  arg.set_mode("l4");
+  arg.set_maglev(true);
+  for (int i = 0; i < kNumGates; i++) {
+    arg.add_gates(i);
+    if (i != 3) {
+      set_arg.add_gates(i);
+    }
+  }
+  ASSERT_EQ(0, lb.Init(arg).error().code());
+  std::vector<gate_idx_t> before = Maglev(lb);
+
+  ASSERT_EQ(0, lb.CommandSetGates(set_arg).error().code());
+  std::vector<gate_idx_t> after = Maglev(lb);
+
+  size_t removed = 0;
+  size_t moved = 0;
+  for (size_t i = 0; i < kSize; i++) {
+    ASSERT_NE(3, after[i]);
+    if (before[i] == 3) {
+      removed++;
+    } else if (before[i] != after[i]) {
+      moved++;
+    }
+  }
+
+  EXPECT_NEAR(kSize / kNumGates, removed, kSize * 0.001);
+  EXPECT_LT(moved, kSize / kNumGates / 4);
+
+  // And back
+  ASSERT_EQ(0, lb.Init(arg).error().code());
+  EXPECT_EQ(before, Maglev(lb));
+}
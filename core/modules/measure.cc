@@ -1,7 +1,10 @@
 #include "measure.h"
 
-#include <cmath>
+#include <x86intrin.h>
 
+#include <new>
+
+#include "../mem_alloc.h"
 #include "../utils/ether.h"
 #include "../utils/ip.h"
 #include "../utils/time.h"
@@ -22,14 +25,28 @@ static bool IsTimestamped(bess::Packet *pkt, size_t offset, uint64_t *time) {
   return false;
 }
 
-/* XXX: currently doesn't support multiple workers */
-
 const Commands Measure::cmds = {
-    {"get_summary", "EmptyArg", MODULE_CMD_FUNC(&Measure::CommandGetSummary),
-     0},
-    {"clear", "EmptyArg", MODULE_CMD_FUNC(&Measure::CommandClear), 0},
+    {"get_summary", "MeasureCommandGetSummaryArg",
+     MODULE_CMD_FUNC(&Measure::CommandGetSummary), 1},
+    {"clear", "EmptyArg", MODULE_CMD_FUNC(&Measure::CommandClear), 1},
 };
 
+void Measure::Stats::Add(const Stats &other) {
+  pkt_cnt += other.pkt_cnt;
+  bytes_cnt += other.bytes_cnt;
+  total_latency += other.total_latency;
+  rtt_hist.merge(other.rtt_hist);
+  jitter_hist.merge(other.jitter_hist);
+}
+
+void Measure::Stats::Reset() {
+  pkt_cnt = 0;
+  bytes_cnt = 0;
+  total_latency = 0;
+  rtt_hist.reset();
+  jitter_hist.reset();
+}
+
 CommandResponse Measure::Init(const bess::pb::MeasureArg &arg) {
   // seconds from nanoseconds
   warmup_ns_ = arg.warmup() * 1000000000ull;
@@ -51,13 +68,81 @@ CommandResponse Measure::Init(const bess::pb::MeasureArg &arg) {
   return CommandSuccess();
 }
 
+void Measure::DeInit() {
+  for (auto &slot : shards_) {
+    FreeShard(slot.exchange(nullptr));
+  }
+}
+
+void Measure::AddActiveWorker(int wid, const ModuleTask *task) {
+  Module::AddActiveWorker(wid, task);
+
+  if (!AllocShard(wid)) {
+    LOG(ERROR) << name() << ": no memory for the stats of worker " << wid;
+  }
+}
+
+Measure::Shard *Measure::AllocShard(int wid) {
+  std::atomic<Shard *> &slot = shards_[wid];
+  Shard *shard = slot.load(std::memory_order_acquire);
+
+  if (shard) {
+    return shard;
+  }
+
+  void *mem = mem_alloc(sizeof(Shard));
+  if (!mem) {
+    return nullptr;
+  }
+
+  // Workers may run while modules are connected, so the worker itself may
+  // have got there first
+  Shard *new_shard = new (mem) Shard();
+  if (slot.compare_exchange_strong(shard, new_shard)) {
+    return new_shard;
+  }
+
+  FreeShard(new_shard);
+  return shard;
+}
+
+void Measure::FreeShard(Shard *shard) {
+  if (shard) {
+    shard->~Shard();
+    mem_free(shard);
+  }
+}
+
+inline Measure::Shard *Measure::GetShard() {
+  Shard *shard = shards_[ctx.wid()].load(std::memory_order_acquire);
+
+  // Only if the worker was resumed without checking the constraints, which
+  // is when workers get attached to modules
+  if (unlikely(!shard)) {
+    shard = AllocShard(ctx.wid());
+  }
+  return shard;
+}
+
 void Measure::ProcessBatch(bess::PacketBatch *batch) {
   // We don't use ctx->current_ns here for better accuracy
   uint64_t now_ns = tsc_to_ns(rdtsc());
   size_t offset = offset_;
 
+  Shard *shard = nullptr;
+
   if (now_ns - start_ns_ >= warmup_ns_) {
-    pkt_cnt_ += batch->cnt();
+    shard = GetShard();
+  }
+
+  if (shard) {
+    uint64_t seq = shard->seq.load(std::memory_order_relaxed);
+
+    // Pairs with Collect(): either it sees us busy, or we see its new epoch
+    shard->seq.store(seq + 1);
+    Stats *stats = &shard->stats[epoch_.load() & 1];
+
+    stats->pkt_cnt += batch->cnt();
 
     for (int i = 0; i < batch->cnt(); i++) {
       uint64_t pkt_time;
@@ -71,53 +156,109 @@ void Measure::ProcessBatch(bess::PacketBatch *batch) {
           continue;
         }
 
-        bytes_cnt_ += batch->pkts()[i]->total_len();
-        total_latency_ += diff;
+        stats->bytes_cnt += batch->pkts()[i]->total_len();
+        stats->total_latency += diff;
 
-        rtt_hist_.insert(diff);
-        if (rand_.GetRealNonzero() <= jitter_sample_prob_) {
-          if (unlikely(!last_rtt_ns_)) {
-            last_rtt_ns_ = diff;
+        stats->rtt_hist.insert(diff);
+        if (shard->rand.GetRealNonzero() <= jitter_sample_prob_) {
+          if (unlikely(!shard->last_rtt_ns)) {
+            shard->last_rtt_ns = diff;
             continue;
           }
-          uint64_t jitter = std::abs(diff - last_rtt_ns_);
-          jitter_hist_.insert(jitter);
-          last_rtt_ns_ = diff;
+          uint64_t jitter = (diff > shard->last_rtt_ns)
+                                ? diff - shard->last_rtt_ns
+                                : shard->last_rtt_ns - diff;
+          stats->jitter_hist.insert(jitter);
+          shard->last_rtt_ns = diff;
         }
       }
     }
+
+    shard->seq.store(seq + 2, std::memory_order_release);
   }
   RunNextModule(batch);
 }
 
-CommandResponse Measure::CommandGetSummary(const bess::pb::EmptyArg &) {
-  uint64_t pkt_total = pkt_cnt_;
-  uint64_t byte_total = bytes_cnt_;
+void Measure::Collect() {
+  uint64_t old_epoch = epoch_.fetch_add(1);
+
+  for (auto &slot : shards_) {
+    Shard *shard = slot.load(std::memory_order_acquire);
+    if (!shard) {
+      continue;
+    }
+
+    // A batch in progress may still be writing into the old stats. Any batch
+    // after it uses the new ones.
+    uint64_t seq = shard->seq.load();
+    if (seq & 1) {
+      while (shard->seq.load(std::memory_order_acquire) == seq) {
+        _mm_pause();
+      }
+    }
+
+    Stats &stats = shard->stats[old_epoch & 1];
+    total_.Add(stats);
+    stats.Reset();
+  }
+}
+
+CommandResponse Measure::CommandGetSummary(
+    const bess::pb::MeasureCommandGetSummaryArg &arg) {
+  for (double p : arg.latency_percentiles()) {
+    if (p < 0.0 || p > 100.0) {
+      return CommandFailure(EINVAL, "percentiles must be in [0, 100]");
+    }
+  }
+  for (double p : arg.jitter_percentiles()) {
+    if (p < 0.0 || p > 100.0) {
+      return CommandFailure(EINVAL, "percentiles must be in [0, 100]");
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(lock_);
+  Collect();
+
+  uint64_t pkt_total = total_.pkt_cnt;
+  uint64_t byte_total = total_.bytes_cnt;
   uint64_t bits = (byte_total + pkt_total * 24) * 8;
+  const LogHistogram &rtt_hist = total_.rtt_hist;
+  const LogHistogram &jitter_hist = total_.jitter_hist;
 
   bess::pb::MeasureCommandGetSummaryResponse r;
 
   r.set_timestamp(get_epoch_time());
   r.set_packets(pkt_total);
   r.set_bits(bits);
-  r.set_total_latency_ns(total_latency_);
-  r.set_latency_min_ns(rtt_hist_.min());
-  r.set_latency_avg_ns(rtt_hist_.avg());
-  r.set_latency_max_ns(rtt_hist_.max());
-  r.set_latency_50_ns(rtt_hist_.percentile(50));
-  r.set_latency_99_ns(rtt_hist_.percentile(99));
-  r.set_jitter_min_ns(jitter_hist_.min());
-  r.set_jitter_avg_ns(jitter_hist_.avg());
-  r.set_jitter_max_ns(jitter_hist_.max());
-  r.set_jitter_50_ns(jitter_hist_.percentile(50));
-  r.set_jitter_99_ns(jitter_hist_.percentile(99));
+  r.set_total_latency_ns(total_.total_latency);
+  r.set_latency_min_ns(rtt_hist.min());
+  r.set_latency_avg_ns(rtt_hist.avg());
+  r.set_latency_max_ns(rtt_hist.max());
+  r.set_latency_50_ns(rtt_hist.percentile(50));
+  r.set_latency_99_ns(rtt_hist.percentile(99));
+  r.set_jitter_min_ns(jitter_hist.min());
+  r.set_jitter_avg_ns(jitter_hist.avg());
+  r.set_jitter_max_ns(jitter_hist.max());
+  r.set_jitter_50_ns(jitter_hist.percentile(50));
+  r.set_jitter_99_ns(jitter_hist.percentile(99));
+
+  for (double p : arg.latency_percentiles()) {
+    r.add_latency_percentiles_ns(rtt_hist.percentile(p));
+  }
+  for (double p : arg.jitter_percentiles()) {
+    r.add_jitter_percentiles_ns(jitter_hist.percentile(p));
+  }
 
   return CommandSuccess(r);
 }
 
 CommandResponse Measure::CommandClear(const bess::pb::EmptyArg &) {
-  rtt_hist_.reset();
-  jitter_hist_.reset();
+  std::lock_guard<std::mutex> guard(lock_);
+
+  // As before, only the histograms start over
+  Collect();
+  total_.rtt_hist.reset();
+  total_.jitter_hist.reset();
   return CommandResponse();
 }
 
@@ -1,56 +1,105 @@
 #ifndef BESS_MODULES_MEASURE_H_
 #define BESS_MODULES_MEASURE_H_
 
+#include <atomic>
+#include <mutex>
+
 #include "../module.h"
 #include "../module_msg.pb.h"
 #include "../utils/histogram.h"
 #include "../utils/random.h"
+#include "../worker.h"
 
+// Measures the latency of packets stamped by the Timestamp module.
+//
+// The module may run on several workers at once. Each worker records into a
+// shard of its own, and commands merge the shards without stopping the
+// workers: every shard has two sets of stats, and workers write into the set
+// of the current epoch. To read, a command moves to the next epoch, waits for
+// the batches still writing into the previous one, and then takes its stats.
 class Measure final : public Module {
  public:
   Measure()
       : Module(),
-        rtt_hist_(kBuckets, kBucketWidth),
-        jitter_hist_(kBuckets, kBucketWidth),
-        rand_(Random()),
+        shards_(),
+        epoch_(),
+        lock_(),
+        total_(),
         jitter_sample_prob_(),
-        last_rtt_ns_(),
         start_ns_(),
         warmup_ns_(),
-        offset_(),
-        pkt_cnt_(),
-        bytes_cnt_(),
-        total_latency_() {}
+        offset_() {}
 
   CommandResponse Init(const bess::pb::MeasureArg &arg);
 
+  void DeInit() override;
+
   void ProcessBatch(bess::PacketBatch *batch) override;
 
-  CommandResponse CommandGetSummary(const bess::pb::EmptyArg &arg);
+  // Allocates the shard of the worker ahead of its first batch
+  void AddActiveWorker(int wid, const ModuleTask *task) override;
+
+  CommandResponse CommandGetSummary(
+      const bess::pb::MeasureCommandGetSummaryArg &arg);
   CommandResponse CommandClear(const bess::pb::EmptyArg &arg);
 
   static const Commands cmds;
 
  private:
-  static const uint64_t kBucketWidth = 100;  // Measure in 100 ns units
-  static const uint64_t kBuckets = 1000000;
+  friend class MeasureTest;
+
   static constexpr double kDefaultIpDvSampleProb = 0.05;
 
-  Histogram<uint64_t> rtt_hist_;
-  Histogram<uint64_t> jitter_hist_;
+  struct Stats {
+    uint64_t pkt_cnt;
+    uint64_t bytes_cnt;
+    uint64_t total_latency;
+    LogHistogram rtt_hist;     // in ns
+    LogHistogram jitter_hist;  // in ns
 
-  Random rand_;
-  double jitter_sample_prob_;
+    Stats() : pkt_cnt(), bytes_cnt(), total_latency() {}
+
+    void Add(const Stats &other);
+    void Reset();
+  };
+
+  struct Shard {
+    // Odd while the worker is in ProcessBatch()
+    std::atomic<uint64_t> seq;
+    Stats stats[2];  // by the parity of the epoch
+
+    Random rand;
+    uint64_t last_rtt_ns;
+
+    Shard() : seq(), stats(), rand(), last_rtt_ns() {}
+  };
 
-  uint64_t last_rtt_ns_;
+  // Returns the shard of worker 'wid', allocating it if there is none yet,
+  // or nullptr if out of memory
+  Shard *AllocShard(int wid);
+
+  static void FreeShard(Shard *shard);
+
+  // Returns the shard of the current worker, or nullptr if it has none and
+  // none can be allocated
+  Shard *GetShard();
+
+  // Starts a new epoch and adds the stats of the previous one to total_.
+  // lock_ must be held.
+  void Collect();
+
+  // Set once, by AddActiveWorker() or else by the worker itself
+  std::atomic<Shard *> shards_[Worker::kMaxWorkers];
+  std::atomic<uint64_t> epoch_;
+
+  std::mutex lock_;  // for commands
+  Stats total_;      // up to the last epoch
+
+  double jitter_sample_prob_;
 
   uint64_t start_ns_;
   uint64_t warmup_ns_;  // no measurement for this warmup period
   size_t offset_;       // in bytes
-
-  uint64_t pkt_cnt_;
-  uint64_t bytes_cnt_;
-  uint64_t total_latency_;
 };
 
 #endif  // BESS_MODULES_MEASURE_H_
@@ -0,0 +1,189 @@
+#include "measure.h"
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../utils/time.h"
+#include "timestamp.h"
+
+// Takes the packets of Measure, so that the tests can send them again
+class MeasureSink : public Module {
+ public:
+  static const gate_idx_t kNumIGates = 1;
+  static const gate_idx_t kNumOGates = 0;
+
+  static const Commands cmds;
+
+  CommandResponse Init(const bess::pb::EmptyArg &) { return CommandSuccess(); }
+
+  void ProcessBatch(bess::PacketBatch *) override {}
+};
+
+const Commands MeasureSink::cmds = {};
+
+DEF_MODULE(MeasureSink, "measure_sink", "ignores the packets it gets");
+
+class MeasureTest : public ::testing::Test {
+ protected:
+  static const int kBatchSize = 32;
+  static const uint16_t kLen = 100;
+  static const size_t kOffset = 42;  // the default, after UDP
+
+  virtual void SetUp() {
+    m_ = static_cast<Measure *>(
+        CreateModule("Measure", bess::pb::MeasureArg()));
+    Module *sink = CreateModule("MeasureSink", bess::pb::EmptyArg());
+    ASSERT_EQ(0, m_->ConnectModules(0, sink, 0));
+  }
+
+  virtual void TearDown() { ModuleBuilder::DestroyAllModules(); }
+
+  static Module *CreateModule(const std::string &class_name,
+                              const google::protobuf::Message &arg) {
+    const ModuleBuilder &builder =
+        ModuleBuilder::all_module_builders().find(class_name)->second;
+    google::protobuf::Any any;
+
+    any.PackFrom(arg);
+
+    Module *m = builder.CreateModule(
+        ModuleBuilder::GenerateDefaultName(builder.class_name(),
+                                           builder.name_template()),
+        &bess::metadata::default_pipeline);
+    ModuleBuilder::AddModule(m);
+    EXPECT_EQ(0, m->InitWithGenericArg(any).error().code());
+    return m;
+  }
+
+  // Sends batches of timestamped packets as worker 'wid' until 'stop' is set,
+  // and returns the number of packets sent
+  uint64_t Send(int wid, const std::atomic<bool> *stop) {
+    std::vector<bess::Packet> pkts(kBatchSize);
+    bess::PacketBatch batch;
+    uint64_t sent = 0;
+
+    ctx.set_wid(wid);
+    for (bess::Packet &pkt : pkts) {
+      pkt.set_buffer(pkt.data());
+      pkt.set_data_off(0);
+      pkt.set_data_len(kLen);
+      pkt.set_total_len(kLen);
+      *pkt.head_data<Timestamp::MarkerType *>(kOffset) = Timestamp::kMarker;
+    }
+
+    while (!stop->load()) {
+      uint64_t now_ns = tsc_to_ns(rdtsc());
+
+      batch.clear();
+      for (bess::Packet &pkt : pkts) {
+        *pkt.head_data<uint64_t *>(kOffset + sizeof(Timestamp::MarkerType)) =
+            now_ns - 1000;
+        batch.add(&pkt);
+      }
+      m_->ProcessBatch(&batch);
+      sent += batch.cnt();
+    }
+    return sent;
+  }
+
+  // Sends from each of 'wids' in a thread of its own, while 'command' runs
+  // 'times' times in this thread. Returns the number of packets sent.
+  uint64_t SendWhile(const std::vector<int> &wids, int times,
+                     std::function<void()> command) {
+    std::atomic<bool> stop(false);
+    std::vector<uint64_t> sent(wids.size());
+    std::vector<std::thread> threads;
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < wids.size(); i++) {
+      threads.emplace_back(
+          [this, &wids, &stop, &sent, i]() { sent[i] = Send(wids[i], &stop); });
+    }
+
+    for (int i = 0; i < times; i++) {
+      command();
+    }
+    stop = true;
+
+    for (size_t i = 0; i < wids.size(); i++) {
+      threads[i].join();
+      total += sent[i];
+    }
+    return total;
+  }
+
+  bess::pb::MeasureCommandGetSummaryResponse GetSummary() {
+    CommandResponse res =
+        m_->CommandGetSummary(bess::pb::MeasureCommandGetSummaryArg());
+    bess::pb::MeasureCommandGetSummaryResponse r;
+
+    EXPECT_EQ(0, res.error().code());
+    res.data().UnpackTo(&r);
+    return r;
+  }
+
+  void Clear() {
+    EXPECT_EQ(0, m_->CommandClear(bess::pb::EmptyArg()).error().code());
+  }
+
+  bool HasShard(int wid) const { return m_->shards_[wid].load() != nullptr; }
+
+  // Samples in the latency histogram since the last clear
+  uint64_t HistogramCount() const { return m_->total_.rtt_hist.count(); }
+
+  Measure *m_;
+
+  MeasureSink_class MeasureSink_singleton;
+};
+
+// Workers attached to the module get their shards before any packet
+TEST_F(MeasureTest, AttachAllocatesShard) {
+  EXPECT_FALSE(HasShard(1));
+  m_->AddActiveWorker(1, nullptr);
+  EXPECT_TRUE(HasShard(1));
+  EXPECT_FALSE(HasShard(0));
+  EXPECT_FALSE(HasShard(2));
+}
+
+// Commands read and clear the stats while workers 0 and 1, attached, and 2,
+// not attached, record packets. No packet is lost or counted twice.
+TEST_F(MeasureTest, ExactCountsAcrossWorkers) {
+  const std::vector<int> wids = {0, 1, 2};
+  const uint64_t kBitsPerPacket = (kLen + 24) * 8;
+  uint64_t last = 0;
+  int reads = 0;
+
+  m_->AddActiveWorker(0, nullptr);
+  m_->AddActiveWorker(1, nullptr);
+
+  // Packet counts only go up, even across clears
+  uint64_t sent = SendWhile(wids, 100, [&]() {
+    bess::pb::MeasureCommandGetSummaryResponse r = GetSummary();
+    EXPECT_LE(last, r.packets());
+    EXPECT_EQ(r.packets() * kBitsPerPacket, r.bits());
+    last = r.packets();
+    if (++reads % 4 == 0) {
+      Clear();
+    }
+  });
+
+  bess::pb::MeasureCommandGetSummaryResponse r = GetSummary();
+  EXPECT_EQ(sent, r.packets());
+  EXPECT_EQ(sent * kBitsPerPacket, r.bits());
+  EXPECT_TRUE(HasShard(2));
+
+  // Without clears, the latency histogram also has every packet once
+  Clear();
+  EXPECT_EQ(0, HistogramCount());
+  uint64_t more = SendWhile(wids, 50, [&]() { GetSummary(); });
+
+  r = GetSummary();
+  EXPECT_EQ(sent + more, r.packets());
+  EXPECT_EQ(more, HistogramCount());
+  EXPECT_LE(1000, r.latency_min_ns());
+}
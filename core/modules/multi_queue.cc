@@ -0,0 +1,351 @@
+#include "multi_queue.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <map>
+
+#include "../utils/format.h"
+#include "../utils/time.h"
+
+// Weights are relative. This keeps weight * quantum_ far from overflowing.
+static const uint64_t kMaxWeight = 1 << 16;
+
+const Commands MultiQueue::cmds = {
+    {"update_queue", "MultiQueueCommandUpdateQueueArg",
+     MODULE_CMD_FUNC(&MultiQueue::CommandUpdateQueue), 0},
+    {"get_stats", "EmptyArg", MODULE_CMD_FUNC(&MultiQueue::CommandGetStats),
+     0},
+};
+
+CommandResponse MultiQueue::Init(const bess::pb::MultiQueueArg &arg) {
+  size_t size = arg.size();
+  if (size < 1 || size > sizeof(uint64_t)) {
+    return CommandFailure(EINVAL, "'size' must be 1-%zu", sizeof(uint64_t));
+  }
+  mask_ = (size == 8) ? 0xffffffffffffffffull : (1ull << (size * 8)) - 1;
+
+  attr_id_ = AddMetadataAttr(arg.attribute(), size,
+                             bess::metadata::Attribute::AccessMode::kRead);
+  if (attr_id_ < 0) {
+    return CommandFailure(-attr_id_, "add_metadata_attr() failed");
+  }
+
+  if (arg.queues_size() < 1 || arg.queues_size() > kMaxQueues) {
+    return CommandFailure(EINVAL, "must have 1-%d queues", kMaxQueues);
+  }
+
+  if (arg.quantum() > 1 << 20) {
+    return CommandFailure(EINVAL, "'quantum' must be at most 1MB");
+  }
+  quantum_ = arg.quantum() ? arg.quantum() : kDefaultQuantum;
+
+  queues_.resize(arg.queues_size());
+  for (int i = 0; i < arg.queues_size(); i++) {
+    CommandResponse err = ConfigureQueue(i, arg.queues(i));
+    if (err.error().code() != 0) {
+      return err;
+    }
+  }
+
+  BuildLevels();
+
+  task_id_t tid = RegisterTask(nullptr);
+  if (tid == INVALID_TASK_ID) {
+    return CommandFailure(ENOMEM, "Task creation failed");
+  }
+
+  return CommandSuccess();
+}
+
+void MultiQueue::DeInit() {
+  for (Queue &q : queues_) {
+    while (q.count() > 0) {
+      bess::Packet::Free(q.front());
+      q.head++;
+    }
+  }
+}
+
+std::string MultiQueue::GetDesc() const {
+  uint64_t backlog = 0;
+
+  for (const Queue &q : queues_) {
+    backlog += q.count();
+  }
+
+  return bess::utils::Format("%zu queues/%" PRIu64 " pkts", queues_.size(),
+                             backlog);
+}
+
+CommandResponse MultiQueue::ConfigureQueue(
+    uint32_t idx, const bess::pb::MultiQueueArg::Queue &arg) {
+  Queue &q = queues_[idx];
+  uint64_t size = arg.size() ? arg.size() : kDefaultQueueSize;
+  uint64_t weight = arg.weight() ? arg.weight() : 1;
+
+  if (size < 4 || size > 16384 || (size & (size - 1))) {
+    return CommandFailure(EINVAL,
+                          "queue %u: 'size' must be a power of 2 in "
+                          "[4, 16384]",
+                          idx);
+  }
+
+  if (size < q.count()) {
+    return CommandFailure(EBUSY, "queue %u holds %u packets, more than 'size'",
+                          idx, q.count());
+  }
+
+  if (weight > kMaxWeight) {
+    return CommandFailure(EINVAL,
+                          "queue %u: 'weight' must be at most %" PRIu64, idx,
+                          kMaxWeight);
+  }
+
+  if (size != q.ring.size()) {
+    std::vector<bess::Packet *> ring(size);
+    uint32_t cnt = q.count();
+
+    for (uint32_t i = 0; i < cnt; i++) {
+      ring[i] = q.ring[(q.head + i) & (q.ring.size() - 1)];
+    }
+    q.ring.swap(ring);
+    q.head = 0;
+    q.tail = cnt;
+  }
+
+  q.priority = arg.priority();
+  q.quantum = weight * quantum_;
+
+  // 1ms worth of traffic by default
+  q.bits_per_cycle = static_cast<double>(arg.rate_limit()) / tsc_hz;
+  q.max_burst = arg.max_burst() ? arg.max_burst() : arg.rate_limit() / 1000.0;
+  q.tokens = q.max_burst;
+  q.last_tsc = rdtsc();
+
+  return CommandSuccess();
+}
+
+void MultiQueue::BuildLevels() {
+  std::map<uint32_t, std::vector<uint32_t>> by_priority;
+
+  for (uint32_t i = 0; i < queues_.size(); i++) {
+    by_priority[queues_[i].priority].push_back(i);
+  }
+
+  levels_.clear();
+  level_of_.resize(queues_.size());
+
+  for (const auto &it : by_priority) {
+    Level l;
+
+    l.priority = it.first;
+    l.active.resize(it.second.size());
+    l.active_head = 0;
+    l.active_cnt = 0;
+    l.resume = false;
+
+    for (uint32_t idx : it.second) {
+      level_of_[idx] = levels_.size();
+    }
+    levels_.push_back(l);
+  }
+
+  for (uint32_t i = 0; i < queues_.size(); i++) {
+    Queue &q = queues_[i];
+
+    q.active = false;
+    q.deficit = 0;
+    if (q.count() > 0) {
+      Activate(i);
+    }
+  }
+}
+
+inline void MultiQueue::Activate(uint32_t idx) {
+  Level &l = levels_[level_of_[idx]];
+
+  l.active[(l.active_head + l.active_cnt) % l.active.size()] = idx;
+  l.active_cnt++;
+  queues_[idx].active = true;
+}
+
+void MultiQueue::ProcessBatch(bess::PacketBatch *batch) {
+  bess::Packet *drops[bess::PacketBatch::kMaxBurst];
+  const uint64_t num_queues = queues_.size();
+  int cnt = batch->cnt();
+  int dropped = 0;
+
+  for (int i = 0; i < cnt; i++) {
+    bess::Packet *pkt = batch->pkts()[i];
+    uint64_t val = get_attr<uint64_t>(this, attr_id_, pkt) & mask_;
+
+    if (val >= num_queues) {
+      drops[dropped++] = pkt;
+      continue;
+    }
+
+    Queue &q = queues_[val];
+
+    if (q.count() == q.ring.size()) {
+      q.dropped++;
+      drops[dropped++] = pkt;
+      continue;
+    }
+
+    q.ring[q.tail++ & (q.ring.size() - 1)] = pkt;
+    q.enqueued++;
+
+    if (!q.active) {
+      Activate(val);
+    }
+  }
+
+  if (dropped > 0) {
+    bess::Packet::Free(drops, dropped);
+  }
+}
+
+uint64_t MultiQueue::ServeLevel(Level *level, bess::PacketBatch *batch,
+                                uint64_t now) {
+  const size_t size = level->active.size();
+  uint64_t total_bytes = 0;
+
+  // Each pass visits every active queue once. A pass that sends nothing means
+  // that all of them are rate limited.
+  size_t visits = level->active_cnt;
+  bool progress = false;
+
+  while (level->active_cnt > 0 && !batch->full()) {
+    if (visits == 0) {
+      if (!progress) {
+        break;
+      }
+      visits = level->active_cnt;
+      progress = false;
+    }
+    visits--;
+
+    uint32_t idx = level->active[level->active_head];
+    Queue &q = queues_[idx];
+    bool limited = q.bits_per_cycle > 0;
+    bool resume = level->resume;
+
+    level->resume = false;
+
+    if (limited && now > q.last_tsc) {
+      q.tokens = std::min(q.max_burst,
+                          q.tokens + (now - q.last_tsc) * q.bits_per_cycle);
+      q.last_tsc = now;
+    }
+
+    bool throttled = limited && q.tokens < 0;
+
+    if (!throttled) {
+      if (!resume) {
+        q.deficit += q.quantum;
+      }
+
+      while (!batch->full() && q.count() > 0) {
+        bess::Packet *pkt = q.front();
+        uint64_t bytes = pkt->total_len();
+
+        if (bytes > q.deficit) {
+          break;
+        }
+        if (limited) {
+          if (q.tokens < 0) {
+            // Do not let the deficit build up while the queue is held back
+            throttled = true;
+            q.deficit = std::min(q.deficit, q.quantum);
+            break;
+          }
+          q.tokens -= (bytes + kPacketOverhead) * 8;
+        }
+
+        q.head++;
+        q.deficit -= bytes;
+        q.dequeued++;
+        batch->add(pkt);
+        total_bytes += bytes;
+        progress = true;
+      }
+    }
+
+    if (q.count() == 0) {
+      q.deficit = 0;
+      q.active = false;
+      level->active_head = (level->active_head + 1) % size;
+      level->active_cnt--;
+    } else if (batch->full() && !throttled &&
+               static_cast<uint64_t>(q.front()->total_len()) <= q.deficit) {
+      // The queue has more to send in this round. Keep it first.
+      level->resume = true;
+    } else {
+      // Move it to the back
+      level->active[(level->active_head + level->active_cnt) % size] = idx;
+      level->active_head = (level->active_head + 1) % size;
+    }
+  }
+
+  return total_bytes;
+}
+
+struct task_result MultiQueue::RunTask(void *) {
+  bess::PacketBatch batch;
+  uint64_t now = ctx.current_tsc();
+  uint64_t total_bytes = 0;
+
+  batch.clear();
+
+  // Strict priority between levels
+  for (Level &l : levels_) {
+    if (batch.full()) {
+      break;
+    }
+    total_bytes += ServeLevel(&l, &batch, now);
+  }
+
+  uint64_t cnt = batch.cnt();
+  if (cnt > 0) {
+    RunNextModule(&batch);
+  }
+
+  return (struct task_result){
+      .packets = cnt, .bits = (total_bytes + cnt * kPacketOverhead) * 8,
+  };
+}
+
+CommandResponse MultiQueue::CommandUpdateQueue(
+    const bess::pb::MultiQueueCommandUpdateQueueArg &arg) {
+  if (arg.queue() >= queues_.size()) {
+    return CommandFailure(EINVAL, "no queue %" PRIu64, arg.queue());
+  }
+
+  CommandResponse err = ConfigureQueue(arg.queue(), arg.config());
+  if (err.error().code() != 0) {
+    return err;
+  }
+
+  BuildLevels();
+  return CommandSuccess();
+}
+
+CommandResponse MultiQueue::CommandGetStats(const bess::pb::EmptyArg &) {
+  bess::pb::MultiQueueCommandGetStatsResponse r;
+
+  for (const Queue &q : queues_) {
+    bess::pb::MultiQueueCommandGetStatsResponse::QueueStats *stats =
+        r.add_queues();
+
+    stats->set_enqueued(q.enqueued);
+    stats->set_dequeued(q.dequeued);
+    stats->set_dropped(q.dropped);
+    stats->set_backlog(q.count());
+  }
+
+  return CommandSuccess(r);
+}
+
+ADD_MODULE(MultiQueue, "mq",
+           "schedules packets from several queues by priority, weight and "
+           "rate limit")
@@ -0,0 +1,116 @@
+#ifndef BESS_MODULES_MULTI_QUEUE_H_
+#define BESS_MODULES_MULTI_QUEUE_H_
+
+#include <vector>
+
+#include "../module.h"
+#include "../module_msg.pb.h"
+
+// Queues packets in several queues and schedules them within a single task,
+// so that one module can shape many classes of traffic (e.g., tenants)
+// without a traffic class and a Queue module for each.
+//
+// Packets are classified by a metadata attribute: value i goes to queue i.
+// Queues of lower priority values are served first. Among queues of the same
+// priority, the output is shared by deficit round robin in proportion to
+// their weights. Queues may also be rate limited, by a token bucket each.
+//
+// The rings, deficits and token buckets are shared by ProcessBatch() and
+// RunTask() without locks. As max_allowed_workers_ is left at 1, the base
+// CheckModuleConstraints() fails if packets come from any other worker.
+class MultiQueue final : public Module {
+ public:
+  static const int kDefaultQueueSize = 1024;
+  static const int kMaxQueues = 65536;
+  static const uint32_t kDefaultQuantum = 1500;  // bytes per round, weight 1
+  static const int kPacketOverhead = 24;  // for rate limits, as in TCs
+
+  static const Commands cmds;
+
+  MultiQueue()
+      : Module(),
+        attr_id_(),
+        mask_(),
+        quantum_(),
+        queues_(),
+        levels_(),
+        level_of_() {}
+
+  CommandResponse Init(const bess::pb::MultiQueueArg &arg);
+
+  void DeInit() override;
+
+  void ProcessBatch(bess::PacketBatch *batch) override;
+
+  struct task_result RunTask(void *arg) override;
+
+  std::string GetDesc() const override;
+
+  CommandResponse CommandUpdateQueue(
+      const bess::pb::MultiQueueCommandUpdateQueueArg &arg);
+  CommandResponse CommandGetStats(const bess::pb::EmptyArg &arg);
+
+ private:
+  friend class MultiQueueTest;
+
+  struct Queue {
+    // Packets, in a ring buffer of a power of 2 size
+    std::vector<bess::Packet *> ring;
+    uint32_t head;  // free running; ring index is (head & (ring.size() - 1))
+    uint32_t tail;
+
+    uint32_t priority;
+    uint64_t quantum;  // bytes per round, i.e., weight * quantum_
+    uint64_t deficit;  // bytes
+
+    // Token bucket, in bits. bits_per_cycle == 0 if unlimited. Packets are
+    // sent while the bucket is not in debt, so that any packet size goes
+    // through.
+    double bits_per_cycle;
+    double max_burst;
+    double tokens;
+    uint64_t last_tsc;
+
+    bool active;  // in its level's list of active queues
+
+    uint64_t enqueued;
+    uint64_t dequeued;
+    uint64_t dropped;
+
+    uint32_t count() const { return tail - head; }
+    bess::Packet *front() const { return ring[head & (ring.size() - 1)]; }
+  };
+
+  // The queues of a priority, and those of them with packets in the order in
+  // which deficit round robin visits them
+  struct Level {
+    uint32_t priority;
+    std::vector<uint32_t> active;  // a ring buffer of queue indices
+    size_t active_head;
+    size_t active_cnt;
+    bool resume;  // the first active queue got its quantum already
+  };
+
+  // Applies a queue configuration to queues_[idx]
+  CommandResponse ConfigureQueue(uint32_t idx,
+                                 const bess::pb::MultiQueueArg::Queue &arg);
+
+  // (Re)builds levels_ out of the queue priorities
+  void BuildLevels();
+
+  void Activate(uint32_t idx);
+
+  // Serves the active queues of the level until the batch is full, all are
+  // empty or rate limited. Returns the number of bytes added to the batch.
+  uint64_t ServeLevel(Level *level, bess::PacketBatch *batch, uint64_t now);
+
+  int attr_id_;
+  uint64_t mask_;
+  uint32_t quantum_;
+
+  std::vector<Queue> queues_;
+  std::vector<Level> levels_;     // by increasing priority value
+  std::vector<uint32_t> level_of_;  // level index of each queue
+};
+
+#endif  // BESS_MODULES_MULTI_QUEUE_H_
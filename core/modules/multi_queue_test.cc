@@ -0,0 +1,204 @@
+#include "multi_queue.h"
+
+#include <unistd.h>
+
+#include <map>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../dpdk.h"
+
+class MultiQueueTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    if (!dpdk_inited_) {
+      if (geteuid() == 0) {
+        init_dpdk("multi_queue_test", 1024, 0, true);
+        bess::init_mempool();
+        dpdk_inited_ = true;
+      } else {
+        LOG(INFO) << "This test requires root privileges. Skipping...";
+      }
+    }
+  }
+
+  virtual void TearDown() { ModuleBuilder::DestroyAllModules(); }
+
+  // Creates a module with a 1-byte queue index attribute and 'queues'
+  MultiQueue *Create(
+      const std::vector<bess::pb::MultiQueueArg::Queue> &queues) {
+    const ModuleBuilder &builder =
+        ModuleBuilder::all_module_builders().find("MultiQueue")->second;
+    bess::pb::MultiQueueArg arg;
+    google::protobuf::Any any;
+
+    arg.set_attribute("mq_test");
+    arg.set_size(1);
+    for (const auto &q : queues) {
+      *arg.add_queues() = q;
+    }
+    any.PackFrom(arg);
+
+    Module *m = builder.CreateModule(
+        ModuleBuilder::GenerateDefaultName(builder.class_name(),
+                                           builder.name_template()),
+        &bess::metadata::default_pipeline);
+    ModuleBuilder::AddModule(m);
+    EXPECT_EQ(0, m->InitWithGenericArg(any).error().code());
+    return static_cast<MultiQueue *>(m);
+  }
+
+  static bess::pb::MultiQueueArg::Queue QueueArg(uint32_t priority,
+                                                 uint64_t weight = 1,
+                                                 uint64_t size = 0) {
+    bess::pb::MultiQueueArg::Queue q;
+
+    q.set_priority(priority);
+    q.set_weight(weight);
+    q.set_size(size);
+    return q;
+  }
+
+  // Queues 'cnt' packets of 'len' bytes to queue 'idx', and returns them
+  static std::vector<bess::Packet *> Send(MultiQueue *mq, uint8_t idx, int cnt,
+                                          uint16_t len = 100) {
+    std::vector<bess::Packet *> sent;
+
+    while (cnt > 0) {
+      bess::PacketBatch batch;
+
+      batch.clear();
+      for (; cnt > 0 && !batch.full(); cnt--) {
+        bess::Packet *pkt = reinterpret_cast<bess::Packet *>(
+            rte_pktmbuf_alloc(bess::get_pframe_pool_socket(0)));
+        EXPECT_NE(nullptr, pkt);
+        pkt->set_data_len(len);
+        pkt->set_total_len(len);
+        set_attr<uint8_t>(mq, 0, pkt, idx);
+        batch.add(pkt);
+        sent.push_back(pkt);
+      }
+      mq->ProcessBatch(&batch);
+    }
+    return sent;
+  }
+
+  // Dequeues up to 'cnt' packets as RunTask() does, and returns them
+  static std::vector<bess::Packet *> Receive(MultiQueue *mq, size_t cnt) {
+    std::vector<bess::Packet *> received;
+
+    while (received.size() < cnt) {
+      bess::PacketBatch batch;
+
+      batch.clear();
+      for (auto &l : mq->levels_) {
+        if (batch.full()) {
+          break;
+        }
+        mq->ServeLevel(&l, &batch, rdtsc());
+      }
+      if (batch.cnt() == 0) {
+        break;
+      }
+      received.insert(received.end(), batch.pkts(),
+                      batch.pkts() + batch.cnt());
+    }
+    return received;
+  }
+
+  static uint32_t Backlog(MultiQueue *mq, uint32_t idx) {
+    return mq->queues_[idx].count();
+  }
+
+  static void Free(const std::vector<bess::Packet *> &pkts) {
+    for (bess::Packet *pkt : pkts) {
+      bess::Packet::Free(pkt);
+    }
+  }
+
+  static bool dpdk_inited_;
+};
+
+bool MultiQueueTest::dpdk_inited_ = false;
+
+// Lower priority values are served first, whatever the arrival order
+TEST_F(MultiQueueTest, StrictPriority) {
+  if (!dpdk_inited_) {
+    return;
+  }
+
+  MultiQueue *mq = Create({QueueArg(2), QueueArg(0), QueueArg(1)});
+  std::vector<bess::Packet *> low = Send(mq, 0, 100);
+  std::vector<bess::Packet *> mid = Send(mq, 2, 100);
+  std::vector<bess::Packet *> high = Send(mq, 1, 100);
+
+  std::vector<bess::Packet *> expected = high;
+  expected.insert(expected.end(), mid.begin(), mid.end());
+  expected.insert(expected.end(), low.begin(), low.end());
+
+  std::vector<bess::Packet *> received = Receive(mq, 300);
+  EXPECT_EQ(expected, received);
+  Free(received);
+}
+
+// Queues of the same priority share the output in proportion to their weights
+TEST_F(MultiQueueTest, WeightedShares) {
+  if (!dpdk_inited_) {
+    return;
+  }
+
+  MultiQueue *mq = Create(
+      {QueueArg(0, 1, 4096), QueueArg(0, 3, 4096), QueueArg(0, 4, 4096)});
+  std::map<bess::Packet *, int> queue_of;
+
+  for (uint8_t idx = 0; idx < 3; idx++) {
+    for (bess::Packet *pkt : Send(mq, idx, 4000)) {
+      queue_of[pkt] = idx;
+    }
+  }
+
+  // All queues stay backlogged
+  std::vector<bess::Packet *> received = Receive(mq, 4000);
+  int sent[3] = {};
+
+  ASSERT_EQ(4000, received.size());
+  for (bess::Packet *pkt : received) {
+    sent[queue_of[pkt]]++;
+  }
+  EXPECT_NEAR(500, sent[0], 25);
+  EXPECT_NEAR(1500, sent[1], 25);
+  EXPECT_NEAR(2000, sent[2], 25);
+
+  Free(received);
+}
+
+// update_queue keeps the packets of the queue, in order
+TEST_F(MultiQueueTest, UpdateQueueKeepsPackets) {
+  if (!dpdk_inited_) {
+    return;
+  }
+
+  MultiQueue *mq = Create({QueueArg(0, 1, 1024), QueueArg(1)});
+  std::vector<bess::Packet *> pkts = Send(mq, 0, 500);
+  std::vector<bess::Packet *> other = Send(mq, 1, 10);
+
+  // Too small for the backlog
+  bess::pb::MultiQueueCommandUpdateQueueArg arg;
+  arg.set_queue(0);
+  *arg.mutable_config() = QueueArg(0, 1, 256);
+  EXPECT_EQ(EBUSY, mq->CommandUpdateQueue(arg).error().code());
+  EXPECT_EQ(500, Backlog(mq, 0));
+
+  // Bigger, and below queue 1 now
+  *arg.mutable_config() = QueueArg(2, 2, 2048);
+  ASSERT_EQ(0, mq->CommandUpdateQueue(arg).error().code());
+  EXPECT_EQ(500, Backlog(mq, 0));
+
+  std::vector<bess::Packet *> expected = other;
+  expected.insert(expected.end(), pkts.begin(), pkts.end());
+
+  std::vector<bess::Packet *> received = Receive(mq, 510);
+  EXPECT_EQ(expected, received);
+  Free(received);
+}
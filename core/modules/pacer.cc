@@ -0,0 +1,323 @@
+#include "pacer.h"
+
+#include <rte_hash_crc.h>
+
+#include <algorithm>
+#include <cinttypes>
+
+#include "../utils/ether.h"
+#include "../utils/format.h"
+#include "../utils/ip.h"
+#include "../utils/time.h"
+
+using bess::utils::Ethernet;
+using bess::utils::Ipv4;
+
+static inline uint32_t hash_64(uint64_t val, uint32_t init_val) {
+#if __SSE4_2__ && __x86_64
+  return crc32c_sse42_u64(val, init_val);
+#else
+  return crc32c_2words(val, init_val);
+#endif
+}
+
+const Commands Pacer::cmds = {
+    {"set_rate", "PacerCommandSetRateArg",
+     MODULE_CMD_FUNC(&Pacer::CommandSetRate), 0},
+    {"get_stats", "EmptyArg", MODULE_CMD_FUNC(&Pacer::CommandGetStats), 0},
+};
+
+CommandResponse Pacer::Init(const bess::pb::PacerArg &arg) {
+  uint64_t num_flows = arg.flows() ? arg.flows() : kDefaultFlows;
+
+  if (arg.attribute().size() > 0) {
+    size_t size = arg.size();
+    if (size < 1 || size > sizeof(uint64_t)) {
+      return CommandFailure(EINVAL, "'size' must be 1-%zu", sizeof(uint64_t));
+    }
+    mask_ = (size == 8) ? 0xffffffffffffffffull : (1ull << (size * 8)) - 1;
+
+    attr_id_ = AddMetadataAttr(arg.attribute(), size,
+                               bess::metadata::Attribute::AccessMode::kRead);
+    if (attr_id_ < 0) {
+      return CommandFailure(-attr_id_, "add_metadata_attr() failed");
+    }
+  } else if (num_flows & (num_flows - 1)) {
+    return CommandFailure(EINVAL,
+                          "'flows' must be a power of 2 without 'attribute'");
+  }
+
+  if (num_flows > kMaxFlows) {
+    return CommandFailure(EINVAL, "'flows' must be at most %" PRIu64,
+                          kMaxFlows);
+  }
+
+  uint64_t granularity_ns =
+      arg.granularity_ns() ? arg.granularity_ns() : kDefaultGranularityNs;
+  uint64_t horizon_ns = arg.horizon_ns() ? arg.horizon_ns() : kDefaultHorizonNs;
+
+  if (horizon_ns < granularity_ns) {
+    return CommandFailure(EINVAL, "'horizon_ns' must be >= 'granularity_ns'");
+  }
+
+  double cycles_per_ns = tsc_hz / 1e9;
+  slot_cycles_ = std::max<uint64_t>(1, granularity_ns * cycles_per_ns);
+  horizon_cycles_ = horizon_ns * cycles_per_ns;
+
+  // Any departure within the horizon must fall in a slot after the cursor
+  uint64_t num_slots = 64;
+  while (num_slots < horizon_cycles_ / slot_cycles_ + 2) {
+    num_slots <<= 1;
+  }
+  if (num_slots > kMaxSlots) {
+    return CommandFailure(
+        EINVAL, "'horizon_ns' / 'granularity_ns' must be below %" PRIu64,
+        kMaxSlots - 2);
+  }
+
+  flows_.resize(num_flows);
+  for (Flow &f : flows_) {
+    f.next_tsc = 0;
+    SetRate(&f, arg.rate());
+  }
+
+  slots_.assign(num_slots, Slot{nullptr, nullptr});
+  nonempty_.assign(num_slots / 64, 0);
+  cursor_ = 0;
+  cursor_tsc_ = rdtsc();
+
+  limit_ = arg.limit() ? arg.limit() : kDefaultLimit;
+
+  task_id_t tid = RegisterTask(nullptr);
+  if (tid == INVALID_TASK_ID) {
+    return CommandFailure(ENOMEM, "Task creation failed");
+  }
+
+  return CommandSuccess();
+}
+
+void Pacer::DeInit() {
+  for (Slot &s : slots_) {
+    while (s.head) {
+      bess::Packet *pkt = s.head;
+      s.head = next_of(pkt);
+      bess::Packet::Free(pkt);
+    }
+    s.tail = nullptr;
+  }
+  std::fill(nonempty_.begin(), nonempty_.end(), 0);
+  buffered_ = 0;
+}
+
+std::string Pacer::GetDesc() const {
+  return bess::utils::Format("%zu flows/%" PRIu64 " pkts", flows_.size(),
+                             buffered_);
+}
+
+void Pacer::SetRate(Flow *f, uint64_t rate) {
+  f->cycles_per_byte = rate ? 8.0 * tsc_hz / rate : 0;
+}
+
+inline Pacer::Flow *Pacer::Classify(bess::Packet *pkt) {
+  if (attr_id_ >= 0) {
+    uint64_t val = get_attr<uint64_t>(this, attr_id_, pkt) & mask_;
+    return val < flows_.size() ? &flows_[val] : nullptr;
+  }
+
+  const Ethernet *eth = pkt->head_data<const Ethernet *>();
+  uint32_t len = pkt->head_len();
+  uint32_t hash;
+
+  if (len < sizeof(Ethernet)) {
+    return &flows_[0];
+  }
+
+  const Ipv4 *ip = reinterpret_cast<const Ipv4 *>(eth + 1);
+
+  if (eth->ether_type == bess::utils::be16_t(Ethernet::Type::kIpv4) &&
+      len >= sizeof(Ethernet) + sizeof(Ipv4) && ip->header_length >= 5) {
+    uint8_t proto = ip->protocol;
+    uint32_t l4_off = sizeof(Ethernet) + (ip->header_length << 2);
+    bool frag = (ip->fragment_offset.value() & (Ipv4::Flag::kMF | 0x1fff));
+    uint64_t ports = 0;
+
+    if (!frag && (proto == Ipv4::Proto::kTcp || proto == Ipv4::Proto::kUdp) &&
+        l4_off + 4 <= len) {
+      ports = *pkt->head_data<const uint32_t *>(l4_off);
+    }
+
+    hash = hash_64(*(reinterpret_cast<const uint64_t *>(&ip->src)), 0);
+    hash = hash_64(ports | static_cast<uint64_t>(proto) << 32, hash);
+  } else {
+    hash = hash_64(*pkt->head_data<const uint64_t *>(), 0);
+    hash = hash_64(*pkt->head_data<const uint32_t *>(8), hash);
+  }
+
+  return &flows_[hash & (flows_.size() - 1)];
+}
+
+inline void Pacer::Insert(bess::Packet *pkt, uint64_t departure) {
+  uint64_t delta = 0;
+
+  if (departure > cursor_tsc_) {
+    delta = (departure - cursor_tsc_) / slot_cycles_;
+  }
+
+  // Only if the task has fallen more than a horizon behind. Packets then go
+  // out late, but still in order.
+  if (delta >= slots_.size()) {
+    delta = slots_.size() - 1;
+  }
+
+  uint64_t idx = (cursor_ + delta) & (slots_.size() - 1);
+  Slot &s = slots_[idx];
+
+  next_of(pkt) = nullptr;
+  if (s.tail) {
+    next_of(s.tail) = pkt;
+  } else {
+    s.head = pkt;
+    nonempty_[idx / 64] |= 1ull << (idx % 64);
+  }
+  s.tail = pkt;
+}
+
+uint32_t Pacer::NextSlot() const {
+  const uint64_t num_words = nonempty_.size();
+  uint64_t w = cursor_ / 64;
+  uint64_t bits = nonempty_[w] & (~0ull << (cursor_ % 64));
+
+  // Wraps around to the word of cursor_ again, for the slots before it
+  for (uint64_t i = 0; i <= num_words && !bits; i++) {
+    w = (w + 1) % num_words;
+    bits = nonempty_[w];
+  }
+
+  DCHECK(bits);
+  uint64_t idx = w * 64 + __builtin_ctzll(bits);
+  return (idx - cursor_) & (slots_.size() - 1);
+}
+
+inline void Pacer::AdvanceCursor(uint64_t slots) {
+  cursor_ = (cursor_ + slots) & (slots_.size() - 1);
+  cursor_tsc_ += slots * slot_cycles_;
+}
+
+void Pacer::ProcessBatch(bess::PacketBatch *batch) {
+  bess::Packet *drops[bess::PacketBatch::kMaxBurst];
+  uint64_t now = ctx.current_tsc();
+  int cnt = batch->cnt();
+  int dropped = 0;
+
+  if (buffered_ == 0) {
+    cursor_tsc_ = now;
+  }
+
+  for (int i = 0; i < cnt; i++) {
+    bess::Packet *pkt = batch->pkts()[i];
+    Flow *f = Classify(pkt);
+
+    if (!f || buffered_ >= limit_) {
+      drops[dropped++] = pkt;
+      continue;
+    }
+
+    uint64_t departure = std::max(f->next_tsc, now);
+
+    // The flow sends faster than its rate
+    if (departure - now > horizon_cycles_) {
+      drops[dropped++] = pkt;
+      continue;
+    }
+
+    f->next_tsc = departure + static_cast<uint64_t>(
+                                  (pkt->total_len() + kPacketOverhead) *
+                                  f->cycles_per_byte);
+
+    Insert(pkt, departure);
+    buffered_++;
+  }
+
+  if (dropped > 0) {
+    dropped_ += dropped;
+    bess::Packet::Free(drops, dropped);
+  }
+}
+
+struct task_result Pacer::RunTask(void *) {
+  bess::PacketBatch batch;
+  uint64_t now = ctx.current_tsc();
+  uint64_t total_bytes = 0;
+
+  batch.clear();
+
+  while (buffered_ > 0 && !batch.full() && now >= cursor_tsc_) {
+    // The slots from cursor_ to cursor_ + due have started
+    uint64_t due = (now - cursor_tsc_) / slot_cycles_;
+    uint32_t next = NextSlot();
+
+    if (next > due) {
+      AdvanceCursor(due);
+      break;
+    }
+    AdvanceCursor(next);
+
+    Slot &s = slots_[cursor_];
+    while (s.head && !batch.full()) {
+      bess::Packet *pkt = s.head;
+      s.head = next_of(pkt);
+      batch.add(pkt);
+      total_bytes += pkt->total_len();
+      buffered_--;
+    }
+
+    if (!s.head) {
+      s.tail = nullptr;
+      nonempty_[cursor_ / 64] &= ~(1ull << (cursor_ % 64));
+    }
+  }
+
+  uint64_t cnt = batch.cnt();
+  sent_ += cnt;
+
+  if (cnt > 0) {
+    RunNextModule(&batch);
+  }
+
+  return (struct task_result){
+      .packets = cnt, .bits = (total_bytes + cnt * kPacketOverhead) * 8,
+  };
+}
+
+CommandResponse Pacer::CommandSetRate(
+    const bess::pb::PacerCommandSetRateArg &arg) {
+  for (uint64_t flow : arg.flows()) {
+    if (flow >= flows_.size()) {
+      return CommandFailure(EINVAL, "no flow %" PRIu64, flow);
+    }
+  }
+
+  if (arg.flows_size() == 0) {
+    for (Flow &f : flows_) {
+      SetRate(&f, arg.rate());
+    }
+  } else {
+    for (uint64_t flow : arg.flows()) {
+      SetRate(&flows_[flow], arg.rate());
+    }
+  }
+
+  return CommandSuccess();
+}
+
+CommandResponse Pacer::CommandGetStats(const bess::pb::EmptyArg &) {
+  bess::pb::PacerCommandGetStatsResponse r;
+
+  r.set_sent(sent_);
+  r.set_dropped(dropped_);
+  r.set_backlog(buffered_);
+
+  return CommandSuccess(r);
+}
+
+ADD_MODULE(Pacer, "pacer", "paces packets out at per-flow rates")
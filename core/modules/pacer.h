@@ -0,0 +1,119 @@
+#ifndef BESS_MODULES_PACER_H_
+#define BESS_MODULES_PACER_H_
+
+#include <vector>
+
+#include "../module.h"
+#include "../module_msg.pb.h"
+
+// Paces packets out at per-flow rates. Unlike a rate-limited traffic class,
+// which lets whole batches out at once, the module gives each packet its own
+// departure time, (size + overhead) / rate after the previous packet of its
+// flow, and holds it in a timing wheel until then. The output is smooth down
+// to the granularity of the wheel, as long as the task is scheduled often
+// enough.
+//
+// Flows are either classes given by a metadata attribute, or buckets of a
+// hash of the IPv4 5-tuple (of the MAC addresses for other packets).
+//
+// ProcessBatch() fills the timing wheel and moves the departure time of each
+// flow forward, while RunTask() drains the wheel, neither under a lock. The
+// module keeps the default limit of one worker, so the pipeline is rejected
+// if packets arrive on a worker other than the one running the task.
+class Pacer final : public Module {
+ public:
+  static const uint64_t kDefaultFlows = 4096;
+  static const uint64_t kMaxFlows = 1 << 20;
+  static const uint64_t kDefaultGranularityNs = 1000;  // 1us
+  static const uint64_t kDefaultHorizonNs = 10000000;  // 10ms
+  static const uint64_t kMaxSlots = 1 << 20;
+  static const uint64_t kDefaultLimit = 65536;
+  static const int kPacketOverhead = 24;  // for rates, as in TCs
+
+  static const Commands cmds;
+
+  Pacer()
+      : Module(),
+        attr_id_(-1),
+        mask_(),
+        flows_(),
+        slots_(),
+        nonempty_(),
+        slot_cycles_(),
+        horizon_cycles_(),
+        cursor_(),
+        cursor_tsc_(),
+        buffered_(),
+        limit_(),
+        sent_(),
+        dropped_() {}
+
+  CommandResponse Init(const bess::pb::PacerArg &arg);
+
+  void DeInit() override;
+
+  void ProcessBatch(bess::PacketBatch *batch) override;
+
+  struct task_result RunTask(void *arg) override;
+
+  std::string GetDesc() const override;
+
+  CommandResponse CommandSetRate(const bess::pb::PacerCommandSetRateArg &arg);
+  CommandResponse CommandGetStats(const bess::pb::EmptyArg &arg);
+
+ private:
+  friend class PacerTest;
+
+  struct Flow {
+    uint64_t next_tsc;  // the earliest departure of its next packet
+    double cycles_per_byte;  // 0 if not paced
+  };
+
+  // Packets of the same departure slot, in arrival order. They are linked
+  // through their scratchpad.
+  struct Slot {
+    bess::Packet *head;
+    bess::Packet *tail;
+  };
+
+  static bess::Packet *&next_of(bess::Packet *pkt) {
+    return *pkt->scratchpad<bess::Packet **>();
+  }
+
+  // Returns the flow of the packet, or nullptr if it has none
+  Flow *Classify(bess::Packet *pkt);
+
+  void SetRate(Flow *f, uint64_t rate);
+
+  // Puts the packet in the slot of 'departure'
+  void Insert(bess::Packet *pkt, uint64_t departure);
+
+  // Returns how many slots after cursor_ the first non-empty one is.
+  // buffered_ must not be 0.
+  uint32_t NextSlot() const;
+
+  void AdvanceCursor(uint64_t slots);
+
+  int attr_id_;  // -1 if flows are hashed
+  uint64_t mask_;
+
+  std::vector<Flow> flows_;
+
+  // The timing wheel. Slot (cursor_ + i) % slots_.size() holds the packets
+  // due in [cursor_tsc_ + i * slot_cycles_, cursor_tsc_ + (i + 1) *
+  // slot_cycles_). nonempty_ has a bit set for each slot with packets.
+  std::vector<Slot> slots_;
+  std::vector<uint64_t> nonempty_;
+  uint64_t slot_cycles_;
+  uint64_t horizon_cycles_;
+  uint64_t cursor_;
+  uint64_t cursor_tsc_;
+
+  uint64_t buffered_;
+  uint64_t limit_;
+
+  uint64_t sent_;
+  uint64_t dropped_;
+};
+
+#endif  // BESS_MODULES_PACER_H_
@@ -0,0 +1,252 @@
+#include "pacer.h"
+
+#include <unistd.h>
+
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../dpdk.h"
+#include "../utils/time.h"
+
+// Records what the pacer lets out, and when
+class PacerSink : public Module {
+ public:
+  static const gate_idx_t kNumIGates = 1;
+  static const gate_idx_t kNumOGates = 0;
+
+  static const Commands cmds;
+
+  CommandResponse Init(const bess::pb::EmptyArg &) { return CommandSuccess(); }
+
+  void ProcessBatch(bess::PacketBatch *batch) override {
+    for (int i = 0; i < batch->cnt(); i++) {
+      out.emplace_back(batch->pkts()[i], ctx.current_tsc());
+    }
+  }
+
+  std::vector<std::pair<bess::Packet *, uint64_t>> out;
+};
+
+const Commands PacerSink::cmds = {};
+
+DEF_MODULE(PacerSink, "pacer_sink", "records the packets it gets");
+
+class PacerTest : public ::testing::Test {
+ protected:
+  // (1000 + 24) bytes at this rate take 10us
+  static const uint64_t kRate = 819200000;
+  static const uint16_t kLen = 1000;
+
+  virtual void SetUp() {
+    if (!dpdk_inited_) {
+      if (geteuid() == 0) {
+        init_dpdk("pacer_test", 1024, 0, true);
+        bess::init_mempool();
+        dpdk_inited_ = true;
+      } else {
+        LOG(INFO) << "This test requires root privileges. Skipping...";
+      }
+    }
+    sink_ = nullptr;
+  }
+
+  virtual void TearDown() {
+    if (sink_) {
+      for (auto &p : sink_->out) {
+        bess::Packet::Free(p.first);
+      }
+    }
+    ModuleBuilder::DestroyAllModules();
+  }
+
+  static Module *CreateModule(const std::string &class_name,
+                              const google::protobuf::Message &arg) {
+    const ModuleBuilder &builder =
+        ModuleBuilder::all_module_builders().find(class_name)->second;
+    google::protobuf::Any any;
+
+    any.PackFrom(arg);
+
+    Module *m = builder.CreateModule(
+        ModuleBuilder::GenerateDefaultName(builder.class_name(),
+                                           builder.name_template()),
+        &bess::metadata::default_pipeline);
+    ModuleBuilder::AddModule(m);
+    EXPECT_EQ(0, m->InitWithGenericArg(any).error().code());
+    return m;
+  }
+
+  // Creates a pacer of 4 flows, given by a 1-byte attribute, all at kRate,
+  // with its output going to sink_
+  Pacer *Create(uint64_t granularity_ns, uint64_t horizon_ns) {
+    bess::pb::PacerArg arg;
+
+    arg.set_attribute("pacer_test");
+    arg.set_size(1);
+    arg.set_flows(4);
+    arg.set_rate(kRate);
+    arg.set_granularity_ns(granularity_ns);
+    arg.set_horizon_ns(horizon_ns);
+
+    Pacer *p = static_cast<Pacer *>(CreateModule("Pacer", arg));
+    sink_ = static_cast<PacerSink *>(CreateModule("PacerSink",
+                                                  bess::pb::EmptyArg()));
+    EXPECT_EQ(0, p->ConnectModules(0, sink_, 0));
+    return p;
+  }
+
+  // Sends 'cnt' packets of 'flow' at the current time, and returns them
+  static std::vector<bess::Packet *> Send(Pacer *p, uint8_t flow, int cnt) {
+    std::vector<bess::Packet *> sent;
+
+    while (cnt > 0) {
+      bess::PacketBatch batch;
+
+      batch.clear();
+      for (; cnt > 0 && !batch.full(); cnt--) {
+        bess::Packet *pkt = reinterpret_cast<bess::Packet *>(
+            rte_pktmbuf_alloc(bess::get_pframe_pool_socket(0)));
+        EXPECT_NE(nullptr, pkt);
+        pkt->set_data_len(kLen);
+        pkt->set_total_len(kLen);
+        set_attr<uint8_t>(p, 0, pkt, flow);
+        batch.add(pkt);
+        sent.push_back(pkt);
+      }
+      p->ProcessBatch(&batch);
+    }
+    return sent;
+  }
+
+  // Runs the task at each 'step' cycles of [start, end)
+  static void Run(Pacer *p, uint64_t start, uint64_t end, uint64_t step) {
+    for (uint64_t now = start; now < end; now += step) {
+      ctx.set_current_tsc(now);
+      p->RunTask(nullptr);
+    }
+  }
+
+  // The packets sent to sink_ so far, in order
+  std::vector<bess::Packet *> Received() const {
+    std::vector<bess::Packet *> pkts;
+
+    for (auto &p : sink_->out) {
+      pkts.push_back(p.first);
+    }
+    return pkts;
+  }
+
+  static uint64_t SlotCycles(Pacer *p) { return p->slot_cycles_; }
+  static size_t NumSlots(Pacer *p) { return p->slots_.size(); }
+  static uint64_t Backlog(Pacer *p) { return p->buffered_; }
+  static uint64_t Dropped(Pacer *p) { return p->dropped_; }
+
+  static bool dpdk_inited_;
+
+  PacerSink_class PacerSink_singleton;
+  PacerSink *sink_;
+};
+
+bool PacerTest::dpdk_inited_ = false;
+
+// Each flow sends one packet per 10us from its first one, and the flows do
+// not hold each other back. A packet leaves at most a slot before its time.
+TEST_F(PacerTest, PerFlowSpacing) {
+  if (!dpdk_inited_) {
+    return;
+  }
+
+  Pacer *p = Create(1000, 10000000);
+  uint64_t gap = tsc_hz / 100000;
+  uint64_t slot = SlotCycles(p);
+  uint64_t start = rdtsc();
+
+  ctx.set_current_tsc(start);
+  std::vector<bess::Packet *> flows[2] = {Send(p, 0, 50), Send(p, 1, 50)};
+  Run(p, start, start + 60 * gap, slot / 4);
+
+  ASSERT_EQ(100, sink_->out.size());
+  for (int f = 0; f < 2; f++) {
+    size_t i = 0;
+
+    for (auto &out : sink_->out) {
+      if (i < flows[f].size() && out.first == flows[f][i]) {
+        // Within the slot of its departure time, give or take rounding
+        EXPECT_NEAR(start + i * gap, out.second, slot + i)
+            << "flow " << f << ", packet " << i;
+        i++;
+      }
+    }
+    EXPECT_EQ(flows[f].size(), i) << "flow " << f << " out of order";
+  }
+}
+
+// With a wheel of 64 slots and 10 slots between packets, the cursor wraps
+// around every few packets. The spacing must not change when it does.
+TEST_F(PacerTest, WheelWrapAround) {
+  if (!dpdk_inited_) {
+    return;
+  }
+
+  Pacer *p = Create(1000, 50000);
+  uint64_t gap = tsc_hz / 100000;
+  uint64_t slot = SlotCycles(p);
+  uint64_t step = slot / 4;
+  uint64_t now = rdtsc();
+  std::vector<bess::Packet *> sent;
+
+  ASSERT_EQ(64, NumSlots(p));
+
+  // Keeps a few packets queued, all within the horizon
+  while (sent.size() < 200 || Backlog(p) > 0) {
+    ctx.set_current_tsc(now);
+    if (sent.size() < 200 && Backlog(p) < 4) {
+      std::vector<bess::Packet *> pkts = Send(p, 0, 1);
+      sent.insert(sent.end(), pkts.begin(), pkts.end());
+    }
+    p->RunTask(nullptr);
+    now += step;
+  }
+
+  EXPECT_EQ(0, Dropped(p));
+  ASSERT_EQ(sent, Received());
+  for (size_t i = 1; i < sink_->out.size(); i++) {
+    EXPECT_NEAR(gap, sink_->out[i].second - sink_->out[i - 1].second,
+                slot + step)
+        << "packet " << i;
+  }
+}
+
+// Packets that would leave more than a horizon from now are dropped. Those
+// queued while the task falls behind by more than a horizon go in the last
+// slot of the wheel, and leave in order once the task runs again.
+TEST_F(PacerTest, PastHorizon) {
+  if (!dpdk_inited_) {
+    return;
+  }
+
+  Pacer *p = Create(1000, 55000);
+  uint64_t slot = SlotCycles(p);
+  uint64_t start = rdtsc();
+
+  // At 0, 10, ..., 50us
+  ctx.set_current_tsc(start);
+  std::vector<bess::Packet *> early = Send(p, 0, 20);
+  EXPECT_EQ(6, Backlog(p));
+  EXPECT_EQ(14, Dropped(p));
+  early.resize(6);
+
+  // Far past the whole wheel, and before the task runs again
+  uint64_t late = start + 100 * NumSlots(p) * slot;
+  ctx.set_current_tsc(late);
+  std::vector<bess::Packet *> expected = Send(p, 1, 2);
+  EXPECT_EQ(8, Backlog(p));
+  EXPECT_EQ(14, Dropped(p));
+
+  expected.insert(expected.begin(), early.begin(), early.end());
+  p->RunTask(nullptr);
+  EXPECT_EQ(0, Backlog(p));
+  EXPECT_EQ(expected, Received());
+}
@@ -1,8 +1,21 @@
 #include "port_out.h"
+
+#include <algorithm>
+#include <cinttypes>
+
+#include "../mem_alloc.h"
 #include "../utils/format.h"
+#include "../utils/time.h"
+#include "../utils/tx_offload.h"
+
+const Commands PortOut::cmds = {
+    {"get_queue_stats", "EmptyArg",
+     MODULE_CMD_FUNC(&PortOut::CommandGetQueueStats), 0},
+};
 
 CommandResponse PortOut::Init(const bess::pb::PortOutArg &arg) {
   const char *port_name;
+  queue_t num_queues;
   int ret;
 
   if (!arg.port().length()) {
@@ -17,27 +30,110 @@ CommandResponse PortOut::Init(const bess::pb::PortOutArg &arg) {
   }
   port_ = it->second;
 
-  if (port_->num_queues[PACKET_DIR_OUT] == 0) {
+  num_queues = port_->num_queues[PACKET_DIR_OUT];
+  if (num_queues == 0) {
     return CommandFailure(ENODEV, "Port %s has no outgoing queue", port_name);
   }
 
+  const std::string &mapping = arg.queue_mapping();
+  if (mapping.empty() || mapping == "worker") {
+    for (int wid = 0; wid < Worker::kMaxWorkers; wid++) {
+      worker_qids_[wid] = wid % num_queues;
+    }
+  } else if (mapping == "single") {
+    for (int wid = 0; wid < Worker::kMaxWorkers; wid++) {
+      worker_qids_[wid] = 0;
+    }
+  } else {
+    return CommandFailure(EINVAL, "Unknown queue_mapping '%s'",
+                          mapping.c_str());
+  }
+
+  if (arg.worker_qids_size() > Worker::kMaxWorkers) {
+    return CommandFailure(EINVAL, "'worker_qids' must have at most %d entries",
+                          Worker::kMaxWorkers);
+  }
+
+  for (int wid = 0; wid < arg.worker_qids_size(); wid++) {
+    if (arg.worker_qids(wid) >= num_queues) {
+      return CommandFailure(EINVAL, "Invalid qid %" PRIu64 " for worker %d",
+                            arg.worker_qids(wid), wid);
+    }
+    worker_qids_[wid] = arg.worker_qids(wid);
+  }
+
+  for (queue_t qid = 0; qid < num_queues; qid++) {
+    int bytes = llring_bytes_with_slots(kHandoffRingSlots);
+    struct llring *ring =
+        static_cast<llring *>(mem_alloc_ex(bytes, alignof(llring), 0));
+    if (!ring) {
+      FreeHandoffRings();
+      return CommandFailure(ENOMEM);
+    }
+
+    // multi-producer, single-consumer
+    if (llring_init(ring, kHandoffRingSlots, 0, 1)) {
+      mem_free(ring);
+      FreeHandoffRings();
+      return CommandFailure(EINVAL);
+    }
+
+    queues_[qid].handoff = ring;
+  }
+
+  if (arg.tx_buffer_ns()) {
+    // Flushes partial bursts that would otherwise wait for more packets
+    task_id_t tid = RegisterTask(nullptr);
+    if (tid == INVALID_TASK_ID) {
+      FreeHandoffRings();
+      return CommandFailure(ENOMEM, "Task creation failed");
+    }
+
+    tx_buffer_tsc_ = std::max<uint64_t>(1, arg.tx_buffer_ns() * tsc_hz / 1e9);
+  }
+
   ret = port_->AcquireQueues(reinterpret_cast<const module *>(this),
                              PACKET_DIR_OUT, nullptr, 0);
 
   node_constraints_ = port_->GetNodePlacementConstraint();
+  tx_offloads_ = port_->GetTxOffloads();
 
   if (ret < 0) {
+    FreeHandoffRings();
     return CommandFailure(-ret);
   }
 
   return CommandSuccess();
 }
 
+void PortOut::FreeHandoffRings() {
+  for (TxQueue &q : queues_) {
+    mem_free(q.handoff);
+    q.handoff = nullptr;
+  }
+}
+
 void PortOut::DeInit() {
   if (port_) {
     port_->ReleaseQueues(reinterpret_cast<const module *>(this), PACKET_DIR_OUT,
                          nullptr, 0);
   }
+
+  for (TxQueue &q : queues_) {
+    bess::Packet *pkt;
+
+    if (!q.handoff) {
+      continue;
+    }
+
+    while (llring_sc_dequeue(q.handoff, (void **)&pkt) == 0) {
+      bess::Packet::Free(pkt);
+    }
+    mem_free(q.handoff);
+    q.handoff = nullptr;
+
+    bess::Packet::Free(&q.buffered);
+  }
 }
 
 std::string PortOut::GetDesc() const {
@@ -45,31 +141,191 @@ std::string PortOut::GetDesc() const {
                              port_->port_builder()->class_name().c_str());
 }
 
-void PortOut::ProcessBatch(bess::PacketBatch *batch) {
+void PortOut::SendToQueue(queue_t qid, bess::Packet **pkts, int cnt) {
   Port *p = port_;
 
-  /* TODO: choose appropriate out queue */
-  const queue_t qid = 0;
-
   uint64_t sent_bytes = 0;
   int sent_pkts;
 
-  sent_pkts = p->SendPackets(qid, batch->pkts(), batch->cnt());
+  if (unlikely(bess::utils::UnsupportedTxOffloads(pkts, cnt, tx_offloads_))) {
+    // Comes back here with packets that need nothing from the port
+    int dropped = bess::utils::ResolveTxOffloads(
+        pkts, cnt, tx_offloads_,
+        [=](bess::Packet **out, int n) { SendToQueue(qid, out, n); });
+
+    if (!(p->GetFlags() & DRIVER_FLAG_SELF_OUT_STATS)) {
+      p->queue_stats[PACKET_DIR_OUT][qid].dropped += dropped;
+    }
+    return;
+  }
+
+  sent_pkts = p->SendPackets(qid, pkts, cnt);
+
+  queues_[qid].tx_bursts++;
+  queues_[qid].tx_burst_packets += cnt;
 
   if (!(p->GetFlags() & DRIVER_FLAG_SELF_OUT_STATS)) {
     const packet_dir_t dir = PACKET_DIR_OUT;
 
     for (int i = 0; i < sent_pkts; i++)
-      sent_bytes += batch->pkts()[i]->total_len();
+      sent_bytes += pkts[i]->total_len();
 
     p->queue_stats[dir][qid].packets += sent_pkts;
-    p->queue_stats[dir][qid].dropped += (batch->cnt() - sent_pkts);
+    p->queue_stats[dir][qid].dropped += (cnt - sent_pkts);
     p->queue_stats[dir][qid].bytes += sent_bytes;
   }
 
-  if (sent_pkts < batch->cnt()) {
-    bess::Packet::Free(batch->pkts() + sent_pkts, batch->cnt() - sent_pkts);
+  if (sent_pkts < cnt) {
+    bess::Packet::Free(pkts + sent_pkts, cnt - sent_pkts);
   }
 }
 
+void PortOut::EnqueueToQueue(queue_t qid, bess::Packet **pkts, int cnt) {
+  TxQueue *q = &queues_[qid];
+  bess::PacketBatch *buffered = &q->buffered;
+  const uint64_t now = ctx.current_tsc();
+
+  if (!tx_buffer_tsc_ ||
+      (buffered->empty() && cnt == bess::PacketBatch::kMaxBurst)) {
+    SendToQueue(qid, pkts, cnt);
+    return;
+  }
+
+  while (cnt > 0) {
+    int n = std::min<int>(cnt, bess::PacketBatch::kMaxBurst - buffered->cnt());
+
+    if (buffered->empty()) {
+      q->buffered_tsc = now;
+    }
+
+    bess::utils::CopyInlined(buffered->pkts() + buffered->cnt(), pkts,
+                             n * sizeof(bess::Packet *));
+    buffered->incr_cnt(n);
+    pkts += n;
+    cnt -= n;
+
+    if (buffered->full()) {
+      FlushBuffered(qid);
+    }
+  }
+
+  // Another worker may have stamped buffered_tsc a bit ahead of our clock
+  if (!buffered->empty() && now > q->buffered_tsc &&
+      now - q->buffered_tsc >= tx_buffer_tsc_) {
+    FlushBuffered(qid);
+  }
+}
+
+void PortOut::FlushBuffered(queue_t qid) {
+  bess::PacketBatch *buffered = &queues_[qid].buffered;
+
+  SendToQueue(qid, buffered->pkts(), buffered->cnt());
+  buffered->clear();
+}
+
+void PortOut::DrainAndRelease(queue_t qid) {
+  TxQueue *q = &queues_[qid];
+  bess::Packet *pkts[bess::PacketBatch::kMaxBurst];
+
+  do {
+    int cnt;
+
+    while ((cnt = llring_sc_dequeue_burst(q->handoff, (void **)pkts,
+                                          bess::PacketBatch::kMaxBurst)) > 0) {
+      q->handoff_packets += cnt;
+      EnqueueToQueue(qid, pkts, cnt);
+    }
+
+    // Full barrier, so that the emptiness check below cannot be reordered
+    // before the release. Otherwise packets handed off right before the
+    // release could be left in the ring.
+    __sync_fetch_and_and(&q->busy, 0);
+  } while (!llring_empty(q->handoff) &&
+           __sync_lock_test_and_set(&q->busy, 1) == 0);
+}
+
+void PortOut::ProcessBatch(bess::PacketBatch *batch) {
+  const queue_t qid = worker_qids_[ctx.wid()];
+  TxQueue *q = &queues_[qid];
+
+  // Fast path: nobody else is using the queue.
+  if (likely(__sync_lock_test_and_set(&q->busy, 1) == 0)) {
+    EnqueueToQueue(qid, batch->pkts(), batch->cnt());
+    DrainAndRelease(qid);
+    return;
+  }
+
+  // The queue is shared with other workers and currently in use.
+  int queued = llring_mp_enqueue_burst(q->handoff, (void **)batch->pkts(),
+                                       batch->cnt());
+  if (queued < batch->cnt()) {
+    __sync_fetch_and_add(&q->handoff_dropped, batch->cnt() - queued);
+    bess::Packet::Free(batch->pkts() + queued, batch->cnt() - queued);
+  }
+
+  // The previous owner may have released the queue before seeing our packets.
+  if (__sync_lock_test_and_set(&q->busy, 1) == 0) {
+    DrainAndRelease(qid);
+  }
+}
+
+/* flushes partial bursts that have been buffered for too long */
+struct task_result PortOut::RunTask(void *) {
+  const uint64_t now = ctx.current_tsc();
+
+  for (queue_t qid = 0; qid < port_->num_queues[PACKET_DIR_OUT]; qid++) {
+    TxQueue *q = &queues_[qid];
+
+    // Unlocked peek to avoid touching idle queues. Checked again below.
+    if (q->buffered.empty() || now <= q->buffered_tsc ||
+        now - q->buffered_tsc < tx_buffer_tsc_) {
+      continue;
+    }
+
+    if (__sync_lock_test_and_set(&q->busy, 1) == 0) {
+      if (!q->buffered.empty() && now > q->buffered_tsc &&
+          now - q->buffered_tsc >= tx_buffer_tsc_) {
+        FlushBuffered(qid);
+      }
+      DrainAndRelease(qid);
+    }
+  }
+
+  return {.packets = 0, .bits = 0};
+}
+
+CommandResponse PortOut::CommandGetQueueStats(const bess::pb::EmptyArg &) {
+  bess::pb::PortOutCommandGetQueueStatsResponse r;
+
+  // Let the driver refresh its per-queue counters
+  port_->GetPortStats();
+
+  for (queue_t qid = 0; qid < port_->num_queues[PACKET_DIR_OUT]; qid++) {
+    const QueueStats &stats = port_->queue_stats[PACKET_DIR_OUT][qid];
+    const TxQueue &q = queues_[qid];
+    auto *stat = r.add_queues();
+    uint64_t mapped = 0;
+
+    for (int wid = 0; wid < Worker::kMaxWorkers; wid++) {
+      if (active_workers()[wid] && worker_qids_[wid] == qid) {
+        mapped++;
+      }
+    }
+
+    stat->set_qid(qid);
+    stat->set_workers(mapped);
+    stat->set_packets(stats.packets);
+    stat->set_dropped(stats.dropped + q.handoff_dropped);
+    stat->set_bytes(stats.bytes);
+    stat->set_handoff_packets(q.handoff_packets);
+    stat->set_tx_bursts(q.tx_bursts);
+    if (q.tx_bursts) {
+      stat->set_avg_tx_burst(static_cast<double>(q.tx_burst_packets) /
+                             q.tx_bursts);
+    }
+  }
+
+  return CommandSuccess(r);
+}
+
 ADD_MODULE(PortOut, "port_out", "sends pakets to a port")
@@ -1,26 +1,89 @@
 #ifndef BESS_MODULES_PORTOUT_H_
 #define BESS_MODULES_PORTOUT_H_
 
+#include "../kmod/llring.h"
 #include "../module.h"
 #include "../module_msg.pb.h"
 #include "../port.h"
+#include "../worker.h"
 
 class PortOut final : public Module {
  public:
   static const gate_idx_t kNumOGates = 0;
 
-  PortOut() : Module(), port_() {}
+  static const Commands cmds;
+
+  PortOut()
+      : Module(),
+        port_(),
+        tx_offloads_(),
+        worker_qids_(),
+        queues_(),
+        tx_buffer_tsc_() {
+    max_allowed_workers_ = Worker::kMaxWorkers;
+  }
 
   CommandResponse Init(const bess::pb::PortOutArg &arg);
 
   void DeInit() override;
 
+  struct task_result RunTask(void *arg) override;
   void ProcessBatch(bess::PacketBatch *batch) override;
 
   std::string GetDesc() const override;
 
+  CommandResponse CommandGetQueueStats(const bess::pb::EmptyArg &arg);
+
  private:
+  // Per outgoing queue state. Each worker sends via the queue it is mapped
+  // onto. If workers outnumber queues, a worker that finds its queue busy does
+  // not wait; it enqueues the packets into the handoff ring (multi-producer,
+  // single-consumer) and whoever holds the queue sends them.
+  //
+  // If TX buffering is enabled, packets are accumulated in 'buffered' and
+  // sent once a full burst is available or the oldest one becomes too old.
+  struct TxQueue {
+    volatile int busy;
+    struct llring *handoff;
+    uint64_t handoff_packets;
+    uint64_t handoff_dropped;
+
+    bess::PacketBatch buffered;
+    uint64_t buffered_tsc;  // when the oldest buffered packet arrived
+
+    uint64_t tx_bursts;
+    uint64_t tx_burst_packets;
+  };
+
+  static const int kHandoffRingSlots = 1024;
+
+  // Sends packets via queue 'qid' and updates its stats. Offloads the port
+  // cannot do are done in software first. The caller must own the queue.
+  void SendToQueue(queue_t qid, bess::Packet **pkts, int cnt);
+
+  // Sends packets via queue 'qid', or accumulates them if TX buffering is
+  // enabled. The caller must own the queue.
+  void EnqueueToQueue(queue_t qid, bess::Packet **pkts, int cnt);
+
+  // Sends all buffered packets of queue 'qid'. The caller must own the queue.
+  void FlushBuffered(queue_t qid);
+
+  // Flushes the handoff ring of the queue and releases it.
+  void DrainAndRelease(queue_t qid);
+
+  // Frees the (empty) handoff rings, for when Init() fails
+  void FreeHandoffRings();
+
   Port *port_;
+  uint64_t tx_offloads_;  // supported by the port (PKT_TX_*)
+
+  // Outgoing queue for each worker ID
+  queue_t worker_qids_[Worker::kMaxWorkers];
+
+  TxQueue queues_[MAX_QUEUES_PER_DIR];
+
+  // Maximum time (in TSC cycles) a packet may stay buffered. 0 if disabled.
+  uint64_t tx_buffer_tsc_;
 };
 
 #endif  // BESS_MODULES_PORTOUT_H_
@@ -10,6 +10,7 @@ const Commands Queue::cmds = {
      MODULE_CMD_FUNC(&Queue::CommandSetBurst), 1},
     {"set_size", "QueueCommandSetSizeArg",
      MODULE_CMD_FUNC(&Queue::CommandSetSize), 0},
+    {"get_stats", "EmptyArg", MODULE_CMD_FUNC(&Queue::CommandGetStats), 0},
 };
 
 int Queue::Resize(int slots) {
@@ -77,6 +78,17 @@ CommandResponse Queue::Init(const bess::pb::QueueArg &arg) {
     prefetch_ = true;
   }
 
+  if (arg.has_aqm()) {
+    bess::utils::Aqm::Policy policy;
+
+    if (!bess::utils::Aqm::ParsePolicy(arg.aqm().policy(), &policy)) {
+      return CommandFailure(EINVAL, "AQM policy must be 'codel', 'pie' or ''");
+    }
+    aqm_ = bess::utils::Aqm(policy, arg.aqm().target_ns(),
+                            arg.aqm().interval_ns());
+    sojourn_hist_.reset(new LogHistogram());
+  }
+
   return CommandSuccess();
 }
 
@@ -99,6 +111,13 @@ std::string Queue::GetDesc() const {
 
 /* from upstream */
 void Queue::ProcessBatch(bess::PacketBatch *batch) {
+  if (sojourn_hist_) {
+    uint64_t now = ctx.current_ns();
+    for (int i = 0; i < batch->cnt(); i++) {
+      *batch->pkts()[i]->scratchpad<uint64_t *>() = now;
+    }
+  }
+
   int queued =
       llring_mp_enqueue_burst(queue_, (void **)batch->pkts(), batch->cnt());
 
@@ -119,6 +138,14 @@ struct task_result Queue::RunTask(void *) {
 
   uint64_t cnt = llring_sc_dequeue_burst(queue_, (void **)batch.pkts(), burst);
 
+  if (sojourn_hist_) {
+    if (cnt > 0) {
+      cnt = RunAqm(batch.pkts(), cnt);
+    } else {
+      aqm_.Empty();
+    }
+  }
+
   if (cnt > 0) {
     batch.set_cnt(cnt);
     RunNextModule(&batch);
@@ -141,6 +168,38 @@ struct task_result Queue::RunTask(void *) {
   return ret;
 }
 
+int Queue::RunAqm(bess::Packet **pkts, int cnt) {
+  bess::Packet *drops[bess::PacketBatch::kMaxBurst];
+  uint64_t now = ctx.current_ns();
+  uint32_t backlog = llring_count(queue_);
+  int kept = 0;
+  int dropped = 0;
+
+  for (int i = 0; i < cnt; i++) {
+    bess::Packet *pkt = pkts[i];
+    uint64_t ts = *pkt->scratchpad<uint64_t *>();
+
+    // Producers on other workers may be slightly ahead of our clock
+    uint64_t sojourn = now > ts ? now - ts : 0;
+    bool last = (i == cnt - 1) && backlog == 0;
+
+    sojourn_hist_->insert(sojourn);
+    sojourn_long_ += sojourn >= kSojournLongNs;
+    if (aqm_.ShouldDrop(now, sojourn, last)) {
+      drops[dropped++] = pkt;
+    } else {
+      pkts[kept++] = pkt;
+    }
+  }
+
+  if (dropped > 0) {
+    bess::Packet::Free(drops, dropped);
+    aqm_drops_ += dropped;
+  }
+
+  return kept;
+}
+
 CommandResponse Queue::CommandSetBurst(
     const bess::pb::QueueCommandSetBurstArg &arg) {
   uint64_t burst = arg.burst();
@@ -175,6 +234,19 @@ CommandResponse Queue::CommandSetSize(
   return SetSize(arg.size());
 }
 
+CommandResponse Queue::CommandGetStats(const bess::pb::EmptyArg &) {
+  bess::pb::AqmCommandGetStatsResponse r;
+
+  if (!sojourn_hist_) {
+    return CommandFailure(EINVAL, "sojourn times require the 'aqm' argument");
+  }
+
+  bess::utils::TakeAqmStats(&r, sojourn_hist_.get(), &aqm_drops_,
+                            &sojourn_long_);
+
+  return CommandSuccess(r);
+}
+
 CheckConstraintResult Queue::CheckModuleConstraints() const {
   int active_workers = num_active_workers() - tasks().size();
   CheckConstraintResult status = CHECK_OK;
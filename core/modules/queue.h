@@ -1,15 +1,30 @@
 #ifndef BESS_MODULES_QUEUE_H_
 #define BESS_MODULES_QUEUE_H_
 
+#include <memory>
+
 #include "../kmod/llring.h"
 #include "../module.h"
 #include "../module_msg.pb.h"
+#include "../utils/aqm.h"
+#include "../utils/histogram.h"
 
 class Queue final : public Module {
  public:
   static const Commands cmds;
 
-  Queue() : Module(), queue_(), prefetch_(), burst_() {
+  // Sojourn times of this long or more are also counted apart
+  static const uint64_t kSojournLongNs = 100000000;  // 100ms
+
+  Queue()
+      : Module(),
+        queue_(),
+        prefetch_(),
+        burst_(),
+        aqm_(),
+        aqm_drops_(),
+        sojourn_long_(),
+        sojourn_hist_() {
     propagate_workers_ = false;
   }
 
@@ -24,6 +39,7 @@ class Queue final : public Module {
 
   CommandResponse CommandSetBurst(const bess::pb::QueueCommandSetBurstArg &arg);
   CommandResponse CommandSetSize(const bess::pb::QueueCommandSetSizeArg &arg);
+  CommandResponse CommandGetStats(const bess::pb::EmptyArg &arg);
 
   CheckConstraintResult CheckModuleConstraints() const override;
 
@@ -31,9 +47,20 @@ class Queue final : public Module {
   int Resize(int slots);
   CommandResponse SetSize(uint64_t size);
 
+  // Records the sojourn times of the dequeued packets and drops those that the
+  // AQM policy picks. Returns the number of packets left in pkts.
+  int RunAqm(bess::Packet **pkts, int cnt);
+
   struct llring *queue_;
   bool prefetch_;
   int burst_;
+
+  // Only with the 'aqm' argument, in which case packets carry their enqueue
+  // time in the scratchpad and sojourn_hist_ is allocated
+  bess::utils::Aqm aqm_;
+  uint64_t aqm_drops_;
+  uint64_t sojourn_long_;
+  std::unique_ptr<LogHistogram> sojourn_hist_;
 };
 
 #endif  // BESS_MODULES_QUEUE_H_
@@ -1,7 +1,15 @@
 #include "queue_out.h"
 
+#include <algorithm>
+
 #include "../port.h"
 #include "../utils/format.h"
+#include "../utils/time.h"
+#include "../utils/tx_offload.h"
+
+const Commands QueueOut::cmds = {
+    {"get_stats", "EmptyArg", MODULE_CMD_FUNC(&QueueOut::CommandGetStats), 0},
+};
 
 CommandResponse QueueOut::Init(const bess::pb::QueueOutArg &arg) {
   const char *port_name;
@@ -21,6 +29,17 @@ CommandResponse QueueOut::Init(const bess::pb::QueueOutArg &arg) {
   port_ = it->second;
 
   node_constraints_ = port_->GetNodePlacementConstraint();
+  tx_offloads_ = port_->GetTxOffloads();
+
+  if (arg.tx_buffer_ns()) {
+    // Flushes partial bursts that would otherwise wait for more packets
+    task_id_t tid = RegisterTask(nullptr);
+    if (tid == INVALID_TASK_ID) {
+      return CommandFailure(ENOMEM, "Task creation failed");
+    }
+
+    tx_buffer_tsc_ = std::max<uint64_t>(1, arg.tx_buffer_ns() * tsc_hz / 1e9);
+  }
 
   ret = port_->AcquireQueues(reinterpret_cast<const module *>(this),
                              PACKET_DIR_OUT, &qid_, 1);
@@ -36,6 +55,8 @@ void QueueOut::DeInit() {
     port_->ReleaseQueues(reinterpret_cast<const module *>(this), PACKET_DIR_OUT,
                          &qid_, 1);
   }
+
+  bess::Packet::Free(&buffered_);
 }
 
 std::string QueueOut::GetDesc() const {
@@ -43,7 +64,7 @@ std::string QueueOut::GetDesc() const {
                              port_->port_builder()->class_name().c_str());
 }
 
-void QueueOut::ProcessBatch(bess::PacketBatch *batch) {
+void QueueOut::SendToPort(bess::Packet **pkts, int cnt) {
   Port *p = port_;
 
   const queue_t qid = qid_;
@@ -51,23 +72,99 @@ void QueueOut::ProcessBatch(bess::PacketBatch *batch) {
   uint64_t sent_bytes = 0;
   int sent_pkts;
 
-  sent_pkts = p->SendPackets(qid, batch->pkts(), batch->cnt());
+  if (unlikely(bess::utils::UnsupportedTxOffloads(pkts, cnt, tx_offloads_))) {
+    // Comes back here with packets that need nothing from the port
+    int dropped = bess::utils::ResolveTxOffloads(
+        pkts, cnt, tx_offloads_,
+        [this](bess::Packet **out, int n) { SendToPort(out, n); });
+
+    if (!(p->GetFlags() & DRIVER_FLAG_SELF_OUT_STATS)) {
+      p->queue_stats[PACKET_DIR_OUT][qid].dropped += dropped;
+    }
+    return;
+  }
+
+  sent_pkts = p->SendPackets(qid, pkts, cnt);
+
+  tx_bursts_++;
+  tx_burst_packets_ += cnt;
 
   if (!(p->GetFlags() & DRIVER_FLAG_SELF_OUT_STATS)) {
     const packet_dir_t dir = PACKET_DIR_OUT;
 
     for (int i = 0; i < sent_pkts; i++) {
-      sent_bytes += batch->pkts()[i]->total_len();
+      sent_bytes += pkts[i]->total_len();
     }
 
     p->queue_stats[dir][qid].packets += sent_pkts;
-    p->queue_stats[dir][qid].dropped += (batch->cnt() - sent_pkts);
+    p->queue_stats[dir][qid].dropped += (cnt - sent_pkts);
     p->queue_stats[dir][qid].bytes += sent_bytes;
   }
 
-  if (sent_pkts < batch->cnt()) {
-    bess::Packet::Free(batch->pkts() + sent_pkts, batch->cnt() - sent_pkts);
+  if (sent_pkts < cnt) {
+    bess::Packet::Free(pkts + sent_pkts, cnt - sent_pkts);
+  }
+}
+
+void QueueOut::FlushBuffered() {
+  SendToPort(buffered_.pkts(), buffered_.cnt());
+  buffered_.clear();
+}
+
+void QueueOut::ProcessBatch(bess::PacketBatch *batch) {
+  const uint64_t now = ctx.current_tsc();
+  bess::Packet **pkts = batch->pkts();
+  int cnt = batch->cnt();
+
+  if (!tx_buffer_tsc_ ||
+      (buffered_.empty() && cnt == bess::PacketBatch::kMaxBurst)) {
+    SendToPort(pkts, cnt);
+    return;
   }
+
+  while (cnt > 0) {
+    int n = std::min<int>(cnt, bess::PacketBatch::kMaxBurst - buffered_.cnt());
+
+    if (buffered_.empty()) {
+      buffered_tsc_ = now;
+    }
+
+    bess::utils::CopyInlined(buffered_.pkts() + buffered_.cnt(), pkts,
+                             n * sizeof(bess::Packet *));
+    buffered_.incr_cnt(n);
+    pkts += n;
+    cnt -= n;
+
+    if (buffered_.full()) {
+      FlushBuffered();
+    }
+  }
+
+  if (!buffered_.empty() && now - buffered_tsc_ >= tx_buffer_tsc_) {
+    FlushBuffered();
+  }
+}
+
+/* flushes a partial burst that has been buffered for too long */
+struct task_result QueueOut::RunTask(void *) {
+  if (!buffered_.empty() &&
+      ctx.current_tsc() - buffered_tsc_ >= tx_buffer_tsc_) {
+    FlushBuffered();
+  }
+
+  return {.packets = 0, .bits = 0};
+}
+
+CommandResponse QueueOut::CommandGetStats(const bess::pb::EmptyArg &) {
+  bess::pb::QueueOutCommandGetStatsResponse r;
+
+  r.set_tx_bursts(tx_bursts_);
+  r.set_tx_packets(tx_burst_packets_);
+  if (tx_bursts_) {
+    r.set_avg_tx_burst(static_cast<double>(tx_burst_packets_) / tx_bursts_);
+  }
+
+  return CommandSuccess(r);
 }
 
 ADD_MODULE(QueueOut, "queue_out",
@@ -9,19 +9,51 @@ class QueueOut final : public Module {
  public:
   static const gate_idx_t kNumOGates = 0;
 
-  QueueOut() : Module(), port_(), qid_() {}
+  static const Commands cmds;
+
+  QueueOut()
+      : Module(),
+        port_(),
+        tx_offloads_(),
+        qid_(),
+        buffered_(),
+        buffered_tsc_(),
+        tx_buffer_tsc_(),
+        tx_bursts_(),
+        tx_burst_packets_() {}
 
   CommandResponse Init(const bess::pb::QueueOutArg &arg);
 
   void DeInit() override;
 
+  struct task_result RunTask(void *arg) override;
   void ProcessBatch(bess::PacketBatch *batch) override;
 
   std::string GetDesc() const override;
 
+  CommandResponse CommandGetStats(const bess::pb::EmptyArg &arg);
+
  private:
+  // Sends packets to the port and updates stats. Offloads the port cannot do
+  // are done in software first.
+  void SendToPort(bess::Packet **pkts, int cnt);
+
+  // Sends all buffered packets.
+  void FlushBuffered();
+
   Port *port_;
+  uint64_t tx_offloads_;  // supported by the port (PKT_TX_*)
   queue_t qid_;
+
+  // Packets accumulated for a full burst (only if TX buffering is enabled)
+  bess::PacketBatch buffered_;
+  uint64_t buffered_tsc_;  // when the oldest buffered packet arrived
+
+  // Maximum time (in TSC cycles) a packet may stay buffered. 0 if disabled.
+  uint64_t tx_buffer_tsc_;
+
+  uint64_t tx_bursts_;
+  uint64_t tx_burst_packets_;
 };
 
 #endif  // BESS_MODULES_QUEUEOUT_H_
@@ -156,10 +156,9 @@ static int run_fastforward_event(int efd)
 	int n = epoll_wait(efd, evs, 1024, -1);
 
 	for (k = 0; k < n; k++) {		
-		char buf[2];
-
 		rxq = evs[k].data.fd;
-		interrupt_cnt += read(in_port->fd[rxq], buf, 1);
+		sn_ack_interrupt(in_port, rxq);
+		interrupt_cnt++;
 
 		do {
 			received = sn_receive_pkts(in_port, rxq, pkts, batch_size);
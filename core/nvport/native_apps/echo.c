@@ -0,0 +1,243 @@
+/* Reflects all packets back to the port they came from. When there is no
+ * traffic for a while, sleeps on the doorbells of the port instead of polling,
+ * so that an idle instance costs (almost) no CPU time. */
+
+#include <stdio.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <rte_config.h>
+#include <rte_cycles.h>
+#include <rte_mbuf.h>
+
+#include "sn.h"
+
+#define MAX_BATCH 32
+
+struct sn_port *port;
+
+int print_stats = 1;
+
+/* Poll this long without packets before going to sleep */
+uint64_t idle_us = 100;
+
+int efd;
+
+struct {
+	uint64_t rx_pkts;
+	uint64_t tx_pkts;
+	uint64_t dropped;
+	uint64_t sleeps;
+	uint64_t wakeups;
+} stats, last_stats;
+
+char unique_name[APPNAMESIZ];
+
+static int run_echo(void)
+{
+	struct snbuf *pkts[MAX_BATCH];
+	int ret = 0;
+	int rxq;
+
+	for (rxq = 0; rxq < port->num_rxq; rxq++) {
+		int txq = rxq % port->num_txq;
+		int received;
+		int sent;
+
+		received = sn_receive_pkts(port, rxq, pkts, MAX_BATCH);
+		if (received == 0)
+			continue;
+
+		stats.rx_pkts += received;
+
+		sent = sn_send_pkts(port, txq, pkts, received);
+
+		/* BESS is behind. Give it a millisecond to catch up. */
+		while (sent < received && sn_wait_tx(port, txq, 1) > 0) {
+			int n = sn_send_pkts(port, txq, pkts + sent,
+					     received - sent);
+			if (n == 0)
+				break;
+			sent += n;
+		}
+
+		if (sent < received) {
+			sn_snb_free_bulk_range(pkts, sent, received - sent);
+			stats.dropped += received - sent;
+		}
+
+		stats.tx_pkts += sent;
+		ret += received;
+	}
+
+	return ret;
+}
+
+static int any_rx_pending(void)
+{
+	int rxq;
+
+	for (rxq = 0; rxq < port->num_rxq; rxq++)
+		if (!llring_empty(port->rx_qs[rxq]))
+			return 1;
+
+	return 0;
+}
+
+/* Sleeps until any RX queue has packets, or for up to a second */
+static void sleep_on_doorbells(void)
+{
+	struct epoll_event evs[MAX_QUEUES_PER_PORT_DIR];
+	int rxq;
+	int n;
+	int i;
+
+	for (rxq = 0; rxq < port->num_rxq; rxq++)
+		sn_enable_interrupt(port->rx_regs[rxq]);
+
+	/* Packets may have arrived before BESS could see the flags */
+	if (!any_rx_pending()) {
+		stats.sleeps++;
+
+		n = epoll_wait(efd, evs, MAX_QUEUES_PER_PORT_DIR, 1000);
+		for (i = 0; i < n; i++)
+			sn_ack_interrupt(port, evs[i].data.u32);
+
+		stats.wakeups += (n > 0);
+	}
+
+	for (rxq = 0; rxq < port->num_rxq; rxq++)
+		sn_disable_interrupt(port->rx_regs[rxq]);
+}
+
+static void init_epoll(void)
+{
+	int rxq;
+
+	efd = epoll_create1(0);
+	assert(efd >= 0);
+
+	for (rxq = 0; rxq < port->num_rxq; rxq++) {
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u32 = rxq;
+		epoll_ctl(efd, EPOLL_CTL_ADD, port->fd[rxq], &ev);
+	}
+}
+
+void show_usage(char *prog_name)
+{
+	fprintf(stderr, "Usage: %s -i <iface> [-c <core id>] [-n <name>] "
+		"[-t <idle usecs before sleeping>] [-q]\n",
+		prog_name);
+	exit(1);
+}
+
+void emit_stats(void)
+{
+	printf("RX: %8lu pkts/s\t"
+	       "TX: %8lu pkts/s\t"
+	       "Dropped: %8lu pkts/s\t"
+	       "Sleeps: %6lu/s (%lu woken up)\n",
+	       stats.rx_pkts - last_stats.rx_pkts,
+	       stats.tx_pkts - last_stats.tx_pkts,
+	       stats.dropped - last_stats.dropped,
+	       stats.sleeps - last_stats.sleeps,
+	       stats.wakeups - last_stats.wakeups);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t last_tsc;
+	uint64_t last_busy;
+	uint64_t idle_cycles;
+	uint64_t hz;
+
+	uint64_t core = 7;
+
+	char ifname[IFNAMSIZ];
+
+	int opt;
+
+	memset(ifname, 0, sizeof(ifname));
+
+	while ((opt = getopt(argc, argv, "c:i:n:t:q")) != -1) {
+		switch (opt) {
+		case 'c':
+			core = atoi(optarg);
+			break;
+		case 'i':
+			strncpy(ifname, optarg, IFNAMSIZ - 1);
+			break;
+		case 'n':
+			strncpy(unique_name, optarg, APPNAMESIZ - 1);
+			break;
+		case 't':
+			idle_us = atoi(optarg);
+			break;
+		case 'q':
+			print_stats = 0;
+			break;
+		default:
+			show_usage(argv[0]);
+		}
+	}
+
+	if (!ifname[0])
+		show_usage(argv[0]);
+
+	if (!unique_name[0]) {
+		// Choose a random unique name if one isn't provided
+		snprintf(unique_name, sizeof(unique_name), "%u", rand());
+	}
+	init_bess(core, unique_name);
+
+	port = init_port(ifname);
+	if (!port) {
+		fprintf(stderr, "Cannot attach to port %s\n", ifname);
+		return 1;
+	}
+
+	if (port->num_rxq == 0 || port->num_txq == 0) {
+		fprintf(stderr, "Port %s has no queue to echo on\n", ifname);
+		return 1;
+	}
+
+	printf("Echoing on %s (%d RX queues, %d TX queues)\n", ifname,
+	       port->num_rxq, port->num_txq);
+
+	init_epoll();
+
+	hz = rte_get_tsc_hz();
+	idle_cycles = hz * idle_us / 1000000;
+	last_tsc = last_busy = rte_rdtsc();
+
+	for (;;) {
+		uint64_t now;
+
+		if (run_echo() > 0) {
+			last_busy = rte_rdtsc();
+		} else if (rte_rdtsc() - last_busy > idle_cycles) {
+			sleep_on_doorbells();
+			last_busy = rte_rdtsc();
+		}
+
+		now = rte_rdtsc();
+		if (now - last_tsc < hz)
+			continue;
+
+		if (print_stats)
+			emit_stats();
+
+		memcpy(&last_stats, &stats, sizeof(stats));
+		last_tsc = now;
+	}
+
+	return 0;
+}
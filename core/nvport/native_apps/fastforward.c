@@ -123,10 +123,9 @@ static int run_fastforward_event(int efd)
 	int total_batch = 0;
 	
 	for (k = 0; k < n; k++) {
-		char buf[100];
-
 		rxq = evs[k].data.fd;
-		interrupt_cnt += read(in_port->fd[rxq], buf, 1);
+		sn_ack_interrupt(in_port, rxq);
+		interrupt_cnt++;
 		int cnt = 0;
 		do {
 			received = sn_receive_pkts(in_port, rxq, pkts, batch_size);
@@ -1,8 +1,13 @@
 #include <assert.h>
+#include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -145,6 +150,70 @@ void init_bess(uint32_t lcore, char *name)
 	init_template();
 }
 
+/* Gets the doorbells of all queues from BESS. Returns 0 on success. */
+static int recv_doorbells(const char *ifname, struct sn_port *port)
+{
+	struct sockaddr_un addr;
+	struct vport_doorbells db;
+	struct iovec iov = {&db, sizeof(db)};
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	char cbuf[CMSG_SPACE(sizeof(int) * MAX_QUEUES_PER_PORT_DIR * 2)];
+	int fds[MAX_QUEUES_PER_PORT_DIR * 2];
+	int num_fds;
+	int sock;
+	int ret;
+	int i;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s/%s.sock",
+			P_tmpdir, VPORT_DIR_PREFIX, ifname);
+
+	sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return -1;
+
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(sock);
+		return -1;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	do {
+		ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (ret < 0 && errno == EINTR);
+	close(sock);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (ret != sizeof(db) || !cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS)
+		return -1;
+
+	num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	memcpy(fds, CMSG_DATA(cmsg), num_fds * sizeof(int));
+
+	if (db.num_inc_q != port->num_txq || db.num_out_q != port->num_rxq ||
+	    num_fds != db.num_inc_q + db.num_out_q) {
+		for (i = 0; i < num_fds; i++)
+			close(fds[i]);
+		return -1;
+	}
+
+	for (i = 0; i < port->num_txq; i++)
+		port->tx_fd[i] = fds[i];
+
+	for (i = 0; i < port->num_rxq; i++)
+		port->fd[i] = fds[port->num_txq + i];
+
+	return 0;
+}
+
 /* return NULL if the device is not found */
 struct sn_port *init_port(const char *ifname)
 {
@@ -186,14 +255,9 @@ struct sn_port *init_port(const char *ifname)
 		port->tx_qs[i] = bar->inc_qs[i];
 	}
 
-	for (i = 0; i < port->num_rxq; i++) {
-		char fifoname[256];
-
-		sprintf(fifoname, "%s/%s/%s.rx%d", 
-				P_tmpdir, VPORT_DIR_PREFIX, ifname, i);
-		
-		port->fd[i] = open(fifoname, O_RDONLY);
-		assert(port->fd[i] > 0);
+	if (recv_doorbells(ifname, port)) {
+		free(port);
+		return NULL;
 	}
 
 	return port;
@@ -209,8 +273,85 @@ void sn_disable_interrupt(struct vport_out_regs *rx_regs)
 	__sn_disable_interrupt(rx_regs);
 }
 
+static void ack_doorbell(int fd)
+{
+	uint64_t cnt;
+
+	/* The doorbell is non-blocking. Nothing to read is fine. */
+	if (read(fd, &cnt, sizeof(cnt)) < 0)
+		return;
+}
+
+/* Sleeps on 'fd' after setting 'flag', unless 'ready' is already true */
+static int wait_doorbell(int fd, volatile uint32_t *flag,
+			 int (*ready)(const struct llring *),
+			 const struct llring *q, int timeout_ms)
+{
+	struct pollfd pfd = {fd, POLLIN, 0};
+	int ret;
+
+	*flag = 1;
+
+	/* BESS checks the flag after updating the ring, so one of us must see
+	 * the other's write */
+	__sync_synchronize();
+
+	if (ready(q)) {
+		*flag = 0;
+		return 1;
+	}
+
+	do {
+		ret = poll(&pfd, 1, timeout_ms);
+	} while (ret < 0 && errno == EINTR);
+
+	*flag = 0;
+	ack_doorbell(fd);
+
+	if (ret < 0)
+		return -1;
+
+	return ready(q);
+}
+
+static int rx_ready(const struct llring *q)
+{
+	return !llring_empty(q);
+}
+
+static int tx_ready(const struct llring *q)
+{
+	return !llring_full(q);
+}
+
+int sn_wait_rx(struct sn_port *port, int rxq, int timeout_ms)
+{
+	return wait_doorbell(port->fd[rxq], &port->rx_regs[rxq]->irq_enabled,
+			     rx_ready, port->rx_qs[rxq], timeout_ms);
+}
+
+int sn_wait_tx(struct sn_port *port, int txq, int timeout_ms)
+{
+	return wait_doorbell(port->tx_fd[txq],
+			     &port->tx_regs[txq]->space_wanted,
+			     tx_ready, port->tx_qs[txq], timeout_ms);
+}
+
+void sn_ack_interrupt(struct sn_port *port, int rxq)
+{
+	ack_doorbell(port->fd[rxq]);
+}
+
 void close_port(struct sn_port *port)
 {
+	int i;
+
+	for (i = 0; i < port->num_rxq; i++)
+		close(port->fd[i]);
+
+	for (i = 0; i < port->num_txq; i++)
+		close(port->tx_fd[i]);
+
 	free(port);
 }
 
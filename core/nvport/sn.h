@@ -30,14 +30,23 @@
 #define __cacheline_aligned __attribute__((aligned(64)))
 #endif
 
+/* A queue has a doorbell (eventfd), which BESS rings only if we set the
+ * corresponding flag below. See sn_wait_rx() and sn_wait_tx(). */
 struct vport_inc_regs {
 	uint64_t dropped;
+	volatile uint32_t space_wanted;
 } __cacheline_aligned;
 
 struct vport_out_regs {
 	volatile uint32_t irq_enabled;
 } __cacheline_aligned;
 
+/* Received from <VPORT_DIR_PREFIX>/<name>.sock, along with the doorbells */
+struct vport_doorbells {
+	int num_inc_q;
+	int num_out_q;
+};
+
 /* This is equivalent to the old bar */
 struct vport_bar {
 	char name[PORT_NAME_LEN];
@@ -68,7 +77,8 @@ struct sn_port {
 	struct vport_out_regs *rx_regs[MAX_QUEUES_PER_PORT_DIR];
 	struct llring *rx_qs[MAX_QUEUES_PER_PORT_DIR];
 
-	int fd[MAX_QUEUES_PER_PORT_DIR];
+	int fd[MAX_QUEUES_PER_PORT_DIR];	/* RX doorbells */
+	int tx_fd[MAX_QUEUES_PER_PORT_DIR];	/* TX doorbells */
 };
 
 /* End ideally share this part */
@@ -100,6 +110,17 @@ void sn_snb_copy_batch(snb_array_t src, snb_array_t dest, int cnt);
 void sn_enable_interrupt(struct vport_out_regs *);
 void sn_disable_interrupt(struct vport_out_regs *);
 
+/* Sleep until the RX queue has packets (returns 1), or for up to timeout_ms
+ * milliseconds (returns 0). A negative timeout means forever. Returns -1 on
+ * errors. */
+int sn_wait_rx(struct sn_port *port, int rxq, int timeout_ms);
+
+/* Same as sn_wait_rx(), but waits until the TX queue has free slots */
+int sn_wait_tx(struct sn_port *port, int txq, int timeout_ms);
+
+/* Clears the RX doorbell after waking up with epoll() on port->fd[rxq] */
+void sn_ack_interrupt(struct sn_port *port, int rxq);
+
 uint16_t sn_num_txq(struct sn_port *vport);
 
 uint16_t sn_num_rxq(struct sn_port *vport);
@@ -20,6 +20,10 @@ DEFINE_bool(s, false, "Show TC statistics every second");
 DEFINE_bool(d, false, "Run BESS in debug mode (with debug log messages)");
 DEFINE_bool(a, false, "Allow multiple instances");
 DEFINE_bool(no_huge, false, "Disable hugepages");
+DEFINE_bool(metadata_overflow, false,
+            "Place metadata attributes that do not fit in the metadata area "
+            "at the front of the packet headroom, leaving only the rest for "
+            "prepending headers");
 DEFINE_string(modules, bess::bessd::GetCurrentDirectory() + "modules",
 	      "Load modules from the specified directory");
 
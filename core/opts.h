@@ -14,6 +14,7 @@ DECLARE_int32(c);
 DECLARE_int32(p);
 DECLARE_int32(m);
 DECLARE_bool(no_huge);
+DECLARE_bool(metadata_overflow);
 DECLARE_string(modules);
 
 #endif  // BESS_OPTS_H_
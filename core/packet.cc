@@ -88,6 +88,10 @@ static void init_templates(void) {
   }
 }
 
+#if DPDK_VER >= DPDK_VER_NUM(16, 7, 0)
+static void init_paddr_index();
+#endif
+
 void init_mempool(void) {
   int initialized[RTE_MAX_NUMA_NODES];
 
@@ -110,6 +114,10 @@ void init_mempool(void) {
     }
   }
 
+#if DPDK_VER >= DPDK_VER_NUM(16, 7, 0)
+  init_paddr_index();
+#endif
+
   init_templates();
 }
 
@@ -142,7 +150,8 @@ static Packet *paddr_to_snb_memchunk(struct rte_mempool_memhdr *chunk,
   return nullptr;
 }
 
-Packet *Packet::from_paddr(phys_addr_t paddr) {
+// Walks the chunk lists of all pools. Slow with many chunks.
+static Packet *paddr_to_snb_slow(phys_addr_t paddr) {
   for (int i = 0; i < RTE_MAX_NUMA_NODES; i++) {
     struct rte_mempool *pool;
     struct rte_mempool_memhdr *chunk;
@@ -154,22 +163,185 @@ Packet *Packet::from_paddr(phys_addr_t paddr) {
 
     STAILQ_FOREACH(chunk, &pool->mem_list, next) {
       Packet *pkt = paddr_to_snb_memchunk(chunk, paddr);
-      if (!pkt) {
+      if (pkt) {
+        return pkt;
+      }
+    }
+  }
+
+  return nullptr;
+}
+
+// Hash table from physical frames to the pool chunk that covers them, built
+// once in init_mempool(). The frame size is fixed to 2MB, whatever the actual
+// page size is. A frame that contains more than one chunk (e.g., the boundary
+// of two pools) is marked with a null chunk, and falls back to the slow path.
+static const int kPaddrFrameShift = 21;
+static const uint64_t kPaddrFrameEmpty = UINT64_MAX;
+
+struct PaddrFrame {
+  uint64_t frame;
+  struct rte_mempool_memhdr *chunk;
+};
+
+static PaddrFrame *paddr_frames;
+static int paddr_frames_bits;
+
+static inline size_t paddr_frame_slot(uint64_t frame) {
+  // Fibonacci hashing
+  return (frame * 0x9e3779b97f4a7c15ull) >> (64 - paddr_frames_bits);
+}
+
+static void paddr_index_insert(uint64_t frame,
+                               struct rte_mempool_memhdr *chunk) {
+  size_t mask = (1ul << paddr_frames_bits) - 1;
+
+  for (size_t i = paddr_frame_slot(frame);; i = (i + 1) & mask) {
+    PaddrFrame *f = &paddr_frames[i];
+
+    if (f->frame == kPaddrFrameEmpty) {
+      f->frame = frame;
+      f->chunk = chunk;
+      return;
+    }
+
+    if (f->frame == frame) {
+      if (f->chunk != chunk) {
+        f->chunk = nullptr;
+      }
+      return;
+    }
+  }
+}
+
+static void init_paddr_index() {
+  size_t num_frames = 0;
+
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass == 1) {
+      // Keep the load factor under 50%
+      paddr_frames_bits = 1;
+      while ((1ul << paddr_frames_bits) < num_frames * 2) {
+        paddr_frames_bits++;
+      }
+
+      paddr_frames = new PaddrFrame[1ul << paddr_frames_bits];
+      for (size_t i = 0; i < (1ul << paddr_frames_bits); i++) {
+        paddr_frames[i] = {kPaddrFrameEmpty, nullptr};
+      }
+    }
+
+    for (int i = 0; i < RTE_MAX_NUMA_NODES; i++) {
+      struct rte_mempool_memhdr *chunk;
+
+      if (!pframe_pool[i]) {
         continue;
       }
 
-      if (pkt->paddr() != paddr) {
-        LOG(ERROR) << "pkt->immutable.paddr corruption: pkt=" << pkt
-                   << ", pkt->immutable.paddr=" << pkt->paddr()
-                   << " (!= " << paddr << ")";
-        return nullptr;
+      STAILQ_FOREACH(chunk, &pframe_pool[i]->mem_list, next) {
+        uint64_t first;
+        uint64_t last;
+
+        if (chunk->phys_addr == RTE_BAD_PHYS_ADDR || chunk->len == 0) {
+          continue;
+        }
+
+        first = chunk->phys_addr >> kPaddrFrameShift;
+        last = (chunk->phys_addr + chunk->len - 1) >> kPaddrFrameShift;
+
+        if (pass == 0) {
+          num_frames += last - first + 1;
+          continue;
+        }
+
+        for (uint64_t frame = first; frame <= last; frame++) {
+          paddr_index_insert(frame, chunk);
+        }
       }
+    }
+  }
+
+  LOG(INFO) << "Packet pools span " << num_frames << " physical frames";
+}
+
+static inline const PaddrFrame *paddr_frame_find(uint64_t frame) {
+  size_t mask = (1ul << paddr_frames_bits) - 1;
 
-      return pkt;
+  for (size_t i = paddr_frame_slot(frame);; i = (i + 1) & mask) {
+    const PaddrFrame *f = &paddr_frames[i];
+
+    if (f->frame == frame) {
+      return f;
+    }
+
+    if (f->frame == kPaddrFrameEmpty) {
+      return nullptr;
     }
   }
+}
 
-  return nullptr;
+// Also returns the chunk that covers the frame of 'paddr', if it is unique.
+static inline Packet *paddr_to_snb(phys_addr_t paddr,
+                                   struct rte_mempool_memhdr **chunk) {
+  const PaddrFrame *f;
+
+  if (unlikely(!paddr_frames)) {
+    *chunk = nullptr;
+    return paddr_to_snb_slow(paddr);
+  }
+
+  f = paddr_frame_find(paddr >> kPaddrFrameShift);
+  if (!f) {
+    *chunk = nullptr;
+    return nullptr;
+  }
+
+  *chunk = f->chunk;
+  if (likely(f->chunk != nullptr)) {
+    return paddr_to_snb_memchunk(f->chunk, paddr);
+  }
+
+  return paddr_to_snb_slow(paddr);
+}
+
+static inline bool paddr_check(Packet *pkt, phys_addr_t paddr) {
+  if (unlikely(pkt->paddr() != paddr)) {
+    LOG(ERROR) << "pkt->immutable.paddr corruption: pkt=" << pkt
+               << ", pkt->immutable.paddr=" << pkt->paddr()
+               << " (!= " << paddr << ")";
+    return false;
+  }
+
+  return true;
+}
+
+Packet *Packet::from_paddr(phys_addr_t paddr) {
+  struct rte_mempool_memhdr *chunk;
+  Packet *pkt = paddr_to_snb(paddr, &chunk);
+
+  if (!pkt || !paddr_check(pkt, paddr)) {
+    return nullptr;
+  }
+
+  return pkt;
+}
+
+void Packet::from_paddr_bulk(Packet **pkts, const phys_addr_t *paddrs,
+                             size_t cnt) {
+  // Packets of a burst tend to come from the same chunk. Skip the lookup
+  // while they do.
+  struct rte_mempool_memhdr *chunk = nullptr;
+
+  for (size_t i = 0; i < cnt; i++) {
+    phys_addr_t paddr = paddrs[i];
+    Packet *pkt = chunk ? paddr_to_snb_memchunk(chunk, paddr) : nullptr;
+
+    if (!pkt) {
+      pkt = paddr_to_snb(paddr, &chunk);
+    }
+
+    pkts[i] = (pkt && paddr_check(pkt, paddr)) ? pkt : nullptr;
+  }
 }
 #else
 Packet *Packet::from_paddr(phys_addr_t paddr) {
@@ -203,6 +375,7 @@ Packet *Packet::from_paddr(phys_addr_t paddr) {
         log_err(
             "snb->immutable.paddr "
             "corruption detected\n");
+        ret = nullptr;
       }
 
       break;
@@ -211,6 +384,13 @@ Packet *Packet::from_paddr(phys_addr_t paddr) {
 
   return ret;
 }
+
+void Packet::from_paddr_bulk(Packet **pkts, const phys_addr_t *paddrs,
+                             size_t cnt) {
+  for (size_t i = 0; i < cnt; i++) {
+    pkts[i] = from_paddr(paddrs[i]);
+  }
+}
 #endif
 
 // basically rte_hexdump() from eal_common_hexdump.c
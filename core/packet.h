@@ -130,6 +130,25 @@ class alignas(64) Packet {
   int total_len() const { return pkt_len_; }
   void set_total_len(uint32_t len) { pkt_len_ = len; }
 
+  // PKT_RX_* / PKT_TX_* flags, as defined by DPDK
+  uint64_t offload_flags() const { return offload_flags_; }
+  void set_offload_flags(uint64_t flags) { offload_flags_ = flags; }
+
+  // Valid if PKT_RX_RSS_HASH is set in offload_flags()
+  uint32_t rss_hash() const { return hash_.rss_; }
+
+  uint16_t l2_len() const { return l2_len_; }
+  void set_l2_len(uint16_t len) { l2_len_ = len; }
+
+  uint16_t l3_len() const { return l3_len_; }
+  void set_l3_len(uint16_t len) { l3_len_ = len; }
+
+  uint16_t l4_len() const { return l4_len_; }
+  void set_l4_len(uint16_t len) { l4_len_ = len; }
+
+  uint16_t tso_segsz() const { return tso_segsz_; }
+  void set_tso_segsz(uint16_t size) { tso_segsz_ = size; }
+
   uint16_t refcnt() const { return rte_mbuf_refcnt_read(&as_rte_mbuf()); }
 
   void set_refcnt(uint16_t cnt) { rte_mbuf_refcnt_set(&as_rte_mbuf(), cnt); }
@@ -153,8 +172,14 @@ class alignas(64) Packet {
 
   void reset() { rte_pktmbuf_reset(&as_rte_mbuf()); }
 
+  // add bytes to the beginning. The front of the headroom is off limits if
+  // it may hold metadata attributes.
   void *prepend(uint16_t len) {
-    if (unlikely(data_off_ < len))
+    uint16_t reserved = bess::metadata::default_pipeline.overflow()
+                            ? bess::metadata::kMetadataOverflowSize
+                            : 0;
+
+    if (unlikely(data_off_ < len + reserved))
       return nullptr;
 
     data_off_ -= len;
@@ -210,6 +235,11 @@ class alignas(64) Packet {
 
   static Packet *from_paddr(phys_addr_t paddr);
 
+  // Translates 'cnt' physical addresses at once. Entries of 'pkts' are set to
+  // nullptr for addresses that do not belong to any packet.
+  static void from_paddr_bulk(Packet **pkts, const phys_addr_t *paddrs,
+                              size_t cnt);
+
   static int mt_offset_to_databuf_offset(bess::metadata::mt_offset_t offset) {
     return offset + offsetof(Packet, metadata_) - offsetof(Packet, headroom_);
   }
@@ -332,6 +362,19 @@ class alignas(64) Packet {
 
       struct rte_mempool *pool_;  // Pool from which mbuf was allocated.
       Packet *next_;              // Next segment of scattered packet.
+
+      // Header lengths for TX offloads, valid if requested in offload_flags_
+      union {
+        uint64_t tx_offload_;  // combined for easy fetch
+        struct {
+          uint64_t l2_len_ : 7;        // L2 (MAC) header length.
+          uint64_t l3_len_ : 9;        // L3 (IP) header length.
+          uint64_t l4_len_ : 8;        // L4 (TCP/UDP) header length.
+          uint64_t tso_segsz_ : 16;    // TCP TSO segment size.
+          uint64_t outer_l3_len_ : 9;  // Outer L3 header length.
+          uint64_t outer_l2_len_ : 7;  // Outer L2 header length.
+        };
+      };
     };
     char mbuf_[SNBUF_MBUF];
   };
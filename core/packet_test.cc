@@ -0,0 +1,97 @@
+#include "packet.h"
+
+#include <unistd.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "dpdk.h"
+#include "utils/random.h"
+
+namespace {
+
+class PacketTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    if (!dpdk_inited_) {
+      if (geteuid() == 0) {
+        init_dpdk("packet_test", 1024, 0, true);
+        bess::init_mempool();
+        dpdk_inited_ = true;
+      } else {
+        LOG(INFO) << "This test requires root privileges. Skipping...";
+      }
+    }
+  }
+
+  static bool dpdk_inited_;
+};
+
+bool PacketTest::dpdk_inited_ = false;
+
+// The bulk version skips the lookup while addresses stay in the same chunk,
+// so mix them up and check that it still agrees with from_paddr(), including
+// on addresses that do not translate.
+TEST_F(PacketTest, FromPaddrBulk) {
+  if (!dpdk_inited_) {
+    return;
+  }
+
+  struct rte_mempool *pool = bess::get_pframe_pool_socket(0);
+  const size_t kNumPkts = 256;
+  std::vector<bess::Packet *> allocated;
+  std::vector<phys_addr_t> paddrs;
+  Random rd(1234);
+
+  ASSERT_NE(nullptr, pool);
+
+  for (size_t i = 0; i < kNumPkts; i++) {
+    bess::Packet *pkt =
+        reinterpret_cast<bess::Packet *>(rte_pktmbuf_alloc(pool));
+
+    ASSERT_NE(nullptr, pkt);
+    allocated.push_back(pkt);
+  }
+
+  for (size_t i = 0; i < kNumPkts * 4; i++) {
+    phys_addr_t paddr = allocated[rd.GetRange(kNumPkts)]->paddr();
+
+    switch (rd.GetRange(8)) {
+      case 0:
+        paddr = 0;  // out of any pool
+        break;
+      case 1:
+        paddr = UINT64_MAX - rd.GetRange(4096);
+        break;
+      case 2:
+        paddr += 1 + rd.GetRange(64);  // in a pool, but not a packet
+        break;
+      default:
+        break;
+    }
+    paddrs.push_back(paddr);
+  }
+
+  // Also a run of consecutive packets, as from a freshly refilled ring
+  for (size_t i = 0; i < kNumPkts; i++) {
+    paddrs.push_back(allocated[i]->paddr());
+  }
+
+  std::vector<bess::Packet *> pkts(paddrs.size());
+  bess::Packet::from_paddr_bulk(pkts.data(), paddrs.data(), paddrs.size());
+
+  for (size_t i = 0; i < paddrs.size(); i++) {
+    ASSERT_EQ(bess::Packet::from_paddr(paddrs[i]), pkts[i])
+        << "paddr " << std::hex << paddrs[i] << " at " << std::dec << i;
+    if (pkts[i]) {
+      EXPECT_EQ(paddrs[i], pkts[i]->paddr());
+    }
+  }
+
+  for (bess::Packet *pkt : allocated) {
+    bess::Packet::Free(pkt);
+  }
+}
+
+}  // namespace (unnamed)
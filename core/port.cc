@@ -145,6 +145,7 @@ Port::PortStats Port::GetPortStats() {
     ret.inc.packets += inc.packets;
     ret.inc.dropped += inc.dropped;
     ret.inc.bytes += inc.bytes;
+    ret.inc.kicks += inc.kicks;
   }
 
   for (queue_t qid = 0; qid < num_queues[PACKET_DIR_OUT]; qid++) {
@@ -152,6 +153,7 @@ Port::PortStats Port::GetPortStats() {
     ret.out.packets += out.packets;
     ret.out.dropped += out.dropped;
     ret.out.bytes += out.bytes;
+    ret.out.kicks += out.kicks;
   }
 
   return ret;
@@ -148,6 +148,7 @@ struct QueueStats {
   uint64_t packets;
   uint64_t dropped;  // Not all drivers support this for INC direction
   uint64_t bytes;    // It doesn't include Ethernet overhead
+  uint64_t kicks;    // Notifications to the peer (OUT direction, some drivers)
 };
 
 class Port {
@@ -192,6 +193,10 @@ class Port {
 
   virtual uint64_t GetFlags() const { return 0; }
 
+  // PKT_TX_* offloads the port can do for outgoing packets. Other offloads
+  // requested by packets are done in software before SendPackets().
+  virtual uint64_t GetTxOffloads() const { return 0; }
+
   /*!
    * Get any placement constraints that need to be met when receiving from this
    * port.
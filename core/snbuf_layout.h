@@ -11,6 +11,8 @@
  *  - 320	64	private area for module/driver's internal use
  *                        (currently used for vport RX/TX descriptors)
  *  - 384	128	_headroom (SNBUF_HEADROOM == RTE_PKTMBUF_HEADROOM)
+ *                        (the first 64 bytes may be used for metadata if
+ *                        the pipeline enables its overflow area)
  *  - 512	1536	_data (SNBUF_DATA)
  *
  * Stride will be 2112B, because of mempool's per-object header which takes 64B.
@@ -0,0 +1,316 @@
+#ifndef BESS_UTILS_AQM_H_
+#define BESS_UTILS_AQM_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+#include "histogram.h"
+#include "random.h"
+
+// Active queue management policies, for queueing modules to drop packets
+// before their queue fills up and builds up delay.
+//
+// Both policies work off the sojourn time of packets, i.e. how long each
+// packet spent in the queue, and decide on dequeue whether to drop it. Times
+// are in nanoseconds.
+namespace bess {
+namespace utils {
+
+// CoDel (RFC 8289): once the sojourn time has stayed above 'target' for a
+// whole 'interval', drops packets at a rate growing with the square root of
+// the number of drops, until the sojourn time falls below 'target'.
+class CoDel {
+ public:
+  static const uint64_t kDefaultTarget = 5000000;     // 5ms
+  static const uint64_t kDefaultInterval = 100000000;  // 100ms
+
+  CoDel(uint64_t target_ns, uint64_t interval_ns)
+      : target_(target_ns),
+        interval_(interval_ns),
+        first_above_time_(),
+        drop_next_(),
+        count_(),
+        lastcount_(),
+        dropping_() {}
+
+  // Called for each packet dequeued at 'now_ns', after 'sojourn_ns' in the
+  // queue. 'last' is true if no other packet is left in the queue. Returns
+  // true if the packet should be dropped.
+  bool ShouldDrop(uint64_t now_ns, uint64_t sojourn_ns, bool last) {
+    bool ok_to_drop = OkToDrop(now_ns, sojourn_ns, last);
+
+    if (dropping_) {
+      if (!ok_to_drop) {
+        dropping_ = false;
+        return false;
+      }
+      if (now_ns >= drop_next_) {
+        count_++;
+        drop_next_ = ControlLaw(drop_next_, count_);
+        return true;
+      }
+      return false;
+    }
+
+    if (!ok_to_drop) {
+      return false;
+    }
+
+    // Start dropping. If we were dropping not long ago, pick up where we
+    // left off rather than from a drop rate of 1/interval.
+    uint32_t delta = count_ - lastcount_;
+    dropping_ = true;
+    count_ = 1;
+    if (delta > 1 &&
+        static_cast<int64_t>(now_ns - drop_next_) <
+            static_cast<int64_t>(16 * interval_)) {
+      count_ = delta;
+    }
+    drop_next_ = ControlLaw(now_ns, count_);
+    lastcount_ = count_;
+    return true;
+  }
+
+  // Called when the queue is found empty
+  void Empty() {
+    first_above_time_ = 0;
+    dropping_ = false;
+  }
+
+  bool dropping() const { return dropping_; }
+
+ private:
+  bool OkToDrop(uint64_t now_ns, uint64_t sojourn_ns, bool last) {
+    if (sojourn_ns < target_ || last) {
+      first_above_time_ = 0;
+      return false;
+    }
+    if (first_above_time_ == 0) {
+      first_above_time_ = now_ns + interval_;
+      return false;
+    }
+    return now_ns >= first_above_time_;
+  }
+
+  uint64_t ControlLaw(uint64_t t, uint32_t count) const {
+    return t + interval_ / std::sqrt(count);
+  }
+
+  uint64_t target_;
+  uint64_t interval_;
+
+  uint64_t first_above_time_;  // when the sojourn time went above target_
+  uint64_t drop_next_;         // when to drop next in the dropping state
+  uint32_t count_;             // drops since entering the dropping state
+  uint32_t lastcount_;         // count_ at the previous entry
+  bool dropping_;
+};
+
+// PIE (RFC 8033): drops packets randomly, with a probability updated every
+// 'tupdate' following the deviation of the sojourn time from 'target' and its
+// trend. Bursts shorter than kMaxBurst go through untouched.
+//
+// RFC 8033 drops on enqueue, estimating the queueing delay from the last
+// dequeued packet. Here the drop happens on dequeue, where the sojourn time is
+// known exactly and queueing modules are single threaded.
+class Pie {
+ public:
+  static const uint64_t kDefaultTarget = 15000000;   // 15ms
+  static const uint64_t kDefaultTupdate = 15000000;  // 15ms
+  static const uint64_t kMaxBurst = 150000000;       // 150ms
+
+  Pie(uint64_t target_ns, uint64_t tupdate_ns)
+      : target_(target_ns),
+        tupdate_(tupdate_ns),
+        prob_(),
+        qdelay_(),
+        qdelay_old_(),
+        burst_allowance_(kMaxBurst),
+        next_update_(),
+        rng_() {}
+
+  // Called for each packet dequeued at 'now_ns', after 'sojourn_ns' in the
+  // queue. 'last' is true if no other packet is left in the queue. Returns
+  // true if the packet should be dropped.
+  bool ShouldDrop(uint64_t now_ns, uint64_t sojourn_ns, bool last) {
+    qdelay_ = sojourn_ns;
+    if (now_ns >= next_update_) {
+      Update();
+      next_update_ = now_ns + tupdate_;
+    }
+
+    if (burst_allowance_ > 0 || last) {
+      return false;
+    }
+    if (qdelay_old_ < target_ / 2 && prob_ < 0.2) {
+      return false;
+    }
+    return rng_.GetReal() < prob_;
+  }
+
+  // Called when the queue is found empty
+  void Empty() { qdelay_ = 0; }
+
+  double drop_probability() const { return prob_; }
+
+ private:
+  // Gains in Hz, i.e. per second of delay
+  static constexpr double kAlpha = 0.125;
+  static constexpr double kBeta = 1.25;
+
+  void Update() {
+    double p = (kAlpha * (static_cast<double>(qdelay_) - target_) +
+                kBeta * (static_cast<double>(qdelay_) - qdelay_old_)) /
+               1e9;
+
+    // Small probabilities move in small steps (RFC 8033 Section 4.2)
+    if (prob_ < 0.000001) {
+      p /= 2048;
+    } else if (prob_ < 0.00001) {
+      p /= 512;
+    } else if (prob_ < 0.0001) {
+      p /= 128;
+    } else if (prob_ < 0.001) {
+      p /= 32;
+    } else if (prob_ < 0.01) {
+      p /= 8;
+    } else if (prob_ < 0.1) {
+      p /= 2;
+    } else if (p > 0.02) {
+      p = 0.02;
+    }
+
+    prob_ += p;
+    if (qdelay_ == 0 && qdelay_old_ == 0) {
+      prob_ *= 0.98;
+    }
+    prob_ = std::min(std::max(prob_, 0.0), 1.0);
+
+    burst_allowance_ -= std::min(burst_allowance_, tupdate_);
+    if (prob_ == 0 && qdelay_ < target_ / 2 && qdelay_old_ < target_ / 2) {
+      burst_allowance_ = kMaxBurst;
+    }
+
+    qdelay_old_ = qdelay_;
+  }
+
+  uint64_t target_;
+  uint64_t tupdate_;
+
+  double prob_;
+  uint64_t qdelay_;      // the latest sojourn time
+  uint64_t qdelay_old_;  // qdelay_ at the previous update
+  uint64_t burst_allowance_;
+  uint64_t next_update_;
+
+  Random rng_;
+};
+
+// Either policy, or none, as picked by the user of a queueing module
+class Aqm {
+ public:
+  enum Policy {
+    kNone,  // tail drop only
+    kCoDel,
+    kPie,
+  };
+
+  Aqm() : Aqm(kNone, 0, 0) {}
+
+  // For CoDel, 'interval_ns' is the interval, and for PIE, tupdate. 0 picks
+  // the policy's default.
+  Aqm(Policy policy, uint64_t target_ns, uint64_t interval_ns)
+      : policy_(policy),
+        target_(target_ns ? target_ns : DefaultTarget(policy)),
+        interval_(interval_ns ? interval_ns : DefaultInterval(policy)),
+        codel_(target_, interval_),
+        pie_(target_, interval_) {}
+
+  // Parses "codel", "pie" or "" (kNone). Returns false if 'name' is none of
+  // them.
+  static bool ParsePolicy(const std::string &name, Policy *policy) {
+    if (name == "") {
+      *policy = kNone;
+    } else if (name == "codel") {
+      *policy = kCoDel;
+    } else if (name == "pie") {
+      *policy = kPie;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  bool ShouldDrop(uint64_t now_ns, uint64_t sojourn_ns, bool last) {
+    switch (policy_) {
+      case kCoDel:
+        return codel_.ShouldDrop(now_ns, sojourn_ns, last);
+      case kPie:
+        return pie_.ShouldDrop(now_ns, sojourn_ns, last);
+      default:
+        return false;
+    }
+  }
+
+  void Empty() {
+    if (policy_ == kCoDel) {
+      codel_.Empty();
+    } else if (policy_ == kPie) {
+      pie_.Empty();
+    }
+  }
+
+  Policy policy() const { return policy_; }
+  uint64_t target_ns() const { return target_; }
+  uint64_t interval_ns() const { return interval_; }
+
+ private:
+  static uint64_t DefaultTarget(Policy policy) {
+    if (policy == kPie) {
+      return Pie::kDefaultTarget;
+    }
+    return CoDel::kDefaultTarget;
+  }
+
+  static uint64_t DefaultInterval(Policy policy) {
+    if (policy == kPie) {
+      return Pie::kDefaultTupdate;
+    }
+    return CoDel::kDefaultInterval;
+  }
+
+  Policy policy_;
+  uint64_t target_;
+  uint64_t interval_;
+
+  CoDel codel_;
+  Pie pie_;
+};
+
+// For the get_stats command of queueing modules with an AQM policy: fills 'r'
+// (an AqmCommandGetStatsResponse) with the sojourn times in 'hist' and the
+// counters, and then resets all of them for the next call.
+template <typename T>
+void TakeAqmStats(T *r, LogHistogram *hist, uint64_t *drops,
+                  uint64_t *sojourn_long) {
+  r->set_packets(hist->count());
+  r->set_drops(*drops);
+  r->set_sojourn_min_ns(hist->min());
+  r->set_sojourn_avg_ns(hist->avg());
+  r->set_sojourn_max_ns(hist->max());
+  r->set_sojourn_50_ns(hist->percentile(50));
+  r->set_sojourn_99_ns(hist->percentile(99));
+  r->set_sojourn_999_ns(hist->percentile(99.9));
+  r->set_sojourn_above_max(*sojourn_long);
+
+  hist->reset();
+  *drops = 0;
+  *sojourn_long = 0;
+}
+
+}  // namespace utils
+}  // namespace bess
+
+#endif  // BESS_UTILS_AQM_H_
@@ -0,0 +1,173 @@
+#include "aqm.h"
+
+#include <gtest/gtest.h>
+
+#include "../module_msg.pb.h"
+
+namespace {
+
+using bess::utils::Aqm;
+using bess::utils::CoDel;
+using bess::utils::Pie;
+using bess::utils::TakeAqmStats;
+
+const uint64_t kMs = 1000000;
+
+// Dequeues a packet every 'gap' ns for 'duration' ns, each with the given
+// sojourn time. Returns the number of drops.
+template <typename T>
+int Dequeue(T *aqm, uint64_t *now, uint64_t duration, uint64_t gap,
+        uint64_t sojourn) {
+  int drops = 0;
+  for (uint64_t end = *now + duration; *now < end; *now += gap) {
+    drops += aqm->ShouldDrop(*now, sojourn, false);
+  }
+  return drops;
+}
+
+TEST(CoDelTest, BelowTarget) {
+  CoDel codel(5 * kMs, 100 * kMs);
+  uint64_t now = 1;
+
+  EXPECT_EQ(0, Dequeue(&codel, &now, 1000 * kMs, kMs / 10, 4 * kMs));
+  EXPECT_FALSE(codel.dropping());
+}
+
+TEST(CoDelTest, AboveTarget) {
+  CoDel codel(5 * kMs, 100 * kMs);
+  uint64_t now = 1;
+
+  // No drop until the delay has been high for an interval
+  EXPECT_EQ(0, Dequeue(&codel, &now, 100 * kMs, kMs / 10, 10 * kMs));
+  EXPECT_EQ(1, Dequeue(&codel, &now, kMs, kMs / 10, 10 * kMs));
+  EXPECT_TRUE(codel.dropping());
+
+  // The next drops come after 100/sqrt(1), 100/sqrt(2), ... ms
+  EXPECT_EQ(0, Dequeue(&codel, &now, 98 * kMs, kMs / 10, 10 * kMs));
+  EXPECT_EQ(1, Dequeue(&codel, &now, 2 * kMs, kMs / 10, 10 * kMs));
+  EXPECT_EQ(0, Dequeue(&codel, &now, 69 * kMs, kMs / 10, 10 * kMs));
+  EXPECT_EQ(1, Dequeue(&codel, &now, 2 * kMs, kMs / 10, 10 * kMs));
+
+  // The drop rate keeps growing as long as the delay stays high
+  EXPECT_LT(20, Dequeue(&codel, &now, 1000 * kMs, kMs / 10, 10 * kMs));
+
+  // Stops as soon as the delay is below the target
+  EXPECT_EQ(0, Dequeue(&codel, &now, 1, 1, kMs));
+  EXPECT_FALSE(codel.dropping());
+}
+
+TEST(CoDelTest, LastPacket) {
+  CoDel codel(5 * kMs, 100 * kMs);
+  uint64_t now = 1;
+
+  for (; now < 1000 * kMs; now += kMs / 10) {
+    EXPECT_FALSE(codel.ShouldDrop(now, 10 * kMs, true));
+  }
+}
+
+TEST(CoDelTest, Empty) {
+  CoDel codel(5 * kMs, 100 * kMs);
+  uint64_t now = 1;
+
+  EXPECT_EQ(1, Dequeue(&codel, &now, 101 * kMs, kMs / 10, 10 * kMs));
+  codel.Empty();
+  EXPECT_FALSE(codel.dropping());
+  EXPECT_EQ(0, Dequeue(&codel, &now, 99 * kMs, kMs / 10, 10 * kMs));
+}
+
+TEST(PieTest, BelowTarget) {
+  Pie pie(15 * kMs, 15 * kMs);
+  uint64_t now = 1;
+
+  EXPECT_EQ(0, Dequeue(&pie, &now, 1000 * kMs, kMs / 10, 10 * kMs));
+  EXPECT_EQ(0, pie.drop_probability());
+}
+
+TEST(PieTest, AboveTarget) {
+  Pie pie(15 * kMs, 15 * kMs);
+  uint64_t now = 1;
+
+  // Bursts are let through
+  EXPECT_EQ(0, Dequeue(&pie, &now, 100 * kMs, kMs / 10, 50 * kMs));
+
+  // The drop probability builds up while the delay stays high...
+  EXPECT_LT(0, Dequeue(&pie, &now, 1000 * kMs, kMs / 10, 50 * kMs));
+  double p = pie.drop_probability();
+  EXPECT_LT(0.0, p);
+  EXPECT_LT(0, Dequeue(&pie, &now, 1000 * kMs, kMs / 10, 50 * kMs));
+  EXPECT_LT(p, pie.drop_probability());
+
+  // ...and decays once it is back to normal
+  p = pie.drop_probability();
+  Dequeue(&pie, &now, 1000 * kMs, kMs / 10, 0);
+  EXPECT_GT(p, pie.drop_probability());
+}
+
+TEST(PieTest, LastPacket) {
+  Pie pie(15 * kMs, 15 * kMs);
+  uint64_t now = 1;
+
+  for (; now < 3000 * kMs; now += kMs / 10) {
+    EXPECT_FALSE(pie.ShouldDrop(now, 50 * kMs, true));
+  }
+  EXPECT_LT(0.0, pie.drop_probability());
+}
+
+TEST(AqmTest, ParsePolicy) {
+  Aqm::Policy policy;
+
+  ASSERT_TRUE(Aqm::ParsePolicy("", &policy));
+  EXPECT_EQ(Aqm::kNone, policy);
+  ASSERT_TRUE(Aqm::ParsePolicy("codel", &policy));
+  EXPECT_EQ(Aqm::kCoDel, policy);
+  ASSERT_TRUE(Aqm::ParsePolicy("pie", &policy));
+  EXPECT_EQ(Aqm::kPie, policy);
+  EXPECT_FALSE(Aqm::ParsePolicy("red", &policy));
+}
+
+TEST(AqmTest, Defaults) {
+  Aqm codel(Aqm::kCoDel, 0, 0);
+  EXPECT_EQ(5 * kMs, codel.target_ns());
+  EXPECT_EQ(100 * kMs, codel.interval_ns());
+
+  Aqm pie(Aqm::kPie, 0, 0);
+  EXPECT_EQ(15 * kMs, pie.target_ns());
+  EXPECT_EQ(15 * kMs, pie.interval_ns());
+
+  Aqm custom(Aqm::kCoDel, 1 * kMs, 20 * kMs);
+  EXPECT_EQ(1 * kMs, custom.target_ns());
+  EXPECT_EQ(20 * kMs, custom.interval_ns());
+}
+
+TEST(AqmTest, None) {
+  Aqm aqm;
+  uint64_t now = 1;
+
+  EXPECT_EQ(Aqm::kNone, aqm.policy());
+  EXPECT_EQ(0, Dequeue(&aqm, &now, 1000 * kMs, kMs / 10, 1000 * kMs));
+}
+
+TEST(AqmTest, TakeStats) {
+  LogHistogram hist;
+  uint64_t drops = 3;
+  uint64_t sojourn_long = 1;
+  bess::pb::AqmCommandGetStatsResponse r;
+
+  for (uint64_t i = 1; i <= 1000; i++) {
+    hist.insert(i * kMs);
+  }
+
+  TakeAqmStats(&r, &hist, &drops, &sojourn_long);
+  EXPECT_EQ(1000, r.packets());
+  EXPECT_EQ(3, r.drops());
+  EXPECT_EQ(1, r.sojourn_above_max());
+  EXPECT_NEAR(500 * kMs, r.sojourn_50_ns(), 5 * kMs);
+  EXPECT_NEAR(990 * kMs, r.sojourn_99_ns(), 10 * kMs);
+
+  // Reset for the next call
+  EXPECT_EQ(0, hist.count());
+  EXPECT_EQ(0, drops);
+  EXPECT_EQ(0, sojourn_long);
+}
+
+}  // namespace
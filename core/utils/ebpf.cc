@@ -0,0 +1,1206 @@
+#include "ebpf.h"
+
+#include <sys/mman.h>
+
+#include <cstring>
+
+namespace bess {
+namespace utils {
+namespace ebpf {
+
+static uint8_t insn_class(const Insn &ins) {
+  return ins.code & 0x07;
+}
+
+static uint8_t insn_size(const Insn &ins) {
+  return ins.code & 0x18;
+}
+
+static uint8_t insn_mode(const Insn &ins) {
+  return ins.code & 0xe0;
+}
+
+static uint8_t insn_source(const Insn &ins) {
+  return ins.code & 0x08;
+}
+
+static uint8_t insn_op(const Insn &ins) {
+  return ins.code & 0xf0;
+}
+
+static int access_size(uint8_t size) {
+  switch (size) {
+    case kB:
+      return 1;
+    case kH:
+      return 2;
+    case kW:
+      return 4;
+    default:
+      return 8;
+  }
+}
+
+static bool is_ld_imm64(const Insn &ins) {
+  return ins.code == (kLd | kDw | kImm);
+}
+
+/* -------------------------------------------------------------------------
+ * Verifier
+ * ------------------------------------------------------------------------- */
+
+// Accesses relative to R10 are checked here, all others at run time
+static const char *check_stack_access(int base, int16_t off, uint8_t size) {
+  if (base == kFramePointer &&
+      (off < -kStackSize || off + access_size(size) > 0)) {
+    return "stack access out of bounds";
+  }
+  return nullptr;
+}
+
+static const char *check_alu(const Insn &ins) {
+  bool is64 = insn_class(ins) == kAlu64;
+  bool is_imm = insn_source(ins) == kK;
+
+  if (ins.dst == kFramePointer) {
+    return "R10 is read-only";
+  }
+
+  // Signed division and sign-extending moves use 'off'
+  if (ins.off != 0) {
+    return "unsupported ALU operation";
+  }
+
+  switch (insn_op(ins)) {
+    case kAdd:
+    case kSub:
+    case kMul:
+    case kOr:
+    case kAnd:
+    case kXor:
+    case kMov:
+      return nullptr;
+
+    case kDiv:
+    case kMod:
+      if (is_imm && ins.imm == 0) {
+        return "division by zero";
+      }
+      return nullptr;
+
+    case kLsh:
+    case kRsh:
+    case kArsh:
+      if (is_imm && (ins.imm < 0 || ins.imm >= (is64 ? 64 : 32))) {
+        return "invalid shift";
+      }
+      return nullptr;
+
+    case kNeg:
+      if (!is_imm) {
+        return "invalid negation";
+      }
+      return nullptr;
+
+    case kEnd:
+      if (is64) {
+        return "unsupported byte swap";
+      }
+      if (ins.imm != 16 && ins.imm != 32 && ins.imm != 64) {
+        return "invalid byte swap size";
+      }
+      return nullptr;
+
+    default:
+      return "unknown ALU operation";
+  }
+}
+
+static const char *check_jmp(const Insn *insns, size_t n, size_t pc,
+                             const std::vector<Helper> &helpers,
+                             const std::vector<bool> &imm64_hi) {
+  const Insn &ins = insns[pc];
+  bool is32 = insn_class(ins) == kJmp32;
+  uint8_t op = insn_op(ins);
+
+  switch (op) {
+    case kCall:
+      if (is32 || insn_source(ins) != kK) {
+        return "unsupported call";
+      }
+      if (ins.imm < 0 || static_cast<size_t>(ins.imm) >= helpers.size() ||
+          !helpers[ins.imm]) {
+        return "unknown helper";
+      }
+      return nullptr;
+
+    case kExit:
+      if (is32) {
+        return "unsupported exit";
+      }
+      return nullptr;
+
+    case kJa:
+      if (is32) {
+        return "unsupported jump";
+      }
+      break;
+
+    case kJeq:
+    case kJgt:
+    case kJge:
+    case kJset:
+    case kJne:
+    case kJsgt:
+    case kJsge:
+    case kJlt:
+    case kJle:
+    case kJslt:
+    case kJsle:
+      break;
+
+    default:
+      return "unknown jump operation";
+  }
+
+  if (ins.off < 0) {
+    return "backward jumps are not allowed";
+  }
+
+  size_t target = pc + 1 + ins.off;
+  if (target >= n) {
+    return "jump out of range";
+  }
+  if (imm64_hi[target]) {
+    return "jump into the middle of an instruction";
+  }
+
+  return nullptr;
+}
+
+static const char *check_insn(const Insn *insns, size_t n, size_t pc,
+                              const std::vector<Helper> &helpers,
+                              const std::vector<bool> &imm64_hi) {
+  const Insn &ins = insns[pc];
+
+  if (ins.dst >= kNumRegs || ins.src >= kNumRegs) {
+    return "invalid register";
+  }
+
+  switch (insn_class(ins)) {
+    case kLd:
+      if (!is_ld_imm64(ins)) {
+        return "unsupported load";
+      }
+      if (ins.src != 0) {
+        return "map references are not supported";
+      }
+      if (ins.dst == kFramePointer) {
+        return "R10 is read-only";
+      }
+      return nullptr;
+
+    case kLdx:
+      if (insn_mode(ins) != kMem) {
+        return "unsupported load";
+      }
+      if (ins.dst == kFramePointer) {
+        return "R10 is read-only";
+      }
+      return check_stack_access(ins.src, ins.off, insn_size(ins));
+
+    case kSt:
+    case kStx:
+      if (insn_mode(ins) != kMem) {
+        return "unsupported store";
+      }
+      return check_stack_access(ins.dst, ins.off, insn_size(ins));
+
+    case kAlu:
+    case kAlu64:
+      return check_alu(ins);
+
+    default:
+      return check_jmp(insns, n, pc, helpers, imm64_hi);
+  }
+}
+
+const uint64_t Program::kAbort;
+
+Program::~Program() {
+  if (jit_func_) {
+    munmap(reinterpret_cast<void *>(jit_func_), jit_size_);
+  }
+}
+
+bool Program::Load(const Insn *insns, size_t n,
+                   const std::vector<Helper> &helpers, std::string *err) {
+  if (n == 0 || n > kMaxInsns) {
+    *err = "programs must have 1 to " + std::to_string(kMaxInsns) +
+           " instructions";
+    return false;
+  }
+
+  // The second halves of 64-bit immediate loads
+  std::vector<bool> imm64_hi(n);
+
+  for (size_t pc = 0; pc < n; pc++) {
+    if (is_ld_imm64(insns[pc])) {
+      if (pc + 1 >= n || insns[pc + 1].code != 0) {
+        *err = "instruction " + std::to_string(pc) +
+               ": incomplete 64-bit immediate load";
+        return false;
+      }
+      imm64_hi[++pc] = true;
+    }
+  }
+
+  for (size_t pc = 0; pc < n; pc++) {
+    if (imm64_hi[pc]) {
+      continue;
+    }
+
+    const char *reason = check_insn(insns, n, pc, helpers, imm64_hi);
+    if (reason) {
+      *err = "instruction " + std::to_string(pc) + ": " + reason;
+      return false;
+    }
+  }
+
+  // Jumps are forward only, so this is the only way to fall off the end
+  if (insns[n - 1].code != (kJmp | kExit)) {
+    *err = "the last instruction must be an exit";
+    return false;
+  }
+
+  if (jit_func_) {
+    munmap(reinterpret_cast<void *>(jit_func_), jit_size_);
+    jit_func_ = nullptr;
+    jit_size_ = 0;
+  }
+
+  insns_.assign(insns, insns + n);
+  helpers_ = helpers;
+  return true;
+}
+
+/* -------------------------------------------------------------------------
+ * Interpreter
+ * ------------------------------------------------------------------------- */
+
+static uint64_t alu64(uint8_t op, uint64_t d, uint64_t s) {
+  switch (op) {
+    case kAdd:
+      return d + s;
+    case kSub:
+      return d - s;
+    case kMul:
+      return d * s;
+    case kDiv:
+      return s ? d / s : 0;
+    case kOr:
+      return d | s;
+    case kAnd:
+      return d & s;
+    case kLsh:
+      return d << (s & 63);
+    case kRsh:
+      return d >> (s & 63);
+    case kNeg:
+      return -d;
+    case kMod:
+      return s ? d % s : d;
+    case kXor:
+      return d ^ s;
+    case kMov:
+      return s;
+    default:  // kArsh
+      return static_cast<int64_t>(d) >> (s & 63);
+  }
+}
+
+static uint32_t alu32(uint8_t op, uint32_t d, uint32_t s) {
+  switch (op) {
+    case kAdd:
+      return d + s;
+    case kSub:
+      return d - s;
+    case kMul:
+      return d * s;
+    case kDiv:
+      return s ? d / s : 0;
+    case kOr:
+      return d | s;
+    case kAnd:
+      return d & s;
+    case kLsh:
+      return d << (s & 31);
+    case kRsh:
+      return d >> (s & 31);
+    case kNeg:
+      return -d;
+    case kMod:
+      return s ? d % s : d;
+    case kXor:
+      return d ^ s;
+    case kMov:
+      return s;
+    default:  // kArsh
+      return static_cast<int32_t>(d) >> (s & 31);
+  }
+}
+
+// Assumes a little-endian host, as the JIT does
+static uint64_t byte_swap(bool to_be, int bits, uint64_t d) {
+  switch (bits) {
+    case 16:
+      return to_be ? __builtin_bswap16(d) : static_cast<uint16_t>(d);
+    case 32:
+      return to_be ? __builtin_bswap32(d) : static_cast<uint32_t>(d);
+    default:
+      return to_be ? __builtin_bswap64(d) : d;
+  }
+}
+
+static bool jump_taken(uint8_t op, uint64_t d, uint64_t s, bool is32) {
+  int64_t sd = is32 ? static_cast<int32_t>(d) : static_cast<int64_t>(d);
+  int64_t ss = is32 ? static_cast<int32_t>(s) : static_cast<int64_t>(s);
+
+  if (is32) {
+    d = static_cast<uint32_t>(d);
+    s = static_cast<uint32_t>(s);
+  }
+
+  switch (op) {
+    case kJa:
+      return true;
+    case kJeq:
+      return d == s;
+    case kJgt:
+      return d > s;
+    case kJge:
+      return d >= s;
+    case kJset:
+      return (d & s) != 0;
+    case kJne:
+      return d != s;
+    case kJsgt:
+      return sd > ss;
+    case kJsge:
+      return sd >= ss;
+    case kJlt:
+      return d < s;
+    case kJle:
+      return d <= s;
+    case kJslt:
+      return sd < ss;
+    default:  // kJsle
+      return sd <= ss;
+  }
+}
+
+// Returns 'addr' if 'size' bytes from there are all in the packet or the
+// stack, nullptr otherwise. Must agree with emit_checked_addr() below.
+static uint8_t *check_access(uint64_t addr, int size, const uint8_t *pkt,
+                             uint32_t len, const uint8_t *stack) {
+  uint64_t pkt_off = addr - reinterpret_cast<uintptr_t>(pkt);
+  uint64_t stack_off = addr - reinterpret_cast<uintptr_t>(stack);
+
+  if ((pkt_off < len && pkt_off + size <= len) ||
+      stack_off <= static_cast<uint64_t>(kStackSize - size)) {
+    return reinterpret_cast<uint8_t *>(addr);
+  }
+
+  return nullptr;
+}
+
+uint64_t Program::Interpret(uint8_t *pkt, uint32_t len, void *ctx) const {
+  uint64_t stack[kStackSize / sizeof(uint64_t)];
+  uint8_t *stack_base = reinterpret_cast<uint8_t *>(stack);
+  uint64_t reg[kNumRegs] = {};
+
+  reg[1] = reinterpret_cast<uintptr_t>(pkt);
+  reg[2] = len;
+  reg[kFramePointer] = reinterpret_cast<uintptr_t>(stack_base + kStackSize);
+
+  for (size_t pc = 0;; pc++) {
+    const Insn &ins = insns_[pc];
+    uint64_t &dst = reg[ins.dst];
+
+    switch (insn_class(ins)) {
+      case kAlu64: {
+        uint64_t s = insn_source(ins) == kX ? reg[ins.src]
+                                            : static_cast<int64_t>(ins.imm);
+        dst = alu64(insn_op(ins), dst, s);
+        break;
+      }
+
+      case kAlu: {
+        uint32_t s = insn_source(ins) == kX ? reg[ins.src] : ins.imm;
+        if (insn_op(ins) == kEnd) {
+          dst = byte_swap(insn_source(ins) == kX, ins.imm, dst);
+        } else {
+          dst = alu32(insn_op(ins), dst, s);
+        }
+        break;
+      }
+
+      case kLd:
+        dst = static_cast<uint32_t>(ins.imm) |
+              static_cast<uint64_t>(insns_[pc + 1].imm) << 32;
+        pc++;
+        break;
+
+      case kLdx: {
+        int size = access_size(insn_size(ins));
+        uint8_t *p =
+            check_access(reg[ins.src] + ins.off, size, pkt, len, stack_base);
+        if (!p) {
+          return kAbort;
+        }
+        dst = 0;
+        memcpy(&dst, p, size);
+        break;
+      }
+
+      case kSt:
+      case kStx: {
+        int size = access_size(insn_size(ins));
+        uint64_t val = insn_class(ins) == kStx
+                           ? reg[ins.src]
+                           : static_cast<int64_t>(ins.imm);
+        uint8_t *p = check_access(dst + ins.off, size, pkt, len, stack_base);
+        if (!p) {
+          return kAbort;
+        }
+        memcpy(p, &val, size);
+        break;
+      }
+
+      default: {  // kJmp, kJmp32
+        uint8_t op = insn_op(ins);
+
+        if (op == kExit) {
+          return reg[0];
+        }
+
+        if (op == kCall) {
+          reg[0] =
+              helpers_[ins.imm](reg[1], reg[2], reg[3], reg[4], reg[5], ctx);
+          memset(&reg[1], 0, 5 * sizeof(reg[0]));
+          break;
+        }
+
+        uint64_t s = insn_source(ins) == kX ? reg[ins.src]
+                                            : static_cast<int64_t>(ins.imm);
+        if (jump_taken(op, dst, s, insn_class(ins) == kJmp32)) {
+          pc += ins.off;
+        }
+        break;
+      }
+    }
+  }
+}
+
+/* -------------------------------------------------------------------------
+ * x86-64 JIT compiler
+ * ------------------------------------------------------------------------- */
+
+namespace {
+
+enum X86Reg : uint8_t {
+  RAX = 0,
+  RCX,
+  RDX,
+  RBX,
+  RSP,
+  RBP,
+  RSI,
+  RDI,
+  R8,
+  R9,
+  R10,
+  R11,
+  R12,
+  R13,
+  R14,
+  R15,
+};
+
+enum X86Cond : uint8_t {
+  kCondB = 0x2,
+  kCondAE = 0x3,
+  kCondE = 0x4,
+  kCondNE = 0x5,
+  kCondBE = 0x6,
+  kCondA = 0x7,
+  kCondL = 0xc,
+  kCondGE = 0xd,
+  kCondLE = 0xe,
+  kCondG = 0xf,
+};
+
+// As in Linux: R1-R5 are in the argument registers, so that helpers get them
+// as they are, and R6-R9 in callee-saved ones. R10 is the frame pointer.
+const X86Reg kRegMap[kNumRegs] = {RAX, RDI, RSI, RDX, RCX, R8,
+                                  RBX, R13, R14, R15, RBP};
+
+// Holds the packet pointer
+const X86Reg kPktReg = R12;
+
+// Scratch registers, free to use within the code of any instruction
+const X86Reg kTmp1 = R10;
+const X86Reg kTmp2 = R11;
+
+// Below the eBPF stack, relative to RBP: the saved callee-saved registers
+// (RBX, R12-R15), then the arguments, and a scratch slot.
+const int32_t kSavedRegsOff = -kStackSize - 8;
+const int32_t kCtxOff = kSavedRegsOff - 5 * 8;
+const int32_t kLenOff = kCtxOff - 8;
+const int32_t kScratchOff = kLenOff - 8;
+
+const X86Reg kCalleeSaved[] = {RBX, R12, R13, R14, R15};
+
+// Special jump targets, in addition to instruction indices
+const int64_t kAbortLabel = -1;
+const int64_t kEpilogueLabel = -2;
+
+class Assembler {
+ public:
+  struct Fixup {
+    size_t pos;  // of the rel32 to patch
+    int64_t target;
+  };
+
+  std::vector<uint8_t> &code() { return code_; }
+  std::vector<Fixup> &fixups() { return fixups_; }
+
+  size_t pos() const { return code_.size(); }
+
+  void Emit(uint8_t b) { code_.push_back(b); }
+
+  void Emit16(uint16_t v) {
+    Emit(v);
+    Emit(v >> 8);
+  }
+
+  void Emit32(uint32_t v) {
+    Emit16(v);
+    Emit16(v >> 16);
+  }
+
+  void Emit64(uint64_t v) {
+    Emit32(v);
+    Emit32(v >> 32);
+  }
+
+  // Omitted if not needed, unless 'force'd to address SIL, DIL, etc.
+  void Rex(bool w, int reg, int rm, bool force = false) {
+    uint8_t rex = 0x40 | (w << 3) | ((reg & 8) >> 1) | ((rm & 8) >> 3);
+    if (rex != 0x40 || force) {
+      Emit(rex);
+    }
+  }
+
+  void ModRmReg(int reg, int rm) { Emit(0xc0 | ((reg & 7) << 3) | (rm & 7)); }
+
+  // [base + disp32]
+  void ModRmMem(int reg, int base, int32_t disp) {
+    Emit(0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) {
+      Emit(0x24);  // SIB without index, needed for RSP and R12
+    }
+    Emit32(disp);
+  }
+
+  // <opcode> rm, reg. e.g., 0x01 (add), 0x39 (cmp), 0x89 (mov)
+  void OpRR(uint8_t opcode, bool w, int rm, int reg) {
+    Rex(w, reg, rm);
+    Emit(opcode);
+    ModRmReg(reg, rm);
+  }
+
+  // Group 1 operation with an immediate. 'ext' is 0 (add), 1 (or), 4 (and),
+  // 5 (sub), 6 (xor), or 7 (cmp).
+  void OpRI(uint8_t ext, bool w, int rm, int32_t imm) {
+    Rex(w, 0, rm);
+    if (imm == static_cast<int8_t>(imm)) {
+      Emit(0x83);
+      ModRmReg(ext, rm);
+      Emit(imm);
+    } else {
+      Emit(0x81);
+      ModRmReg(ext, rm);
+      Emit32(imm);
+    }
+  }
+
+  // Group 2 (shift) or group 3 (not, neg, mul, div) operation
+  void OpR(uint8_t opcode, uint8_t ext, bool w, int rm) {
+    Rex(w, 0, rm);
+    Emit(opcode);
+    ModRmReg(ext, rm);
+  }
+
+  void MovRR(bool w, int dst, int src) { OpRR(0x89, w, dst, src); }
+
+  // Sign-extended if 'w', zero-extended otherwise
+  void MovRI(bool w, int dst, int32_t imm) {
+    if (w) {
+      OpR(0xc7, 0, true, dst);
+    } else {
+      Rex(false, 0, dst);
+      Emit(0xb8 + (dst & 7));
+    }
+    Emit32(imm);
+  }
+
+  void MovRI64(int dst, uint64_t imm) {
+    Rex(true, 0, dst);
+    Emit(0xb8 + (dst & 7));
+    Emit64(imm);
+  }
+
+  void Xor32(int reg) { OpRR(0x31, false, reg, reg); }
+
+  // 64-bit accesses to [base + disp]
+  void Load64(int dst, int base, int32_t disp) {
+    Rex(true, dst, base);
+    Emit(0x8b);
+    ModRmMem(dst, base, disp);
+  }
+
+  void Store64(int base, int32_t disp, int src) {
+    Rex(true, src, base);
+    Emit(0x89);
+    ModRmMem(src, base, disp);
+  }
+
+  void Cmp64(int reg, int base, int32_t disp) {
+    Rex(true, reg, base);
+    Emit(0x3b);
+    ModRmMem(reg, base, disp);
+  }
+
+  void Lea(int dst, int base, int32_t disp) {
+    Rex(true, dst, base);
+    Emit(0x8d);
+    ModRmMem(dst, base, disp);
+  }
+
+  // Zero-extending load of an eBPF access 'size'
+  void LoadMem(uint8_t size, int dst, int base, int32_t disp) {
+    Rex(size == kDw, dst, base);
+    switch (size) {
+      case kB:
+        Emit(0x0f);
+        Emit(0xb6);
+        break;
+      case kH:
+        Emit(0x0f);
+        Emit(0xb7);
+        break;
+      default:
+        Emit(0x8b);
+    }
+    ModRmMem(dst, base, disp);
+  }
+
+  void StoreMem(uint8_t size, int base, int32_t disp, int src) {
+    if (size == kH) {
+      Emit(0x66);
+    }
+    Rex(size == kDw, src, base, size == kB);
+    Emit(size == kB ? 0x88 : 0x89);
+    ModRmMem(src, base, disp);
+  }
+
+  void StoreImm(uint8_t size, int base, int32_t disp, int32_t imm) {
+    if (size == kH) {
+      Emit(0x66);
+    }
+    Rex(size == kDw, 0, base);
+    Emit(size == kB ? 0xc6 : 0xc7);
+    ModRmMem(0, base, disp);
+    switch (size) {
+      case kB:
+        Emit(imm);
+        break;
+      case kH:
+        Emit16(imm);
+        break;
+      default:
+        Emit32(imm);
+    }
+  }
+
+  void Push(int reg) {
+    Rex(false, 0, reg);
+    Emit(0x50 + (reg & 7));
+  }
+
+  // Short jumps, for use within the code of an instruction. Returns the
+  // position to Patch8().
+  size_t Jmp8() {
+    Emit(0xeb);
+    Emit(0);
+    return pos() - 1;
+  }
+
+  size_t Jcc8(uint8_t cond) {
+    Emit(0x70 | cond);
+    Emit(0);
+    return pos() - 1;
+  }
+
+  void Patch8(size_t at) { code_[at] = pos() - (at + 1); }
+
+  void Jmp(int64_t target) {
+    Emit(0xe9);
+    AddFixup(target);
+  }
+
+  void Jcc(uint8_t cond, int64_t target) {
+    Emit(0x0f);
+    Emit(0x80 | cond);
+    AddFixup(target);
+  }
+
+ private:
+  void AddFixup(int64_t target) {
+    fixups_.push_back({pos(), target});
+    Emit32(0);
+  }
+
+  std::vector<uint8_t> code_;
+  std::vector<Fixup> fixups_;
+};
+
+}  // namespace (unnamed)
+
+static void emit_prologue(Assembler *a) {
+  a->Push(RBP);
+  a->MovRR(true, RBP, RSP);
+  a->OpRI(5, true, RSP, kStackSize);  // sub rsp, kStackSize
+  for (X86Reg r : kCalleeSaved) {
+    a->Push(r);
+  }
+
+  // 'len' is 32 bits; the upper half of RSI is undefined
+  a->MovRR(false, RSI, RSI);
+  a->Push(RDX);                // ctx
+  a->Push(RSI);                // len
+  a->OpRI(5, true, RSP, 8);    // scratch, also keeps RSP 16-byte aligned
+  a->MovRR(true, kPktReg, RDI);
+
+  // R1 (packet) and R2 (length) are already in place, R10 is RBP
+  for (int i = 0; i < kNumRegs; i++) {
+    if (i != 1 && i != 2 && i != kFramePointer) {
+      a->Xor32(kRegMap[i]);
+    }
+  }
+}
+
+static void emit_epilogue(Assembler *a) {
+  int32_t off = kSavedRegsOff;
+
+  for (X86Reg r : kCalleeSaved) {
+    a->Load64(r, RBP, off);
+    off -= 8;
+  }
+  a->Emit(0xc9);  // leave
+  a->Emit(0xc3);  // ret
+}
+
+// Leaves base + off in kTmp1, after checking that 'size' bytes from there are
+// all in the packet or the stack. Must agree with check_access() above.
+static void emit_checked_addr(Assembler *a, int base, int16_t off,
+                              uint8_t size) {
+  int n = access_size(size);
+
+  a->Lea(kTmp1, base, off);
+  a->MovRR(true, kTmp2, kTmp1);
+  a->OpRR(0x29, true, kTmp2, kPktReg);  // sub: offset in the packet
+  a->Cmp64(kTmp2, RBP, kLenOff);
+  size_t not_pkt = a->Jcc8(kCondAE);
+  a->OpRI(0, true, kTmp2, n);
+  a->Cmp64(kTmp2, RBP, kLenOff);
+  size_t ok = a->Jcc8(kCondBE);
+
+  a->Patch8(not_pkt);
+  a->MovRR(true, kTmp2, kTmp1);
+  a->OpRR(0x29, true, kTmp2, RBP);  // sub: offset in the stack
+  a->OpRI(0, true, kTmp2, kStackSize);
+  a->OpRI(7, true, kTmp2, kStackSize - n);
+  a->Jcc(kCondA, kAbortLabel);
+
+  a->Patch8(ok);
+}
+
+static void emit_div(Assembler *a, const Insn &ins, bool w) {
+  X86Reg d = kRegMap[ins.dst];
+  bool is_mod = insn_op(ins) == kMod;
+  size_t done = 0;
+
+  if (insn_source(ins) == kX) {
+    a->MovRR(w, kTmp2, kRegMap[ins.src]);
+    a->OpRR(0x85, w, kTmp2, kTmp2);  // test
+    size_t nonzero = a->Jcc8(kCondNE);
+    if (!is_mod) {
+      a->Xor32(d);
+    } else if (!w) {
+      a->MovRR(false, d, d);
+    }
+    done = a->Jmp8();
+    a->Patch8(nonzero);
+  } else {
+    a->MovRI(w, kTmp2, ins.imm);
+  }
+
+  // DIV takes RDX:RAX, so save them
+  a->Store64(RBP, kScratchOff, RDX);
+  a->MovRR(true, kTmp1, RAX);
+  a->MovRR(true, RAX, d);
+  a->Xor32(RDX);
+  a->OpR(0xf7, 6, w, kTmp2);  // div
+  a->MovRR(true, kTmp2, is_mod ? RDX : RAX);
+  a->MovRR(true, RAX, kTmp1);
+  a->Load64(RDX, RBP, kScratchOff);
+  a->MovRR(true, d, kTmp2);
+
+  if (insn_source(ins) == kX) {
+    a->Patch8(done);
+  }
+}
+
+static void emit_shift(Assembler *a, const Insn &ins, bool w) {
+  X86Reg d = kRegMap[ins.dst];
+  uint8_t ext;
+
+  switch (insn_op(ins)) {
+    case kLsh:
+      ext = 4;
+      break;
+    case kRsh:
+      ext = 5;
+      break;
+    default:  // kArsh
+      ext = 7;
+  }
+
+  if (insn_source(ins) == kK) {
+    a->OpR(0xc1, ext, w, d);
+    a->Emit(ins.imm);
+    return;
+  }
+
+  // The count must be in CL, so save RCX (R4), or shift its saved copy if it
+  // is the destination.
+  X86Reg target = (d == RCX) ? kTmp1 : d;
+  a->MovRR(true, kTmp1, RCX);
+  a->MovRR(true, RCX, kRegMap[ins.src]);
+  a->OpR(0xd3, ext, w, target);
+  a->MovRR(true, RCX, kTmp1);
+}
+
+static void emit_byte_swap(Assembler *a, const Insn &ins) {
+  X86Reg d = kRegMap[ins.dst];
+
+  if (insn_source(ins) == kX && ins.imm != 16) {
+    a->Rex(ins.imm == 64, 0, d);
+    a->Emit(0x0f);
+    a->Emit(0xc8 + (d & 7));  // bswap
+    return;
+  }
+
+  if (insn_source(ins) == kX) {
+    a->Emit(0x66);
+    a->OpR(0xc1, 0, false, d);  // rol r16, 8
+    a->Emit(8);
+  }
+
+  switch (ins.imm) {
+    case 16:
+      a->Rex(false, d, d);
+      a->Emit(0x0f);
+      a->Emit(0xb7);  // movzx r32, r16
+      a->ModRmReg(d, d);
+      break;
+    case 32:
+      a->MovRR(false, d, d);
+      break;
+  }
+}
+
+static void emit_alu(Assembler *a, const Insn &ins) {
+  bool w = insn_class(ins) == kAlu64;
+  bool is_imm = insn_source(ins) == kK;
+  X86Reg d = kRegMap[ins.dst];
+  X86Reg s = kRegMap[ins.src];
+
+  // 'op r/m, reg' opcode and group 1 extension for the immediate form
+  uint8_t opcode;
+  uint8_t ext;
+
+  switch (insn_op(ins)) {
+    case kAdd:
+      opcode = 0x01;
+      ext = 0;
+      break;
+    case kSub:
+      opcode = 0x29;
+      ext = 5;
+      break;
+    case kOr:
+      opcode = 0x09;
+      ext = 1;
+      break;
+    case kAnd:
+      opcode = 0x21;
+      ext = 4;
+      break;
+    case kXor:
+      opcode = 0x31;
+      ext = 6;
+      break;
+
+    case kMov:
+      if (is_imm) {
+        a->MovRI(w, d, ins.imm);
+      } else {
+        a->MovRR(w, d, s);
+      }
+      return;
+
+    case kMul:
+      if (is_imm) {
+        a->Rex(w, d, d);
+        a->Emit(0x69);  // imul r, r/m, imm32
+        a->ModRmReg(d, d);
+        a->Emit32(ins.imm);
+      } else {
+        a->Rex(w, d, s);
+        a->Emit(0x0f);
+        a->Emit(0xaf);  // imul r, r/m
+        a->ModRmReg(d, s);
+      }
+      return;
+
+    case kNeg:
+      a->OpR(0xf7, 3, w, d);
+      return;
+
+    case kDiv:
+    case kMod:
+      emit_div(a, ins, w);
+      return;
+
+    case kLsh:
+    case kRsh:
+    case kArsh:
+      emit_shift(a, ins, w);
+      return;
+
+    default:  // kEnd
+      emit_byte_swap(a, ins);
+      return;
+  }
+
+  if (is_imm) {
+    a->OpRI(ext, w, d, ins.imm);
+  } else {
+    a->OpRR(opcode, w, d, s);
+  }
+}
+
+static void emit_call(Assembler *a, Helper helper) {
+  a->Load64(R9, RBP, kCtxOff);
+  a->MovRI64(kTmp2, reinterpret_cast<uintptr_t>(helper));
+  a->OpR(0xff, 2, false, kTmp2);  // call r11
+
+  // As the interpreter does. They are garbage anyway.
+  for (int i = 1; i <= 5; i++) {
+    a->Xor32(kRegMap[i]);
+  }
+}
+
+static void emit_jmp(Assembler *a, const Insn &ins, size_t pc) {
+  bool w = insn_class(ins) == kJmp;
+  X86Reg d = kRegMap[ins.dst];
+  int64_t target = pc + 1 + ins.off;
+  uint8_t op = insn_op(ins);
+  uint8_t cond;
+
+  if (op == kJa) {
+    a->Jmp(target);
+    return;
+  }
+
+  if (op == kJset) {
+    if (insn_source(ins) == kK) {
+      a->OpR(0xf7, 0, w, d);  // test r/m, imm32
+      a->Emit32(ins.imm);
+    } else {
+      a->OpRR(0x85, w, d, kRegMap[ins.src]);
+    }
+  } else {
+    if (insn_source(ins) == kK) {
+      a->OpRI(7, w, d, ins.imm);
+    } else {
+      a->OpRR(0x39, w, d, kRegMap[ins.src]);
+    }
+  }
+
+  switch (op) {
+    case kJeq:
+      cond = kCondE;
+      break;
+    case kJset:
+    case kJne:
+      cond = kCondNE;
+      break;
+    case kJgt:
+      cond = kCondA;
+      break;
+    case kJge:
+      cond = kCondAE;
+      break;
+    case kJlt:
+      cond = kCondB;
+      break;
+    case kJle:
+      cond = kCondBE;
+      break;
+    case kJsgt:
+      cond = kCondG;
+      break;
+    case kJsge:
+      cond = kCondGE;
+      break;
+    case kJslt:
+      cond = kCondL;
+      break;
+    default:  // kJsle
+      cond = kCondLE;
+  }
+
+  a->Jcc(cond, target);
+}
+
+bool Program::Jit() {
+  const size_t n = insns_.size();
+  std::vector<size_t> addrs(n);
+  Assembler a;
+
+  if (jit_func_) {
+    return true;
+  }
+
+  emit_prologue(&a);
+
+  for (size_t pc = 0; pc < n; pc++) {
+    const Insn &ins = insns_[pc];
+    X86Reg d = kRegMap[ins.dst];
+    X86Reg s = kRegMap[ins.src];
+    uint8_t size = insn_size(ins);
+
+    addrs[pc] = a.pos();
+
+    switch (insn_class(ins)) {
+      case kAlu:
+      case kAlu64:
+        emit_alu(&a, ins);
+        break;
+
+      case kLd:
+        a.MovRI64(d, static_cast<uint32_t>(ins.imm) |
+                         static_cast<uint64_t>(insns_[pc + 1].imm) << 32);
+        addrs[++pc] = a.pos();
+        break;
+
+      case kLdx:
+        if (ins.src == kFramePointer) {
+          a.LoadMem(size, d, RBP, ins.off);
+        } else {
+          emit_checked_addr(&a, s, ins.off, size);
+          a.LoadMem(size, d, kTmp1, 0);
+        }
+        break;
+
+      case kSt:
+      case kStx: {
+        int base = d;
+        int32_t disp = ins.off;
+
+        if (ins.dst != kFramePointer) {
+          emit_checked_addr(&a, d, ins.off, size);
+          base = kTmp1;
+          disp = 0;
+        }
+
+        if (insn_class(ins) == kSt) {
+          a.StoreImm(size, base, disp, ins.imm);
+        } else {
+          a.StoreMem(size, base, disp, s);
+        }
+        break;
+      }
+
+      default:  // kJmp, kJmp32
+        if (insn_op(ins) == kCall) {
+          emit_call(&a, helpers_[ins.imm]);
+        } else if (insn_op(ins) == kExit) {
+          // The last one falls through to the epilogue
+          if (pc + 1 < n) {
+            a.Jmp(kEpilogueLabel);
+          }
+        } else {
+          emit_jmp(&a, ins, pc);
+        }
+    }
+  }
+
+  size_t epilogue = a.pos();
+  emit_epilogue(&a);
+
+  size_t abort = a.pos();
+  a.MovRI(true, RAX, -1);  // kAbort
+  a.Jmp(kEpilogueLabel);
+
+  std::vector<uint8_t> &code = a.code();
+
+  for (const Assembler::Fixup &f : a.fixups()) {
+    size_t target;
+
+    if (f.target == kAbortLabel) {
+      target = abort;
+    } else if (f.target == kEpilogueLabel) {
+      target = epilogue;
+    } else {
+      target = addrs[f.target];
+    }
+
+    int32_t rel = static_cast<int64_t>(target) - (f.pos + 4);
+    memcpy(&code[f.pos], &rel, sizeof(rel));
+  }
+
+  void *mem = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    return false;
+  }
+
+  memcpy(mem, code.data(), code.size());
+  if (mprotect(mem, code.size(), PROT_READ | PROT_EXEC) != 0) {
+    munmap(mem, code.size());
+    return false;
+  }
+
+  jit_func_ = reinterpret_cast<JitFunc>(mem);
+  jit_size_ = code.size();
+  return true;
+}
+
+}  // namespace ebpf
+}  // namespace utils
+}  // namespace bess
@@ -0,0 +1,157 @@
+#ifndef BESS_UTILS_EBPF_H_
+#define BESS_UTILS_EBPF_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// An interpreter and an x86-64 JIT compiler for eBPF programs.
+//
+// Programs run against a packet buffer: on entry R1 points to the packet and
+// R2 holds its length, R10 is the (read-only) frame pointer of a kStackSize
+// byte stack, and all other registers are zero. The value of R0 is returned
+// on EXIT.
+//
+// Unlike the Linux verifier, Program::Load() does not track pointers through
+// registers. Instead, it accepts only forward jumps (so programs always
+// terminate) and memory accesses not relative to R10 are bounds checked at
+// run time against the packet and the stack. A program aborts, returning
+// kAbort, on an out-of-bounds access.
+namespace bess {
+namespace utils {
+namespace ebpf {
+
+// Same layout as the Linux kernel's struct bpf_insn
+struct Insn {
+  uint8_t code;
+  uint8_t dst : 4;
+  uint8_t src : 4;
+  int16_t off;
+  int32_t imm;
+};
+
+static_assert(sizeof(Insn) == 8, "eBPF instructions must be 8 bytes");
+
+// Instruction classes
+enum Class : uint8_t {
+  kLd = 0x00,
+  kLdx = 0x01,
+  kSt = 0x02,
+  kStx = 0x03,
+  kAlu = 0x04,
+  kJmp = 0x05,
+  kJmp32 = 0x06,
+  kAlu64 = 0x07,
+};
+
+// Memory access sizes and modes
+enum Size : uint8_t {
+  kW = 0x00,
+  kH = 0x08,
+  kB = 0x10,
+  kDw = 0x18,
+};
+
+enum Mode : uint8_t {
+  kImm = 0x00,
+  kMem = 0x60,
+};
+
+// Operand sources. For kEnd, kK means to little endian and kX to big endian.
+enum Source : uint8_t {
+  kK = 0x00,
+  kX = 0x08,
+};
+
+enum AluOp : uint8_t {
+  kAdd = 0x00,
+  kSub = 0x10,
+  kMul = 0x20,
+  kDiv = 0x30,
+  kOr = 0x40,
+  kAnd = 0x50,
+  kLsh = 0x60,
+  kRsh = 0x70,
+  kNeg = 0x80,
+  kMod = 0x90,
+  kXor = 0xa0,
+  kMov = 0xb0,
+  kArsh = 0xc0,
+  kEnd = 0xd0,
+};
+
+enum JmpOp : uint8_t {
+  kJa = 0x00,
+  kJeq = 0x10,
+  kJgt = 0x20,
+  kJge = 0x30,
+  kJset = 0x40,
+  kJne = 0x50,
+  kJsgt = 0x60,
+  kJsge = 0x70,
+  kCall = 0x80,
+  kExit = 0x90,
+  kJlt = 0xa0,
+  kJle = 0xb0,
+  kJslt = 0xc0,
+  kJsle = 0xd0,
+};
+
+static const int kNumRegs = 11;
+static const int kFramePointer = 10;
+
+static const int kStackSize = 512;
+static const size_t kMaxInsns = 4096;
+
+// Called with R1-R5 and the 'ctx' given to Program::Run(). Its return value
+// is stored in R0, and R1-R5 are zeroed.
+typedef uint64_t (*Helper)(uint64_t r1, uint64_t r2, uint64_t r3, uint64_t r4,
+                           uint64_t r5, void *ctx);
+
+class Program {
+ public:
+  // Returned by programs that access memory out of bounds
+  static const uint64_t kAbort = UINT64_MAX;
+
+  Program() : insns_(), helpers_(), jit_func_(), jit_size_() {}
+  ~Program();
+
+  // Verifies 'insns' and keeps a copy of them. "call i" calls helpers[i].
+  // Returns false, with the reason in *err, if the program is invalid.
+  bool Load(const Insn *insns, size_t n, const std::vector<Helper> &helpers,
+            std::string *err);
+
+  // Compiles the program into native code, used by Run() from then on.
+  // Returns false if compilation failed; Run() keeps interpreting then.
+  bool Jit();
+
+  bool jitted() const { return jit_func_ != nullptr; }
+
+  uint64_t Run(uint8_t *pkt, uint32_t len, void *ctx) const {
+    if (jit_func_) {
+      return jit_func_(pkt, len, ctx);
+    }
+    return Interpret(pkt, len, ctx);
+  }
+
+  uint64_t Interpret(uint8_t *pkt, uint32_t len, void *ctx) const;
+
+ private:
+  typedef uint64_t (*JitFunc)(uint8_t *pkt, uint32_t len, void *ctx);
+
+  Program(const Program &) = delete;
+  Program &operator=(const Program &) = delete;
+
+  std::vector<Insn> insns_;
+  std::vector<Helper> helpers_;
+
+  JitFunc jit_func_;
+  size_t jit_size_;  // needed for munmap()
+};
+
+}  // namespace ebpf
+}  // namespace utils
+}  // namespace bess
+
+#endif  // BESS_UTILS_EBPF_H_
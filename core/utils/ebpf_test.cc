@@ -0,0 +1,285 @@
+#include "ebpf.h"
+
+#include <gtest/gtest.h>
+
+#include "random.h"
+
+using namespace bess::utils::ebpf;
+
+namespace {
+
+Insn MakeInsn(uint8_t code, int dst, int src, int16_t off, int32_t imm) {
+  Insn ins;
+  ins.code = code;
+  ins.dst = dst;
+  ins.src = src;
+  ins.off = off;
+  ins.imm = imm;
+  return ins;
+}
+
+Insn Alu64(uint8_t op, int dst, int32_t imm) {
+  return MakeInsn(kAlu64 | op | kK, dst, 0, 0, imm);
+}
+
+Insn Alu64Reg(uint8_t op, int dst, int src) {
+  return MakeInsn(kAlu64 | op | kX, dst, src, 0, 0);
+}
+
+Insn Ldx(uint8_t size, int dst, int src, int16_t off) {
+  return MakeInsn(kLdx | kMem | size, dst, src, off, 0);
+}
+
+Insn Stx(uint8_t size, int dst, int src, int16_t off) {
+  return MakeInsn(kStx | kMem | size, dst, src, off, 0);
+}
+
+Insn Jmp(uint8_t op, int dst, int32_t imm, int16_t off) {
+  return MakeInsn(kJmp | op | kK, dst, 0, off, imm);
+}
+
+Insn Call(int32_t helper) {
+  return MakeInsn(kJmp | kCall, 0, 0, 0, helper);
+}
+
+Insn Exit() {
+  return MakeInsn(kJmp | kExit, 0, 0, 0, 0);
+}
+
+uint64_t AddHelper(uint64_t r1, uint64_t r2, uint64_t r3, uint64_t r4,
+                   uint64_t r5, void *ctx) {
+  return r1 + r2 + r3 + r4 + r5 + *static_cast<uint64_t *>(ctx);
+}
+
+class EbpfTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    helpers_ = {AddHelper};
+    ctx_ = 0;
+    pkt_.resize(64);
+    for (size_t i = 0; i < pkt_.size(); i++) {
+      pkt_[i] = i;
+    }
+  }
+
+  // Runs 'prog' both interpreted and compiled, each on its own copy of pkt_,
+  // and expects the same results.
+  uint64_t Run(const std::vector<Insn> &prog) {
+    Program p;
+    std::string err;
+
+    EXPECT_TRUE(p.Load(prog.data(), prog.size(), helpers_, &err)) << err;
+
+    std::vector<uint8_t> pkt = pkt_;
+    uint64_t ret = p.Interpret(pkt.data(), pkt.size(), &ctx_);
+
+    std::vector<uint8_t> jit_pkt = pkt_;
+    EXPECT_TRUE(p.Jit());
+    EXPECT_EQ(ret, p.Run(jit_pkt.data(), jit_pkt.size(), &ctx_));
+    EXPECT_EQ(pkt, jit_pkt);
+
+    return ret;
+  }
+
+  std::string LoadError(const std::vector<Insn> &prog) {
+    Program p;
+    std::string err;
+
+    EXPECT_FALSE(p.Load(prog.data(), prog.size(), helpers_, &err));
+    return err;
+  }
+
+  std::vector<Helper> helpers_;
+  uint64_t ctx_;
+  std::vector<uint8_t> pkt_;
+};
+
+TEST_F(EbpfTest, Verifier) {
+  EXPECT_NE("", LoadError({}));
+  EXPECT_NE("", LoadError({Alu64(kMov, 0, 1)}));  // falls off the end
+
+  // Backward jump
+  EXPECT_NE("", LoadError({Alu64(kMov, 0, 1), Jmp(kJeq, 0, 1, -2), Exit()}));
+
+  // Out of range, and into the second half of a 64-bit immediate load
+  EXPECT_NE("", LoadError({Jmp(kJa, 0, 0, 1), Exit()}));
+  EXPECT_NE("", LoadError({Jmp(kJa, 0, 0, 1), MakeInsn(kLd | kDw, 0, 0, 0, 1),
+                           MakeInsn(0, 0, 0, 0, 0), Exit()}));
+
+  EXPECT_NE("", LoadError({Alu64(kDiv, 0, 0), Exit()}));
+  EXPECT_NE("", LoadError({Alu64(kLsh, 0, 64), Exit()}));
+  EXPECT_NE("", LoadError({Alu64(kMov, kFramePointer, 0), Exit()}));
+  EXPECT_NE("", LoadError({Alu64(kMov, 11, 0), Exit()}));
+  EXPECT_NE("", LoadError({Call(1), Exit()}));
+
+  // The stack is [R10 - kStackSize, R10)
+  EXPECT_NE("", LoadError({Ldx(kDw, 0, kFramePointer, -4), Exit()}));
+  EXPECT_NE("",
+            LoadError({Ldx(kB, 0, kFramePointer, -kStackSize - 1), Exit()}));
+}
+
+TEST_F(EbpfTest, Alu) {
+  EXPECT_EQ(42, Run({Alu64(kMov, 0, 40), Alu64(kAdd, 0, 2), Exit()}));
+
+  // Sign extension of immediates, and zero extension of 32-bit results
+  EXPECT_EQ(UINT64_MAX, Run({Alu64(kMov, 0, -1), Exit()}));
+  EXPECT_EQ(0xffffffffu, Run({MakeInsn(kAlu | kMov | kK, 0, 0, 0, -1),
+                              Exit()}));
+
+  // Division and modulo by zero
+  EXPECT_EQ(0, Run({Alu64(kMov, 0, 7), Alu64Reg(kDiv, 0, 3), Exit()}));
+  EXPECT_EQ(7, Run({Alu64(kMov, 0, 7), Alu64Reg(kMod, 0, 3), Exit()}));
+
+  EXPECT_EQ(0x0201, Run({Ldx(kH, 0, 1, 1), Exit()}));
+  EXPECT_EQ(0x0102, Run({Ldx(kH, 0, 1, 1),
+                         MakeInsn(kAlu | kEnd | kX, 0, 0, 0, 16), Exit()}));
+}
+
+// Random ALU operations, stack accesses and forward jumps, with all registers
+// folded into R0
+TEST_F(EbpfTest, Random) {
+  const uint8_t ops[] = {kAdd, kSub, kMul, kDiv, kOr,  kAnd, kLsh,
+                         kRsh, kNeg, kMod, kXor, kMov, kArsh, kEnd};
+  const uint8_t jmps[] = {kJeq, kJgt,  kJge,  kJset, kJne,  kJsgt,
+                          kJsge, kJlt, kJle, kJslt, kJsle};
+  const uint8_t sizes[] = {kB, kH, kW, kDw};
+  const int bytes[] = {1, 2, 4, 8};
+  const int kBody = 200;
+  Random rng(42);
+
+  for (int iter = 0; iter < 100; iter++) {
+    std::vector<Insn> prog;
+
+    // Stack contents are undefined on entry
+    for (int off = -kStackSize; off < 0; off += 8) {
+      prog.push_back(MakeInsn(kSt | kMem | kDw, kFramePointer, 0, off, 0));
+    }
+
+    for (int r = 0; r < kFramePointer; r++) {
+      prog.push_back(MakeInsn(kLd | kDw, r, 0, 0, rng.Get()));
+      prog.push_back(MakeInsn(0, 0, 0, 0, rng.GetRange(4) ? rng.Get() : 0));
+    }
+
+    for (int i = 0; i < kBody; i++) {
+      int dst = rng.GetRange(kFramePointer);
+      int src = rng.GetRange(kFramePointer);
+      int32_t imm = rng.GetRange(2) ? rng.Get() : rng.GetRange(8);
+      int remaining = kBody - i - 1;
+
+      if (rng.GetRange(8) == 0) {
+        uint8_t cls = rng.GetRange(2) ? kJmp : kJmp32;
+        uint8_t op = jmps[rng.GetRange(sizeof(jmps))];
+        uint8_t source = rng.GetRange(2) ? kX : kK;
+        int16_t off = rng.GetRange(std::min(remaining, 8) + 1);
+
+        prog.push_back(MakeInsn(cls | op | source, dst, src, off, imm));
+        continue;
+      }
+
+      if (rng.GetRange(8) == 0) {
+        int k = rng.GetRange(sizeof(sizes));
+        uint8_t size = sizes[k];
+        int16_t off = -bytes[k] - rng.GetRange(kStackSize - 7);
+
+        switch (rng.GetRange(3)) {
+          case 0:
+            prog.push_back(Ldx(size, dst, kFramePointer, off));
+            break;
+          case 1:
+            prog.push_back(Stx(size, kFramePointer, src, off));
+            break;
+          default:
+            prog.push_back(
+                MakeInsn(kSt | kMem | size, kFramePointer, 0, off, imm));
+        }
+        continue;
+      }
+
+      uint8_t cls = rng.GetRange(2) ? kAlu64 : kAlu;
+      uint8_t op = ops[rng.GetRange(sizeof(ops))];
+      uint8_t source = rng.GetRange(2) ? kX : kK;
+
+      switch (op) {
+        case kDiv:
+        case kMod:
+          imm = imm ? imm : 1;
+          break;
+        case kLsh:
+        case kRsh:
+        case kArsh:
+          imm = rng.GetRange(cls == kAlu64 ? 64 : 32);
+          break;
+        case kNeg:
+          source = kK;
+          break;
+        case kEnd:
+          cls = kAlu;
+          imm = 16 << rng.GetRange(3);
+          break;
+      }
+
+      prog.push_back(MakeInsn(cls | op | source, dst, src, 0, imm));
+    }
+
+    for (int r = 1; r < kFramePointer; r++) {
+      prog.push_back(Alu64(kLsh, 0, 1));
+      prog.push_back(Alu64Reg(kXor, 0, r));
+    }
+    prog.push_back(Exit());
+
+    Run(prog);
+  }
+}
+
+TEST_F(EbpfTest, Memory) {
+  // Loads of all sizes
+  EXPECT_EQ(0x3f, Run({Ldx(kB, 0, 1, 63), Exit()}));
+  EXPECT_EQ(0x07060504, Run({Ldx(kW, 0, 1, 4), Exit()}));
+  EXPECT_EQ(0x0f0e0d0c0b0a0908, Run({Ldx(kDw, 0, 1, 8), Exit()}));
+
+  // Stores to the packet
+  EXPECT_EQ(0, Run({Alu64(kMov, 3, 0x1234), Stx(kH, 1, 3, 10),
+                    MakeInsn(kSt | kMem | kB, 1, 0, 20, -1),
+                    Alu64(kMov, 0, 0), Exit()}));
+
+  // The stack, directly and through another register
+  EXPECT_EQ(0x0f0e0d0c0b0a0908,
+            Run({Ldx(kDw, 3, 1, 8), Alu64Reg(kMov, 4, kFramePointer),
+                 Alu64(kAdd, 4, -16), Stx(kDw, 4, 3, 0),
+                 Ldx(kDw, 0, kFramePointer, -16), Exit()}));
+  EXPECT_EQ(0, Run({Alu64Reg(kMov, 4, kFramePointer),
+                    MakeInsn(kSt | kMem | kW, 4, 0, -4, 0),
+                    Ldx(kW, 0, 4, -4), Exit()}));
+}
+
+TEST_F(EbpfTest, OutOfBounds) {
+  // Past the end, before the beginning, straddling the end
+  EXPECT_EQ(Program::kAbort, Run({Ldx(kB, 0, 1, 64), Exit()}));
+  EXPECT_EQ(Program::kAbort, Run({Ldx(kB, 0, 1, -1), Exit()}));
+  EXPECT_EQ(Program::kAbort, Run({Ldx(kDw, 0, 1, 60), Exit()}));
+  EXPECT_EQ(Program::kAbort,
+            Run({MakeInsn(kSt | kMem | kW, 1, 0, 62, 0), Exit()}));
+
+  // Straddling the start of the packet, just above the stack, and null
+  EXPECT_EQ(Program::kAbort, Run({Ldx(kW, 0, 1, -2), Exit()}));
+  EXPECT_EQ(Program::kAbort,
+            Run({Alu64Reg(kMov, 4, kFramePointer), Ldx(kB, 0, 4, 0), Exit()}));
+  EXPECT_EQ(Program::kAbort, Run({Ldx(kB, 0, 3, 0), Exit()}));
+
+  // Packet length is checked at run time
+  EXPECT_EQ(Program::kAbort, Run({Alu64Reg(kAdd, 1, 2), Ldx(kB, 0, 1, 0),
+                                  Exit()}));
+}
+
+TEST_F(EbpfTest, Call) {
+  ctx_ = 1000;
+
+  EXPECT_EQ(1015, Run({Alu64(kMov, 1, 1), Alu64(kMov, 2, 2), Alu64(kMov, 3, 3),
+                       Alu64(kMov, 4, 4), Alu64(kMov, 5, 5), Call(0), Exit()}));
+
+  // Callee-saved registers survive calls, R1-R5 do not
+  EXPECT_EQ(6, Run({Alu64(kMov, 6, 6), Alu64(kMov, 1, 1), Call(0),
+                    Alu64Reg(kMov, 0, 6), Alu64Reg(kAdd, 0, 1), Exit()}));
+}
+
+}  // namespace (unnamed)
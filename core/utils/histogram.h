@@ -1,7 +1,9 @@
 #ifndef BESS_UTILS_HISTOGRAM_H_
 #define BESS_UTILS_HISTOGRAM_H_
 
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <cstring>
 #include <sstream>
 #include <string>
@@ -10,7 +12,7 @@
 static const std::vector<double> quartiles = {0.25f, 0.5f, 0.75f, 1.0f};
 
 // A general purpose histogram. A bin b_i is labeled by (i+1) * bucket_width_.
-// T must be an arithmetic type
+// T must be an arithmetic type. See LogHistogram for logarithmic bins.
 template <typename T>
 class Histogram {
  public:
@@ -143,7 +145,6 @@ class Histogram {
   }
 
  private:
-  // TODO(melvin): add support for logarithmic binning
   size_t *bucket(T x) { return buckets_ + (uintptr_t)(x / bucket_width_); }
 
   // Convert the histogram into a cummulative histogram. Called by min(), max(),
@@ -179,4 +180,124 @@ class Histogram {
   size_t max_bucket_;
 };
 
+// A log-linear histogram of unsigned integers, in the style of HdrHistogram.
+// Values below 2^precision are counted exactly. Above, each power of 2 is
+// split into 2^precision buckets, so that percentiles are off by at most
+// 2^-(precision + 1) of their value (0.4% with the default precision).
+//
+// Unlike Histogram, it covers the whole 64-bit range in a few tens of KB,
+// insert() is O(1), queries leave it untouched, and histograms of the same
+// precision can be merged, e.g. those of several workers.
+class LogHistogram {
+ public:
+  static const int kDefaultPrecision = 7;
+
+  // 'precision' should be in [1, 20]. Memory use doubles with each bit.
+  explicit LogHistogram(int precision = kDefaultPrecision)
+      : precision_(precision),
+        buckets_(static_cast<size_t>(65 - precision) << precision),
+        count_(),
+        total_(),
+        min_(),
+        max_() {
+    reset();
+  }
+
+  void insert(uint64_t x) {
+    buckets_[index(x)]++;
+    count_++;
+    total_ += x;
+    min_ = std::min(min_, x);
+    max_ = std::max(max_, x);
+  }
+
+  // Adds the values of another histogram to this one. Returns false, leaving
+  // this one untouched, if their precisions differ.
+  bool merge(const LogHistogram &other) {
+    if (other.precision_ != precision_) {
+      return false;
+    }
+    for (size_t i = 0; i < buckets_.size(); i++) {
+      buckets_[i] += other.buckets_[i];
+    }
+    count_ += other.count_;
+    total_ += other.total_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+    return true;
+  }
+
+  uint64_t count() const { return count_; }
+  uint64_t total() const { return total_; }
+
+  // The exact smallest and largest values, or 0 if empty
+  uint64_t min() const { return count_ ? min_ : 0; }
+  uint64_t max() const { return max_; }
+
+  uint64_t avg() const { return count_ ? total_ / count_ : 0; }
+
+  // Returns the smallest value that at least p % of the values are less than
+  // or equal to, within the precision of the histogram. p should be in
+  // [0, 100].
+  uint64_t percentile(double p) const {
+    if (!count_) {
+      return 0;
+    }
+
+    uint64_t rank = std::ceil(p / 100.0 * count_);
+    rank = std::max<uint64_t>(rank, 1);
+    if (rank >= count_) {
+      return max_;
+    }
+
+    uint64_t seen = 0;
+    size_t i = 0;
+    for (; i < buckets_.size() - 1; i++) {
+      seen += buckets_[i];
+      if (seen >= rank) {
+        break;
+      }
+    }
+    return std::min(std::max(value(i), min_), max_);
+  }
+
+  int precision() const { return precision_; }
+
+  void reset() {
+    std::fill(buckets_.begin(), buckets_.end(), 0);
+    count_ = 0;
+    total_ = 0;
+    min_ = UINT64_MAX;
+    max_ = 0;
+  }
+
+ private:
+  size_t index(uint64_t x) const {
+    if (x < (1ull << precision_)) {
+      return x;
+    }
+    int shift = 63 - __builtin_clzll(x) - precision_;
+    return (static_cast<size_t>(shift + 1) << precision_) +
+           (x >> shift) - (1ull << precision_);
+  }
+
+  // The middle of bucket i
+  uint64_t value(size_t i) const {
+    if (i < (1ull << precision_)) {
+      return i;
+    }
+    int shift = (i >> precision_) - 1;
+    uint64_t low = ((1ull << precision_) + (i & ((1ull << precision_) - 1)))
+                   << shift;
+    return low + ((1ull << shift) - 1) / 2;
+  }
+
+  int precision_;
+  std::vector<uint64_t> buckets_;
+  uint64_t count_;
+  uint64_t total_;
+  uint64_t min_;
+  uint64_t max_;
+};
+
 #endif  // BESS_UTILS_HISTOGRAM_H_
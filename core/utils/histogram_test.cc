@@ -2,6 +2,9 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <random>
+
 namespace {
 
 TEST(HistogramTest, U32Quartiles) {
@@ -39,4 +42,89 @@ TEST(HistogramTest, DoubleQuartiles) {
   ASSERT_DOUBLE_EQ(3.0, hist.percentile(75));   // 75th percentile
   ASSERT_DOUBLE_EQ(5.0, hist.percentile(100));  // 100th percentile
 }
+
+TEST(LogHistogramTest, Empty) {
+  LogHistogram hist;
+  EXPECT_EQ(0, hist.count());
+  EXPECT_EQ(0, hist.min());
+  EXPECT_EQ(0, hist.max());
+  EXPECT_EQ(0, hist.avg());
+  EXPECT_EQ(0, hist.percentile(50));
+}
+
+TEST(LogHistogramTest, SmallValuesAreExact) {
+  LogHistogram hist;
+  for (uint64_t x = 1; x <= 100; x++) {
+    hist.insert(x);
+  }
+  EXPECT_EQ(100, hist.count());
+  EXPECT_EQ(5050, hist.total());
+  EXPECT_EQ(1, hist.min());
+  EXPECT_EQ(100, hist.max());
+  EXPECT_EQ(50, hist.avg());
+  EXPECT_EQ(1, hist.percentile(0));
+  EXPECT_EQ(25, hist.percentile(25));
+  EXPECT_EQ(50, hist.percentile(50));
+  EXPECT_EQ(99, hist.percentile(99));
+  EXPECT_EQ(100, hist.percentile(100));
+}
+
+TEST(LogHistogramTest, RelativeError) {
+  LogHistogram hist;
+  std::mt19937_64 rng(42);
+  std::vector<uint64_t> values;
+
+  for (int i = 0; i < 100000; i++) {
+    // Spread over many orders of magnitude
+    uint64_t x = rng() >> (rng() % 60);
+    values.push_back(x);
+    hist.insert(x);
+  }
+  std::sort(values.begin(), values.end());
+
+  EXPECT_EQ(values.front(), hist.min());
+  EXPECT_EQ(values.back(), hist.max());
+  for (double p : {1.0, 10.0, 50.0, 90.0, 99.0, 99.9, 99.99}) {
+    uint64_t exact = values[std::ceil(p / 100 * values.size()) - 1];
+    double error = std::fabs(static_cast<double>(hist.percentile(p)) - exact);
+    EXPECT_LE(error, exact / 256.0) << "p" << p;
+  }
+}
+
+TEST(LogHistogramTest, Merge) {
+  LogHistogram a;
+  LogHistogram b;
+  LogHistogram all;
+
+  for (uint64_t x = 0; x < 100000; x += 7) {
+    (x % 2 ? a : b).insert(x * 1000);
+    all.insert(x * 1000);
+  }
+  ASSERT_TRUE(a.merge(b));
+  EXPECT_EQ(all.count(), a.count());
+  EXPECT_EQ(all.total(), a.total());
+  EXPECT_EQ(all.min(), a.min());
+  EXPECT_EQ(all.max(), a.max());
+  for (double p : {0.0, 50.0, 99.0, 100.0}) {
+    EXPECT_EQ(all.percentile(p), a.percentile(p));
+  }
+
+  LogHistogram other(3);
+  other.insert(1);
+  EXPECT_FALSE(a.merge(other));
+  EXPECT_EQ(all.count(), a.count());
+}
+
+TEST(LogHistogramTest, Reset) {
+  LogHistogram hist(4);
+  hist.insert(UINT64_MAX);
+  hist.insert(12345);
+  EXPECT_EQ(UINT64_MAX, hist.max());
+  EXPECT_EQ(UINT64_MAX, hist.percentile(100));
+  hist.reset();
+  EXPECT_EQ(0, hist.count());
+  hist.insert(7);
+  EXPECT_EQ(7, hist.min());
+  EXPECT_EQ(7, hist.percentile(50));
+}
 }
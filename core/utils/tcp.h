@@ -13,6 +13,8 @@ struct[[gnu::packed]] Tcp {
     kPsh = 0x08,
     kAck = 0x10,
     kUrg = 0x20,
+    kEce = 0x40,
+    kCwr = 0x80,
   };
 
   be16_t src_port;  // Source port.
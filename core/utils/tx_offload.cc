@@ -0,0 +1,239 @@
+#include "tx_offload.h"
+
+#include "checksum.h"
+#include "copy.h"
+#include "ip.h"
+#include "tcp.h"
+#include "udp.h"
+
+namespace bess {
+namespace utils {
+
+namespace {
+
+const size_t kIpv6HeaderLen = 40;
+
+// Reduces a 64-bit one's complement sum to 32 bits
+uint32_t ReduceSum(uint64_t sum) {
+  while (sum >> 32) {
+    sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+  }
+
+  return static_cast<uint32_t>(sum);
+}
+
+// Returns the 32-bit one's complement sum of the packet data, from 'offset' to
+// the end of the packet, across all segments
+uint32_t CalculateSumFrom(const Packet *pkt, uint32_t offset) {
+  uint64_t sum = 0;
+  bool odd = false;
+
+  for (const Packet *seg = pkt; seg; seg = seg->next()) {
+    uint32_t seg_len = seg->head_len();
+
+    if (offset >= seg_len) {
+      offset -= seg_len;
+      continue;
+    }
+
+    uint32_t len = seg_len - offset;
+    uint32_t seg_sum = CalculateSum(seg->head_data<const char *>(offset), len);
+
+    // A segment starting at an odd offset has its bytes summed in the
+    // opposite lanes
+    if (odd) {
+      seg_sum = (seg_sum >> 16) + (seg_sum & 0xFFFF);
+      seg_sum = (seg_sum >> 16) + (seg_sum & 0xFFFF);
+      seg_sum = ((seg_sum & 0xFF) << 8) | (seg_sum >> 8);
+    }
+
+    sum += seg_sum;
+    odd ^= len & 1;
+    offset = 0;
+  }
+
+  return ReduceSum(sum);
+}
+
+// Copies 'len' bytes of the packet data at 'offset', across all segments
+void CopyFrom(const Packet *pkt, uint32_t offset, char *dst, uint32_t len) {
+  for (const Packet *seg = pkt; seg && len > 0; seg = seg->next()) {
+    uint32_t seg_len = seg->head_len();
+
+    if (offset >= seg_len) {
+      offset -= seg_len;
+      continue;
+    }
+
+    uint32_t n = std::min(len, seg_len - offset);
+
+    Copy(dst, seg->head_data<const char *>(offset), n);
+    dst += n;
+    len -= n;
+    offset = 0;
+  }
+}
+
+// Returns the one's complement sum of the pseudo header for TCP/UDP.
+// 'l3' points to the IPv4 or IPv6 header.
+uint32_t CalculatePseudoHeaderSum(const char *l3, bool ipv6, uint8_t proto,
+                                  uint32_t l4_len) {
+  uint64_t sum;
+
+  if (ipv6) {
+    sum = CalculateSum(l3 + 8, 32);  // source and destination addresses
+  } else {
+    sum = CalculateSum(l3 + 12, 8);
+  }
+
+  sum += be16_t::swap(static_cast<uint16_t>(l4_len));
+  sum += be16_t::swap(static_cast<uint16_t>(proto));
+
+  return ReduceSum(sum);
+}
+
+void SetIpv4Checksum(Ipv4 *ip, uint16_t l3_len) {
+  ip->checksum = 0;
+  ip->checksum = CalculateGenericChecksum(ip, l3_len);
+}
+
+}  // namespace
+
+bool CalculateTxChecksums(Packet *pkt) {
+  uint64_t flags = pkt->offload_flags();
+  uint32_t l4_off = pkt->l2_len() + pkt->l3_len();
+  uint32_t cksum_off;
+
+  if (flags & PKT_TX_IP_CKSUM) {
+    if (pkt->l3_len() < sizeof(Ipv4) ||
+        l4_off > static_cast<uint32_t>(pkt->head_len())) {
+      return false;
+    }
+
+    SetIpv4Checksum(pkt->head_data<Ipv4 *>(pkt->l2_len()), pkt->l3_len());
+  }
+
+  switch (flags & PKT_TX_L4_MASK) {
+    case PKT_TX_TCP_CKSUM:
+      cksum_off = l4_off + offsetof(Tcp, checksum);
+      break;
+
+    case PKT_TX_UDP_CKSUM:
+      cksum_off = l4_off + offsetof(Udp, checksum);
+      break;
+
+    default:
+      cksum_off = 0;
+  }
+
+  if (cksum_off) {
+    if (cksum_off + sizeof(uint16_t) > static_cast<uint32_t>(pkt->head_len())) {
+      return false;
+    }
+
+    // The field already has the pseudo header checksum, so just add the rest
+    uint16_t *cksum = pkt->head_data<uint16_t *>(cksum_off);
+    *cksum = FoldChecksum(CalculateSumFrom(pkt, l4_off));
+
+    if ((flags & PKT_TX_L4_MASK) == PKT_TX_UDP_CKSUM && *cksum == 0) {
+      *cksum = 0xFFFF;
+    }
+  }
+
+  pkt->set_offload_flags(flags & ~(PKT_TX_IP_CKSUM | PKT_TX_L4_MASK));
+  return true;
+}
+
+int CountTcpSegments(const Packet *pkt) {
+  uint32_t hdr_len = pkt->l2_len() + pkt->l3_len() + pkt->l4_len();
+  uint32_t mss = pkt->tso_segsz();
+  uint32_t payload;
+
+  if (mss == 0 || pkt->l4_len() < sizeof(Tcp) ||
+      hdr_len > static_cast<uint32_t>(pkt->head_len()) ||
+      hdr_len + mss > SNBUF_DATA) {
+    return 0;
+  }
+
+  if (pkt->offload_flags() & PKT_TX_IPV4) {
+    if (pkt->l3_len() < sizeof(Ipv4)) {
+      return 0;
+    }
+  } else if (pkt->offload_flags() & PKT_TX_IPV6) {
+    if (pkt->l3_len() < kIpv6HeaderLen) {
+      return 0;
+    }
+  } else {
+    return 0;
+  }
+
+  payload = pkt->total_len() - hdr_len;
+  if (payload == 0) {
+    return 1;
+  }
+
+  return (payload + mss - 1) / mss;
+}
+
+bool SegmentTcp(const Packet *pkt, int first, int cnt, Packet **segs) {
+  const bool ipv6 = pkt->offload_flags() & PKT_TX_IPV6;
+  const uint16_t l2_len = pkt->l2_len();
+  const uint16_t l3_len = pkt->l3_len();
+  const uint32_t hdr_len = l2_len + l3_len + pkt->l4_len();
+  const uint32_t mss = pkt->tso_segsz();
+  const uint32_t payload = pkt->total_len() - hdr_len;
+  const int last = payload ? (payload + mss - 1) / mss - 1 : 0;
+
+  const Tcp *orig_tcp = pkt->head_data<const Tcp *>(l2_len + l3_len);
+
+  if (Packet::Alloc(segs, cnt, 0) != static_cast<size_t>(cnt)) {
+    return false;
+  }
+
+  for (int i = 0; i < cnt; i++) {
+    Packet *seg = segs[i];
+    int idx = first + i;
+    uint32_t offset = idx * mss;
+    uint32_t seg_payload = std::min(mss, payload - offset);
+    uint32_t l4_len = pkt->l4_len() + seg_payload;
+    char *data = seg->head_data<char *>();
+
+    Copy(data, pkt->head_data<const char *>(), hdr_len);
+    CopyFrom(pkt, hdr_len + offset, data + hdr_len, seg_payload);
+
+    seg->set_data_len(hdr_len + seg_payload);
+    seg->set_total_len(hdr_len + seg_payload);
+
+    char *l3 = data + l2_len;
+    Tcp *tcp = reinterpret_cast<Tcp *>(l3 + l3_len);
+
+    if (ipv6) {
+      // Payload length, including extension headers
+      be16_t *ip6_plen = reinterpret_cast<be16_t *>(l3 + 4);
+      *ip6_plen = be16_t(l3_len - kIpv6HeaderLen + l4_len);
+    } else {
+      Ipv4 *ip = reinterpret_cast<Ipv4 *>(l3);
+      ip->length = be16_t(l3_len + l4_len);
+      ip->id = be16_t(ip->id.value() + idx);
+      SetIpv4Checksum(ip, l3_len);
+    }
+
+    tcp->seq_num = be32_t(orig_tcp->seq_num.value() + offset);
+    if (idx != last) {
+      tcp->flags &= ~(Tcp::kFin | Tcp::kPsh);
+    }
+    if (idx != 0) {
+      tcp->flags &= ~Tcp::kCwr;
+    }
+
+    tcp->checksum = 0;
+    tcp->checksum = FoldChecksum(
+        ReduceSum(static_cast<uint64_t>(CalculateSum(tcp, l4_len)) +
+                  CalculatePseudoHeaderSum(l3, ipv6, Ipv4::kTcp, l4_len)));
+  }
+
+  return true;
+}
+
+}  // namespace utils
+}  // namespace bess
@@ -0,0 +1,119 @@
+// Software fallback for TX offloads (L3/L4 checksums and TCP segmentation),
+// for packets leaving through a port that cannot do them in hardware
+
+#ifndef BESS_UTILS_TX_OFFLOAD_H_
+#define BESS_UTILS_TX_OFFLOAD_H_
+
+#include <algorithm>
+
+#include "../packet.h"
+#include "../pktbatch.h"
+
+namespace bess {
+namespace utils {
+
+// PKT_TX_* flags that ask the port to do some work for the packet.
+// As with DPDK, l2_len() and l3_len() (and l4_len() and tso_segsz() for TSO)
+// must be set, and the L4 checksum field must hold the checksum of the pseudo
+// header, which includes the L4 length unless PKT_TX_TCP_SEG is set.
+static const uint64_t kTxOffloadRequests =
+    PKT_TX_IP_CKSUM | PKT_TX_L4_MASK | PKT_TX_TCP_SEG;
+
+// Returns the offloads requested by any of the packets, but not in 'supported'
+static inline uint64_t UnsupportedTxOffloads(Packet *const *pkts, int cnt,
+                                             uint64_t supported) {
+  uint64_t flags = 0;
+
+  for (int i = 0; i < cnt; i++) {
+    flags |= pkts[i]->offload_flags();
+  }
+
+  return flags & kTxOffloadRequests & ~supported;
+}
+
+// Fills in the IPv4 header and TCP/UDP checksums requested by the packet, and
+// clears the requests. The packet may have multiple segments, as long as the
+// headers are in the first one. Returns false if the request is malformed.
+bool CalculateTxChecksums(Packet *pkt);
+
+// Returns the number of segments SegmentTcp() makes out of a TSO packet, or 0
+// if the request is malformed or a segment would not fit in a single buffer.
+int CountTcpSegments(const Packet *pkt);
+
+// Allocates and builds segments [first, first + cnt) of a TSO packet, each with
+// tso_segsz() bytes of TCP payload (less for the last one) and all checksums
+// filled in. Returns false if packets could not be allocated.
+bool SegmentTcp(const Packet *pkt, int first, int cnt, Packet **segs);
+
+// Does the offloads requested by the packets but not in 'supported' in
+// software, and passes the resulting packets to 'send' in bursts of up to
+// PacketBatch::kMaxBurst. TSO packets are replaced with their segments.
+// Packets that cannot be processed are freed.
+//
+// RETURNS: the number of (original) packets dropped
+template <typename F>
+int ResolveTxOffloads(Packet **pkts, int cnt, uint64_t supported, F send) {
+  PacketBatch out;
+  int dropped = 0;
+
+  out.clear();
+
+  for (int i = 0; i < cnt; i++) {
+    Packet *pkt = pkts[i];
+    uint64_t todo = pkt->offload_flags() & kTxOffloadRequests & ~supported;
+
+    if (todo & PKT_TX_TCP_SEG) {
+      int num_segs = CountTcpSegments(pkt);
+      int seg = 0;
+
+      while (seg < num_segs) {
+        int n = std::min<int>(num_segs - seg,
+                              PacketBatch::kMaxBurst - out.cnt());
+
+        if (!SegmentTcp(pkt, seg, n, out.pkts() + out.cnt())) {
+          break;
+        }
+
+        out.incr_cnt(n);
+        seg += n;
+
+        if (out.full()) {
+          send(out.pkts(), out.cnt());
+          out.clear();
+        }
+      }
+
+      // Partially sent if some segments could not be allocated
+      if (num_segs == 0 || seg < num_segs) {
+        dropped++;
+      }
+
+      Packet::Free(pkt);
+      continue;
+    }
+
+    if (todo && !(pkt->offload_flags() & PKT_TX_TCP_SEG) &&
+        !CalculateTxChecksums(pkt)) {
+      dropped++;
+      Packet::Free(pkt);
+      continue;
+    }
+
+    out.add(pkt);
+    if (out.full()) {
+      send(out.pkts(), out.cnt());
+      out.clear();
+    }
+  }
+
+  if (!out.empty()) {
+    send(out.pkts(), out.cnt());
+  }
+
+  return dropped;
+}
+
+}  // namespace utils
+}  // namespace bess
+
+#endif  // BESS_UTILS_TX_OFFLOAD_H_
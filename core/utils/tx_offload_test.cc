@@ -0,0 +1,134 @@
+#include "tx_offload.h"
+
+#include <gtest/gtest.h>
+
+#include "checksum.h"
+#include "ether.h"
+#include "ip.h"
+#include "random.h"
+#include "tcp.h"
+
+namespace bess {
+namespace utils {
+namespace {
+
+const size_t kHeaderLen = sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Tcp);
+
+// A TCP/IPv4 packet split into two segments, at an odd offset
+class TxOffloadTest : public ::testing::Test {
+ protected:
+  static const size_t kSeg1Payload = 1001;
+  static const size_t kSeg2Payload = 2000;
+  static const size_t kPayload = kSeg1Payload + kSeg2Payload;
+
+  virtual void SetUp() {
+    Random rd;
+
+    bytes_.resize(kHeaderLen + kPayload);
+    for (char &c : bytes_) {
+      c = rd.Get();
+    }
+
+    Ethernet *eth = reinterpret_cast<Ethernet *>(bytes_.data());
+    eth->ether_type = be16_t(Ethernet::Type::kIpv4);
+
+    Ipv4 *ip = reinterpret_cast<Ipv4 *>(eth + 1);
+    ip->version = 4;
+    ip->header_length = 5;
+    ip->length = be16_t(sizeof(Ipv4) + sizeof(Tcp) + kPayload);
+    ip->fragment_offset = be16_t(0);
+    ip->protocol = Ipv4::Proto::kTcp;
+    ip->checksum = 0;
+
+    Tcp *tcp = reinterpret_cast<Tcp *>(ip + 1);
+    tcp->offset = 5;
+
+    // What the host stack leaves in the field for checksum offloading
+    uint32_t pseudo = CalculateSum(&ip->src, 8) +
+                      be16_t::swap(static_cast<uint16_t>(sizeof(Tcp) +
+                                                         kPayload)) +
+                      be16_t::swap(static_cast<uint16_t>(Ipv4::kTcp));
+    tcp->checksum = ~FoldChecksum(pseudo);
+
+    for (int i = 0; i < 2; i++) {
+      segs_[i] = new Packet();
+      segs_[i]->set_buffer(segs_[i]->data());
+    }
+
+    size_t seg1_len = kHeaderLen + kSeg1Payload;
+    Copy(segs_[0]->data(), bytes_.data(), seg1_len);
+    Copy(segs_[1]->data(), bytes_.data() + seg1_len, kSeg2Payload);
+
+    segs_[0]->set_data_len(seg1_len);
+    segs_[0]->set_total_len(bytes_.size());
+    segs_[0]->set_nb_segs(2);
+    segs_[0]->set_next(segs_[1]);
+    segs_[1]->set_data_len(kSeg2Payload);
+
+    segs_[0]->set_l2_len(sizeof(Ethernet));
+    segs_[0]->set_l3_len(sizeof(Ipv4));
+    segs_[0]->set_l4_len(sizeof(Tcp));
+  }
+
+  virtual void TearDown() {
+    delete segs_[0];
+    delete segs_[1];
+  }
+
+  std::vector<char> bytes_;
+  Packet *segs_[2];
+};
+
+TEST_F(TxOffloadTest, ChecksumMultiSegment) {
+  Packet *pkt = segs_[0];
+
+  pkt->set_offload_flags(PKT_TX_IPV4 | PKT_TX_IP_CKSUM | PKT_TX_TCP_CKSUM);
+  ASSERT_TRUE(CalculateTxChecksums(pkt));
+  EXPECT_EQ(PKT_TX_IPV4, pkt->offload_flags());
+
+  const Ipv4 *ip = pkt->head_data<const Ipv4 *>(sizeof(Ethernet));
+  const Tcp *tcp = reinterpret_cast<const Tcp *>(ip + 1);
+  EXPECT_TRUE(VerifyIpv4NoOptChecksum(*ip));
+
+  // Compare against the checksum of the contiguous packet
+  const Ipv4 *ref_ip =
+      reinterpret_cast<const Ipv4 *>(bytes_.data() + sizeof(Ethernet));
+  const Tcp *ref_tcp = reinterpret_cast<const Tcp *>(ref_ip + 1);
+  EXPECT_EQ(CalculateIpv4TcpChecksum(*ref_ip, *ref_tcp), tcp->checksum);
+}
+
+TEST_F(TxOffloadTest, CountTcpSegments) {
+  Packet *pkt = segs_[0];
+
+  pkt->set_offload_flags(PKT_TX_IPV4 | PKT_TX_TCP_CKSUM | PKT_TX_TCP_SEG);
+
+  pkt->set_tso_segsz(1000);
+  EXPECT_EQ(4, CountTcpSegments(pkt));
+
+  pkt->set_tso_segsz(1448);
+  EXPECT_EQ(3, CountTcpSegments(pkt));
+
+  pkt->set_tso_segsz(1900);
+  EXPECT_EQ(2, CountTcpSegments(pkt));
+
+  // Each segment must fit in a buffer
+  pkt->set_tso_segsz(SNBUF_DATA);
+  EXPECT_EQ(0, CountTcpSegments(pkt));
+
+  pkt->set_tso_segsz(0);
+  EXPECT_EQ(0, CountTcpSegments(pkt));
+}
+
+TEST_F(TxOffloadTest, NoRequest) {
+  Packet *pkt = segs_[0];
+
+  EXPECT_EQ(0ULL, UnsupportedTxOffloads(&pkt, 1, 0));
+
+  pkt->set_offload_flags(PKT_TX_IPV4 | PKT_TX_TCP_CKSUM);
+  EXPECT_EQ(PKT_TX_TCP_CKSUM, UnsupportedTxOffloads(&pkt, 1, 0));
+  EXPECT_EQ(0ULL, UnsupportedTxOffloads(&pkt, 1, PKT_TX_TCP_CKSUM));
+}
+
+}  // namespace (unnamed)
+}  // namespace utils
+}  // namespace bess
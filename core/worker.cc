@@ -146,7 +146,7 @@ void resume_all_workers() {
     }
   }
 
-  bess::metadata::default_pipeline.ComputeMetadataOffsets();
+  bess::metadata::default_pipeline.UpdateMetadataOffsets();
   for (int wid = 0; wid < Worker::kMaxWorkers; wid++)
     resume_worker(wid);
 }
@@ -68,6 +68,8 @@ class Worker {
   void set_status(worker_status_t status) { status_ = status; }
 
   int wid() { return wid_; }
+  void set_wid(int wid) { wid_ = wid; }
+
   int core() { return core_; }
   int socket() { return socket_; }
   int fd_event() { return fd_event_; }
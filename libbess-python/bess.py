@@ -333,6 +333,9 @@ class BESS(object):
         request.name = name
         return self._request('GetModuleInfo', request)
 
+    def get_metadata_layout(self):
+        return self._request('GetMetadataLayout')
+
     def connect_modules(self, m1, m2, ogate=0, igate=0):
         request = bess_msg.ConnectModulesRequest()
         request.m1 = m1
@@ -380,12 +383,16 @@ class BESS(object):
         else:
             return response
 
-    def enable_tcpdump(self, fifo, m, direction='out', gate=0):
+    def enable_tcpdump(self, fifo, m, direction='out', gate=0, snaplen=0,
+                       sample_every=1, max_pps=0):
         request = bess_msg.EnableTcpdumpRequest()
         request.name = m
         request.is_igate = (direction == 'in')
         request.gate = gate
         request.fifo = fifo
+        request.snaplen = snaplen
+        request.sample_every = sample_every
+        request.max_pps = max_pps
         return self._request('EnableTcpdump', request)
 
     def disable_tcpdump(self, m, direction='out', gate=0):
@@ -417,6 +424,32 @@ class BESS(object):
         request.is_igate = (direction == 'in')
         return self._request('DisableTrack', request)
 
+    def enable_gate_stats(self, m, gate=None, sample_every=0):
+        request = bess_msg.EnableGateStatsRequest()
+        request.name = m
+        if gate is None:
+            request.use_gate = False
+        else:
+            request.use_gate = True
+            request.ogate = gate
+        request.sample_every = sample_every
+        return self._request('EnableGateStats', request)
+
+    def disable_gate_stats(self, m, gate=None):
+        request = bess_msg.DisableGateStatsRequest()
+        request.name = m
+        if gate is None:
+            request.use_gate = False
+        else:
+            request.use_gate = True
+            request.ogate = gate
+        return self._request('DisableGateStats', request)
+
+    def get_gate_stats(self, m=''):
+        request = bess_msg.GetGateStatsRequest()
+        request.name = m
+        return self._request('GetGateStats', request)
+
     def list_workers(self):
         return self._request('ListWorkers')
 